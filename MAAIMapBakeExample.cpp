@@ -0,0 +1,466 @@
+/**
+
+Offline AI data bake for maps.
+Bots used to work out everything about the map live with traces, ground height most of all (GetHeightAboveGround is called several
+times per bot per think). -run=MAAIMapBake loads a map, splits its static collision into tiles, and bakes per tile:
+- ground height for a grid of cells, traced top down the same way GetHeightAboveGround does, ignoring anything that can move
+- ground slope per cell, for traversal (what's skiable and what's a wall)
+- which other tiles can be seen from eye height at the tile center, for coarse static visibility
+into one versioned file per map under Content/AIData. Each tile stores a hash of the static collision overlapping it. On a rebake only
+tiles whose hash changed (plus visibility for the tiles around them) are redone, so a small edit takes seconds, not a full bake.
+Tiles are baked in parallel across all cores.
+The persistent level and every streaming level are loaded before baking, so the bake sees the whole map.
+At runtime the file is loaded the first time a bot asks for it and freed once no world is running the map. GetHeightAboveGround
+interpolates it instead of tracing when it covers the point and the ground there is smooth enough, and falls back to the trace otherwise.
+
+-run=MAAIMapBake -Map=/Game/Maps/MyMap [-Full]
+
+*/
+
+#include "MidairCE.h"
+#include "MAAIMapData.h"
+#include "MABotAIComponent.h"
+#include "MAMatchHostEngine.h"
+#include "MAMemoryAccounting.h"
+#include "Components/PrimitiveComponent.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "Async/ParallelFor.h"
+#include "Engine/LevelStreaming.h"
+#include "Serialization/BufferArchive.h"
+#include "Serialization/MemoryReader.h"
+#include "Misc/SecureHash.h"
+
+static const uint32 AIMapDataMagic = 0x4941414D;
+//bump when the tile contents or how they are baked changes, older files are then rebaked from scratch
+static const int32 AIMapDataVersion = 2;
+static const float AIBakeTileSize = 4000.0f;
+static const int32 AIBakeCellsPerTile = 20;
+//how far up from the ground we look from, and how far we bother checking visibility
+static const float AIBakeEyeHeight = 200.0f;
+static const float AIBakeVisibilityRange = 24000.0f;
+//cells the ground trace didn't hit anything for
+static const float AIBakeNoGround = -MAX_flt;
+//neighbouring cells further apart in height than this are a ledge or overhang, interpolating across them would make up ground
+static const float AIBakeMaxInterpolatedStep = 200.0f;
+
+FArchive& operator<<(FArchive& Ar, FMAAIBakeTile& Tile)
+{
+	Ar << Tile.Coord;
+	Ar.Serialize(Tile.GeometryHash.Hash, sizeof(Tile.GeometryHash.Hash));
+	Ar << Tile.GroundHeights;
+	Ar << Tile.GroundSlopes;
+	Ar << Tile.VisibleTiles;
+	return Ar;
+}
+
+void FMAAIMapData::Serialize(FArchive& Ar)
+{
+	uint32 Magic = AIMapDataMagic;
+	int32 Version = AIMapDataVersion;
+	Ar << Magic;
+	Ar << Version;
+	if (Ar.IsLoading() && (Magic != AIMapDataMagic || Version != AIMapDataVersion))
+	{
+		Ar.SetError();
+		return;
+	}
+	Ar << TileSize;
+	Ar << CellsPerTile;
+	Ar << Tiles;
+	if (Ar.IsLoading())
+	{
+		TileLookup.Reset();
+		for (int32 TileIndex = 0; TileIndex < Tiles.Num(); TileIndex++)
+		{
+			TileLookup.Add(Tiles[TileIndex].Coord, TileIndex);
+		}
+	}
+}
+
+bool FMAAIMapData::LoadFromFile(const FString& Path)
+{
+	TArray<uint8> FileData;
+	if (!FFileHelper::LoadFileToArray(FileData, *Path, FILEREAD_Silent))
+	{
+		return false;
+	}
+	FMemoryReader Reader(FileData);
+	Serialize(Reader);
+	return !Reader.IsError();
+}
+
+bool FMAAIMapData::SaveToFile(const FString& Path)
+{
+	FBufferArchive Writer;
+	Serialize(Writer);
+	return FFileHelper::SaveArrayToFile(Writer, *Path);
+}
+
+FString FMAAIMapData::GetPathForMap(const FString& MapPackageName)
+{
+	return FPaths::ProjectContentDir() / TEXT("AIData") / FPackageName::GetShortName(MapPackageName) + TEXT(".maai");
+}
+
+FIntPoint FMAAIMapData::GetTileCoord(const FVector& Location) const
+{
+	return FIntPoint(FMath::FloorToInt(Location.X / TileSize), FMath::FloorToInt(Location.Y / TileSize));
+}
+
+const FMAAIBakeTile* FMAAIMapData::FindTile(const FIntPoint& Coord) const
+{
+	const int32* TileIndex = TileLookup.Find(Coord);
+	return TileIndex != nullptr ? &Tiles[*TileIndex] : nullptr;
+}
+
+//Baked height at a cell center, cells numbered across the whole map so neighbours can be in the next tile over.
+bool FMAAIMapData::GetCellGroundHeight(int32 CellX, int32 CellY, float& OutGroundZ) const
+{
+	FIntPoint Coord(FMath::DivideAndRoundDown(CellX, CellsPerTile), FMath::DivideAndRoundDown(CellY, CellsPerTile));
+	const FMAAIBakeTile* Tile = FindTile(Coord);
+	if (Tile == nullptr)
+	{
+		return false;
+	}
+	OutGroundZ = Tile->GroundHeights[(CellY - Coord.Y * CellsPerTile) * CellsPerTile + (CellX - Coord.X * CellsPerTile)];
+	return OutGroundZ != AIBakeNoGround;
+}
+
+//Bilinear between the four surrounding cell centers, where the trace was done. Only answers where the ground between them is
+//smooth, so it's within a few units of what the trace would say. Edges, ledges and holes return false and the caller traces.
+bool FMAAIMapData::GetGroundHeight(const FVector& Point, float& OutGroundZ) const
+{
+	float CellSize = TileSize / CellsPerTile;
+	float GridX = Point.X / CellSize - 0.5f;
+	float GridY = Point.Y / CellSize - 0.5f;
+	int32 CellX = FMath::FloorToInt(GridX);
+	int32 CellY = FMath::FloorToInt(GridY);
+	float Heights[4];
+	if (!GetCellGroundHeight(CellX, CellY, Heights[0]) || !GetCellGroundHeight(CellX + 1, CellY, Heights[1])
+		|| !GetCellGroundHeight(CellX, CellY + 1, Heights[2]) || !GetCellGroundHeight(CellX + 1, CellY + 1, Heights[3]))
+	{
+		return false;
+	}
+	if (FMath::Max3(Heights[0], Heights[1], FMath::Max(Heights[2], Heights[3])) - FMath::Min3(Heights[0], Heights[1], FMath::Min(Heights[2], Heights[3])) > AIBakeMaxInterpolatedStep)
+	{
+		return false;
+	}
+	OutGroundZ = FMath::BiLerp(Heights[0], Heights[1], Heights[2], Heights[3], GridX - CellX, GridY - CellY);
+	return true;
+}
+
+//Coarse static visibility between two locations' tiles. True when we have no data, so callers fall back to a real trace.
+bool FMAAIMapData::CouldBeVisible(const FVector& From, const FVector& To) const
+{
+	const FMAAIBakeTile* Tile = FindTile(GetTileCoord(From));
+	FIntPoint ToCoord = GetTileCoord(To);
+	if (Tile == nullptr || Tile->Coord == ToCoord || FVector::Dist2D(From, To) > AIBakeVisibilityRange)
+	{
+		return true;
+	}
+	return Tile->VisibleTiles.Contains(ToCoord);
+}
+
+SIZE_T FMAAIMapData::GetAllocatedSize() const
+{
+	SIZE_T Bytes = Tiles.GetAllocatedSize() + TileLookup.GetAllocatedSize();
+	for (const FMAAIBakeTile& Tile : Tiles)
+	{
+		Bytes += Tile.GroundHeights.GetAllocatedSize() + Tile.GroundSlopes.GetAllocatedSize() + Tile.VisibleTiles.GetAllocatedSize();
+	}
+	return Bytes;
+}
+
+//Game thread. Loaded once per map the first time anything asks, maps without a bake are remembered so we don't keep hitting the disk.
+//Freed again when the last world using the map is cleaned up.
+const FMAAIMapData* FMAAIMapData::FindForWorld(UWorld* World)
+{
+	static TMap<FName, TSharedPtr<FMAAIMapData>> LoadedMaps;
+	static TMap<TWeakObjectPtr<UWorld>, FName> WorldMaps;
+	static bool bCleanupRegistered = false;
+	if (World == nullptr)
+	{
+		return nullptr;
+	}
+	if (const FName* WorldMap = WorldMaps.Find(World))
+	{
+		return LoadedMaps.FindRef(*WorldMap).Get();
+	}
+	//once for the life of the process, the maps emptying out again doesn't mean the delegate went away
+	if (!bCleanupRegistered)
+	{
+		bCleanupRegistered = true;
+		FWorldDelegates::OnWorldCleanup.AddLambda([](UWorld* CleanedWorld, bool bSessionEnded, bool bCleanupResources)
+		{
+			FName MapName;
+			if (!WorldMaps.RemoveAndCopyValue(CleanedWorld, MapName))
+			{
+				return;
+			}
+			for (const TPair<TWeakObjectPtr<UWorld>, FName>& Entry : WorldMaps)
+			{
+				if (Entry.Value == MapName)
+				{
+					return;
+				}
+			}
+			TSharedPtr<FMAAIMapData> MapData;
+			if (LoadedMaps.RemoveAndCopyValue(MapName, MapData) && MapData.IsValid())
+			{
+				FMAMemoryAccounting::AIBakeDataBytes -= MapData->GetAllocatedSize();
+			}
+		});
+	}
+	//keyed by the map on disk rather than the world's package, so every match and PIE instance running a map shares one read-only copy
+	FName MapPackageName = UMAMatchHostEngine::GetSourceMapName(World);
+	WorldMaps.Add(World, MapPackageName);
+	if (TSharedPtr<FMAAIMapData>* Loaded = LoadedMaps.Find(MapPackageName))
+	{
+		return Loaded->Get();
+	}
+	MA_LLM_SCOPE(AIBakeData);
+	TSharedPtr<FMAAIMapData> MapData = MakeShared<FMAAIMapData>();
+	if (!MapData->LoadFromFile(GetPathForMap(MapPackageName.ToString())))
+	{
+		MapData.Reset();
+	}
+	else {
+		FMAMemoryAccounting::AIBakeDataBytes += MapData->GetAllocatedSize();
+	}
+	LoadedMaps.Add(MapPackageName, MapData);
+	return MapData.Get();
+}
+
+//Blocking world static collision, the same thing the bake traces hit.
+static bool IsWorldStaticCollision(const UPrimitiveComponent* Primitive)
+{
+	return Primitive->IsCollisionEnabled() && Primitive->GetCollisionObjectType() == ECC_WorldStatic;
+}
+
+//Anything that can move is left to live traces, the bake traces ignore it and it isn't hashed.
+static bool IsBakeableCollision(const UPrimitiveComponent* Primitive)
+{
+	return IsWorldStaticCollision(Primitive) && Primitive->Mobility != EComponentMobility::Movable;
+}
+
+//Anything that would change a trace against this component: what it is, where it is, and its collision.
+static FSHAHash HashCollisionComponent(UPrimitiveComponent* Primitive)
+{
+	FSHA1 Hasher;
+	FString PathName = Primitive->GetPathName();
+	Hasher.UpdateWithString(*PathName, PathName.Len());
+	FTransform Transform = Primitive->GetComponentTransform();
+	FVector Location = Transform.GetLocation();
+	FQuat Rotation = Transform.GetRotation();
+	FVector Scale = Transform.GetScale3D();
+	Hasher.Update((const uint8*)&Location, sizeof(Location));
+	Hasher.Update((const uint8*)&Rotation, sizeof(Rotation));
+	Hasher.Update((const uint8*)&Scale, sizeof(Scale));
+	//the body setup guid changes whenever the collision geometry itself is edited or reimported. Landscape collision has none.
+	if (UBodySetup* BodySetup = Primitive->GetBodySetup())
+	{
+		Hasher.Update((const uint8*)&BodySetup->BodySetupGuid, sizeof(BodySetup->BodySetupGuid));
+	}
+	Hasher.Final();
+	FSHAHash Hash;
+	Hasher.GetHash(Hash.Hash);
+	return Hash;
+}
+
+static void BakeTileGround(UWorld* World, FMAAIBakeTile& Tile, const FCollisionQueryParams& QueryParams)
+{
+	float CellSize = AIBakeTileSize / AIBakeCellsPerTile;
+	Tile.GroundHeights.SetNumUninitialized(AIBakeCellsPerTile * AIBakeCellsPerTile);
+	Tile.GroundSlopes.SetNumUninitialized(AIBakeCellsPerTile * AIBakeCellsPerTile);
+	for (int32 CellY = 0; CellY < AIBakeCellsPerTile; CellY++)
+	{
+		for (int32 CellX = 0; CellX < AIBakeCellsPerTile; CellX++)
+		{
+			float X = Tile.Coord.X * AIBakeTileSize + (CellX + 0.5f) * CellSize;
+			float Y = Tile.Coord.Y * AIBakeTileSize + (CellY + 0.5f) * CellSize;
+			//same trace range as GetHeightAboveGround so the baked answer is the one it would have got
+			FHitResult HitResult;
+			World->LineTraceSingleByObjectType(HitResult, FVector(X, Y, 10000.0f), FVector(X, Y, -10000.0f),
+				FCollisionObjectQueryParams(ECollisionChannel::ECC_WorldStatic), QueryParams);
+			int32 CellIndex = CellY * AIBakeCellsPerTile + CellX;
+			Tile.GroundHeights[CellIndex] = HitResult.bBlockingHit ? HitResult.ImpactPoint.Z : AIBakeNoGround;
+			Tile.GroundSlopes[CellIndex] = HitResult.bBlockingHit ? (uint8)FMath::Clamp(FMath::RoundToInt(HitResult.ImpactNormal.Z * 255.0f), 0, 255) : 0;
+		}
+	}
+}
+
+static void BakeTileVisibility(UWorld* World, FMAAIBakeTile& Tile, const TArray<FMAAIBakeTile>& AllTiles, const FCollisionQueryParams& QueryParams)
+{
+	auto GetEyeLocation = [](const FMAAIBakeTile& EyeTile)
+	{
+		//center cell
+		float GroundZ = EyeTile.GroundHeights[(AIBakeCellsPerTile / 2) * AIBakeCellsPerTile + AIBakeCellsPerTile / 2];
+		return FVector((EyeTile.Coord.X + 0.5f) * AIBakeTileSize, (EyeTile.Coord.Y + 0.5f) * AIBakeTileSize, GroundZ + AIBakeEyeHeight);
+	};
+	Tile.VisibleTiles.Reset();
+	FVector Eye = GetEyeLocation(Tile);
+	if (Eye.Z < AIBakeNoGround * 0.5f)
+	{
+		return;
+	}
+	for (const FMAAIBakeTile& Other : AllTiles)
+	{
+		if (Other.Coord == Tile.Coord)
+		{
+			continue;
+		}
+		FVector OtherEye = GetEyeLocation(Other);
+		if (OtherEye.Z < AIBakeNoGround * 0.5f || FVector::Dist2D(Eye, OtherEye) > AIBakeVisibilityRange)
+		{
+			continue;
+		}
+		FHitResult HitResult;
+		if (!World->LineTraceSingleByObjectType(HitResult, Eye, OtherEye, FCollisionObjectQueryParams(ECollisionChannel::ECC_WorldStatic), QueryParams))
+		{
+			Tile.VisibleTiles.Add(Other.Coord);
+		}
+	}
+}
+
+int32 UMAAIMapBakeCommandlet::Main(const FString& Params)
+{
+	FString MapPackageName;
+	if (!FParse::Value(*Params, TEXT("Map="), MapPackageName))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Usage: -run=MAAIMapBake -Map=/Game/Maps/MapName [-Full]"));
+		return 1;
+	}
+	bool bFullBake = FParse::Param(*Params, TEXT("Full"));
+	double StartTime = FPlatformTime::Seconds();
+
+	UPackage* MapPackage = LoadPackage(nullptr, *MapPackageName, LOAD_None);
+	UWorld* World = MapPackage != nullptr ? UWorld::FindWorldInPackage(MapPackage) : nullptr;
+	if (World == nullptr)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Couldn't load map %s"), *MapPackageName);
+		return 1;
+	}
+	//just enough of a world to trace against
+	World->WorldType = EWorldType::Editor;
+	World->AddToRoot();
+	World->InitWorld(UWorld::InitializationValues().AllowAudioPlayback(false).CreatePhysicsScene(true).RequiresHitProxies(false)
+		.CreateNavigation(false).CreateAISystem(false).ShouldSimulatePhysics(false).SetTransactional(false));
+	World->UpdateWorldComponents(true, false);
+	//most maps keep a good part of their geometry in sublevels, bake with all of it in
+	for (ULevelStreaming* StreamingLevel : World->GetStreamingLevels())
+	{
+		StreamingLevel->SetShouldBeLoaded(true);
+		StreamingLevel->SetShouldBeVisible(true);
+	}
+	World->FlushLevelStreaming(EFlushLevelStreamingType::Full);
+	for (ULevelStreaming* StreamingLevel : World->GetStreamingLevels())
+	{
+		if (StreamingLevel->GetLoadedLevel() == nullptr)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Couldn't load streaming level %s, baking without it"), *StreamingLevel->GetWorldAssetPackageName());
+		}
+	}
+
+	//which static collision touches which tile, and the movable collision the bake traces have to look through
+	TMap<FIntPoint, TArray<FSHAHash>> TileComponentHashes;
+	FCollisionQueryParams BakeQueryParams;
+	for (TObjectIterator<UPrimitiveComponent> It; It; ++It)
+	{
+		UPrimitiveComponent* Primitive = *It;
+		if (Primitive->GetWorld() != World || !IsWorldStaticCollision(Primitive))
+		{
+			continue;
+		}
+		if (!IsBakeableCollision(Primitive))
+		{
+			BakeQueryParams.AddIgnoredComponent(Primitive);
+			continue;
+		}
+		FBox Bounds = Primitive->Bounds.GetBox();
+		FSHAHash ComponentHash = HashCollisionComponent(Primitive);
+		for (int32 TileX = FMath::FloorToInt(Bounds.Min.X / AIBakeTileSize); TileX <= FMath::FloorToInt(Bounds.Max.X / AIBakeTileSize); TileX++)
+		{
+			for (int32 TileY = FMath::FloorToInt(Bounds.Min.Y / AIBakeTileSize); TileY <= FMath::FloorToInt(Bounds.Max.Y / AIBakeTileSize); TileY++)
+			{
+				TileComponentHashes.FindOrAdd(FIntPoint(TileX, TileY)).Add(ComponentHash);
+			}
+		}
+	}
+
+	FString OutputPath = FMAAIMapData::GetPathForMap(MapPackageName);
+	FMAAIMapData Previous;
+	bool bHasPrevious = !bFullBake && Previous.LoadFromFile(OutputPath) && Previous.TileSize == AIBakeTileSize && Previous.CellsPerTile == AIBakeCellsPerTile;
+
+	FMAAIMapData Baked;
+	Baked.TileSize = AIBakeTileSize;
+	Baked.CellsPerTile = AIBakeCellsPerTile;
+	TArray<int32> GroundDirty;
+	TArray<FIntPoint> ChangedCoords;
+	for (TPair<FIntPoint, TArray<FSHAHash>>& Entry : TileComponentHashes)
+	{
+		//component order isn't stable between loads, so sort before combining
+		Entry.Value.Sort([](const FSHAHash& A, const FSHAHash& B) { return FMemory::Memcmp(A.Hash, B.Hash, sizeof(A.Hash)) < 0; });
+		FSHAHash TileHash;
+		FSHA1::HashBuffer(Entry.Value.GetData(), Entry.Value.Num() * sizeof(FSHAHash), TileHash.Hash);
+
+		int32 TileIndex = Baked.Tiles.Num();
+		const FMAAIBakeTile* PreviousTile = bHasPrevious ? Previous.FindTile(Entry.Key) : nullptr;
+		if (PreviousTile != nullptr && PreviousTile->GeometryHash == TileHash)
+		{
+			Baked.Tiles.Add(*PreviousTile);
+		}
+		else {
+			FMAAIBakeTile& Tile = Baked.Tiles.AddDefaulted_GetRef();
+			Tile.Coord = Entry.Key;
+			Tile.GeometryHash = TileHash;
+			GroundDirty.Add(TileIndex);
+			ChangedCoords.Add(Entry.Key);
+		}
+	}
+	//tiles that lost all their collision changed too, as far as visibility through them goes
+	if (bHasPrevious)
+	{
+		for (const FMAAIBakeTile& PreviousTile : Previous.Tiles)
+		{
+			if (!TileComponentHashes.Contains(PreviousTile.Coord))
+			{
+				ChangedCoords.Add(PreviousTile.Coord);
+			}
+		}
+	}
+
+	ParallelFor(GroundDirty.Num(), [&](int32 DirtyIndex)
+	{
+		BakeTileGround(World, Baked.Tiles[GroundDirty[DirtyIndex]], BakeQueryParams);
+	});
+
+	//a changed tile can block or open up sight lines passing over it, so redo visibility for everything in range of a change
+	TArray<int32> VisibilityDirty;
+	int32 TileRange = FMath::CeilToInt(AIBakeVisibilityRange / AIBakeTileSize);
+	for (int32 TileIndex = 0; TileIndex < Baked.Tiles.Num(); TileIndex++)
+	{
+		for (const FIntPoint& Changed : ChangedCoords)
+		{
+			if (!bHasPrevious || (FMath::Abs(Baked.Tiles[TileIndex].Coord.X - Changed.X) <= TileRange && FMath::Abs(Baked.Tiles[TileIndex].Coord.Y - Changed.Y) <= TileRange))
+			{
+				VisibilityDirty.Add(TileIndex);
+				break;
+			}
+		}
+	}
+	ParallelFor(VisibilityDirty.Num(), [&](int32 DirtyIndex)
+	{
+		BakeTileVisibility(World, Baked.Tiles[VisibilityDirty[DirtyIndex]], Baked.Tiles, BakeQueryParams);
+	});
+
+	bool bSaved = Baked.SaveToFile(OutputPath);
+	World->RemoveFromRoot();
+	World->DestroyWorld(false);
+	if (!bSaved)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Couldn't write AI data to %s"), *OutputPath);
+		return 1;
+	}
+	UE_LOG(LogTemp, Display, TEXT("Baked %s: %d tiles, %d rebaked ground, %d rebaked visibility, %.1fs"), *OutputPath, Baked.Tiles.Num(),
+		GroundDirty.Num(), VisibilityDirty.Num(), FPlatformTime::Seconds() - StartTime);
+	return 0;
+}
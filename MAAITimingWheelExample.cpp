@@ -0,0 +1,332 @@
+/**
+
+Timing wheel for bot and practice mode timers.
+Every bot had its own world timers (DetermineCurrentTask, UpdateNetRelevancy) and polled a handful of "has it been long enough"
+timestamps every tick (aim point changes, jet toggling, weapon switch cooldown), and practice components kept a 9999s "infinite" drill timer
+running. All of these now go through one hierarchical timing wheel per world:
+- 4 levels of 64 slots at 1/60s resolution, so anything up to ~78 hours away is an O(1) insert into a slot list
+- cancel is O(1) through the handle, and handles of fired or cancelled timers just stop being valid
+- once per frame, after actors tick, the wheel advances to the world time and everything that expired fires as one batch
+Timers hold a weak pointer to their owner and are skipped if it's gone, so nothing has to cancel on destruction.
+Cooldowns are timers with no callback, "is the cooldown running" is just IsScheduled on its handle.
+ma.AITimers logs how many timers are scheduled and how many fired per frame.
+
+*/
+
+#include "MidairCE.h"
+#include "MAAITimingWheel.h"
+#include "MABotAIComponent.h"
+#include "MAPracticeComponent.h"
+#include "MABotTuning.h"
+#include "MAMetrics.h"
+#include "Player/MACharacter.h"
+#include "Misc/DelayedAutoRegister.h"
+
+static const float AITimerTickSeconds = 1.0f / 60.0f;
+static const int32 AITimerSlotBits = 6;
+static const int32 AITimerSlots = 1 << AITimerSlotBits;
+static const int32 AITimerSlotMask = AITimerSlots - 1;
+
+static TMap<TWeakObjectPtr<UWorld>, TUniquePtr<FMAAITimingWheel>>& GetTimingWheels()
+{
+	static TMap<TWeakObjectPtr<UWorld>, TUniquePtr<FMAAITimingWheel>> Wheels;
+	return Wheels;
+}
+
+//one delegate for all worlds, each world advances its own wheel after its actors have ticked
+static FDelayedAutoRegisterHelper GRegisterAITimingWheels(EDelayedRegisterRunPhase::EndOfEngineInit, []()
+{
+	FWorldDelegates::OnWorldPostActorTick.AddLambda([](UWorld* TickedWorld, ELevelTick TickType, float DeltaSeconds)
+	{
+		if (TUniquePtr<FMAAITimingWheel>* Wheel = GetTimingWheels().Find(TickedWorld))
+		{
+			(*Wheel)->Advance(TickedWorld->GetTimeSeconds());
+		}
+	});
+	FWorldDelegates::OnWorldCleanup.AddLambda([](UWorld* CleanedWorld, bool bSessionEnded, bool bCleanupResources)
+	{
+		GetTimingWheels().Remove(CleanedWorld);
+	});
+});
+
+FMAAITimingWheel& FMAAITimingWheel::Get(UWorld* World)
+{
+	TUniquePtr<FMAAITimingWheel>& Wheel = GetTimingWheels().FindOrAdd(World);
+	if (!Wheel.IsValid())
+	{
+		Wheel = MakeUnique<FMAAITimingWheel>(World->GetTimeSeconds());
+	}
+	return *Wheel;
+}
+
+FMAAITimingWheel::FMAAITimingWheel(float NowSeconds)
+	: CurrentTick(FMath::FloorToInt(NowSeconds / AITimerTickSeconds))
+{
+	for (int32& Head : SlotHeads)
+	{
+		Head = INDEX_NONE;
+	}
+}
+
+FMAAITimerHandle FMAAITimingWheel::Schedule(UObject* Owner, float DelaySeconds, TFunction<void()>&& Callback, float RepeatSeconds)
+{
+	int32 NodeIndex;
+	if (FreeNodes.Num() > 0)
+	{
+		NodeIndex = FreeNodes.Pop(false);
+	}
+	else {
+		NodeIndex = Nodes.AddDefaulted();
+	}
+	FTimerNode& Node = Nodes[NodeIndex];
+	Node.Owner = Owner;
+	Node.Callback = MoveTemp(Callback);
+	//never sooner than the next tick, a 0 delay timer fires in the next batch rather than from inside this call
+	Node.ExpireTick = CurrentTick + FMath::Max<int64>(1, FMath::CeilToInt(DelaySeconds / AITimerTickSeconds));
+	Node.RepeatTicks = RepeatSeconds > 0.0f ? FMath::Max<int64>(1, FMath::RoundToInt(RepeatSeconds / AITimerTickSeconds)) : 0;
+	Node.bActive = true;
+	LinkNode(NodeIndex);
+	NumScheduled++;
+
+	FMAAITimerHandle Handle;
+	Handle.Index = NodeIndex;
+	Handle.Serial = Node.Serial;
+	return Handle;
+}
+
+FMAAITimerHandle FMAAITimingWheel::StartCooldown(UObject* Owner, float DurationSeconds)
+{
+	return Schedule(Owner, DurationSeconds, TFunction<void()>());
+}
+
+void FMAAITimingWheel::Cancel(FMAAITimerHandle& Handle)
+{
+	if (IsScheduled(Handle))
+	{
+		UnlinkNode(Handle.Index);
+		FreeNode(Handle.Index);
+	}
+	Handle = FMAAITimerHandle();
+}
+
+bool FMAAITimingWheel::IsScheduled(const FMAAITimerHandle& Handle) const
+{
+	return Nodes.IsValidIndex(Handle.Index) && Nodes[Handle.Index].bActive && Nodes[Handle.Index].Serial == Handle.Serial;
+}
+
+float FMAAITimingWheel::GetRemaining(const FMAAITimerHandle& Handle) const
+{
+	return IsScheduled(Handle) ? FMath::Max<int64>(0, Nodes[Handle.Index].ExpireTick - CurrentTick) * AITimerTickSeconds : 0.0f;
+}
+
+//Lowest level whose range covers the delay. Timers further away than the whole wheel sit in the top level and get re-placed when it
+//comes round again.
+void FMAAITimingWheel::LinkNode(int32 NodeIndex)
+{
+	FTimerNode& Node = Nodes[NodeIndex];
+	int64 Delay = FMath::Max<int64>(0, Node.ExpireTick - CurrentTick);
+	int64 PlacedTick = Node.ExpireTick;
+	int32 Level = 0;
+	while (Level < AITimerLevels - 1 && Delay >= (int64(1) << (AITimerSlotBits * (Level + 1))))
+	{
+		Level++;
+	}
+	if (Level == AITimerLevels - 1)
+	{
+		PlacedTick = CurrentTick + FMath::Min<int64>(Delay, (int64(1) << (AITimerSlotBits * AITimerLevels)) - 1);
+	}
+	else if (Delay == 0)
+	{
+		PlacedTick = CurrentTick;
+	}
+	int32 Slot = Level * AITimerSlots + int32((PlacedTick >> (AITimerSlotBits * Level)) & AITimerSlotMask);
+	Node.Slot = Slot;
+	Node.Prev = INDEX_NONE;
+	Node.Next = SlotHeads[Slot];
+	if (Node.Next != INDEX_NONE)
+	{
+		Nodes[Node.Next].Prev = NodeIndex;
+	}
+	SlotHeads[Slot] = NodeIndex;
+}
+
+void FMAAITimingWheel::UnlinkNode(int32 NodeIndex)
+{
+	FTimerNode& Node = Nodes[NodeIndex];
+	//already taken off the wheel, waiting to fire in this frame's batch
+	if (Node.Slot == INDEX_NONE)
+	{
+		return;
+	}
+	if (Node.Prev != INDEX_NONE)
+	{
+		Nodes[Node.Prev].Next = Node.Next;
+	}
+	else {
+		SlotHeads[Node.Slot] = Node.Next;
+	}
+	if (Node.Next != INDEX_NONE)
+	{
+		Nodes[Node.Next].Prev = Node.Prev;
+	}
+	Node.Slot = INDEX_NONE;
+	Node.Prev = INDEX_NONE;
+	Node.Next = INDEX_NONE;
+}
+
+void FMAAITimingWheel::FreeNode(int32 NodeIndex)
+{
+	FTimerNode& Node = Nodes[NodeIndex];
+	Node.bActive = false;
+	//any handle still pointing here is now stale
+	Node.Serial++;
+	Node.Callback.Reset();
+	Node.Owner.Reset();
+	FreeNodes.Add(NodeIndex);
+	NumScheduled--;
+}
+
+//Takes a whole slot off the wheel, putting what's in it on Out.
+void FMAAITimingWheel::TakeSlot(int32 Slot, TArray<int32>& Out)
+{
+	int32 NodeIndex = SlotHeads[Slot];
+	while (NodeIndex != INDEX_NONE)
+	{
+		FTimerNode& Node = Nodes[NodeIndex];
+		Out.Add(NodeIndex);
+		NodeIndex = Node.Next;
+		Node.Slot = INDEX_NONE;
+		Node.Prev = INDEX_NONE;
+		Node.Next = INDEX_NONE;
+	}
+	SlotHeads[Slot] = INDEX_NONE;
+}
+
+void FMAAITimingWheel::Advance(float NowSeconds)
+{
+	int64 TargetTick = FMath::FloorToInt(NowSeconds / AITimerTickSeconds);
+	Expired.Reset();
+	while (CurrentTick < TargetTick)
+	{
+		CurrentTick++;
+		//whenever a level wraps, the next slot up is spread back down over the levels below it
+		for (int32 Level = 1; Level < AITimerLevels; Level++)
+		{
+			if ((CurrentTick & ((int64(1) << (AITimerSlotBits * Level)) - 1)) != 0)
+			{
+				break;
+			}
+			Cascade.Reset();
+			TakeSlot(Level * AITimerSlots + int32((CurrentTick >> (AITimerSlotBits * Level)) & AITimerSlotMask), Cascade);
+			for (int32 NodeIndex : Cascade)
+			{
+				LinkNode(NodeIndex);
+			}
+		}
+		Cascade.Reset();
+		TakeSlot(int32(CurrentTick & AITimerSlotMask), Cascade);
+		for (int32 NodeIndex : Cascade)
+		{
+			//top level timers can come round before they are actually due
+			if (Nodes[NodeIndex].ExpireTick > CurrentTick)
+			{
+				LinkNode(NodeIndex);
+			}
+			else {
+				Expired.Emplace(NodeIndex, Nodes[NodeIndex].Serial);
+			}
+		}
+	}
+
+	//fire the batch. Callbacks can schedule and cancel freely, including timers later in this same batch.
+	FiredLastFrame = 0;
+	for (const TPair<int32, uint32>& Entry : Expired)
+	{
+		FTimerNode& Node = Nodes[Entry.Key];
+		if (!Node.bActive || Node.Serial != Entry.Value)
+		{
+			continue;
+		}
+		if (!Node.Owner.IsValid())
+		{
+			FreeNode(Entry.Key);
+			continue;
+		}
+		if (Node.RepeatTicks > 0)
+		{
+			//re-arm before calling so the callback can cancel its own repeating timer
+			Node.ExpireTick = CurrentTick + Node.RepeatTicks;
+			LinkNode(Entry.Key);
+			if (Node.Callback)
+			{
+				//copy, the callback can schedule new timers which can grow Nodes under us
+				TFunction<void()> Callback = Node.Callback;
+				Callback();
+			}
+		}
+		else {
+			TFunction<void()> Callback = MoveTemp(Node.Callback);
+			FreeNode(Entry.Key);
+			if (Callback)
+			{
+				Callback();
+			}
+		}
+		FiredLastFrame++;
+	}
+	MaxFiredInFrame = FMath::Max(MaxFiredInFrame, FiredLastFrame);
+	TotalFired += FiredLastFrame;
+	FMAMetrics::Increment(EMACounter::AITimersFired, FiredLastFrame);
+	FMAMetrics::Record(EMAHistogram::AITimersFiredPerFrame, FiredLastFrame);
+}
+
+static FAutoConsoleCommand CmdAITimers(
+	TEXT("ma.AITimers"),
+	TEXT("Bot and practice timers scheduled on each world's timing wheel, and how many fired per frame."),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		for (const TPair<TWeakObjectPtr<UWorld>, TUniquePtr<FMAAITimingWheel>>& Entry : GetTimingWheels())
+		{
+			if (UWorld* World = Entry.Key.Get())
+			{
+				UE_LOG(LogTemp, Display, TEXT("%s: %d scheduled, %d fired last frame, %d most in one frame, %lld total"), *World->GetMapName(),
+					Entry.Value->GetNumScheduled(), Entry.Value->GetFiredLastFrame(), Entry.Value->GetMaxFiredInFrame(), Entry.Value->GetTotalFired());
+			}
+		}
+	}));
+
+//Looping, so aim error stays the same for a second at a time instead of changing every tick.
+void UMABotAIComponent::ChangeAimpoint()
+{
+	//how far off we are per accuracy level comes from the tuning, MAX/Perfect aim bots have no skew at all.
+	FMABotCombatModel::RollAimSkew(Tuning, AimRandom, RandomPitchSkew, RandomYawSkew, RandomProjectilePropertiesSkew);
+}
+
+//Idle jetting flips on and off every 1-3s while we are moving around, rather than rolling for it every tick.
+void UMABotAIComponent::ToggleIdleJet()
+{
+	if (ParentCharacter == nullptr || bIsDead || bIsParked || AIState.CurrentTask == EAIStates::MoveToTarget || AIState.CurrentTask == EAIStates::RouteRunner)
+	{
+		return;
+	}
+	if (ParentCharacter->GetEnergy() > 40 || ParentCharacter->GetEnergy() < 5)
+	{
+		bIsJetting = !bIsJetting;
+		OnJetChanged();
+	}
+	else {
+		AITimer_IdleJetToggle = FMAAITimingWheel::Get(GetWorld()).Schedule(this, FMath::RandRange(1.0f, 3.0f), [this]() { ToggleIdleJet(); });
+	}
+}
+
+//Everything that cares how long ago jetting changed keys off these instead of TimeOfLastJetChange.
+void UMABotAIComponent::OnJetChanged()
+{
+	FMAAITimingWheel& TimingWheel = FMAAITimingWheel::Get(GetWorld());
+	TimingWheel.Cancel(AITimer_JetSettle);
+	TimingWheel.Cancel(AITimer_JetRecharge);
+	TimingWheel.Cancel(AITimer_IdleJetToggle);
+	AITimer_JetSettle = TimingWheel.StartCooldown(this, 1.0f);
+	AITimer_JetRecharge = TimingWheel.StartCooldown(this, 2.0f);
+	AITimer_IdleJetToggle = TimingWheel.Schedule(this, FMath::RandRange(1.0f, 3.0f), [this]() { ToggleIdleJet(); });
+}
@@ -0,0 +1,175 @@
+/**
+
+Abstract combat for bot vs bot fights nobody is watching.
+On pub starter servers bots spend a lot of their time fighting each other on the far side of the map from any human. Both sides would
+still run full aim traces, projectile spawns and character movement for every shot, none of which anyone sees.
+When two bots are shooting at each other and neither is within relevance range of a human (playing or spectating), both stop simulating
+and the fight is advanced every half second with FMABotCombatModel, the same hit chance/damage estimates the tuning harness uses, so who
+wins still depends on their accuracy level and weapon choice. Damage goes through the normal TakeDamage path so kills, scoring and respawns
+work as usual. Positions are carried along cheaply with one capsule sweep per tick instead of the movement component.
+The moment a human comes into range, both bots hand back to the full simulation with the velocity they had.
+
+*/
+
+#include "MidairCE.h"
+#include "MABotAIComponent.h"
+#include "MABotTuning.h"
+#include "MAAITimingWheel.h"
+#include "Player/AIPlayerController.h"
+#include "Player/MACharacter.h"
+#include "GameFramework/CharacterMovementComponent.h"
+
+static TAutoConsoleVariable<float> CVarBotAbstractCombatRange(
+	TEXT("bots.AbstractCombatRange"),
+	25000.0f,
+	TEXT("Bot vs bot fights further than this from every human are resolved statistically instead of simulated. 0 to always simulate."),
+	ECVF_Default);
+
+//how often an abstract fight trades damage, same rate as DetermineCurrentTask
+static const float AbstractCombatStep = 0.5f;
+
+//Any human, alive, dead or spectating, whose view point is close enough that they could see or hear something at Location.
+bool UMABotAIComponent::IsNearAnyHuman(const FVector& Location, float Range) const
+{
+	float RangeSquared = FMath::Square(Range);
+	for (FConstPlayerControllerIterator Iterator = GetWorld()->GetPlayerControllerIterator(); Iterator; ++Iterator)
+	{
+		APlayerController* PC = Iterator->Get();
+		if (PC == nullptr || PC->IsA<AAIPlayerController>())
+		{
+			continue;
+		}
+		FVector ViewLocation;
+		FRotator ViewRotation;
+		PC->GetPlayerViewPoint(ViewLocation, ViewRotation);
+		if (FVector::DistSquared(ViewLocation, Location) < RangeSquared)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+//Called from TickComponent. Returns true while this bot's fight is being resolved statistically, in which case the bot does nothing else this tick.
+bool UMABotAIComponent::UpdateAbstractCombat(float DeltaTime)
+{
+	float Range = CVarBotAbstractCombatRange.GetValueOnGameThread();
+	AMACharacter* Target = AIState.CurrentTarget;
+	UMABotAIComponent* TargetBot = Target != nullptr ? Target->FindComponentByClass<UMABotAIComponent>() : nullptr;
+
+	//only bots locked on to each other, nobody carrying a flag (caps need the real movement), and no human anywhere near either of them.
+	//Both bots run the same check so they go in and out together.
+	bool bCanAbstract = Range > 0.0f && TargetBot != nullptr && TargetBot->AIState.CurrentTarget == ParentCharacter
+		&& !TargetBot->bIsDead && !TargetBot->bIsParked && BotConfig.BotType != EBotTypes::RouteRunner
+		&& ParentCharacter->CarriedObject == nullptr && Target->CarriedObject == nullptr
+		&& !IsNearAnyHuman(ParentCharacter->GetActorLocation(), Range) && !IsNearAnyHuman(Target->GetActorLocation(), Range);
+
+	if (!bCanAbstract)
+	{
+		if (bInAbstractCombat)
+		{
+			ExitAbstractCombat();
+		}
+		return false;
+	}
+	if (!bInAbstractCombat)
+	{
+		EnterAbstractCombat();
+	}
+
+	//swept so the capsule stops at walls and terrain instead of drifting through them, then slide along whatever we hit
+	FHitResult Hit;
+	ParentCharacter->SetActorLocation(ParentCharacter->GetActorLocation() + AbstractVelocity * DeltaTime, true, &Hit, ETeleportType::TeleportPhysics);
+	if (Hit.bBlockingHit)
+	{
+		AbstractVelocity = FVector::VectorPlaneProject(AbstractVelocity, Hit.Normal);
+	}
+	AbstractCombatAccumulator += DeltaTime;
+	if (AbstractCombatAccumulator >= AbstractCombatStep)
+	{
+		AbstractCombatAccumulator -= AbstractCombatStep;
+		ResolveAbstractCombatStep(Target, TargetBot);
+	}
+	return true;
+}
+
+void UMABotAIComponent::EnterAbstractCombat()
+{
+	bInAbstractCombat = true;
+	AbstractCombatAccumulator = 0.0f;
+	ParentCharacter->SetTrigger(0, false);
+	ParentCharacter->StopJetting();
+	ParentCharacter->StopSkating();
+	//we move the actor ourselves from here on, so the movement component doesn't need to tick at all
+	UCharacterMovementComponent* Movement = ParentCharacter->GetCharacterMovement();
+	AbstractVelocity = Movement->Velocity;
+	AbstractHeightAboveGround = GetHeightAboveGround(ParentCharacter->GetActorLocation(), false);
+	Movement->SetComponentTickEnabled(false);
+}
+
+void UMABotAIComponent::ExitAbstractCombat()
+{
+	bInAbstractCombat = false;
+	if (ParentCharacter == nullptr)
+	{
+		return;
+	}
+	UCharacterMovementComponent* Movement = ParentCharacter->GetCharacterMovement();
+	Movement->SetComponentTickEnabled(true);
+	Movement->Velocity = AbstractVelocity;
+	Movement->SetMovementMode(MOVE_Falling);
+	//pick a fresh aim point as soon as we are shooting for real again
+	FMAAITimingWheel& TimingWheel = FMAAITimingWheel::Get(GetWorld());
+	TimingWheel.Cancel(AITimer_AimpointChange);
+	ChangeAimpoint();
+	AITimer_AimpointChange = TimingWheel.Schedule(this, 1.0f, [this]() { ChangeAimpoint(); }, 1.0f);
+}
+
+//One half second of the fight: pick a weapon the way SelectBestWeapon would, roll the damage we land, and steer towards where we were going.
+void UMABotAIComponent::ResolveAbstractCombatStep(AMACharacter* Target, UMABotAIComponent* TargetBot)
+{
+	FVector Location = ParentCharacter->GetActorLocation();
+	FVector TargetLocation = Target->GetActorLocation();
+
+	//both movement components are off, so velocities and heights come from the abstract state rather than the characters
+	FMAEngagementView View;
+	View.TargetHealth = Target->GetHealth();
+	View.TargetSpeedKph = TargetBot->AbstractVelocity.Size() * 0.036f;
+	View.TargetHeightAboveGround = TargetBot->AbstractHeightAboveGround;
+	View.TargetDistance = FVector::Dist(Location, TargetLocation);
+	View.bIsCurrentTarget = true;
+	View.bTargetCarryingFlag = false;
+	View.bTargetMovingRadially = FMath::Abs(FVector::DotProduct(TargetBot->AbstractVelocity.GetSafeNormal(), (TargetLocation - Location).GetSafeNormal())) > 0.8f;
+
+	bool bDisc = FMABotCombatModel::PrefersDisc(Tuning, View, false, 0.0f, BotConfig.bNoDisc, BotConfig.bNoChaingun);
+	bool bHasWeapon = bDisc ? !BotConfig.bNoDisc : !BotConfig.bNoChaingun;
+	if (BotConfig.bBotShoots && bHasWeapon)
+	{
+		float Damage = FMABotCombatModel::RollDamage(Tuning, bDisc, View, AbstractCombatStep, AimRandom);
+		if (Damage > 0.0f)
+		{
+			//normal damage path, so the kill is credited and the target dies and respawns like any other death
+			Target->TakeDamage(Damage, FDamageEvent(), ParentCharacter->GetController(), ParentCharacter);
+		}
+	}
+	//the target may have killed us through its own step already this frame
+	if (bIsDead || !bInAbstractCombat)
+	{
+		return;
+	}
+
+	//keep our speed, turn gradually towards where we were going, and ease back to the height above ground we went in at.
+	//The ground is only sampled here, once per step, so in between ticks it's just the one swept move.
+	FVector Horizontal(AbstractVelocity.X, AbstractVelocity.Y, 0.0f);
+	FVector ToMoveLocation = (AIState.DesiredMoveLocation - Location).GetSafeNormal2D();
+	if (!ToMoveLocation.IsNearlyZero())
+	{
+		Horizontal = FMath::Lerp(Horizontal.GetSafeNormal(), ToMoveLocation, 0.25f).GetSafeNormal() * Horizontal.Size();
+	}
+	float HeightAboveGround = GetHeightAboveGround(Location, false);
+	AbstractVelocity = FVector(Horizontal.X, Horizontal.Y, (AbstractHeightAboveGround - HeightAboveGround) / AbstractCombatStep);
+
+	FRotator ActorRot = (TargetLocation - Location).Rotation();
+	ActorRot.Pitch = 0.0f;
+	ParentCharacter->SetActorRotation(ActorRot);
+}
@@ -16,6 +16,17 @@
 
 #include "MidairCE.h"
 #include "MABotAIComponent.h"
+#include "MABotBrain.h"
+#include "MABotBrainSidecar.h"
+#include "MABotTuning.h"
+#include "MABotThinkPool.h"
+#include "MAAITimingWheel.h"
+#include "MABotCrowd.h"
+#include "MAGameplayEvents.h"
+#include "MAAIMapData.h"
+#include "MAMemoryAccounting.h"
+#include "MAMetrics.h"
+#include "MARouteFollowerComponent.h"
 #include "Perception/PawnSensingComponent.h"
 #include "Player/AIPlayerController.h"
 #include "Player/MACharacter.h"
@@ -37,6 +48,8 @@ void UMABotAIComponent::EnableBotAI()
 	{
 		return;
 	}
+	//nearly everything allocated here is the sensing component
+	MA_LLM_SCOPE(BotPerception);
 	PawnSensingComp = NewObject<UPawnSensingComponent>(this, UPawnSensingComponent::StaticClass());
 	PrimaryComponentTick.bCanEverTick = true;
 	PawnSensingComp->OnSeePawn.AddDynamic(this, &UMABotAIComponent::OnPawnSeen);
@@ -46,9 +59,22 @@ void UMABotAIComponent::EnableBotAI()
 	PawnSensingComp->bHearNoises = false;
 	PawnSensingComp->SightRadius = 60000.0f;
 	PawnSensingComp->RegisterComponent();
+	//deaths come in through the gameplay event bus
+	SubscribeToGameplayEvents();
+	//before the first ChangeAimpoint below, which reads both
+	AccuracyLevel = BotConfig.AccuracyLevel;
+	Tuning = UMABotTuningLibrary::GetTuning(AccuracyLevel);
+	AimRandom.Initialize(FMath::Rand());
 	if (ParentCharacter != nullptr)
 	{
-		ParentCharacter->GetWorldTimerManager().SetTimer(TimerHandle_DetermineCurrentTask, this, &UMABotAIComponent::DetermineCurrentTask, 0.5f, true);
+		//bot timers all go through the world's AI timing wheel, see MAAITimingWheel
+		FMAAITimingWheel& TimingWheel = FMAAITimingWheel::Get(GetWorld());
+		AITimer_DetermineCurrentTask = TimingWheel.Schedule(this, 0.5f, [this]() { DetermineCurrentTask(); }, 0.5f);
+		//how often and how precisely we replicate depends on who is near us, see MABotNetRelevancy
+		AITimer_UpdateNetRelevancy = TimingWheel.Schedule(this, 0.5f, [this]() { UpdateNetRelevancy(); }, 0.5f);
+		//We don't want bots changing where they are aiming every tick, that makes them spaz out. Choose how much they are off every second and stick to it.
+		ChangeAimpoint();
+		AITimer_AimpointChange = TimingWheel.Schedule(this, 1.0f, [this]() { ChangeAimpoint(); }, 1.0f);
 	}
 
 	//initialize flag related game state
@@ -66,17 +92,26 @@ void UMABotAIComponent::EnableBotAI()
 			GameState.FriendlyStandLocation = Stand->GetActorLocation();
 		}
 	}
-	AccuracyLevel = BotConfig.AccuracyLevel;
+	//so we keep out of each other's way, see MABotCrowd
+	FMABotCrowd::Get(GetWorld()).Register(this);
 	bBotInitialized = true;
 }
 
+void UMABotAIComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	//the brain host looks bots up by id when commands come back, don't leave ours behind
+	FMABotBrainHost::Get().Unregister(this);
+	Super::EndPlay(EndPlayReason);
+}
+
 
 // Called every frame
 void UMABotAIComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+	MA_LLM_SCOPE(BotAI);
 	
-	if (ParentCharacter == nullptr || ParentCharacter->GetController() == nullptr || bIsDead)
+	if (ParentCharacter == nullptr || ParentCharacter->GetController() == nullptr || bIsDead || bIsParked)
 	{
 		return;
 	}
@@ -99,6 +134,11 @@ void UMABotAIComponent::TickComponent(float DeltaTime, ELevelTick TickType, FAct
 	{
 		AIState.CurrentTarget = nullptr;
 	}
+	//bot vs bot fights nobody can see are resolved statistically instead of simulated, see MABotAbstractCombat
+	if (UpdateAbstractCombat(DeltaTime))
+	{
+		return;
+	}
 
 	//Each tick, we merely follow our current desired behavior, behavior definition is determined in DetermineCurrentTask less frequently.
 	switch(AIState.CurrentTask)
@@ -142,25 +182,20 @@ void UMABotAIComponent::TickComponent(float DeltaTime, ELevelTick TickType, FAct
 }
 
 //Ticks every half second (todo-emallon: make this configurable so we can reduce client load if they are running it locally),
-//determining what actions/states the bot actor should be taking. General approach is to give all possible tasks a weighting, increasing in
-//likelihood they take that action based on the situation. Weight added to various possible states is influenced by the bots assigned role.
-//Highest weighted task option is chosen to be performed.
+//determining what actions/states the bot actor should be taking. The weighting itself lives in MABotBrain::Think (MABotBrainExample.cpp),
+//so the sidecar and the shared think pool make exactly the decisions we would.
 //todo-emallon try out choosing randomly-ish from all possible tasks, probably with an extra weight added to the 'winner'.
 void UMABotAIComponent::DetermineCurrentTask()
 {
-	if (ParentCharacter == nullptr || bIsDead)
+	if (ParentCharacter == nullptr || bIsDead || bIsParked)
 	{
 		return;
 	}
-	TMap< EAIStates, float> TaskWeights;
-	EAIStates LastTask = AIState.CurrentTask;
-	//default to looking around if we have nothing else to do
-	AIState.CurrentTask = EAIStates::LookingForEnemy;
+	MA_LLM_SCOPE(BotAI);
+	FMAMetrics::Increment(EMACounter::BotDecisions);
+	FMAMetricScopeTimer DecisionTimer(EMAHistogram::BotDecisionTime);
 	//we don't want to do the same thing for too long, so we track how long we have been doing our last task to bias against it
 	float TimeSinceTaskChange = ParentCharacter->GetWorld()->GetTimeSeconds() - TimeOfTaskStart;
-	
-	AAIPlayerController* AIPC = Cast<AAIPlayerController>(ParentCharacter->GetController());
-	UMAPracticeComponent* PracticeComponent = AIPC->PracticeComponent;
 
 	//if our goal in life is to just run a route, we ignore everything else.
 	if (BotConfig.BotType == EBotTypes::RouteRunner)
@@ -178,335 +213,55 @@ void UMABotAIComponent::DetermineCurrentTask()
 		return;
 	}
 
-	//Route running bots need to figure out what route they are running prior to us running the determineMoveLoc code
-	if (BotConfig.BotType == EBotTypes::Offense && AIState.RouteState == EAIRouteState::NoRouteSelected)
+	//nothing to decide while an unobserved fight is being resolved, we go back to thinking as soon as it ends or a human gets close
+	if (bInAbstractCombat)
 	{
-		DetermineRouteToRun();
-	}
-
-	//Figure out where we should move to -- a target player, one of the flags, our route start.
-	DetermineMoveLocation();
-
-	//display a line pointer for each bot to their desired move location
-	if (bBotDebugMode)
-	{
-		ClientDrawDebugLine(
-			ParentCharacter->GetActorLocation(),
-			AIState.DesiredMoveLocation,
-			FColor(0, 255, 0),
-			2.0f
-		);
-	}
-	
-
-	//handle our target being dead so we can reset it.
-	if (AIState.CurrentTarget != nullptr && (!IsValid(AIState.CurrentTarget) || FMath::IsNearlyZero(AIState.CurrentTarget->GetHealth())))
-	{
-		AIState.CurrentTarget = nullptr;
-	}
-
-	//We need to ensure we are periodically looking around for new targets, and changing our movement directions.
-	float TimeSinceLastCheckedForEnemies = ParentCharacter->GetWorld()->GetTimeSeconds() - TimeOfLastLookForEnemy;
-	float TimeSinceLastMovementChange = ParentCharacter->GetWorld()->GetTimeSeconds() - TimeOfLastMovementTargetChange;
-
-	float DistanceToMoveLocation = DistanceBetweenTargets(ParentCharacter->GetActorLocation(), AIState.DesiredMoveLocation);
-	if (BotConfig.BotType == EBotTypes::Offense)
-	{
-		//If we are on O, try to move to our route start or if we are close enough, trigger the route follow to begin.
-		if (AIState.RouteState == EAIRouteState::MovingToRouteStart)
-		{
-			//if we can't quite get to our route start we just teleport there. If they get stuck for a while, increase our teleport distance so they don't do stupid things.
-			//we can improve this later when we have better movement code. todo-emallon
-			//3s = 3 * 3 * 10 = 90
-			//10s = 10 * 10 * 10 = 1000
-			//20s = 20 * 20 * 10 = 4000
-			//but cap it so we don't get super weird teleports
-
-			if (AIState.MoveTargetType == EAIMoveTargetTypes::RouteStart && DistanceToMoveLocation < TimeSinceLastMovementChange * TimeSinceLastMovementChange * 10 && DistanceToMoveLocation < 5000)
-			{
-				StartRouteFollow();
-			}
-			else {
-				TaskWeights.Add(EAIStates::MoveToTarget, 70.0f);
-			}
-
-		}
-		//while running a route, we only care about changing tasks if we have overshot the flag.
-		if (AIState.RouteState == EAIRouteState::RunningRoute)
-		{
-			//determine where we are, and where the grab happens so we can figure out if we are past it
-			int priorMarkerNumber = FMath::Clamp(PracticeComponent->CurrentMarkerIndex - 1, 0, PracticeComponent->RouteTrailToRun.MarkerLocations.Num());
-			int GrabMarker = AIState.CurrentRoute.GrabTime / PracticeComponent->PathRecordMarkerInterval / PracticeComponent->ModulusForLowPrecisionRecordMarkers;
-
-			//if we are past our grab time and don't have the flag, we aren't going to be grabbing, so stop our route to clear
-			//Or, if we are past the end of our route, abandon it.
-			if ((priorMarkerNumber > GrabMarker && ParentCharacter->CarriedObject == nullptr)
-				|| priorMarkerNumber == PracticeComponent->RouteTrailToRun.MarkerLocations.Num() - 2)
-			{
-				AIState.RouteState = EAIRouteState::AbandonedRoute;
-				PracticeComponent->EndRoutePathPlayback();
-			}
-			else {
-				TaskWeights.Add(EAIStates::RunningRoute, 170.0f);
-			}
-			//todo-emallon add code to abandon route if they are heavily damaged prior to attempting to grab the flag.
-			//if damaged on route MORE than we expect we should be (due to disc jumps or whatever), 
-			//if (FMath::IsNearlyEqual(ParentCharacter->GetHealth(), PracticeComponent->RouteTrailToRun.MarkerLocations[priorMarkerNumber].Health))
-
-		}
-		if (AIState.RouteState == EAIRouteState::RouteFinished)
-		{
-			if (AIState.MoveTargetType == EAIMoveTargetTypes::FriendlyStand && AIState.bIsHoldingFlag) {
-				if (GameState.FlagState == EAIFlagStates::EnemyFlagTakenFriendlySafe)
-				{
-					//if we are trying to cap, that is always most important.
-					TaskWeights.Add(EAIStates::MoveToTarget, 200.0f);
-				}
-				else {
-					//otherwise stay close to the flag
-					TaskWeights.Add(EAIStates::MoveToTarget, FMath::Clamp((DistanceToMoveLocation - 500) / 100, 15.0f, 150.0f));
-				}
-			}
-			else {
-				//If the route is over and we don't have flag, just respawn. 
-				//todo-emallon, once we get a team coordiator to handle bot crosstalk better, they can clear if someone else is coming in.
-				AIPC->Suicide();
-				OnDied();
-				return;
-			}
-		}
-		if (AIState.RouteState == EAIRouteState::AbandonedRoute)
-		{
-			//if we have the flag, try to cap if home, or get close if it isn't.
-			if (AIState.bIsHoldingFlag && (DistanceToMoveLocation > 3000 || GameState.bFriendlyFlagHome))
-			{
-				TaskWeights.Add(EAIStates::MoveToTarget, 200.0f);				
-			}
-			else {
-				//if we abandoned our route, and don't have the flag, and haven't spawned in a while, suicide and start running routes again.
-				if (GetWorld()->GetTimeSeconds() - TimeOfLastSpawn > 10 && !AIState.bIsHoldingFlag && GameState.bEnemyFlagHome)
-				{
-					AIPC->Suicide();
-					OnDied();
-					return;
-				}
-				else {
-					//otherwise default to at least going somewhere.
-					TaskWeights.Add(EAIStates::MoveToTarget, 20.0f);
-				}
-				
-			}
-		}
-	}
-	if (BotConfig.BotType == EBotTypes::Chase)
-	{
-		if (AIState.MoveTargetType == EAIMoveTargetTypes::FriendlyFlag && !GameState.bFriendlyFlagHome)
-		{
-			if (DistanceToMoveLocation < 10000 || AIState.CurrentTarget == nullptr)
-			{
-				//if we are close to a return, or we have no target, we care most about that
-				TaskWeights.Add(EAIStates::MoveToTarget, 200.0f);
-			}
-			else {
-				//otherwise, if flag isn't home, going towards it is generally quite important.
-				TaskWeights.Add(EAIStates::MoveToTarget, 70.0f);
-			}
-			
-		}
-		else {
-			//if we are too far from our stand, and our flag is home, respawn to get closer again.
-			if (DistanceToMoveLocation > 20000 && GameState.bFriendlyFlagHome == true)
-			{
-				AIPC->Suicide();
-				OnDied();
-				return;
-			}
-			//always care at least a bit about the flag location, unless we are super close to ours already and dont need to return.
-			if (DistanceToMoveLocation > 500)
-			{
-				TaskWeights.Add(EAIStates::MoveToTarget, FMath::Clamp((DistanceToMoveLocation - 500) / 100, 5.0f, 110.0f));
-			}
-			
-		}
-		
-	}
-	if (BotConfig.BotType == EBotTypes::LO)
-	{
-		//as LO, we are a bit more biased towards killing anything we see
-		if (AIState.MoveTargetType != EAIMoveTargetTypes::EnemyStand || DistanceToMoveLocation > 400)
-		{
-			if (AIState.MoveTargetType == EAIMoveTargetTypes::FriendlyFlag && !GameState.bFriendlyFlagHeld && !GameState.bFriendlyFlagHome)
-			{
-				TaskWeights.Add(EAIStates::MoveToTarget, FMath::Clamp((DistanceToMoveLocation - 500) / 100, 10.0f, 400.0f));
-			}
-			else {
-				TaskWeights.Add(EAIStates::MoveToTarget, FMath::Clamp((DistanceToMoveLocation - 500) / 100, 30.0f, 40.0f));
-			}
-			
-		}
-		else {
-			TaskWeights.Add(EAIStates::LookingForEnemy, 10.0f);
-		}
-		
-		
-	}
-	if (BotConfig.BotType == EBotTypes::StayAtHome)
-	{
-		//if enemy flag is in field, SaH generally wants to go pick it up, unless it is really far.
-		if (AIState.MoveTargetType == EAIMoveTargetTypes::EnemyFlag && GameState.bEnemyFlagHeld == false && AIState.bIsHoldingFlag == false)
-		{
-			TaskWeights.Add(EAIStates::MoveToTarget, FMath::Clamp((DistanceToMoveLocation - 50) / 100, 65.0f, 150.0f));
-		}
-		//if friendly flag is nearby for a return, also very important
-		else if (AIState.MoveTargetType == EAIMoveTargetTypes::FriendlyFlag && GameState.bFriendlyFlagHome == false && GameState.bFriendlyFlagHeld == false && AIState.bIsHoldingFlag == false)
-		{
-			TaskWeights.Add(EAIStates::MoveToTarget, FMath::Clamp((DistanceToMoveLocation - 500) / 100, 20.0f, 100.0f));
-		}
-		else {
-			TaskWeights.Add(EAIStates::MoveToTarget, FMath::Clamp((DistanceToMoveLocation - 500) / 100, 5.0f, 110.0f));
-			TaskWeights.Add(EAIStates::LookingForEnemy, 6.0f);
-		}
-		
+		return;
 	}
-	
-	if (RecentlySeenTargets.Num() == 0 && AIState.CurrentTarget == nullptr)
-	{
-		//here, we have no good target
-		//increase our desire to look for dudes by 5 every second
-		float LookForEnemyTaskWeight = TimeSinceLastCheckedForEnemies * 5.0f;
-		//if we have already been looking recently, we don't need to KEEP looking. Don't start looking if we haven't been doing something for long
-		if ((LastTask != EAIStates::LookingForEnemy && TimeSinceTaskChange <= 2.0f) || (LastTask == EAIStates::LookingForEnemy && TimeSinceTaskChange > 2.0f))
-		{
-			LookForEnemyTaskWeight = 3.0f;
-		}
-		TaskWeights.Add(EAIStates::LookingForEnemy, LookForEnemyTaskWeight);
-	} else {
-		//we have at least one target, need to determine how badly we want to shoot at them, or if we should be waiting for a better shot
-		float TargetHeightAboveGround = 9999999.0f;
-		if (AIState.CurrentTarget != nullptr)
-		{
-			TargetHeightAboveGround = GetHeightAboveGround(AIState.CurrentTarget->GetActorLocation(), false);
-		}
 
-		float WaitForBetterShotWeight = 0.0f;
-		if (AIState.CurrentTarget != nullptr)
-		{
-			// if close to ground AND falling
-			if (TargetHeightAboveGround < 1000 && AIState.CurrentTarget->GetVelocity().Z < -200.0f)
-			{
-				WaitForBetterShotWeight += 9.0f;
-			}
-		}
-		float ChangeTargetWeight = 0.0f;
-		if (RecentlySeenTargets.Num() > 0)
-		{
-			AMACharacter* MostDesirableTarget = AIState.CurrentTarget;
-			float HighestFocusScore = 0.0f;
-			//first prune any targets that might have died/left/whatever.
-			TMap<AMACharacter*, float> ValidRecentlySeenTargets;
-			for (auto Element : RecentlySeenTargets)
-			{
-				float WorldTimeLastSeen = Element.Value; //was working on giving memory to bots again
-				if (Element.Key != nullptr && Element.Key && IsValid(Element.Key)  && Element.Key->IsValidLowLevel() && Element.Key->GetDebugName(Element.Key).Contains("BP_LightCharacter")
-					&& ParentCharacter->GetWorld()->GetTimeSeconds() - WorldTimeLastSeen < 5.0f)
-				{
-					ValidRecentlySeenTargets.Add(Element);
-				}
-			}
-			RecentlySeenTargets = ValidRecentlySeenTargets;
-			for (auto Element : RecentlySeenTargets)
-			{
-				//fetch how desirable this particular target is, so we can find who best to shoot.
-				float FocusScoreForTarget = GetTargetFocusScore(Element.Key);
-				if (FocusScoreForTarget > HighestFocusScore)
-				{
-					HighestFocusScore = FocusScoreForTarget;
-					MostDesirableTarget = Element.Key;
-				}
-			}
-			
-			if (MostDesirableTarget == AIState.CurrentTarget)
-			{
-				bool bCanSeeTarget = AimAtTarget(false);
-				if (bCanSeeTarget)
-				{
-					TaskWeights.Add(EAIStates::ShootAtTarget, HighestFocusScore);
-				}
-			}
-			else {
-				TaskWeights.Add(EAIStates::ChangeTarget, HighestFocusScore);
-				AIState.CurrentTarget = MostDesirableTarget;
-			}
-		}
-		else {
-			ParentCharacter->SetTrigger(0, false);
-		}
-	}
-	//if we have the flag and the flag is home, nothing else matters over getting there.
-	if (AIState.bIsHoldingFlag && GameState.bFriendlyFlagHome)
+	//Route running bots need to figure out what route they are running before we decide where to move
+	if (BotConfig.BotType == EBotTypes::Offense && AIState.RouteState == EAIRouteState::NoRouteSelected)
 	{
-		TaskWeights.Add(EAIStates::MoveToTarget, 9001.0f);
+		DetermineRouteToRun();
 	}
 
-	float MaxTaskWeight = 0.0f;
-	for (auto Element : TaskWeights)
-	{
-		if (Element.Value > MaxTaskWeight)
-		{
-			MaxTaskWeight = Element.Value;
-			AIState.CurrentTask = Element.Key;
-		}
-	}
+	//The decision itself is made by MABotBrain::Think from a snapshot of what we know, so it comes out the same whether it runs here,
+	//in the sidecar process or on the shared think pool.
+	FMABotBrainSnapshot Snapshot;
+	BuildBrainSnapshot(Snapshot);
 
-	//if we are moving to the stand but can't actually DO anything there, switch to look for targets/wander so we prevent the spinning in place issues
-	//if at the enemy stand and the flag isn't home, look for things to shoot.
-	//if at the friendly flag and we aren't holding the flag and the flag isn't home (aka we are capping), look for enemies to shoot.
-	if(AIState.CurrentTask == EAIStates::MoveToTarget && DistanceToMoveLocation < 300 
-		&& ((AIState.MoveTargetType == EAIMoveTargetTypes::EnemyStand && GameState.bEnemyFlagHome == false)
-			|| (AIState.MoveTargetType == EAIMoveTargetTypes::FriendlyStand && (AIState.bIsHoldingFlag == false || GameState.bFriendlyFlagHome == false))))
+	//optionally hand the thinking off to the sidecar process, its answer comes back through ApplyBrainCommand
+	if (FMABotBrainHost::Get().IsAvailable() && SubmitBrainSnapshot(Snapshot))
 	{
-		AIState.CurrentTask = EAIStates::LookingForEnemy;
+		RecentlySeenTargets.Reset();
+		return;
 	}
-
-
-	FString AISTateString = "Undefined";
-	switch (AIState.CurrentTask)
+	//or to the worker threads shared by every match in this process, the answer comes back the same way as the next frame starts
+	if (FMABotThinkPool::IsEnabled())
 	{
-	case(EAIStates::ChangeTarget):
-		AISTateString = "Change Target";
-		break;
-	case(EAIStates::LookingForEnemy):
-		AISTateString = "Looking for Enemy";
-		break;
-	case(EAIStates::MoveToTarget):
-		AISTateString = "Move To Target";
-		break;
-	case(EAIStates::RouteRunner):
-		AISTateString = "Route RUnner";
-		break;
-	case(EAIStates::RunningRoute):
-		AISTateString = "Running ROute";
-		break;
-	case(EAIStates::ShootAtTarget):
-		AISTateString = "Shoot at target";
-		break;
-	case(EAIStates::WaitForBetterShot):
-		AISTateString = "Wait for better shot";
-		break;
+		FMABotThinkPool::Get().Submit(this, Snapshot, Tuning);
+		RecentlySeenTargets.Reset();
+		return;
 	}
-	AISTateString = "Task: " + AISTateString;
-	//GEngine->AddOnScreenDebugMessage(73, 130.1f, FColor::Black, AISTateString);
-	//GEngine->AddOnScreenDebugMessage(75, 130.1f, FColor::Red, FString::Printf(TEXT("task time: %f"), TimeSinceTaskChange));
 
-	if (AIState.CurrentTask != LastTask)
-	{
-		TimeOfTaskStart = ParentCharacter->GetWorld()->GetTimeSeconds();
-		AIState.IsTaskInitialized = false;
-	}
+	FMABotCommandFrame Command;
+	MABotBrain::Think(Snapshot, Tuning, Command);
+	ApplyBrainCommand(Command);
 	//todo-emallon hack that removes the bots memory. Right now we aren't properly pruning recently seen targets when characters die
 	//so we crash when checking focus scores for the already dead targets sometimes.
 	//need to probably change this to a map of TWeakObjectPtr instead.
 	RecentlySeenTargets.Reset();
+
+	//display a line pointer for each bot to their desired move location
+	if (bBotDebugMode && !bIsDead)
+	{
+		ClientDrawDebugLine(
+			ParentCharacter->GetActorLocation(),
+			AIState.DesiredMoveLocation,
+			FColor(0, 255, 0),
+			2.0f
+		);
+	}
 }
 
 void UMABotAIComponent::DetermineRouteToRun()
@@ -520,57 +275,45 @@ void UMABotAIComponent::DetermineRouteToRun()
 	{
 		int BotRouteToRun = FMath::RandRange(0, BotConfig.RouteTrailNames.Num() - 1);
 		FString BotRoute = BotConfig.RouteTrailNames[BotRouteToRun];
-		UMAPracticeComponent* PracticeComponent = AIPC->PracticeComponent;
 
 		int TeamID = 0;
 		if (AMAPlayerState* PS = Cast<AMAPlayerState>(ParentCharacter->GetController()->PlayerState))
 		{
 			TeamID = PS->GetTeamId();
 		}
-		AIState.CurrentRoute = PracticeComponent->GetRouteTrailByName(BotRoute, TeamID); //todo-emallon use a RouteTrailLite here so we don't pass all marker locations/input around
-		if (AIState.CurrentRoute.MarkerLocations.Num() > 0)
+		//the follower holds a shared copy of the route, every bot running it from the same practice file points at the same one
+		if (AIPC->RouteFollower->SelectRoute(BotRoute, TeamID))
 		{
-			AIState.RouteStartLocation = AIState.CurrentRoute.MarkerLocations[0].Location;
+			AIState.RouteStartLocation = AIPC->RouteFollower->GetRoute()->MarkerLocations[0].Location;
 		}
 		AIState.RouteState = EAIRouteState::MovingToRouteStart;
 	}
 }
 
-void UMABotAIComponent::DetermineMoveLocation()
+//Reads where both flags are and what state they are in, for the snapshot MABotBrain::Think decides from.
+//Flag state comes from the world's flag tracker, which follows flag events, see MAGameplayEvents.
+void UMABotAIComponent::RefreshFlagGameState()
 {
-	if (ParentCharacter == nullptr)
-	{
-		return;
-	}
-	float TargetDistance = DistanceToTarget(AIState.CurrentTarget);
-	FVector OriginalMoveLocation = AIState.DesiredMoveLocation;
-	EAIMoveTargetTypes OriginalMoveLocationType = AIState.MoveTargetType;
-	AIState.DesiredMoveLocation = FVector::ZeroVector;
-	//if we need to start a route, then we just go ASAP to route start.
-	if (BotConfig.BotType == EBotTypes::Offense && AIState.RouteState == EAIRouteState::MovingToRouteStart)
+	uint8 BotTeamId = ParentCharacter->GetTeamId();
+	for (const FMATrackedFlag& TrackedFlag : FMAFlagTracker::Get(GetWorld()).GetFlags())
 	{
-		AIState.MoveTargetType = EAIMoveTargetTypes::RouteStart;
-		AIState.DesiredMoveLocation = AIState.RouteStartLocation;
-		return;
-	}
-	//first, get the latest game state.
-	for (TActorIterator<AMACTFFlag> ActorItr(GetWorld()); ActorItr; ++ActorItr)
-	{
-		AMACTFFlag *Flag = *ActorItr;
-		uint8 BotTeamId = ParentCharacter->GetTeamId();
-		uint8 FlagTeamId = Flag->GetTeamId();
-		bool bEnemyFlag = BotTeamId != FlagTeamId;
+		AMACTFFlag *Flag = TrackedFlag.Flag.Get();
+		if (Flag == nullptr)
+		{
+			continue;
+		}
+		bool bEnemyFlag = BotTeamId != TrackedFlag.TeamId;
 		if (bEnemyFlag)
 		{
 			GameState.EnemyFlagLocation = Flag->GetActorLocation();
-			GameState.bEnemyFlagHome = Flag->IsHome();
-			GameState.bEnemyFlagHeld = Flag->StateName == CarriedObjectState::Held;
+			GameState.bEnemyFlagHome = TrackedFlag.bHome;
+			GameState.bEnemyFlagHeld = TrackedFlag.Holder.IsValid();
 			AIState.DistanceToEnemyFlag = DistanceBetweenTargets(ParentCharacter->GetActorLocation(), Flag->GetActorLocation());
 		}
 		else {
 			GameState.FriendlyFlagLocation = Flag->GetActorLocation();
-			GameState.bFriendlyFlagHome = Flag->IsHome();
-			GameState.bFriendlyFlagHeld = Flag->StateName == CarriedObjectState::Held;
+			GameState.bFriendlyFlagHome = TrackedFlag.bHome;
+			GameState.bFriendlyFlagHeld = TrackedFlag.Holder.IsValid();
 			AIState.DistanceToFriendlyFlag = DistanceBetweenTargets(ParentCharacter->GetActorLocation(), Flag->GetActorLocation());
 		}
 	}
@@ -587,221 +330,6 @@ void UMABotAIComponent::DetermineMoveLocation()
 	{
 		GameState.FlagState = EAIFlagStates::Standoff;
 	}
-	
-	AIState.bIsHoldingFlag = ParentCharacter->CarriedObject != nullptr;
-
-	//If we have the flag we always try to cap. 
-	if (AIState.bIsHoldingFlag)
-	{
-		AIState.MoveTargetType = EAIMoveTargetTypes::FriendlyStand;
-		AIState.DesiredMoveLocation = GameState.FriendlyStandLocation;
-	}
-	//If chase, we always care about our flag unless we are holding.
-	if (!AIState.bIsHoldingFlag && BotConfig.BotType == EBotTypes::Chase)
-	{
-		AIState.MoveTargetType = EAIMoveTargetTypes::FriendlyFlag;
-		AIState.DesiredMoveLocation = GameState.FriendlyFlagLocation;
-	}
-	//if we are on O, we care about returns in standoffs and otherwise the enemy flag.
-	if (!AIState.bIsHoldingFlag && (BotConfig.BotType == EBotTypes::Offense || BotConfig.BotType == EBotTypes::LO))
-	{
-		//if enemy flag is dropped and close, we go for that
-		if (GameState.bEnemyFlagHome == false && GameState.bEnemyFlagHeld == false && AIState.DistanceToEnemyFlag < 5000) 
-		{
-			AIState.MoveTargetType = EAIMoveTargetTypes::EnemyFlag;
-			AIState.DesiredMoveLocation = GameState.EnemyFlagLocation;
-		}
-		//if friendly flag is dropped and close, we prioritize that next
-		else if (GameState.bFriendlyFlagHeld == false && GameState.bFriendlyFlagHome == false && AIState.DistanceToFriendlyFlag < 5000) 
-		{
-			AIState.MoveTargetType = EAIMoveTargetTypes::FriendlyFlag;
-			AIState.DesiredMoveLocation = GameState.FriendlyFlagLocation;
-		}else if (GameState.FlagState == EAIFlagStates::Standoff)
-		{
-			AIState.MoveTargetType = EAIMoveTargetTypes::FriendlyFlag;
-			AIState.DesiredMoveLocation = GameState.FriendlyFlagLocation;
-		} else {
-			if (BotConfig.BotType == EBotTypes::Offense)
-			{
-				AIState.MoveTargetType = EAIMoveTargetTypes::EnemyFlag;
-				AIState.DesiredMoveLocation = GameState.EnemyFlagLocation;
-			}
-			else if (BotConfig.BotType == EBotTypes::LO)
-			{
-				if (GameState.FlagState == EAIFlagStates::EnemyFlagTakenFriendlySafe)
-				{
-					AIState.MoveTargetType = EAIMoveTargetTypes::EnemyFlag;
-					AIState.DesiredMoveLocation = GameState.EnemyFlagLocation;
-				}
-				else {
-					AIState.MoveTargetType = EAIMoveTargetTypes::EnemyStand;
-					AIState.DesiredMoveLocation = GameState.EnemyStandLocation;
-				}
-				
-			}
-			
-		}
-		
-	}
-	//Stay at home cares about friendly flag before standoffs, and enemy during standoffs.
-	if (BotConfig.BotType == EBotTypes::StayAtHome)
-	{
-		//in general, SaH goes to their own stand
-		AIState.MoveTargetType = EAIMoveTargetTypes::FriendlyStand;
-		AIState.DesiredMoveLocation = GameState.FriendlyStandLocation;
-
-		//if you are in a standoff and the flag is close to you, try to pick it up
-		if (GameState.FlagState == EAIFlagStates::Standoff 
-			|| (GameState.FlagState == EAIFlagStates::EnemyFlagTakenFriendlySafe && AIState.DistanceToEnemyFlag < 10000 && GameState.bEnemyFlagHeld == false))
-		{
-			AIState.MoveTargetType = EAIMoveTargetTypes::EnemyFlag;
-			AIState.DesiredMoveLocation = GameState.EnemyFlagLocation;
-		}
-		else {
-			//if friendly flag has been taken, and is close and we don't have their flag, chase.
-			if (GameState.FlagState == EAIFlagStates::FriendlyTakenEnemyHome && AIState.DistanceToFriendlyFlag < 10000)
-			{
-				AIState.MoveTargetType = EAIMoveTargetTypes::FriendlyFlag;
-				AIState.DesiredMoveLocation = GameState.FriendlyFlagLocation;
-			}			
-		}
-	}
-	float DistanceToMoveLocation = DistanceBetweenTargets(ParentCharacter->GetActorLocation(), AIState.DesiredMoveLocation);
-	//if we are relatively close to where we want to be and have a target, go for our target.
-	if (AIState.CurrentTarget != nullptr && TargetDistance < 20000 && DistanceToMoveLocation < 10000)
-	{
-		AIState.MoveTargetType = EAIMoveTargetTypes::EnemyTarget;
-		AIState.DesiredMoveLocation = AIState.CurrentTarget->GetActorLocation();
-	}
-
-	//distance to flag where it being on the ground overrides everything else, differs per position
-	float FriendlyFlagOverrideDistance = 5000.0f;
-	float EnemyFlagOverrideDistance = 5000.0f;
-
-	if (BotConfig.BotType == EBotTypes::StayAtHome)
-	{
-		EnemyFlagOverrideDistance = 15000;
-		FriendlyFlagOverrideDistance = 10000;
-	}
-	if (BotConfig.BotType == EBotTypes::Chase)
-	{
-		FriendlyFlagOverrideDistance = 15000;
-	}
-	//if the flag is in the field, we can care about that most, usually.
-	if (AIState.DistanceToFriendlyFlag < FriendlyFlagOverrideDistance && !GameState.bFriendlyFlagHeld 
-		&& (GameState.FlagState == EAIFlagStates::FriendlyTakenEnemyHome || GameState.FlagState == EAIFlagStates::Standoff))
-	{
-		AIState.MoveTargetType = EAIMoveTargetTypes::FriendlyFlag;
-		AIState.DesiredMoveLocation = GameState.FriendlyFlagLocation;
-	}
-	if (AIState.DistanceToEnemyFlag < EnemyFlagOverrideDistance && !GameState.bEnemyFlagHeld 
-		&& (GameState.FlagState == EAIFlagStates::EnemyFlagTakenFriendlySafe || GameState.FlagState == EAIFlagStates::Standoff))
-	{
-		AIState.MoveTargetType = EAIMoveTargetTypes::EnemyFlag;
-		AIState.DesiredMoveLocation = GameState.EnemyFlagLocation;
-	}
-
-	//If we have the flag and can cap, we always try to cap. 
-	if (AIState.bIsHoldingFlag && GameState.bFriendlyFlagHome)
-	{
-		AIState.MoveTargetType = EAIMoveTargetTypes::FriendlyStand;
-		AIState.DesiredMoveLocation = GameState.FriendlyStandLocation;
-	}
-	//not fully accurate yet, doesnt track changing enemy targets.
-	if (OriginalMoveLocationType != AIState.MoveTargetType)
-	{
-		TimeOfLastMovementTargetChange = GetWorld()->GetTimeSeconds();
-
-		//start of prototype multi-waypoint moves to allow for planning of more complex movements around geometry. barely started.
-		/* FVector StartLocation = ParentCharacter->GetActorLocation();
-		FVector EndLocation = AIState.DesiredMoveLocation;           // Raytrace end point.
-
-		FCollisionQueryParams CollisionParams = FCollisionObjectQueryParams::AllStaticObjects;
-		CollisionParams.AddIgnoredActor(ParentCharacter);
-
-		// Raytrace for overlapping actors.
-		FHitResult HitResult;
-		if (GetWorld())
-		{
-			GetWorld()->LineTraceSingleByObjectType(
-				OUT HitResult,
-				StartLocation,
-				EndLocation,
-				FCollisionObjectQueryParams(ECollisionChannel::ECC_WorldStatic),
-				CollisionParams
-			);
-			FColor LineColor;
-
-			if (HitResult.GetActor()) LineColor = FColor::Red;
-			else LineColor = FColor::Green;
-
-			DrawDebugLine(
-				ParentCharacter->GetWorld(),
-				StartLocation,
-				EndLocation,
-				LineColor,
-				true,
-				10.f,
-				ESceneDepthPriorityGroup::SDPG_World,
-				10.f
-			);
-
-			//we hit something in between us and flag, try going up first.
-			if (HitResult.GetActor())
-			{
-				FVector EndLocationWaypoint = AIState.DesiredMoveLocation;
-				EndLocationWaypoint.Z += 600.0f; //200 =~ height of flag
-
-				GetWorld()->LineTraceSingleByObjectType(
-					OUT HitResult,
-					StartLocation,
-					EndLocationWaypoint,
-					FCollisionObjectQueryParams(ECollisionChannel::ECC_WorldStatic),
-					CollisionParams
-				);
-
-				if (HitResult.GetActor()) LineColor = FColor::Red;
-				else LineColor = FColor::Green;
-
-				DrawDebugLine(
-					ParentCharacter->GetWorld(),
-					StartLocation,
-					EndLocationWaypoint,
-					LineColor,
-					true,
-					10.f,
-					ESceneDepthPriorityGroup::SDPG_World,
-					10.f
-				);
-
-				GetWorld()->LineTraceSingleByObjectType(
-					OUT HitResult,
-					EndLocationWaypoint,
-					EndLocation,
-					FCollisionObjectQueryParams(ECollisionChannel::ECC_WorldStatic),
-					CollisionParams
-				);
-
-
-				if (HitResult.GetActor()) LineColor = FColor::Red;
-				else LineColor = FColor::Green;
-
-				DrawDebugLine(
-					ParentCharacter->GetWorld(),
-					EndLocationWaypoint,
-					EndLocation,
-					LineColor,
-					true,
-					10.f,
-					ESceneDepthPriorityGroup::SDPG_World,
-					10.f
-				);
-			}
-		} */
-		
-
-	}
-
 }
 
 void UMABotAIComponent::ShootAtTarget()
@@ -852,6 +380,8 @@ void UMABotAIComponent::MoveToTarget()
 	ParentCharacter->SetActorRotation(ActorRot);
 
 	ParentCharacter->MoveForward(1.0f);
+	//spread out from other bots heading to the same place
+	ApplyCrowdSteering();
 
 	//we don't want to skii if we are sliding backwards from our target, since we won't gain mommentum going the correct direction
 	float DistanceToTargetPlusVelocity = DistanceToDesiredLocation + DistanceBetweenTargets(ParentCharacter->GetActorLocation() + ParentCharacter->GetVelocity(), AIState.DesiredMoveLocation);
@@ -866,16 +396,19 @@ void UMABotAIComponent::MoveToTarget()
 	//TODO improve amount of jets needed to go X height formula
 	//1000 below, -1000. Z velocity goes to like 3-4k when skiing up fast. If we are close, and already have velocity, we stop jetting. 
 	bool bWasPreviouslyJetting = bIsJetting;
-	float TimeOfSinceJetChange = ParentCharacter->GetWorld()->GetTimeSeconds() - TimeOfLastJetChange;
+	FMAAITimingWheel& TimingWheel = FMAAITimingWheel::Get(GetWorld());
+	//cooldowns started by OnJetChanged, 1s and 2s after we last started or stopped jetting
+	bool bJetSettled = !TimingWheel.IsScheduled(AITimer_JetSettle);
+	bool bJetRecharged = !TimingWheel.IsScheduled(AITimer_JetRecharge);
 	float CharEnergy = ParentCharacter->GetEnergy();
 	bool HeightAboveTargetCheck = HeightAboveTargetLoc < 0;
 	//we want to give jet energy some time to recharge if it is low, before trying to jet
-	bool EnergyRechargeCheck = (bWasPreviouslyJetting || TimeOfSinceJetChange > 2.0f || CharEnergy > 100);
+	bool EnergyRechargeCheck = (bWasPreviouslyJetting || bJetRecharged || CharEnergy > 100);
 	float VelocityZ = ParentCharacter->GetVelocity().Z;
 	//controls how far above a target we overshoot so we don't accidentally not get all the way up.
 	float OvershootFudgeFactor = 300.0f;
 	//stop jetting early so we don't go WAY above it
-	bool OvershootCheck = !(VelocityZ / 2 + HeightAboveTargetLoc > OvershootFudgeFactor && TimeOfSinceJetChange > 1.0f);
+	bool OvershootCheck = !(VelocityZ / 2 + HeightAboveTargetLoc > OvershootFudgeFactor && bJetSettled);
 	//bots are bad with energy for now, so blatently cheat //todo-emallon REMOVE ME
 	if (CharEnergy < 50.5f)
 	{
@@ -894,7 +427,7 @@ void UMABotAIComponent::MoveToTarget()
 	}
 	if (bWasPreviouslyJetting != bIsJetting)
 	{
-		TimeOfLastJetChange = ParentCharacter->GetWorld()->GetTimeSeconds();
+		OnJetChanged();
 	}
 
 }
@@ -942,14 +475,11 @@ void UMABotAIComponent::MoveAround()
 			TimeOfLastMovementChange = ParentCharacter->GetWorld()->GetTimeSeconds();
 		}
 	}
-	float TimeSinceLastJetChange = ParentCharacter->GetWorld()->GetTimeSeconds() - TimeOfLastJetChange;
-	if (TimeSinceLastJetChange > 1.0f && (ParentCharacter->GetEnergy() > 40 || ParentCharacter->GetEnergy() < 5))
+	//jetting flips on and off by itself every 1-3s while we move around, see ToggleIdleJet
+	FMAAITimingWheel& TimingWheel = FMAAITimingWheel::Get(GetWorld());
+	if (!TimingWheel.IsScheduled(AITimer_IdleJetToggle))
 	{
-		if (FMath::RandRange(0.0f, 3.0f) + TimeSinceLastJetChange > 3.0f)
-		{
-			bIsJetting = !bIsJetting;
-			TimeOfLastJetChange = ParentCharacter->GetWorld()->GetTimeSeconds();
-		}
+		AITimer_IdleJetToggle = TimingWheel.Schedule(this, FMath::RandRange(1.0f, 3.0f), [this]() { ToggleIdleJet(); });
 	}
 	//now that we figured out what we SHOULD do, we can implement it.
 	//first, stop skiing, we are already close
@@ -981,32 +511,23 @@ void UMABotAIComponent::MoveAround()
 		ParentCharacter->MoveRight(1.0f);
 		break;
 	}
+	ApplyCrowdSteering();
 }
 
 //standard bot route running
 void UMABotAIComponent::StartRouteFollow()
 {
-	if (AIState.IsTaskInitialized || AIState.CurrentRoute.MarkerLocations.Num() < 1)
+	AAIPlayerController* AIPC = Cast<AAIPlayerController>(ParentCharacter->GetController());
+	if (AIState.IsTaskInitialized || AIPC == nullptr || AIPC->RouteFollower->GetRoute() == nullptr)
 	{
 		return;
 	}
-	if (AAIPlayerController* AIPC = Cast<AAIPlayerController>(ParentCharacter->GetController()))
-	{
-
-		UMAPracticeComponent* PracticeComponent = AIPC->PracticeComponent;
-
-		//set up options for how we want to run the route (these mostly matter for practice mode, and will always be like this for a real bot running AI)
-		PracticeComponent->SelectedRouteTrail = AIState.CurrentRoute;
-		PracticeComponent->RouteTrailMarkerIndex = 0;
-		PracticeComponent->bResumePathAfterDamage = false;
-		PracticeComponent->bStayAliveAfterRouteEnd = true;
-		PracticeComponent->bRestoreHealthOnTeleport = false;
-		//start the auto-follow of the selected route.
-		PracticeComponent->MovePawnOnRoutePath();
-		AIState.IsTaskInitialized = true;
-		AIState.RouteState = EAIRouteState::RunningRoute;
-		AIState.CurrentTask = EAIStates::RunningRoute;
-	}
+	//start the auto-follow of the selected route from the beginning. A real bot running AI never resumes after damage, stays alive
+	//at the end of the route to carry on with the flag, and keeps whatever health it has.
+	AIPC->RouteFollower->StartRoute(0, false, true, false);
+	AIState.IsTaskInitialized = true;
+	AIState.RouteState = EAIRouteState::RunningRoute;
+	AIState.CurrentTask = EAIStates::RunningRoute;
 }
 
 //Run a route in complete AFK mode, including spawning mid-route, will never exit early
@@ -1020,7 +541,7 @@ void UMABotAIComponent::RunRouteSimple()
 	{
 		int BotRouteToRun = FMath::RandRange(0, BotConfig.RouteTrailNames.Num() - 1);
 		FString BotRoute = BotConfig.RouteTrailNames[BotRouteToRun];
-		UMAPracticeComponent* PracticeComponent = AIPC->PracticeComponent;
+		UMARouteFollowerComponent* RouteFollower = AIPC->RouteFollower;
 
 		int TeamID = 0;
 		if (AMAPlayerState* PS = Cast<AMAPlayerState>(ParentCharacter->GetController()->PlayerState))
@@ -1028,14 +549,18 @@ void UMABotAIComponent::RunRouteSimple()
 			TeamID = PS->GetTeamId();
 		}
 
-		FMARouteTrail RouteTrail = PracticeComponent->GetRouteTrailByName(BotRoute, TeamID);
+		if (!RouteFollower->SelectRoute(BotRoute, TeamID))
+		{
+			return;
+		}
+		const FMARouteTrail& RouteTrail = *RouteFollower->GetRoute();
 		int MarkerIndexToSpawnBotAt = 0;
 		if (BotConfig.BotSpawnType == EDrillBotSpawnType::SecondsBeforeGrab)
 		{
 			if (RouteTrail.GrabTime >= BotConfig.SpawnDelay)
 			{
 				float TimeAtWhichToSpawnBot = RouteTrail.GrabTime - BotConfig.SpawnDelay;
-				MarkerIndexToSpawnBotAt = TimeAtWhichToSpawnBot / PracticeComponent->PathRecordMarkerInterval / (float)PracticeComponent->ModulusForPathRecordMarkers;
+				MarkerIndexToSpawnBotAt = RouteFollower->GetMarkerIndexAtTime(TimeAtWhichToSpawnBot);
 				//add some randomness to when they spawn
 				MarkerIndexToSpawnBotAt -= FMath::RandRange(0, 8);
 			}
@@ -1046,19 +571,15 @@ void UMABotAIComponent::RunRouteSimple()
 		if (BotConfig.BotSpawnType == EDrillBotSpawnType::SecondsIntoRoute)
 		{
 			float TimeAtWhichToSpawnBot = BotConfig.SpawnDelay;
-			MarkerIndexToSpawnBotAt = TimeAtWhichToSpawnBot / PracticeComponent->PathRecordMarkerInterval / (float)PracticeComponent->ModulusForPathRecordMarkers;
+			MarkerIndexToSpawnBotAt = RouteFollower->GetMarkerIndexAtTime(TimeAtWhichToSpawnBot);
 			MarkerIndexToSpawnBotAt -= FMath::RandRange(0, 8);
 		}
 		//make sure we have a valid marker index after we added a bit of randomness to it
-		MarkerIndexToSpawnBotAt = FMath::Clamp(MarkerIndexToSpawnBotAt, 0, RouteTrail.MarkerLocations.Num() / PracticeComponent->ModulusForPathRecordMarkers);
+		MarkerIndexToSpawnBotAt = FMath::Clamp(MarkerIndexToSpawnBotAt, 0, RouteTrail.MarkerLocations.Num() - 1);
 
 		if (BotConfig.BotType == EBotTypes::RouteRunner)
 		{
-			PracticeComponent->SelectedRouteTrail = RouteTrail;
-			PracticeComponent->RouteTrailMarkerIndex = MarkerIndexToSpawnBotAt > 0 ? MarkerIndexToSpawnBotAt : 0;
-			PracticeComponent->bResumePathAfterDamage = !BotConfig.bBotAlwaysFollowPath;
-			PracticeComponent->bRestoreHealthOnTeleport = !BotConfig.bBotTakesDamage;
-			PracticeComponent->MovePawnOnRoutePath();
+			RouteFollower->StartRoute(MarkerIndexToSpawnBotAt, !BotConfig.bBotAlwaysFollowPath, false, !BotConfig.bBotTakesDamage);
 		}
 		AIState.IsTaskInitialized = true;
 	}
@@ -1078,82 +599,26 @@ void UMABotAIComponent::LookForEnemies()
 	ParentCharacter->SetActorRotation(ActorRot);
 }
 //based on the health/location/velocity of our target, choose what to shoot them with
-//doesn't use nade yet, just disc + chain.
+//doesn't use nade yet, just disc + chain. The weighting itself is in FMABotCombatModel so the tuning harness runs the same code.
 void UMABotAIComponent::SelectBestWeapon()
 {
-	//don't swap weapons if we just did it less than 2s ago
+	//don't swap weapons if we just did it, the cooldown is started whenever we switch
 	if (AIState.CurrentTarget == nullptr || ParentCharacter == nullptr ||
-		!FMath::IsNearlyZero(AIState.CurrentTarget->TimeOfDeath) ||(ParentCharacter->GetWorld()->GetTimeSeconds() - TimeOfLastWeaponChange) < 2.0f)
+		!FMath::IsNearlyZero(AIState.CurrentTarget->TimeOfDeath) || FMAAITimingWheel::Get(GetWorld()).IsScheduled(AITimer_WeaponSwitchCooldown))
 	{
 		return;
 	}
-	float DiscWeight = 1.0f;
-	float ChaingunWeight = 0.0f;
-	float NadeWeight = 0.0f;
-	if (AIState.CurrentTarget->GetHealth() < 50)
-	{
-		ChaingunWeight += 30.0f;
-		DiscWeight += 5.0f;
-	}
-	//generally ground pound with disc, shoot flying targets with chain.
-	float TargetHeightAboveGround = GetHeightAboveGround(AIState.CurrentTarget->GetActorLocation(), false);
-	if (TargetHeightAboveGround < 600)
-	{
-		DiscWeight += 30.0f;
-	}
-	else {
-		ChaingunWeight += 10.0f;
-	}
-	//chain better against faster targets
-	if (GetTargetVelocity(AIState.CurrentTarget) > 160.0f)
-	{
-		ChaingunWeight += 15.0f;
-	}
-	//chain much than disc better against further targets
-	float TargetDistance = DistanceToTarget(AIState.CurrentTarget);
-	if (TargetDistance > 10000)
-	{
-		ChaingunWeight += 20.0f;
-	}
-	else if (TargetDistance < 3000)
-	{
-		DiscWeight += 20.0f;
-	}
-	// see if they are coming directly towards or away from us. If the angle is small, disc is more likely to be used, easier shot
-	float TargetDistancePlusVelocity = DistanceBetweenTargets(ParentCharacter->GetActorLocation(), AIState.CurrentTarget->GetActorLocation() + GetTargetVelocity(AIState.CurrentTarget));
-	if (FMath::Abs(TargetDistancePlusVelocity - TargetDistance) > 0.8 * AIState.CurrentTarget->GetVelocity().Size())
-	{
-		DiscWeight += 15.0f;
-	}
-	//...but if the config says to not use the weapon, don't.
-	if (BotConfig.bNoChaingun)
-	{
-		ChaingunWeight = -100.0f;
-	}
-	if (BotConfig.bNoDisc)
-	{
-		DiscWeight = -100.0f;
-	}
+	FMAEngagementView View = GetEngagementView(AIState.CurrentTarget);
 	FString WeaponClassName = ParentCharacter->Weapon->GetName();
-	
-	if (WeaponClassName.Contains("Chaingun"))
-	{
-		//discourage bad bots from chaining a lot
-		float TimeSinceLastWeaponChange = ParentCharacter->GetWorld()->GetTimeSeconds() - TimeOfLastWeaponChange;
-		if (BotConfig.AccuracyLevel == EBotAccuracyLevels::Horrible && TimeSinceLastWeaponChange > 2.0f)
-		{
-			ChaingunWeight -= 50.0f;
-		}else if (BotConfig.AccuracyLevel == EBotAccuracyLevels::Decent && TimeSinceLastWeaponChange > 3.0f)
-		{
-			ChaingunWeight -= 20.0f;
-		}
-	}
+	float TimeSinceLastWeaponChange = ParentCharacter->GetWorld()->GetTimeSeconds() - TimeOfLastWeaponChange;
+	bool bPrefersDisc = FMABotCombatModel::PrefersDisc(Tuning, View, WeaponClassName.Contains("Chaingun"), TimeSinceLastWeaponChange, BotConfig.bNoDisc, BotConfig.bNoChaingun);
 
-	if (DiscWeight > ChaingunWeight)
+	if (bPrefersDisc)
 	{
 		if (WeaponClassName.Contains("Chaingun"))
 		{
 			TimeOfLastWeaponChange = ParentCharacter->GetWorld()->GetTimeSeconds();
+			AITimer_WeaponSwitchCooldown = FMAAITimingWheel::Get(GetWorld()).StartCooldown(this, Tuning.WeaponSwitchCooldown);
 		}
 		ParentCharacter->SwitchToWeaponAtIndex(0);
 	}
@@ -1161,6 +626,7 @@ void UMABotAIComponent::SelectBestWeapon()
 		if (WeaponClassName.Contains("RingLauncher"))
 		{
 			TimeOfLastWeaponChange = ParentCharacter->GetWorld()->GetTimeSeconds();
+			AITimer_WeaponSwitchCooldown = FMAAITimingWheel::Get(GetWorld()).StartCooldown(this, Tuning.WeaponSwitchCooldown);
 		}
 		ParentCharacter->SwitchToWeaponAtIndex(2);
 	}
@@ -1173,34 +639,25 @@ float UMABotAIComponent::GetTargetFocusScore(AMACharacter* Target)
 	{
 		return 0.0f;
 	}
-	float TargetFocusScore = 0.0f;
-	//we like to keep shooting what we are already shooting
-	if (Target == AIState.CurrentTarget)
-	{
-		TargetFocusScore += 30.0f;
-	}
-	//low HP target -- how low their HP is, from 0 - 20
-	TargetFocusScore += (200.0f - Target->GetHealth()) / 10;
-	//slower targets -- kph 0 - 40 (can be negative too if they are faster than 200)
-	TargetFocusScore += (200.0f - GetTargetVelocity(Target)) / 5;
-	//close to ground
-	float TargetHeightAboveGround = GetHeightAboveGround(Target->GetActorLocation(), false);
-	if (TargetHeightAboveGround < 200)
-	{
-		TargetFocusScore += 30.0f;
-	}
-	//close targets
-	TargetFocusScore += FMath::Clamp((10000.0f - DistanceToTarget(Target)) / 100.0f, -100.0f, 40.0f); //TODO-EMALLON figure out weighting for this.
-
-	//we really like shooting the carrier
-	if (Target->CarriedObject != nullptr)
-	{
-		TargetFocusScore += 50.0f;
-	}
-
 	//we want to make some of these negative -- a really far target is NOT desirable at all, even if other items are good.
 	//could probably break out of the function early in those cases too, to save perf
-	return TargetFocusScore;
+	return FMABotCombatModel::GetTargetFocusScore(Tuning, GetEngagementView(Target));
+}
+
+//Everything the combat model needs to know about a target, as seen from this bot.
+FMAEngagementView UMABotAIComponent::GetEngagementView(AMACharacter* Target)
+{
+	FMAEngagementView View;
+	View.TargetHealth = Target->GetHealth();
+	View.TargetSpeedKph = GetTargetVelocity(Target);
+	View.TargetHeightAboveGround = GetHeightAboveGround(Target->GetActorLocation(), false);
+	View.TargetDistance = DistanceToTarget(Target);
+	View.bIsCurrentTarget = Target == AIState.CurrentTarget;
+	View.bTargetCarryingFlag = Target->CarriedObject != nullptr;
+	// see if they are coming directly towards or away from us. If the angle is small, disc is an easier shot
+	float TargetDistancePlusVelocity = DistanceBetweenTargets(ParentCharacter->GetActorLocation(), Target->GetActorLocation() + GetTargetVelocity(Target));
+	View.bTargetMovingRadially = FMath::Abs(TargetDistancePlusVelocity - View.TargetDistance) > 0.8 * Target->GetVelocity().Size();
+	return View;
 }
 //convert from engine units to KPH
 float UMABotAIComponent::GetTargetVelocity(AMACharacter* Target)
@@ -1228,73 +685,20 @@ bool UMABotAIComponent::AimAtTarget(bool FireWeapon)
 	}
 
 	//which weapon we want to use determines how
-	FString WeaponClassName = ParentCharacter->Weapon->GetName();
 	float ProjectileSpeed = 0.0f;
 	float Inheritance = 0.0f;
-	bool bIsChaingun = false;
-	//todo-emallon fetch these from the class itself
-	if (WeaponClassName.Contains("RingLauncher"))
-	{
-		ProjectileSpeed = 6500.0f;
-		Inheritance = 0.5f;
-	}
-
-	if (WeaponClassName.Contains("Chaingun"))
-	{
-		ProjectileSpeed = 52500.0f;
-		Inheritance = 1.0f;
-		bIsChaingun = true;
-	}
+	bool bIsChaingun = GetWeaponProjectileProperties(ProjectileSpeed, Inheritance);
 
 	bool bShouldFireWeapon = FireWeapon && BotConfig.bBotShoots;
 	//first check if we should be firing. Generally dont want to fire TOO much, particularly on lower difficulty bots, as it gets overpowering
 	float TimeSinceLastShot = ParentCharacter->GetWorld()->GetTimeSeconds() - TimeOfLastShot;
-	if (!bIsChaingun)
+	if (!bIsChaingun && TimeSinceLastShot < Tuning.DiscFireInterval)
 	{
-		switch (AccuracyLevel)
-		{
-		case(EBotAccuracyLevels::Horrible):
-			if (TimeSinceLastShot < 6.0f)
-			{
-				bShouldFireWeapon = false;
-			}
-			break;
-		case(EBotAccuracyLevels::Decent):
-			if (TimeSinceLastShot < 4.0f)
-			{
-				bShouldFireWeapon = false;
-			}
-			break;
-		case(EBotAccuracyLevels::Good):
-			if (TimeSinceLastShot < 2.0f)
-			{
-				bShouldFireWeapon = false;
-			}
-			break;
-		}
+		bShouldFireWeapon = false;
 	}
-	else {
-		switch (AccuracyLevel)
-		{
-		case(EBotAccuracyLevels::Horrible):
-			if (ParentCharacter->Weapon->Heat > 0.1f)
-			{
-				bShouldFireWeapon = false;
-			}
-			break;
-		case(EBotAccuracyLevels::Decent):
-			if (ParentCharacter->Weapon->Heat > 0.2f)
-			{
-				bShouldFireWeapon = false;
-			}
-			break;
-		case(EBotAccuracyLevels::Good):
-			if (ParentCharacter->Weapon->Heat > 0.4f)
-			{
-				bShouldFireWeapon = false;
-			}
-			break;
-		}
+	else if (bIsChaingun && ParentCharacter->Weapon->Heat > Tuning.ChaingunMaxHeat)
+	{
+		bShouldFireWeapon = false;
 	}
 	if (ParentCharacter->Weapon->CurrentState != EMAWeaponActivity::WEAP_Idle || ParentCharacter->Weapon->StateTimeElapsed < ParentCharacter->Weapon->ReloadTime)
 	{
@@ -1305,68 +709,7 @@ bool UMABotAIComponent::AimAtTarget(bool FireWeapon)
 	FVector VectorToTarget = TargetLoc - ThisPawnLoc;
 	FRotator Rot = UKismetMathLibrary::MakeRotFromXZ(VectorToTarget.GetSafeNormal(), ParentCharacter->GetActorUpVector());
 
-	//We don't want bots changing where they are aiming every tick, that makes them spaz out. CHoose how much they are off by every 1 seconds and stick to it.
-	if (ParentCharacter->GetWorld()->GetTimeSeconds() - TimeOfLastAimpointChange > 1.0f)
-	{
-		TimeOfLastAimpointChange = ParentCharacter->GetWorld()->GetTimeSeconds();
-		float AddPitch = FMath::RandRange(0, 1) == 0 ? 1 : -1;
-		float AddYaw = FMath::RandRange(0, 1) == 0 ? 1 : -1;
-		RandomPitchSkew = 0.0f;
-		RandomYawSkew = 0.0f;
-		RandomProjectilePropertiesSkew = 1.0f;
-		switch (AccuracyLevel)
-		{
-		case(EBotAccuracyLevels::Horrible):
-			//for terrible bots, always make them aim actively badly almost all the time
-			RandomProjectilePropertiesSkew = FMath::RandRange(0.5f, 1.5f);
-			if (FMath::RandRange(0, 5) != 0)
-			{
-				//here we take the correct aim and always add or subtract 15-30 degrees, meaning they can't possibly hit unless super close.
-				RandomPitchSkew += FMath::RandRange(15.0f, 30.0f) * AddPitch;
-				RandomYawSkew += FMath::RandRange(15.0f, 30.0f) * AddYaw;
-			}
-			else {
-				//here they still skew randomly, but if they get 0,0 (or small numbers) for skew, they can actually hit.
-				RandomPitchSkew += FMath::RandRange(-25.0f, 25.0f);
-				RandomYawSkew += FMath::RandRange(-15.0f, 15.0f);
-			}
-			break;
-		case(EBotAccuracyLevels::Decent):
-			//for decent bots, we have them be at least a little bad all the time, and more bad much of the time.
-			if (FMath::RandRange(0, 1) == 0)
-			{
-				RandomProjectilePropertiesSkew = FMath::RandRange(0.2f, 1.5f);
-			}
-			if (FMath::RandRange(0, 1) != 0)
-			{
-				RandomPitchSkew += FMath::RandRange(15.0f, 25.0f) * AddPitch;
-				RandomYawSkew += FMath::RandRange(15.0f, 25.0f) * AddYaw;
-			}
-			else {
-				RandomPitchSkew += FMath::RandRange(-20.0f, 20.0f);
-				RandomYawSkew += FMath::RandRange(-20.0f, 20.0f);
-			}
-
-			break;
-		case(EBotAccuracyLevels::Good):
-			//Good bots are off 50% of the time but by less, 25% of the time pretty close aim, and 12.5% perfectly accurate
-			if (FMath::RandRange(0, 1) == 0)
-			{
-				RandomProjectilePropertiesSkew = FMath::RandRange(0.5f, 1.5f);
-			}
-			if (FMath::RandRange(0, 1) == 0)
-			{
-				RandomPitchSkew += FMath::RandRange(15.0f, 35.0f) * AddPitch;
-				RandomYawSkew += FMath::RandRange(10.0, 30.0f) * AddYaw;
-			}
-			else if (FMath::RandRange(0, 1) == 0) {
-				RandomPitchSkew += FMath::RandRange(-15.0f, 15.0f);
-				RandomYawSkew += FMath::RandRange(-15.0f, 15.0f);
-			}
-			break;
-		}
-		//MAX/Perfect aim bot have no random pitch or yaw skew, so they aren't in this switch.
-	}
+	//how far off we aim is rerolled once a second by ChangeAimpoint
 	RandomYawSkew = FMath::Clamp(RandomYawSkew, -80.0f, 80.0f);
 	RandomPitchSkew = FMath::Clamp(RandomPitchSkew, -80.0f, 80.0f);
 
@@ -1399,29 +742,13 @@ bool UMABotAIComponent::AimAtTarget(bool FireWeapon)
 	AimRot.Yaw += RandomYawSkew;
 
 	//check if we can actually still see our target.
-	FHitResult HitResult;
-	GetWorld()->LineTraceSingleByObjectType(
-		OUT HitResult,
-		ParentCharacter->GetActorLocation(),
-		ThisPawnLoc + AimSpot,
-		FCollisionObjectQueryParams(ECollisionChannel::ECC_OverlapAll_Deprecated),
-		FCollisionQueryParams()
-	);
-	bool bCanSeeTarget = false;
-	float DistanceToTarget = DistanceBetweenTargets(ParentCharacter->GetActorLocation(), AimSpot);
-	float DistanceToIntersectPoint = DistanceBetweenTargets(ParentCharacter->GetActorLocation(), HitResult.Location);
-
-	if ((DistanceToIntersectPoint - 100.0f) > DistanceToTarget)
+	if (!IsAimSpotVisible(AimSpot))
 	{
-		bCanSeeTarget = false;
 		ParentCharacter->SetTrigger(0, false);
 		return false;
 	}
-	else {
-		bCanSeeTarget = true;
-	}
 
-	if (bShouldFireWeapon && bCanSeeTarget)
+	if (bShouldFireWeapon)
 	{
 		//we don't want to snap to target, but move more smoothly over there.
 		//should control based on delta T
@@ -1450,6 +777,60 @@ bool UMABotAIComponent::AimAtTarget(bool FireWeapon)
 	return true;
 }
 
+//Projectile speed and inheritance of the weapon we're holding, returns whether it's the chaingun.
+bool UMABotAIComponent::GetWeaponProjectileProperties(float& OutProjectileSpeed, float& OutInheritance) const
+{
+	FString WeaponClassName = ParentCharacter->Weapon->GetName();
+	OutProjectileSpeed = 0.0f;
+	OutInheritance = 0.0f;
+	//todo-emallon fetch these from the class itself
+	if (WeaponClassName.Contains("RingLauncher"))
+	{
+		OutProjectileSpeed = 6500.0f;
+		OutInheritance = 0.5f;
+	}
+
+	if (WeaponClassName.Contains("Chaingun"))
+	{
+		OutProjectileSpeed = 52500.0f;
+		OutInheritance = 1.0f;
+		return true;
+	}
+	return false;
+}
+
+//Traces towards where we would aim, true if nothing is in the way before the target.
+bool UMABotAIComponent::IsAimSpotVisible(const FVector& AimSpot)
+{
+	FHitResult HitResult;
+	FMAMetrics::Increment(EMACounter::BotTraces);
+	GetWorld()->LineTraceSingleByObjectType(
+		OUT HitResult,
+		ParentCharacter->GetActorLocation(),
+		ParentCharacter->GetActorLocation() + AimSpot,
+		FCollisionObjectQueryParams(ECollisionChannel::ECC_OverlapAll_Deprecated),
+		FCollisionQueryParams()
+	);
+	float DistanceToTarget = DistanceBetweenTargets(ParentCharacter->GetActorLocation(), AimSpot);
+	float DistanceToIntersectPoint = DistanceBetweenTargets(ParentCharacter->GetActorLocation(), HitResult.Location);
+	return (DistanceToIntersectPoint - 100.0f) <= DistanceToTarget;
+}
+
+//Same visibility check AimAtTarget makes, without turning us or touching the trigger. For the brain snapshot.
+bool UMABotAIComponent::CanSeeCurrentTarget()
+{
+	if (AIState.CurrentTarget == nullptr || ParentCharacter == nullptr || ParentCharacter->GetController() == nullptr
+		|| AIState.CurrentTarget->GetHealth() == 0 || ParentCharacter->Weapon == nullptr)
+	{
+		return false;
+	}
+	float ProjectileSpeed = 0.0f;
+	float Inheritance = 0.0f;
+	GetWeaponProjectileProperties(ProjectileSpeed, Inheritance);
+	FVector AimSpot = GetWeaponAimLocation(AIState.CurrentTarget, ProjectileSpeed, Inheritance);
+	return AimSpot != FVector::ForwardVector && IsAimSpotVisible(AimSpot);
+}
+
 
 void UMABotAIComponent::OnPawnSeen(APawn* SeenPawn)
 {
@@ -1458,6 +839,7 @@ void UMABotAIComponent::OnPawnSeen(APawn* SeenPawn)
 		return;
 	}
 
+	MA_LLM_SCOPE(BotPerception);
 	if (AMACharacter* SeenCharacter = Cast<AMACharacter>(SeenPawn))
 	{
 		if (SeenCharacter->GetTeamId() != ParentCharacter->GetTeamId() && !SeenCharacter->IsPendingKill())
@@ -1470,6 +852,10 @@ void UMABotAIComponent::OnPawnSeen(APawn* SeenPawn)
 
 void UMABotAIComponent::OnDied()
 {
+	if (bInAbstractCombat)
+	{
+		ExitAbstractCombat();
+	}
 	bIsJetting = false;
 	AIState.RouteState = EAIRouteState::NoRouteSelected;
 	AIState.CurrentTarget = nullptr;
@@ -1485,6 +871,48 @@ void UMABotAIComponent::OnSpawn()
 	AIState.RouteStartLocation = FVector::ZeroVector;
 }
 
+//Used by practice mode to reuse a live bot for a new drill instead of killing and respawning it. Wipes everything the bot had decided
+//so it behaves like it just spawned.
+void UMABotAIComponent::ResetForDrill()
+{
+	OnDied();
+	AIState = FAIState();
+	AIState.CurrentTask = EAIStates::LookingForEnemy;
+	AccuracyLevel = BotConfig.AccuracyLevel;
+	Tuning = UMABotTuningLibrary::GetTuning(AccuracyLevel);
+	TimeOfTaskStart = GetWorld()->GetTimeSeconds();
+	TimeOfLastShot = 0.0f;
+	SetParked(false);
+	OnSpawn();
+}
+
+//Parked bots stay in the world between practice drills, but hidden, frozen and not thinking.
+void UMABotAIComponent::SetParked(bool bParked)
+{
+	bIsParked = bParked;
+	if (bInAbstractCombat)
+	{
+		ExitAbstractCombat();
+	}
+	if (ParentCharacter == nullptr)
+	{
+		return;
+	}
+	ParentCharacter->SetTrigger(0, false);
+	ParentCharacter->StopJetting();
+	ParentCharacter->StopSkating();
+	ParentCharacter->SetActorHiddenInGame(bParked);
+	ParentCharacter->SetActorEnableCollision(!bParked);
+	if (bParked)
+	{
+		ParentCharacter->GetCharacterMovement()->StopMovementImmediately();
+		ParentCharacter->GetCharacterMovement()->DisableMovement();
+	}
+	else {
+		ParentCharacter->GetCharacterMovement()->SetMovementMode(MOVE_Falling);
+	}
+}
+
 void UMABotAIComponent::PossibleTargetDied(AMACharacter* Target)
 {
 	if(AIState.CurrentTarget == Target)
@@ -1676,6 +1104,17 @@ float UMABotAIComponent::GetHeightAboveGround(FVector Point, bool bDrawDebugLine
 {
 	UWorld* World = ParentCharacter->GetWorld() ;
 
+	//baked ground heights when the map has them, saves a trace. Debug draws still trace so they show what's really there.
+	if (!bDrawDebugLines)
+	{
+		const FMAAIMapData* AIMapData = FMAAIMapData::FindForWorld(World);
+		float GroundZ;
+		if (AIMapData != nullptr && AIMapData->GetGroundHeight(Point, GroundZ))
+		{
+			return Point.Z - GroundZ;
+		}
+	}
+
 	if (World)
 	{
 		FVector StartLocation{ Point.X, Point.Y, 10000 };    // Raytrace starting point.
@@ -1683,6 +1122,7 @@ float UMABotAIComponent::GetHeightAboveGround(FVector Point, bool bDrawDebugLine
 
 		// Raytrace for overlapping actors.
 		FHitResult HitResult;
+		FMAMetrics::Increment(EMACounter::BotTraces);
 		World->LineTraceSingleByObjectType(
 			OUT HitResult,
 			StartLocation,
@@ -0,0 +1,568 @@
+/**
+
+The bot's decision making, kept apart from the transports that carry it.
+BuildBrainSnapshot copies out everything the bot decides on, MABotBrain::Think turns a snapshot into a command frame without touching any
+UObjects, and ApplyBrainCommand carries the command out on the bot. DetermineCurrentTask runs all three in-process, the sidecar process
+(MABotBrainSidecarExample.cpp) and the shared think pool (MAMatchHostExample.cpp) run Think elsewhere and hand the command back.
+
+*/
+
+#include "MidairCE.h"
+#include "MABotBrain.h"
+#include "MABotAIComponent.h"
+#include "MABotTuning.h"
+#include "MARouteFollowerComponent.h"
+#include "Player/AIPlayerController.h"
+#include "Player/MACharacter.h"
+
+//Copies out everything DetermineCurrentTask decides on, so MABotBrain::Think can make the decision from this alone wherever it runs.
+void UMABotAIComponent::BuildBrainSnapshot(FMABotBrainSnapshot& Snapshot)
+{
+	float Now = GetWorld()->GetTimeSeconds();
+	AAIPlayerController* AIPC = Cast<AAIPlayerController>(ParentCharacter->GetController());
+	UMARouteFollowerComponent* RouteFollower = AIPC != nullptr ? AIPC->RouteFollower : nullptr;
+	RefreshFlagGameState();
+
+	//handle our target being dead so we can reset it.
+	if (AIState.CurrentTarget != nullptr && (!IsValid(AIState.CurrentTarget) || FMath::IsNearlyZero(AIState.CurrentTarget->GetHealth())))
+	{
+		AIState.CurrentTarget = nullptr;
+	}
+
+	Snapshot.BotId = ParentCharacter->GetUniqueID();
+	Snapshot.Sequence = ++BrainSnapshotSequence;
+	Snapshot.BotType = (uint8)BotConfig.BotType;
+	Snapshot.AccuracyLevel = (uint8)AccuracyLevel;
+	Snapshot.bHoldingFlag = ParentCharacter->CarriedObject != nullptr;
+	Snapshot.Location = ParentCharacter->GetActorLocation();
+	Snapshot.Velocity = ParentCharacter->GetVelocity();
+	Snapshot.Health = ParentCharacter->GetHealth();
+	Snapshot.Energy = ParentCharacter->GetEnergy();
+	Snapshot.LastTask = (uint8)AIState.CurrentTask;
+	Snapshot.LastMoveTargetType = (uint8)AIState.MoveTargetType;
+	Snapshot.TimeSinceTaskChange = Now - TimeOfTaskStart;
+	Snapshot.TimeSinceLastLookForEnemy = Now - TimeOfLastLookForEnemy;
+	Snapshot.TimeSinceMovementTargetChange = Now - TimeOfLastMovementTargetChange;
+	Snapshot.TimeSinceSpawn = Now - TimeOfLastSpawn;
+	Snapshot.FriendlyFlagLocation = GameState.FriendlyFlagLocation;
+	Snapshot.EnemyFlagLocation = GameState.EnemyFlagLocation;
+	Snapshot.FriendlyStandLocation = GameState.FriendlyStandLocation;
+	Snapshot.EnemyStandLocation = GameState.EnemyStandLocation;
+	Snapshot.bFriendlyFlagHome = GameState.bFriendlyFlagHome;
+	Snapshot.bFriendlyFlagHeld = GameState.bFriendlyFlagHeld;
+	Snapshot.bEnemyFlagHome = GameState.bEnemyFlagHome;
+	Snapshot.bEnemyFlagHeld = GameState.bEnemyFlagHeld;
+
+	//where we are on our route, if we are running one
+	Snapshot.RouteState = (uint8)AIState.RouteState;
+	Snapshot.RouteStartLocation = AIState.RouteStartLocation;
+	Snapshot.bFollowingRoute = RouteFollower != nullptr && RouteFollower->IsFollowingRoute();
+	Snapshot.RouteMarker = RouteFollower != nullptr ? FMath::Max(RouteFollower->GetCurrentMarkerIndex() - 1, 0) : 0;
+	Snapshot.RouteGrabMarker = RouteFollower != nullptr ? RouteFollower->GetGrabMarkerIndex() : INDEX_NONE;
+	Snapshot.RouteNumMarkers = RouteFollower != nullptr ? RouteFollower->GetNumMarkers() : 0;
+
+	Snapshot.bHasCurrentTarget = AIState.CurrentTarget != nullptr;
+	Snapshot.CurrentTargetId = AIState.CurrentTarget != nullptr ? AIState.CurrentTarget->GetUniqueID() : 0;
+	Snapshot.CurrentTargetLocation = AIState.CurrentTarget != nullptr ? AIState.CurrentTarget->GetActorLocation() : FVector::ZeroVector;
+	Snapshot.NumTargets = 0;
+	BrainSnapshotTargets.Reset();
+	for (auto Element : RecentlySeenTargets)
+	{
+		//prune any targets that might have died/left/whatever, or that we haven't seen in a while
+		AMACharacter* Target = Element.Key;
+		if (Snapshot.NumTargets >= UE_ARRAY_COUNT(Snapshot.Targets) || Target == nullptr || !IsValid(Target) || !Target->IsValidLowLevel()
+			|| !Target->GetDebugName(Target).Contains("BP_LightCharacter") || Now - Element.Value >= 5.0f || Target->GetMesh1P() == nullptr)
+		{
+			continue;
+		}
+		FMAEngagementView View = GetEngagementView(Target);
+		FMABotBrainTarget& BrainTarget = Snapshot.Targets[Snapshot.NumTargets++];
+		BrainTarget.TargetId = Target->GetUniqueID();
+		BrainTarget.Location = Target->GetActorLocation();
+		BrainTarget.Velocity = Target->GetVelocity();
+		BrainTarget.Health = View.TargetHealth;
+		BrainTarget.HeightAboveGround = View.TargetHeightAboveGround;
+		BrainTarget.bCarryingFlag = View.bTargetCarryingFlag;
+		BrainTarget.bMovingRadially = View.bTargetMovingRadially;
+		//the command refers to targets by id, so remember who was in this snapshot to turn the id back into a character
+		BrainSnapshotTargets.Add(Target);
+	}
+	//whether we could take the shot at who we are already on. Needs a trace, so it's answered here rather than by the brain.
+	//Only a query, taking the snapshot mustn't turn the bot or let go of the trigger.
+	Snapshot.bCanSeeCurrentTarget = Snapshot.NumTargets > 0 && CanSeeCurrentTarget();
+}
+
+//Carries out a decision from MABotBrain::Think, whether it was made in-process, by the sidecar or on the shared think pool.
+void UMABotAIComponent::ApplyBrainCommand(const FMABotCommandFrame& Command)
+{
+	//commands for a snapshot from before we died, or older than one we already applied, are useless
+	if (bIsDead || ParentCharacter == nullptr || Command.Sequence <= LastAppliedBrainSequence)
+	{
+		return;
+	}
+	LastAppliedBrainSequence = Command.Sequence;
+	float Now = GetWorld()->GetTimeSeconds();
+	AAIPlayerController* AIPC = Cast<AAIPlayerController>(ParentCharacter->GetController());
+
+	EAIStates LastTask = AIState.CurrentTask;
+	if (Command.bSuicide)
+	{
+		AIState.CurrentTask = EAIStates::LookingForEnemy;
+		if (AIPC != nullptr)
+		{
+			AIPC->Suicide();
+		}
+		OnDied();
+		return;
+	}
+
+	EAIMoveTargetTypes MoveTargetType = (EAIMoveTargetTypes)Command.MoveTargetType;
+	//heading for our route start doesn't count as a change, how long we have been trying to get there decides when we teleport
+	if (MoveTargetType != AIState.MoveTargetType && MoveTargetType != EAIMoveTargetTypes::RouteStart)
+	{
+		TimeOfLastMovementTargetChange = Now;
+	}
+	AIState.MoveTargetType = MoveTargetType;
+	AIState.DesiredMoveLocation = Command.DesiredMoveLocation;
+	AIState.bIsHoldingFlag = ParentCharacter->CarriedObject != nullptr;
+
+	if (Command.bStartRoute)
+	{
+		StartRouteFollow();
+	}
+	if (Command.bAbandonRoute && AIPC != nullptr)
+	{
+		AIPC->RouteFollower->StopRoute();
+	}
+	AIState.RouteState = (EAIRouteState)Command.RouteState;
+	if (Command.bReleaseTrigger)
+	{
+		ParentCharacter->SetTrigger(0, false);
+	}
+
+	//keep who we are on, or pick up who the brain chose out of the snapshot
+	if (Command.TargetId == 0)
+	{
+		AIState.CurrentTarget = nullptr;
+	}
+	else if (AIState.CurrentTarget == nullptr || AIState.CurrentTarget->GetUniqueID() != Command.TargetId)
+	{
+		AIState.CurrentTarget = nullptr;
+		for (const TWeakObjectPtr<AMACharacter>& Target : BrainSnapshotTargets)
+		{
+			if (Target.IsValid() && Target->GetUniqueID() == Command.TargetId)
+			{
+				AIState.CurrentTarget = Target.Get();
+				break;
+			}
+		}
+	}
+
+	AIState.CurrentTask = (EAIStates)Command.Task;
+	if (AIState.CurrentTask != LastTask)
+	{
+		TimeOfTaskStart = Now;
+		AIState.IsTaskInitialized = false;
+	}
+}
+
+//Figures out where we should move to -- a target player, one of the flags, our route start.
+static void ChooseMoveLocation(const FMABotBrainSnapshot& Snapshot, EAIFlagStates FlagState, float DistanceToFriendlyFlag, float DistanceToEnemyFlag,
+	EAIMoveTargetTypes& OutMoveTargetType, FVector& OutMoveLocation)
+{
+	EBotTypes BotType = (EBotTypes)Snapshot.BotType;
+	OutMoveTargetType = (EAIMoveTargetTypes)Snapshot.LastMoveTargetType;
+	OutMoveLocation = FVector::ZeroVector;
+	//if we need to start a route, then we just go ASAP to route start.
+	if (BotType == EBotTypes::Offense && (EAIRouteState)Snapshot.RouteState == EAIRouteState::MovingToRouteStart)
+	{
+		OutMoveTargetType = EAIMoveTargetTypes::RouteStart;
+		OutMoveLocation = Snapshot.RouteStartLocation;
+		return;
+	}
+
+	//If we have the flag we always try to cap.
+	if (Snapshot.bHoldingFlag)
+	{
+		OutMoveTargetType = EAIMoveTargetTypes::FriendlyStand;
+		OutMoveLocation = Snapshot.FriendlyStandLocation;
+	}
+	//If chase, we always care about our flag unless we are holding.
+	if (!Snapshot.bHoldingFlag && BotType == EBotTypes::Chase)
+	{
+		OutMoveTargetType = EAIMoveTargetTypes::FriendlyFlag;
+		OutMoveLocation = Snapshot.FriendlyFlagLocation;
+	}
+	//if we are on O, we care about returns in standoffs and otherwise the enemy flag.
+	if (!Snapshot.bHoldingFlag && (BotType == EBotTypes::Offense || BotType == EBotTypes::LO))
+	{
+		//if enemy flag is dropped and close, we go for that
+		if (!Snapshot.bEnemyFlagHome && !Snapshot.bEnemyFlagHeld && DistanceToEnemyFlag < 5000)
+		{
+			OutMoveTargetType = EAIMoveTargetTypes::EnemyFlag;
+			OutMoveLocation = Snapshot.EnemyFlagLocation;
+		}
+		//if friendly flag is dropped and close, we prioritize that next
+		else if (!Snapshot.bFriendlyFlagHeld && !Snapshot.bFriendlyFlagHome && DistanceToFriendlyFlag < 5000)
+		{
+			OutMoveTargetType = EAIMoveTargetTypes::FriendlyFlag;
+			OutMoveLocation = Snapshot.FriendlyFlagLocation;
+		}
+		else if (FlagState == EAIFlagStates::Standoff)
+		{
+			OutMoveTargetType = EAIMoveTargetTypes::FriendlyFlag;
+			OutMoveLocation = Snapshot.FriendlyFlagLocation;
+		}
+		else if (BotType == EBotTypes::Offense || FlagState == EAIFlagStates::EnemyFlagTakenFriendlySafe)
+		{
+			OutMoveTargetType = EAIMoveTargetTypes::EnemyFlag;
+			OutMoveLocation = Snapshot.EnemyFlagLocation;
+		}
+		else {
+			OutMoveTargetType = EAIMoveTargetTypes::EnemyStand;
+			OutMoveLocation = Snapshot.EnemyStandLocation;
+		}
+	}
+	//Stay at home cares about friendly flag before standoffs, and enemy during standoffs.
+	if (BotType == EBotTypes::StayAtHome)
+	{
+		//in general, SaH goes to their own stand
+		OutMoveTargetType = EAIMoveTargetTypes::FriendlyStand;
+		OutMoveLocation = Snapshot.FriendlyStandLocation;
+
+		//if you are in a standoff and the flag is close to you, try to pick it up
+		if (FlagState == EAIFlagStates::Standoff
+			|| (FlagState == EAIFlagStates::EnemyFlagTakenFriendlySafe && DistanceToEnemyFlag < 10000 && !Snapshot.bEnemyFlagHeld))
+		{
+			OutMoveTargetType = EAIMoveTargetTypes::EnemyFlag;
+			OutMoveLocation = Snapshot.EnemyFlagLocation;
+		}
+		//if friendly flag has been taken, and is close and we don't have their flag, chase.
+		else if (FlagState == EAIFlagStates::FriendlyTakenEnemyHome && DistanceToFriendlyFlag < 10000)
+		{
+			OutMoveTargetType = EAIMoveTargetTypes::FriendlyFlag;
+			OutMoveLocation = Snapshot.FriendlyFlagLocation;
+		}
+	}
+	//if we are relatively close to where we want to be and have a target, go for our target.
+	if (Snapshot.bHasCurrentTarget && FVector::Dist(Snapshot.Location, Snapshot.CurrentTargetLocation) < 20000
+		&& FVector::Dist(Snapshot.Location, OutMoveLocation) < 10000)
+	{
+		OutMoveTargetType = EAIMoveTargetTypes::EnemyTarget;
+		OutMoveLocation = Snapshot.CurrentTargetLocation;
+	}
+
+	//distance to flag where it being on the ground overrides everything else, differs per position
+	float FriendlyFlagOverrideDistance = 5000.0f;
+	float EnemyFlagOverrideDistance = 5000.0f;
+	if (BotType == EBotTypes::StayAtHome)
+	{
+		EnemyFlagOverrideDistance = 15000;
+		FriendlyFlagOverrideDistance = 10000;
+	}
+	if (BotType == EBotTypes::Chase)
+	{
+		FriendlyFlagOverrideDistance = 15000;
+	}
+	//if the flag is in the field, we can care about that most, usually.
+	if (DistanceToFriendlyFlag < FriendlyFlagOverrideDistance && !Snapshot.bFriendlyFlagHeld
+		&& (FlagState == EAIFlagStates::FriendlyTakenEnemyHome || FlagState == EAIFlagStates::Standoff))
+	{
+		OutMoveTargetType = EAIMoveTargetTypes::FriendlyFlag;
+		OutMoveLocation = Snapshot.FriendlyFlagLocation;
+	}
+	if (DistanceToEnemyFlag < EnemyFlagOverrideDistance && !Snapshot.bEnemyFlagHeld
+		&& (FlagState == EAIFlagStates::EnemyFlagTakenFriendlySafe || FlagState == EAIFlagStates::Standoff))
+	{
+		OutMoveTargetType = EAIMoveTargetTypes::EnemyFlag;
+		OutMoveLocation = Snapshot.EnemyFlagLocation;
+	}
+
+	//If we have the flag and can cap, we always try to cap.
+	if (Snapshot.bHoldingFlag && Snapshot.bFriendlyFlagHome)
+	{
+		OutMoveTargetType = EAIMoveTargetTypes::FriendlyStand;
+		OutMoveLocation = Snapshot.FriendlyStandLocation;
+	}
+}
+
+//Task weights in the order they were first added. Adding a task again replaces its weight, the same way the TMap DetermineCurrentTask
+//used to keep them in did, so ties still go to whichever task was weighted first.
+struct FMABotTaskWeights
+{
+	TArray<TPair<EAIStates, float>, TInlineAllocator<8>> Weights;
+
+	void Add(EAIStates Task, float Weight)
+	{
+		for (TPair<EAIStates, float>& Element : Weights)
+		{
+			if (Element.Key == Task)
+			{
+				Element.Value = Weight;
+				return;
+			}
+		}
+		Weights.Add(TPair<EAIStates, float>(Task, Weight));
+	}
+};
+
+//The bot's whole decision: what to do, where to go and who to be shooting at. Pure function of the snapshot, no UObjects, so it's safe to
+//run anywhere -- DetermineCurrentTask calls it directly, the sidecar process and the shared think pool call it on their own threads.
+void MABotBrain::Think(const FMABotBrainSnapshot& Snapshot, FMABotCommandFrame& OutCommand)
+{
+	Think(Snapshot, UMABotTuningLibrary::GetTuning((EBotAccuracyLevels)Snapshot.AccuracyLevel), OutCommand);
+}
+
+//Same, with the tuning looked up by the caller. The tuning table is a UObject, so anything thinking off the game thread has to use this one.
+//General approach is to give all possible tasks a weighting, increasing in likelihood they take that action based on the situation.
+//Weight added to various possible states is influenced by the bots assigned role. Highest weighted task option is chosen to be performed.
+void MABotBrain::Think(const FMABotBrainSnapshot& Snapshot, const FMABotTuningParams& Tuning, FMABotCommandFrame& OutCommand)
+{
+	EBotTypes BotType = (EBotTypes)Snapshot.BotType;
+	EAIStates LastTask = (EAIStates)Snapshot.LastTask;
+	EAIRouteState RouteState = (EAIRouteState)Snapshot.RouteState;
+	OutCommand.BotId = Snapshot.BotId;
+	OutCommand.Sequence = Snapshot.Sequence;
+	OutCommand.TargetId = Snapshot.CurrentTargetId;
+	OutCommand.bStartRoute = false;
+	OutCommand.bAbandonRoute = false;
+	OutCommand.bSuicide = false;
+	OutCommand.bReleaseTrigger = false;
+	//default to looking around if we have nothing else to do
+	OutCommand.Task = (uint8)EAIStates::LookingForEnemy;
+
+	EAIFlagStates FlagState = EAIFlagStates::Standoff;
+	if (Snapshot.bEnemyFlagHome && Snapshot.bFriendlyFlagHome)
+	{
+		FlagState = EAIFlagStates::BothFlagsHome;
+	}
+	else if (!Snapshot.bEnemyFlagHome && Snapshot.bFriendlyFlagHome)
+	{
+		FlagState = EAIFlagStates::EnemyFlagTakenFriendlySafe;
+	}
+	else if (Snapshot.bEnemyFlagHome && !Snapshot.bFriendlyFlagHome)
+	{
+		FlagState = EAIFlagStates::FriendlyTakenEnemyHome;
+	}
+	float DistanceToFriendlyFlag = FVector::Dist(Snapshot.Location, Snapshot.FriendlyFlagLocation);
+	float DistanceToEnemyFlag = FVector::Dist(Snapshot.Location, Snapshot.EnemyFlagLocation);
+
+	EAIMoveTargetTypes MoveTargetType;
+	FVector MoveLocation;
+	ChooseMoveLocation(Snapshot, FlagState, DistanceToFriendlyFlag, DistanceToEnemyFlag, MoveTargetType, MoveLocation);
+	OutCommand.MoveTargetType = (uint8)MoveTargetType;
+	OutCommand.DesiredMoveLocation = MoveLocation;
+
+	FMABotTaskWeights TaskWeights;
+	float DistanceToMoveLocation = FVector::Dist(Snapshot.Location, MoveLocation);
+	if (BotType == EBotTypes::Offense)
+	{
+		//If we are on O, try to move to our route start or if we are close enough, trigger the route follow to begin.
+		if (RouteState == EAIRouteState::MovingToRouteStart)
+		{
+			//if we can't quite get to our route start we just teleport there. If they get stuck for a while, increase our teleport distance so they don't do stupid things.
+			//we can improve this later when we have better movement code. todo-emallon
+			//3s = 3 * 3 * 10 = 90
+			//10s = 10 * 10 * 10 = 1000
+			//20s = 20 * 20 * 10 = 4000
+			//but cap it so we don't get super weird teleports
+			if (MoveTargetType == EAIMoveTargetTypes::RouteStart && DistanceToMoveLocation < Snapshot.TimeSinceMovementTargetChange * Snapshot.TimeSinceMovementTargetChange * 10 
+				&& DistanceToMoveLocation < 5000)
+			{
+				//starting the follow puts us on the first marker of the route
+				OutCommand.bStartRoute = true;
+				RouteState = EAIRouteState::RunningRoute;
+			}
+			else {
+				TaskWeights.Add(EAIStates::MoveToTarget, Tuning.RouteStartMoveWeight);
+			}
+		}
+		//while running a route, we only care about changing tasks if we have overshot the flag.
+		if (RouteState == EAIRouteState::RunningRoute)
+		{
+			bool bFollowingRoute = OutCommand.bStartRoute || Snapshot.bFollowingRoute;
+			int32 PriorMarkerNumber = OutCommand.bStartRoute ? 0 : Snapshot.RouteMarker;
+			//if we are past our grab time and don't have the flag, we aren't going to be grabbing, so stop our route to clear
+			//Or, if we are past the end of our route, abandon it.
+			if ((PriorMarkerNumber > Snapshot.RouteGrabMarker && !Snapshot.bHoldingFlag) || PriorMarkerNumber >= Snapshot.RouteNumMarkers - 2 || !bFollowingRoute)
+			{
+				RouteState = EAIRouteState::AbandonedRoute;
+				OutCommand.bAbandonRoute = true;
+			}
+			else {
+				TaskWeights.Add(EAIStates::RunningRoute, Tuning.RunningRouteWeight);
+			}
+		}
+		if (RouteState == EAIRouteState::RouteFinished)
+		{
+			if (MoveTargetType == EAIMoveTargetTypes::FriendlyStand && Snapshot.bHoldingFlag)
+			{
+				if (FlagState == EAIFlagStates::EnemyFlagTakenFriendlySafe)
+				{
+					//if we are trying to cap, that is always most important.
+					TaskWeights.Add(EAIStates::MoveToTarget, Tuning.CapMoveWeight);
+				}
+				else {
+					//otherwise stay close to the flag
+					TaskWeights.Add(EAIStates::MoveToTarget, FMath::Clamp((DistanceToMoveLocation - 500) / 100, Tuning.CarrierStayCloseMin, Tuning.CarrierStayCloseMax));
+				}
+			}
+			else {
+				//If the route is over and we don't have flag, just respawn.
+				OutCommand.bSuicide = true;
+				return;
+			}
+		}
+		if (RouteState == EAIRouteState::AbandonedRoute)
+		{
+			//if we have the flag, try to cap if home, or get close if it isn't.
+			if (Snapshot.bHoldingFlag && (DistanceToMoveLocation > 3000 || Snapshot.bFriendlyFlagHome))
+			{
+				TaskWeights.Add(EAIStates::MoveToTarget, Tuning.AbandonedRouteCarrierWeight);
+			}
+			//if we abandoned our route, and don't have the flag, and haven't spawned in a while, suicide and start running routes again.
+			else if (Snapshot.TimeSinceSpawn > 10 && !Snapshot.bHoldingFlag && Snapshot.bEnemyFlagHome)
+			{
+				OutCommand.bSuicide = true;
+				return;
+			}
+			else {
+				//otherwise default to at least going somewhere.
+				TaskWeights.Add(EAIStates::MoveToTarget, Tuning.AbandonedRouteMoveWeight);
+			}
+		}
+	}
+	OutCommand.RouteState = (uint8)RouteState;
+	if (BotType == EBotTypes::Chase)
+	{
+		if (MoveTargetType == EAIMoveTargetTypes::FriendlyFlag && !Snapshot.bFriendlyFlagHome)
+		{
+			//if we are close to a return, or we have no target, we care most about that. Otherwise going towards it is generally quite important.
+			TaskWeights.Add(EAIStates::MoveToTarget, DistanceToMoveLocation < 10000 || !Snapshot.bHasCurrentTarget ? Tuning.ChaseCloseReturnWeight : Tuning.ChaseFarReturnWeight);
+		}
+		else {
+			//if we are too far from our stand, and our flag is home, respawn to get closer again.
+			if (DistanceToMoveLocation > 20000 && Snapshot.bFriendlyFlagHome)
+			{
+				OutCommand.bSuicide = true;
+				return;
+			}
+			//always care at least a bit about the flag location, unless we are super close to ours already and dont need to return.
+			if (DistanceToMoveLocation > 500)
+			{
+				TaskWeights.Add(EAIStates::MoveToTarget, FMath::Clamp((DistanceToMoveLocation - 500) / 100, Tuning.ChaseMoveMin, Tuning.ChaseMoveMax));
+			}
+		}
+	}
+	if (BotType == EBotTypes::LO)
+	{
+		//as LO, we are a bit more biased towards killing anything we see
+		if (MoveTargetType != EAIMoveTargetTypes::EnemyStand || DistanceToMoveLocation > 400)
+		{
+			if (MoveTargetType == EAIMoveTargetTypes::FriendlyFlag && !Snapshot.bFriendlyFlagHeld && !Snapshot.bFriendlyFlagHome)
+			{
+				TaskWeights.Add(EAIStates::MoveToTarget, FMath::Clamp((DistanceToMoveLocation - 500) / 100, Tuning.LOFlagReturnMin, Tuning.LOFlagReturnMax));
+			}
+			else {
+				TaskWeights.Add(EAIStates::MoveToTarget, FMath::Clamp((DistanceToMoveLocation - 500) / 100, Tuning.LOMoveMin, Tuning.LOMoveMax));
+			}
+		}
+		else {
+			TaskWeights.Add(EAIStates::LookingForEnemy, Tuning.LOLookForEnemyWeight);
+		}
+	}
+	if (BotType == EBotTypes::StayAtHome)
+	{
+		//if enemy flag is in field, SaH generally wants to go pick it up, unless it is really far.
+		if (MoveTargetType == EAIMoveTargetTypes::EnemyFlag && !Snapshot.bEnemyFlagHeld && !Snapshot.bHoldingFlag)
+		{
+			TaskWeights.Add(EAIStates::MoveToTarget, FMath::Clamp((DistanceToMoveLocation - 50) / 100, Tuning.SaHEnemyFlagMin, Tuning.SaHEnemyFlagMax));
+		}
+		//if friendly flag is nearby for a return, also very important
+		else if (MoveTargetType == EAIMoveTargetTypes::FriendlyFlag && !Snapshot.bFriendlyFlagHome && !Snapshot.bFriendlyFlagHeld && !Snapshot.bHoldingFlag)
+		{
+			TaskWeights.Add(EAIStates::MoveToTarget, FMath::Clamp((DistanceToMoveLocation - 500) / 100, Tuning.SaHFriendlyFlagMin, Tuning.SaHFriendlyFlagMax));
+		}
+		else {
+			TaskWeights.Add(EAIStates::MoveToTarget, FMath::Clamp((DistanceToMoveLocation - 500) / 100, Tuning.SaHMoveMin, Tuning.SaHMoveMax));
+			TaskWeights.Add(EAIStates::LookingForEnemy, Tuning.SaHLookForEnemyWeight);
+		}
+	}
+
+	if (Snapshot.NumTargets == 0 && !Snapshot.bHasCurrentTarget)
+	{
+		//here, we have no good target, our desire to look for dudes grows every second
+		float LookForEnemyTaskWeight = Snapshot.TimeSinceLastLookForEnemy * Tuning.LookForEnemyWeightPerSecond;
+		//if we have already been looking recently, we don't need to KEEP looking. Don't start looking if we haven't been doing something for long
+		if ((LastTask != EAIStates::LookingForEnemy && Snapshot.TimeSinceTaskChange <= 2.0f) || (LastTask == EAIStates::LookingForEnemy && Snapshot.TimeSinceTaskChange > 2.0f))
+		{
+			LookForEnemyTaskWeight = Tuning.LookForEnemyRecentWeight;
+		}
+		TaskWeights.Add(EAIStates::LookingForEnemy, LookForEnemyTaskWeight);
+	}
+	else if (Snapshot.NumTargets > 0)
+	{
+		//fetch how desirable each target is, so we can find who best to shoot.
+		uint32 MostDesirableTargetId = Snapshot.CurrentTargetId;
+		float HighestFocusScore = 0.0f;
+		for (int32 TargetIndex = 0; TargetIndex < Snapshot.NumTargets; TargetIndex++)
+		{
+			const FMABotBrainTarget& Target = Snapshot.Targets[TargetIndex];
+			FMAEngagementView View;
+			View.TargetHealth = Target.Health;
+			View.TargetSpeedKph = Target.Velocity.Size() * 0.036f;
+			View.TargetHeightAboveGround = Target.HeightAboveGround;
+			View.TargetDistance = FVector::Dist(Snapshot.Location, Target.Location);
+			View.bIsCurrentTarget = Target.TargetId == Snapshot.CurrentTargetId;
+			View.bTargetCarryingFlag = Target.bCarryingFlag;
+			View.bTargetMovingRadially = Target.bMovingRadially;
+			float FocusScoreForTarget = FMABotCombatModel::GetTargetFocusScore(Tuning, View);
+			if (FocusScoreForTarget > HighestFocusScore)
+			{
+				HighestFocusScore = FocusScoreForTarget;
+				MostDesirableTargetId = Target.TargetId;
+			}
+		}
+		if (MostDesirableTargetId == Snapshot.CurrentTargetId)
+		{
+			if (Snapshot.bCanSeeCurrentTarget)
+			{
+				TaskWeights.Add(EAIStates::ShootAtTarget, HighestFocusScore);
+			}
+		}
+		else {
+			TaskWeights.Add(EAIStates::ChangeTarget, HighestFocusScore);
+			OutCommand.TargetId = MostDesirableTargetId;
+		}
+	}
+	else {
+		OutCommand.bReleaseTrigger = true;
+	}
+	//if we have the flag and the flag is home, nothing else matters over getting there.
+	if (Snapshot.bHoldingFlag && Snapshot.bFriendlyFlagHome)
+	{
+		TaskWeights.Add(EAIStates::MoveToTarget, Tuning.HoldingFlagCapWeight);
+	}
+
+	EAIStates Task = EAIStates::LookingForEnemy;
+	float MaxTaskWeight = 0.0f;
+	for (const TPair<EAIStates, float>& Element : TaskWeights.Weights)
+	{
+		if (Element.Value > MaxTaskWeight)
+		{
+			MaxTaskWeight = Element.Value;
+			Task = Element.Key;
+		}
+	}
+
+	//if we are moving to the stand but can't actually DO anything there, switch to look for targets/wander so we prevent the spinning in place issues
+	//if at the enemy stand and the flag isn't home, look for things to shoot.
+	//if at the friendly flag and we aren't holding the flag and the flag isn't home (aka we are capping), look for enemies to shoot.
+	if (Task == EAIStates::MoveToTarget && DistanceToMoveLocation < 300
+		&& ((MoveTargetType == EAIMoveTargetTypes::EnemyStand && !Snapshot.bEnemyFlagHome)
+			|| (MoveTargetType == EAIMoveTargetTypes::FriendlyStand && (!Snapshot.bHoldingFlag || !Snapshot.bFriendlyFlagHome))))
+	{
+		Task = EAIStates::LookingForEnemy;
+	}
+	OutCommand.Task = (uint8)Task;
+}
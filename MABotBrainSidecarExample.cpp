@@ -0,0 +1,308 @@
+/**
+
+Optional out-of-process bot brain.
+Normally DetermineCurrentTask runs on the game thread in the server process, so a bug in the AI takes the whole match down with it,
+and AI cost shows up as game thread time. With bots.BrainSidecar enabled, the server instead launches a sidecar process
+(the same executable running the MABotBrainSidecar commandlet) and talks to it through two lock-free single producer/single consumer
+rings in a named shared memory region. Bots publish a snapshot of what they know twice a second, the sidecar runs the same MABotBrain::Think
+the bot would have run in-process and sends back a command frame, and the bot's tick carries it out as usual (aiming and traces still happen in the server, they need the world).
+If the sidecar dies or stops answering, bots drop straight back to in-process DetermineCurrentTask while the host restarts it.
+
+*/
+
+#include "MidairCE.h"
+#include "MABotAIComponent.h"
+#include "MABotBrain.h"
+#include "MABotBrainSidecar.h"
+#include "HAL/PlatformProcess.h"
+
+static TAutoConsoleVariable<int32> CVarBotBrainSidecar(
+	TEXT("bots.BrainSidecar"),
+	0,
+	TEXT("Run bot decision making in a separate local process. 0 = in-process (default), 1 = sidecar with in-process fallback."),
+	ECVF_Default);
+
+static const uint32 BotBrainRegionMagic = 0x4D414242; //'MABB'
+static const uint32 BotBrainRegionVersion = 2;
+//if either side hasn't bumped its heartbeat in this long we consider it gone
+static const double BotBrainHeartbeatTimeout = 2.0;
+//bots fall back to thinking in-process if the sidecar hasn't answered their last snapshot in this long
+static const float BotBrainCommandTimeout = 1.5f;
+
+//Fixed size, lock-free ring that lives inside the shared memory region. One process only ever pushes, the other only ever pops.
+//Head/Tail are free running counters, slot is counter % Capacity, so full is Head - Tail == Capacity.
+template<typename T, uint32 Capacity>
+struct TMABotBrainRing
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+	//keep the producer and consumer counters on their own cache lines, they are written from different processes
+	alignas(64) volatile int32 Head;
+	alignas(64) volatile int32 Tail;
+	alignas(64) T Slots[Capacity];
+
+	void Init()
+	{
+		Head = 0;
+		Tail = 0;
+	}
+
+	bool Push(const T& Item)
+	{
+		int32 CurrentHead = Head;
+		int32 CurrentTail = FPlatformAtomics::AtomicRead(&Tail);
+		if ((uint32)(CurrentHead - CurrentTail) >= Capacity)
+		{
+			return false;
+		}
+		Slots[(uint32)CurrentHead & (Capacity - 1)] = Item;
+		//publishes the slot write before the consumer can see the new head
+		FPlatformAtomics::InterlockedExchange(&Head, CurrentHead + 1);
+		return true;
+	}
+
+	bool Pop(T& OutItem)
+	{
+		int32 CurrentTail = Tail;
+		int32 CurrentHead = FPlatformAtomics::AtomicRead(&Head);
+		if (CurrentTail == CurrentHead)
+		{
+			return false;
+		}
+		OutItem = Slots[(uint32)CurrentTail & (Capacity - 1)];
+		FPlatformAtomics::InterlockedExchange(&Tail, CurrentTail + 1);
+		return true;
+	}
+};
+
+//Everything in here has to be plain data, both processes map it at different addresses.
+struct FMABotBrainSharedRegion
+{
+	uint32 Magic;
+	uint32 Version;
+	volatile int32 HostHeartbeat;
+	volatile int32 SidecarHeartbeat;
+	TMABotBrainRing<FMABotBrainSnapshot, 256> Snapshots;
+	TMABotBrainRing<FMABotCommandFrame, 256> Commands;
+};
+
+FMABotBrainHost& FMABotBrainHost::Get()
+{
+	static FMABotBrainHost Host;
+	return Host;
+}
+
+bool FMABotBrainHost::IsAvailable() const
+{
+	return CVarBotBrainSidecar.GetValueOnGameThread() != 0 && Region != nullptr && bSidecarHealthy;
+}
+
+bool FMABotBrainHost::StartSidecar()
+{
+	if (SharedMemory == nullptr)
+	{
+		RegionName = FString::Printf(TEXT("MABotBrain_%u"), FPlatformProcess::GetCurrentProcessId());
+		SharedMemory = FPlatformMemory::MapNamedSharedMemoryRegion(RegionName, true,
+			FPlatformMemory::ESharedMemoryAccess::Read | FPlatformMemory::ESharedMemoryAccess::Write, sizeof(FMABotBrainSharedRegion));
+		if (SharedMemory == nullptr)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Bot brain sidecar: couldn't create shared memory region, staying in-process."));
+			return false;
+		}
+		Region = static_cast<FMABotBrainSharedRegion*>(SharedMemory->GetAddress());
+	}
+	//fresh rings every launch, anything left from a crashed sidecar is stale anyway
+	Region->Magic = BotBrainRegionMagic;
+	Region->Version = BotBrainRegionVersion;
+	Region->HostHeartbeat = 0;
+	Region->SidecarHeartbeat = 0;
+	Region->Snapshots.Init();
+	Region->Commands.Init();
+	//bots register again with their next snapshot
+	RegisteredBots.Reset();
+	//lets bots that gave up on the last sidecar try this one
+	SidecarLaunchCount++;
+
+	FString Params = FString::Printf(TEXT("\"%s\" -run=MABotBrainSidecar -BotBrainRegion=%s -unattended -nullrhi -nosound"),
+		*FPaths::GetProjectFilePath(), *RegionName);
+	SidecarProcess = FPlatformProcess::CreateProc(FPlatformProcess::ExecutablePath(), *Params, true, true, true, nullptr, 0, nullptr, nullptr);
+	LastSidecarHeartbeat = 0;
+	LastHeartbeatChangeTime = FPlatformTime::Seconds();
+	bSidecarHealthy = SidecarProcess.IsValid();
+	return bSidecarHealthy;
+}
+
+//Called once a frame from the game mode tick. Keeps the sidecar alive and hands any finished commands back to their bots.
+void FMABotBrainHost::Tick(float DeltaTime)
+{
+	if (CVarBotBrainSidecar.GetValueOnGameThread() == 0)
+	{
+		if (SidecarProcess.IsValid())
+		{
+			FPlatformProcess::TerminateProc(SidecarProcess);
+			FPlatformProcess::CloseProc(SidecarProcess);
+			bSidecarHealthy = false;
+			RegisteredBots.Reset();
+		}
+		return;
+	}
+	double Now = FPlatformTime::Seconds();
+	if (!SidecarProcess.IsValid())
+	{
+		//back off between restarts so a sidecar that crashes on launch doesn't eat the server
+		if (Now - LastRestartAttemptTime > RestartBackoffSeconds)
+		{
+			LastRestartAttemptTime = Now;
+			RestartBackoffSeconds = FMath::Min(RestartBackoffSeconds * 2.0f, 30.0f);
+			StartSidecar();
+		}
+		return;
+	}
+
+	FPlatformAtomics::InterlockedIncrement(&Region->HostHeartbeat);
+	int32 SidecarHeartbeat = FPlatformAtomics::AtomicRead(&Region->SidecarHeartbeat);
+	if (SidecarHeartbeat != LastSidecarHeartbeat)
+	{
+		LastSidecarHeartbeat = SidecarHeartbeat;
+		LastHeartbeatChangeTime = Now;
+		RestartBackoffSeconds = 1.0f;
+	}
+	if (!FPlatformProcess::IsProcRunning(SidecarProcess) || Now - LastHeartbeatChangeTime > BotBrainHeartbeatTimeout)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Bot brain sidecar stopped responding, bots are thinking in-process until it restarts."));
+		FPlatformProcess::TerminateProc(SidecarProcess);
+		FPlatformProcess::CloseProc(SidecarProcess);
+		bSidecarHealthy = false;
+		return;
+	}
+	bSidecarHealthy = true;
+
+	FMABotCommandFrame Command;
+	while (Region->Commands.Pop(Command))
+	{
+		TWeakObjectPtr<UMABotAIComponent>* Bot = RegisteredBots.Find(Command.BotId);
+		if (Bot != nullptr && Bot->IsValid())
+		{
+			(*Bot)->OnSidecarCommand(Command);
+		}
+		else if (Bot != nullptr)
+		{
+			RegisteredBots.Remove(Command.BotId);
+		}
+	}
+}
+
+bool FMABotBrainHost::SubmitSnapshot(UMABotAIComponent* Bot, const FMABotBrainSnapshot& Snapshot)
+{
+	if (!IsAvailable())
+	{
+		return false;
+	}
+	RegisteredBots.Add(Snapshot.BotId, Bot);
+	return Region->Snapshots.Push(Snapshot);
+}
+
+//Called when a bot goes away, so its id doesn't keep pointing at a dead component.
+void FMABotBrainHost::Unregister(UMABotAIComponent* Bot)
+{
+	for (auto It = RegisteredBots.CreateIterator(); It; ++It)
+	{
+		if (!It.Value().IsValid() || It.Value().Get() == Bot)
+		{
+			It.RemoveCurrent();
+		}
+	}
+}
+
+//Hands the snapshot to the sidecar. Returns false if we should just think in-process.
+bool UMABotAIComponent::SubmitBrainSnapshot(const FMABotBrainSnapshot& Snapshot)
+{
+	FMABotBrainHost& Host = FMABotBrainHost::Get();
+	float Now = GetWorld()->GetTimeSeconds();
+	//a restarted sidecar gets a fresh chance
+	if (SidecarLaunchSeen != Host.GetSidecarLaunchCount())
+	{
+		SidecarLaunchSeen = Host.GetSidecarLaunchCount();
+		bAwaitingSidecarCommand = false;
+	}
+	//the sidecar has gone quiet on us, think in-process so the bot doesn't stall. Don't queue this snapshot either, nobody would use the answer.
+	if (bAwaitingSidecarCommand && Now - TimeOfSidecarSubmit >= BotBrainCommandTimeout)
+	{
+		return false;
+	}
+	if (!Host.SubmitSnapshot(this, Snapshot))
+	{
+		return false;
+	}
+	//time from the oldest unanswered snapshot, so a steady stream of submits can't hide a sidecar that never replies
+	if (!bAwaitingSidecarCommand)
+	{
+		bAwaitingSidecarCommand = true;
+		TimeOfSidecarSubmit = Now;
+	}
+	return true;
+}
+
+//Only replies that actually came back from the sidecar count towards its timeout, in-process decisions go straight to ApplyBrainCommand.
+void UMABotAIComponent::OnSidecarCommand(const FMABotCommandFrame& Command)
+{
+	bAwaitingSidecarCommand = false;
+	ApplyBrainCommand(Command);
+}
+
+//Entry point for the sidecar process: UE4Editor-Cmd/MidairCEServer <project> -run=MABotBrainSidecar -BotBrainRegion=<name>
+int32 UMABotBrainSidecarCommandlet::Main(const FString& Params)
+{
+	FString RegionName;
+	if (!FParse::Value(*Params, TEXT("BotBrainRegion="), RegionName))
+	{
+		return 1;
+	}
+	FPlatformMemory::FSharedMemoryRegion* SharedMemory = FPlatformMemory::MapNamedSharedMemoryRegion(RegionName, false,
+		FPlatformMemory::ESharedMemoryAccess::Read | FPlatformMemory::ESharedMemoryAccess::Write, sizeof(FMABotBrainSharedRegion));
+	if (SharedMemory == nullptr)
+	{
+		return 1;
+	}
+	FMABotBrainSharedRegion* Region = static_cast<FMABotBrainSharedRegion*>(SharedMemory->GetAddress());
+	if (Region->Magic != BotBrainRegionMagic || Region->Version != BotBrainRegionVersion)
+	{
+		FPlatformMemory::UnmapNamedSharedMemoryRegion(SharedMemory);
+		return 1;
+	}
+
+	int32 LastHostHeartbeat = FPlatformAtomics::AtomicRead(&Region->HostHeartbeat);
+	double LastHostHeartbeatTime = FPlatformTime::Seconds();
+	FMABotBrainSnapshot Snapshot;
+	FMABotCommandFrame Command;
+	while (true)
+	{
+		FPlatformAtomics::InterlockedIncrement(&Region->SidecarHeartbeat);
+		bool bDidWork = false;
+		while (Region->Snapshots.Pop(Snapshot))
+		{
+			MABotBrain::Think(Snapshot, Command);
+			//if the host isn't draining commands, dropping is fine, the bot just falls back in-process
+			Region->Commands.Push(Command);
+			bDidWork = true;
+		}
+		//host went away (crashed or shut down), no one left to think for
+		double Now = FPlatformTime::Seconds();
+		int32 HostHeartbeat = FPlatformAtomics::AtomicRead(&Region->HostHeartbeat);
+		if (HostHeartbeat != LastHostHeartbeat)
+		{
+			LastHostHeartbeat = HostHeartbeat;
+			LastHostHeartbeatTime = Now;
+		}
+		else if (Now - LastHostHeartbeatTime > BotBrainHeartbeatTimeout * 5)
+		{
+			break;
+		}
+		if (!bDidWork)
+		{
+			FPlatformProcess::Sleep(0.001f);
+		}
+	}
+	FPlatformMemory::UnmapNamedSharedMemoryRegion(SharedMemory);
+	return 0;
+}
@@ -0,0 +1,216 @@
+/**
+
+Crowd separation for bot steering.
+MoveToTarget and MoveAround steer each bot on its own, so bots sharing a move target (both chasers on our flag, a StayAtHome and an
+LO on the stand) end up stacked on top of each other. Once per frame, the first bot to move rebuilds a spatial hash of every bot in the
+world and works out a steering term for all of them in one pass over their neighbours:
+- separation, pushing away from anyone inside bots.SeparationRadius, harder the closer they are
+- avoidance, sidestepping anyone we are about to pass through in the next second given both velocities, but never further ahead
+  than closing another separation radius, so everyone we could reach is inside the cells we look at
+Bots then add that on top of whatever movement they were going to do. Cells are twice the separation radius and each bot only ever
+looks at the 3x3 cells around it, so the whole pass is O(n) rather than every bot checking every other bot.
+
+*/
+
+#include "MidairCE.h"
+#include "MABotCrowd.h"
+#include "MABotAIComponent.h"
+#include "MAMetrics.h"
+#include "Player/MACharacter.h"
+
+static TAutoConsoleVariable<float> CVarBotSeparationRadius(
+	TEXT("bots.SeparationRadius"),
+	600.0f,
+	TEXT("Bots closer than this to each other steer apart. 0 turns crowd separation off."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarBotSeparationWeight(
+	TEXT("bots.SeparationWeight"),
+	1.0f,
+	TEXT("How strongly crowd separation and avoidance steer bots, 1 being a full strafe input."),
+	ECVF_Default);
+
+//how far ahead we look for bots we're about to run through, cut short for fast closers, see AvoidanceReach below
+static const float BotAvoidanceLookahead = 1.0f;
+
+static TMap<TWeakObjectPtr<UWorld>, TUniquePtr<FMABotCrowd>>& GetCrowds()
+{
+	static TMap<TWeakObjectPtr<UWorld>, TUniquePtr<FMABotCrowd>> Crowds;
+	return Crowds;
+}
+
+FMABotCrowd& FMABotCrowd::Get(UWorld* World)
+{
+	TMap<TWeakObjectPtr<UWorld>, TUniquePtr<FMABotCrowd>>& Crowds = GetCrowds();
+	for (auto It = Crowds.CreateIterator(); It; ++It)
+	{
+		if (!It.Key().IsValid())
+		{
+			It.RemoveCurrent();
+		}
+	}
+	TUniquePtr<FMABotCrowd>& Crowd = Crowds.FindOrAdd(World);
+	if (!Crowd.IsValid())
+	{
+		Crowd = MakeUnique<FMABotCrowd>();
+	}
+	return *Crowd;
+}
+
+void FMABotCrowd::Register(UMABotAIComponent* Bot)
+{
+	Bots.AddUnique(Bot);
+}
+
+//Cheap to call from every bot every frame, only the first call in a frame does any work.
+void FMABotCrowd::Update()
+{
+	if (LastUpdateFrame == GFrameCounter)
+	{
+		return;
+	}
+	LastUpdateFrame = GFrameCounter;
+
+	Bots.RemoveAll([](const TWeakObjectPtr<UMABotAIComponent>& Bot) { return !Bot.IsValid(); });
+	float Radius = CVarBotSeparationRadius.GetValueOnGameThread();
+	float Weight = CVarBotSeparationWeight.GetValueOnGameThread();
+
+	//snapshot everyone who is actually out there moving around
+	Active.Reset();
+	Positions.Reset();
+	Velocities.Reset();
+	for (const TWeakObjectPtr<UMABotAIComponent>& WeakBot : Bots)
+	{
+		UMABotAIComponent* Bot = WeakBot.Get();
+		Bot->CrowdSteering = FVector::ZeroVector;
+		if (Bot->ParentCharacter == nullptr || Bot->bIsDead || Bot->bIsParked)
+		{
+			continue;
+		}
+		Active.Add(Bot);
+		Positions.Add(Bot->ParentCharacter->GetActorLocation());
+		Velocities.Add(Bot->ParentCharacter->GetVelocity());
+	}
+	//one crowd per world, and a server can be running several matches, so the gauge is the total over all of them
+	int64 TotalActive = 0;
+	for (const TPair<TWeakObjectPtr<UWorld>, TUniquePtr<FMABotCrowd>>& Crowd : GetCrowds())
+	{
+		TotalActive += Crowd.Value->Active.Num();
+	}
+	FMAMetrics::SetGauge(EMAGauge::BotsActive, TotalActive);
+	if (Radius <= 0.0f || Active.Num() < 2)
+	{
+		return;
+	}
+
+	//avoidance only looks as far ahead as it takes to close this much more distance, so anyone it could act on starts within
+	//Radius + AvoidanceReach of us. Cells that size mean the 3x3 around us always holds everyone both checks can see.
+	float AvoidanceReach = Radius;
+	float CellSize = Radius + AvoidanceReach;
+
+	//counting sort of bots into hashed cells. Buckets can be shared by unrelated cells, which only costs a distance check,
+	//so there's no need for a map and nothing is allocated once the arrays have grown to the bot count.
+	int32 NumBuckets = FMath::RoundUpToPowerOfTwo(Active.Num() * 2);
+	uint32 BucketMask = NumBuckets - 1;
+	auto GetCell = [CellSize](const FVector& Position) { return FIntPoint(FMath::FloorToInt(Position.X / CellSize), FMath::FloorToInt(Position.Y / CellSize)); };
+	auto GetBucket = [BucketMask](const FIntPoint& Cell) { return HashCombine(GetTypeHash(Cell.X), GetTypeHash(Cell.Y)) & BucketMask; };
+	BucketStart.Reset();
+	BucketStart.AddZeroed(NumBuckets + 1);
+	BotBuckets.SetNumUninitialized(Active.Num());
+	for (int32 BotIndex = 0; BotIndex < Active.Num(); BotIndex++)
+	{
+		BotBuckets[BotIndex] = GetBucket(GetCell(Positions[BotIndex]));
+		BucketStart[BotBuckets[BotIndex] + 1]++;
+	}
+	for (int32 Bucket = 0; Bucket < NumBuckets; Bucket++)
+	{
+		BucketStart[Bucket + 1] += BucketStart[Bucket];
+	}
+	SortedBots.SetNumUninitialized(Active.Num());
+	BucketFill.Reset();
+	BucketFill.Append(BucketStart.GetData(), NumBuckets);
+	for (int32 BotIndex = 0; BotIndex < Active.Num(); BotIndex++)
+	{
+		SortedBots[BucketFill[BotBuckets[BotIndex]]++] = BotIndex;
+	}
+
+	float RadiusSquared = Radius * Radius;
+	for (int32 BotIndex = 0; BotIndex < Active.Num(); BotIndex++)
+	{
+		const FVector& Position = Positions[BotIndex];
+		FIntPoint Cell = GetCell(Position);
+		FVector Separation = FVector::ZeroVector;
+		FVector Avoidance = FVector::ZeroVector;
+		//neighbouring cells can hash to the same bucket, so only visit each bucket once
+		TArray<uint32, TInlineAllocator<9>> NeighbourBuckets;
+		for (int32 OffsetY = -1; OffsetY <= 1; OffsetY++)
+		{
+			for (int32 OffsetX = -1; OffsetX <= 1; OffsetX++)
+			{
+				NeighbourBuckets.AddUnique(GetBucket(Cell + FIntPoint(OffsetX, OffsetY)));
+			}
+		}
+		for (uint32 Bucket : NeighbourBuckets)
+		{
+			for (int32 Entry = BucketStart[Bucket]; Entry < BucketStart[Bucket + 1]; Entry++)
+			{
+				int32 OtherIndex = SortedBots[Entry];
+				FIntPoint OtherCell = GetCell(Positions[OtherIndex]);
+				//skip ourselves and anyone who only shares a bucket with our neighbourhood, not a cell
+				if (OtherIndex == BotIndex || FMath::Abs(OtherCell.X - Cell.X) > 1 || FMath::Abs(OtherCell.Y - Cell.Y) > 1)
+				{
+					continue;
+				}
+				//only horizontal, bots stacked vertically are usually one flying over the other which is fine
+				FVector Offset = Position - Positions[OtherIndex];
+				Offset.Z = 0.0f;
+				float DistSquared = Offset.SizeSquared();
+				if (DistSquared < RadiusSquared)
+				{
+					float Distance = FMath::Sqrt(DistSquared);
+					//two bots spawned on exactly the same spot still need to pick a way to go
+					FVector Away = Distance > KINDA_SMALL_NUMBER ? Offset / Distance : FVector(BotIndex < OtherIndex ? 1.0f : -1.0f, 0.0f, 0.0f);
+					Separation += Away * (1.0f - Distance / Radius);
+				}
+				//closest approach over the lookahead, given we both keep going the way we're going
+				FVector RelativeVelocity = Velocities[BotIndex] - Velocities[OtherIndex];
+				RelativeVelocity.Z = 0.0f;
+				float RelativeSpeedSquared = RelativeVelocity.SizeSquared();
+				if (RelativeSpeedSquared > KINDA_SMALL_NUMBER)
+				{
+					float Lookahead = FMath::Min(BotAvoidanceLookahead, AvoidanceReach / FMath::Sqrt(RelativeSpeedSquared));
+					float TimeToClosest = -FVector::DotProduct(Offset, RelativeVelocity) / RelativeSpeedSquared;
+					if (TimeToClosest > 0.0f && TimeToClosest < Lookahead)
+					{
+						FVector ClosestOffset = Offset + RelativeVelocity * TimeToClosest;
+						float ClosestDistSquared = ClosestOffset.SizeSquared();
+						if (ClosestDistSquared < RadiusSquared)
+						{
+							//sooner and closer matters more
+							float Urgency = (1.0f - TimeToClosest / Lookahead) * (1.0f - FMath::Sqrt(ClosestDistSquared) / Radius);
+							//head on, step to our right. The other bot sees the opposite relative velocity so it steps the other way.
+							FVector SidestepDirection = ClosestDistSquared > KINDA_SMALL_NUMBER ? ClosestOffset.GetSafeNormal()
+								: FVector(-RelativeVelocity.Y, RelativeVelocity.X, 0.0f).GetSafeNormal();
+							Avoidance += SidestepDirection * Urgency;
+						}
+					}
+				}
+			}
+		}
+		FVector Steering = (Separation + Avoidance) * Weight;
+		Active[BotIndex]->CrowdSteering = Steering.GetClampedToMaxSize(1.0f);
+	}
+}
+
+//Adds this frame's crowd steering to whatever movement input the bot has already decided on.
+void UMABotAIComponent::ApplyCrowdSteering()
+{
+	FMABotCrowd::Get(GetWorld()).Update();
+	if (CrowdSteering.IsNearlyZero())
+	{
+		return;
+	}
+	FRotator YawRotation(0.0f, ParentCharacter->GetActorRotation().Yaw, 0.0f);
+	ParentCharacter->MoveForward(FVector::DotProduct(CrowdSteering, FRotationMatrix(YawRotation).GetUnitAxis(EAxis::X)));
+	ParentCharacter->MoveRight(FVector::DotProduct(CrowdSteering, FRotationMatrix(YawRotation).GetUnitAxis(EAxis::Y)));
+}
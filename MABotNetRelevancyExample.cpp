@@ -0,0 +1,146 @@
+/**
+
+Adaptive replication for bot characters.
+Bots aim and move every tick and used to replicate exactly like a human player, at full rate to every client. On a server with a lot of
+bots most of that is wasted: a bot on the far side of the map, behind you, not shooting at you, doesn't need 30 updates a second with
+full precision aim.
+Two parts:
+- Per viewer, GetNetPriority scales a bot's priority by how much it matters to that connection (distance, whether it is in their view cone,
+  whether it's shooting at them), so saturated connections spend their bandwidth on the bots that matter to them.
+- Per bot, every half second the update rate and aim precision are picked from the closest/most interested human. A bot nobody is near
+  drops to a few updates a second, with byte rather than short rotation components.
+
+*/
+
+#include "MidairCE.h"
+#include "MABotAIComponent.h"
+#include "MAPracticeComponent.h"
+#include "Player/AIPlayerController.h"
+#include "Player/MACharacter.h"
+
+static TAutoConsoleVariable<float> CVarBotNetNearRange(
+	TEXT("bots.NetNearRange"),
+	5000.0f,
+	TEXT("Bots closer than this to a human replicate at the full rate with full precision aim."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarBotNetFarRange(
+	TEXT("bots.NetFarRange"),
+	30000.0f,
+	TEXT("Bots further than this from every human replicate at the minimum rate."),
+	ECVF_Default);
+
+//update rates for bots nobody is near, as a fraction of the normal rate, and a floor so they never stall completely
+static const float BotNetInViewFrequencyScale = 0.5f;
+static const float BotNetFarFrequency = 4.0f;
+static const float BotNetMinFrequency = 2.0f;
+//roughly a 60 degree view cone
+static const float BotNetViewConeDot = 0.5f;
+
+//Called by the replication driver once per connection. Bots are weighted by how much they matter to this particular viewer.
+float AMACharacter::GetNetPriority(const FVector& ViewPos, const FVector& ViewDir, AActor* Viewer, AActor* ViewTarget, UActorChannel* InChannel, float Time, bool bLowBandwidth)
+{
+	float Priority = Super::GetNetPriority(ViewPos, ViewDir, Viewer, ViewTarget, InChannel, Time, bLowBandwidth);
+	if (!Cast<AAIPlayerController>(GetController()))
+	{
+		return Priority;
+	}
+	UMABotAIComponent* BotAI = FindComponentByClass<UMABotAIComponent>();
+	return BotAI != nullptr ? Priority * BotAI->GetNetPriorityScaleFor(ViewPos, ViewDir, ViewTarget) : Priority;
+}
+
+//Watchers with the drill ghost feed on get their own drill bots as ghost frames from their practice component instead.
+bool AMACharacter::IsNetRelevantFor(const AActor* RealViewer, const AActor* ViewTarget, const FVector& SrcLocation) const
+{
+	const AAIPlayerController* AIPC = Cast<AAIPlayerController>(GetController());
+	if (AIPC != nullptr && UMAPracticeComponent::IsDrillGhostFor(RealViewer, AIPC))
+	{
+		return false;
+	}
+	return Super::IsNetRelevantFor(RealViewer, ViewTarget, SrcLocation);
+}
+
+//How much this bot matters to one viewer, 1 being a normal player.
+float UMABotAIComponent::GetNetPriorityScaleFor(const FVector& ViewPos, const FVector& ViewDir, const AActor* ViewTarget) const
+{
+	//whoever we are shooting at needs to see us turn and fire on time
+	if (ViewTarget != nullptr && ViewTarget == AIState.CurrentTarget)
+	{
+		return 1.5f;
+	}
+	FVector ToBot = ParentCharacter->GetActorLocation() - ViewPos;
+	float Distance = ToBot.Size();
+	float DistanceScale = FMath::GetMappedRangeValueClamped(FVector2D(CVarBotNetNearRange.GetValueOnGameThread(), CVarBotNetFarRange.GetValueOnGameThread()),
+		FVector2D(1.0f, 0.2f), Distance);
+	//behind the viewer is worth a lot less than in front of them
+	float ViewScale = FVector::DotProduct(ViewDir, ToBot / FMath::Max(Distance, 1.0f)) > BotNetViewConeDot ? 1.0f : 0.4f;
+	return DistanceScale * ViewScale;
+}
+
+//Timer, every half second on the server. Picks this bot's update rate and aim precision from the most interested human.
+void UMABotAIComponent::UpdateNetRelevancy()
+{
+	if (ParentCharacter == nullptr || !ParentCharacter->HasAuthority())
+	{
+		return;
+	}
+	//the rate the character was set up with is what a human gets, remember it the first time through
+	if (FullNetUpdateFrequency <= 0.0f)
+	{
+		FullNetUpdateFrequency = ParentCharacter->NetUpdateFrequency;
+	}
+
+	float NearRange = CVarBotNetNearRange.GetValueOnGameThread();
+	float FarRange = CVarBotNetFarRange.GetValueOnGameThread();
+	FVector BotLocation = ParentCharacter->GetActorLocation();
+	float NearestHumanDistance = MAX_flt;
+	bool bInViewOfHuman = false;
+	bool bTargetingHuman = false;
+	for (FConstPlayerControllerIterator Iterator = GetWorld()->GetPlayerControllerIterator(); Iterator; ++Iterator)
+	{
+		APlayerController* PC = Iterator->Get();
+		if (PC == nullptr || PC->IsA<AAIPlayerController>())
+		{
+			continue;
+		}
+		FVector ViewLocation;
+		FRotator ViewRotation;
+		PC->GetPlayerViewPoint(ViewLocation, ViewRotation);
+		FVector ToBot = BotLocation - ViewLocation;
+		float Distance = ToBot.Size();
+		NearestHumanDistance = FMath::Min(NearestHumanDistance, Distance);
+		if (Distance < FarRange && FVector::DotProduct(ViewRotation.Vector(), ToBot / FMath::Max(Distance, 1.0f)) > BotNetViewConeDot)
+		{
+			bInViewOfHuman = true;
+		}
+		if (AIState.CurrentTarget != nullptr && AIState.CurrentTarget == PC->GetPawn())
+		{
+			bTargetingHuman = true;
+		}
+	}
+
+	float Frequency = BotNetFarFrequency;
+	if (bTargetingHuman || NearestHumanDistance < NearRange)
+	{
+		Frequency = FullNetUpdateFrequency;
+	}
+	else if (bInViewOfHuman)
+	{
+		Frequency = FullNetUpdateFrequency * BotNetInViewFrequencyScale;
+	}
+	Frequency = FMath::Max(Frequency, BotNetMinFrequency);
+
+	//coming back into someone's interest should be seen straight away, not after the next slow update
+	bool bRaisedFrequency = Frequency > ParentCharacter->NetUpdateFrequency;
+	ParentCharacter->NetUpdateFrequency = Frequency;
+	ParentCharacter->MinNetUpdateFrequency = FMath::Min(BotNetMinFrequency, Frequency);
+
+	//byte rotation components are about 1.4 degrees, nobody can tell at range, and they're half the size
+	bool bFullPrecisionAim = bTargetingHuman || NearestHumanDistance < NearRange;
+	ParentCharacter->GetReplicatedMovement_Mutable().RotationQuantizationLevel = bFullPrecisionAim ? ERotatorQuantization::ShortComponents : ERotatorQuantization::ByteComponents;
+
+	if (bRaisedFrequency)
+	{
+		ParentCharacter->ForceNetUpdate();
+	}
+}
@@ -0,0 +1,592 @@
+/**
+
+Bot tuning parameters, and the offline harness that tunes them.
+All the weights and thresholds DetermineCurrentTask, GetTargetFocusScore, SelectBestWeapon and AimAtTarget use live in FMABotTuningParams,
+with one row per accuracy level in the DT_BotTuning data table. The built-in defaults are the hand tuned values the bots shipped with,
+so a missing table or row changes nothing.
+
+The harness (-run=MABotTuning) treats the combat parameters as a vector and runs an evolution strategy over them. Candidates are scored
+by running thousands of simulated 1v1 engagements in parallel across all cores against a reference bot, with the goal of hitting a
+target win rate per accuracy level (so Horrible stays beatable and Good stays a challenge). The winners are written out as a CSV that imports
+straight into the data table. The engagements use FMABotCombatModel, a cheap statistical stand-in for a real fight that shares the focus/weapon/aim
+code with the live bots, so it can't drift from what they actually do.
+
+*/
+
+#include "MidairCE.h"
+#include "MABotAIComponent.h"
+#include "MABotTuning.h"
+#include "Async/ParallelFor.h"
+#include "Engine/DataTable.h"
+
+FMABotTuningParams FMABotTuningParams::GetDefaults(EBotAccuracyLevels AccuracyLevel)
+{
+	FMABotTuningParams Params;
+	//DetermineCurrentTask weights, same for every accuracy level
+	Params.RouteStartMoveWeight = 70.0f;
+	Params.RunningRouteWeight = 170.0f;
+	Params.CapMoveWeight = 200.0f;
+	Params.CarrierStayCloseMin = 15.0f;
+	Params.CarrierStayCloseMax = 150.0f;
+	Params.AbandonedRouteCarrierWeight = 200.0f;
+	Params.AbandonedRouteMoveWeight = 20.0f;
+	Params.ChaseCloseReturnWeight = 200.0f;
+	Params.ChaseFarReturnWeight = 70.0f;
+	Params.ChaseMoveMin = 5.0f;
+	Params.ChaseMoveMax = 110.0f;
+	Params.LOFlagReturnMin = 10.0f;
+	Params.LOFlagReturnMax = 400.0f;
+	Params.LOMoveMin = 30.0f;
+	Params.LOMoveMax = 40.0f;
+	Params.LOLookForEnemyWeight = 10.0f;
+	Params.SaHEnemyFlagMin = 65.0f;
+	Params.SaHEnemyFlagMax = 150.0f;
+	Params.SaHFriendlyFlagMin = 20.0f;
+	Params.SaHFriendlyFlagMax = 100.0f;
+	Params.SaHMoveMin = 5.0f;
+	Params.SaHMoveMax = 110.0f;
+	Params.SaHLookForEnemyWeight = 6.0f;
+	Params.LookForEnemyWeightPerSecond = 5.0f;
+	Params.LookForEnemyRecentWeight = 3.0f;
+	Params.WaitForBetterShotWeight = 9.0f;
+	Params.HoldingFlagCapWeight = 9001.0f;
+	//GetTargetFocusScore
+	Params.FocusCurrentTargetBonus = 30.0f;
+	Params.FocusHealthDivisor = 10.0f;
+	Params.FocusSpeedDivisor = 5.0f;
+	Params.FocusLowTargetHeight = 200.0f;
+	Params.FocusLowTargetBonus = 30.0f;
+	Params.FocusDistanceMin = -100.0f;
+	Params.FocusDistanceMax = 40.0f;
+	Params.FocusCarrierBonus = 50.0f;
+	//SelectBestWeapon
+	Params.WeaponSwitchCooldown = 2.0f;
+	Params.LowHealthThreshold = 50.0f;
+	Params.LowHealthChaingunWeight = 30.0f;
+	Params.LowHealthDiscWeight = 5.0f;
+	Params.GroundedTargetHeight = 600.0f;
+	Params.GroundedDiscWeight = 30.0f;
+	Params.AirborneChaingunWeight = 10.0f;
+	Params.FastTargetSpeed = 160.0f;
+	Params.FastTargetChaingunWeight = 15.0f;
+	Params.FarTargetDistance = 10000.0f;
+	Params.FarTargetChaingunWeight = 20.0f;
+	Params.CloseTargetDistance = 3000.0f;
+	Params.CloseTargetDiscWeight = 20.0f;
+	Params.StraightLineDiscWeight = 15.0f;
+	Params.ChaingunHoldPenalty = 0.0f;
+	Params.ChaingunHoldPenaltyDelay = 0.0f;
+	//AimAtTarget. MAX/Perfect aim bots have no skew and no fire limits, everyone else overrides these below.
+	Params.DiscFireInterval = 0.0f;
+	Params.ChaingunMaxHeat = 1.0f;
+	Params.ProjectileSkewChance = 0.0f;
+	Params.ProjectileSkewMin = 1.0f;
+	Params.ProjectileSkewMax = 1.0f;
+	Params.LargeSkewChance = 0.0f;
+	Params.LargeSkewPitchMin = 0.0f;
+	Params.LargeSkewPitchMax = 0.0f;
+	Params.LargeSkewYawMin = 0.0f;
+	Params.LargeSkewYawMax = 0.0f;
+	Params.SmallSkewChance = 0.0f;
+	Params.SmallSkewPitch = 0.0f;
+	Params.SmallSkewYaw = 0.0f;
+
+	switch (AccuracyLevel)
+	{
+	case(EBotAccuracyLevels::Horrible):
+		Params.ChaingunHoldPenalty = 50.0f;
+		Params.ChaingunHoldPenaltyDelay = 2.0f;
+		Params.DiscFireInterval = 6.0f;
+		Params.ChaingunMaxHeat = 0.1f;
+		//for terrible bots, always make them aim actively badly almost all the time
+		Params.ProjectileSkewChance = 1.0f;
+		Params.ProjectileSkewMin = 0.5f;
+		Params.ProjectileSkewMax = 1.5f;
+		Params.LargeSkewChance = 5.0f / 6.0f;
+		Params.LargeSkewPitchMin = 15.0f;
+		Params.LargeSkewPitchMax = 30.0f;
+		Params.LargeSkewYawMin = 15.0f;
+		Params.LargeSkewYawMax = 30.0f;
+		Params.SmallSkewChance = 1.0f;
+		Params.SmallSkewPitch = 25.0f;
+		Params.SmallSkewYaw = 15.0f;
+		break;
+	case(EBotAccuracyLevels::Decent):
+		Params.ChaingunHoldPenalty = 20.0f;
+		Params.ChaingunHoldPenaltyDelay = 3.0f;
+		Params.DiscFireInterval = 4.0f;
+		Params.ChaingunMaxHeat = 0.2f;
+		//at least a little bad all the time, and more bad much of the time.
+		Params.ProjectileSkewChance = 0.5f;
+		Params.ProjectileSkewMin = 0.2f;
+		Params.ProjectileSkewMax = 1.5f;
+		Params.LargeSkewChance = 0.5f;
+		Params.LargeSkewPitchMin = 15.0f;
+		Params.LargeSkewPitchMax = 25.0f;
+		Params.LargeSkewYawMin = 15.0f;
+		Params.LargeSkewYawMax = 25.0f;
+		Params.SmallSkewChance = 1.0f;
+		Params.SmallSkewPitch = 20.0f;
+		Params.SmallSkewYaw = 20.0f;
+		break;
+	case(EBotAccuracyLevels::Good):
+		Params.DiscFireInterval = 2.0f;
+		Params.ChaingunMaxHeat = 0.4f;
+		//off 50% of the time but by less, 25% of the time pretty close aim, and 12.5% perfectly accurate
+		Params.ProjectileSkewChance = 0.5f;
+		Params.ProjectileSkewMin = 0.5f;
+		Params.ProjectileSkewMax = 1.5f;
+		Params.LargeSkewChance = 0.5f;
+		Params.LargeSkewPitchMin = 15.0f;
+		Params.LargeSkewPitchMax = 35.0f;
+		Params.LargeSkewYawMin = 10.0f;
+		Params.LargeSkewYawMax = 30.0f;
+		Params.SmallSkewChance = 0.5f;
+		Params.SmallSkewPitch = 15.0f;
+		Params.SmallSkewYaw = 15.0f;
+		break;
+	}
+	return Params;
+}
+
+//The full parameter vector, in data table column order. The harness only searches over the ones marked tunable, task weights depend on map flow
+//the engagement model doesn't simulate, and the focus bonuses only matter when choosing between several targets, which a 1v1 never does.
+//Those are carried through unchanged and can still be edited in the data table by hand.
+static const FMABotTuningParamDesc TuningParamDescs[] =
+{
+	{ TEXT("RouteStartMoveWeight"),			&FMABotTuningParams::RouteStartMoveWeight,			false,	0.0f,	0.0f },
+	{ TEXT("RunningRouteWeight"),			&FMABotTuningParams::RunningRouteWeight,			false,	0.0f,	0.0f },
+	{ TEXT("CapMoveWeight"),				&FMABotTuningParams::CapMoveWeight,					false,	0.0f,	0.0f },
+	{ TEXT("CarrierStayCloseMin"),			&FMABotTuningParams::CarrierStayCloseMin,			false,	0.0f,	0.0f },
+	{ TEXT("CarrierStayCloseMax"),			&FMABotTuningParams::CarrierStayCloseMax,			false,	0.0f,	0.0f },
+	{ TEXT("AbandonedRouteCarrierWeight"),	&FMABotTuningParams::AbandonedRouteCarrierWeight,	false,	0.0f,	0.0f },
+	{ TEXT("AbandonedRouteMoveWeight"),		&FMABotTuningParams::AbandonedRouteMoveWeight,		false,	0.0f,	0.0f },
+	{ TEXT("ChaseCloseReturnWeight"),		&FMABotTuningParams::ChaseCloseReturnWeight,		false,	0.0f,	0.0f },
+	{ TEXT("ChaseFarReturnWeight"),			&FMABotTuningParams::ChaseFarReturnWeight,			false,	0.0f,	0.0f },
+	{ TEXT("ChaseMoveMin"),					&FMABotTuningParams::ChaseMoveMin,					false,	0.0f,	0.0f },
+	{ TEXT("ChaseMoveMax"),					&FMABotTuningParams::ChaseMoveMax,					false,	0.0f,	0.0f },
+	{ TEXT("LOFlagReturnMin"),				&FMABotTuningParams::LOFlagReturnMin,				false,	0.0f,	0.0f },
+	{ TEXT("LOFlagReturnMax"),				&FMABotTuningParams::LOFlagReturnMax,				false,	0.0f,	0.0f },
+	{ TEXT("LOMoveMin"),					&FMABotTuningParams::LOMoveMin,						false,	0.0f,	0.0f },
+	{ TEXT("LOMoveMax"),					&FMABotTuningParams::LOMoveMax,						false,	0.0f,	0.0f },
+	{ TEXT("LOLookForEnemyWeight"),			&FMABotTuningParams::LOLookForEnemyWeight,			false,	0.0f,	0.0f },
+	{ TEXT("SaHEnemyFlagMin"),				&FMABotTuningParams::SaHEnemyFlagMin,				false,	0.0f,	0.0f },
+	{ TEXT("SaHEnemyFlagMax"),				&FMABotTuningParams::SaHEnemyFlagMax,				false,	0.0f,	0.0f },
+	{ TEXT("SaHFriendlyFlagMin"),			&FMABotTuningParams::SaHFriendlyFlagMin,			false,	0.0f,	0.0f },
+	{ TEXT("SaHFriendlyFlagMax"),			&FMABotTuningParams::SaHFriendlyFlagMax,			false,	0.0f,	0.0f },
+	{ TEXT("SaHMoveMin"),					&FMABotTuningParams::SaHMoveMin,					false,	0.0f,	0.0f },
+	{ TEXT("SaHMoveMax"),					&FMABotTuningParams::SaHMoveMax,					false,	0.0f,	0.0f },
+	{ TEXT("SaHLookForEnemyWeight"),		&FMABotTuningParams::SaHLookForEnemyWeight,			false,	0.0f,	0.0f },
+	{ TEXT("LookForEnemyWeightPerSecond"),	&FMABotTuningParams::LookForEnemyWeightPerSecond,	false,	0.0f,	0.0f },
+	{ TEXT("LookForEnemyRecentWeight"),		&FMABotTuningParams::LookForEnemyRecentWeight,		false,	0.0f,	0.0f },
+	{ TEXT("WaitForBetterShotWeight"),		&FMABotTuningParams::WaitForBetterShotWeight,		false,	0.0f,	0.0f },
+	{ TEXT("HoldingFlagCapWeight"),			&FMABotTuningParams::HoldingFlagCapWeight,			false,	0.0f,	0.0f },
+	{ TEXT("FocusCurrentTargetBonus"),		&FMABotTuningParams::FocusCurrentTargetBonus,		false,	0.0f,	0.0f },
+	{ TEXT("FocusHealthDivisor"),			&FMABotTuningParams::FocusHealthDivisor,			false,	0.0f,	0.0f },
+	{ TEXT("FocusSpeedDivisor"),			&FMABotTuningParams::FocusSpeedDivisor,				false,	0.0f,	0.0f },
+	{ TEXT("FocusLowTargetHeight"),			&FMABotTuningParams::FocusLowTargetHeight,			false,	0.0f,	0.0f },
+	{ TEXT("FocusLowTargetBonus"),			&FMABotTuningParams::FocusLowTargetBonus,			false,	0.0f,	0.0f },
+	{ TEXT("FocusDistanceMin"),				&FMABotTuningParams::FocusDistanceMin,				false,	0.0f,	0.0f },
+	{ TEXT("FocusDistanceMax"),				&FMABotTuningParams::FocusDistanceMax,				false,	0.0f,	0.0f },
+	{ TEXT("FocusCarrierBonus"),			&FMABotTuningParams::FocusCarrierBonus,				false,	0.0f,	0.0f },
+	{ TEXT("WeaponSwitchCooldown"),			&FMABotTuningParams::WeaponSwitchCooldown,			false,	0.0f,	0.0f },
+	{ TEXT("LowHealthThreshold"),			&FMABotTuningParams::LowHealthThreshold,			true,	10.0f,	90.0f },
+	{ TEXT("LowHealthChaingunWeight"),		&FMABotTuningParams::LowHealthChaingunWeight,		true,	0.0f,	60.0f },
+	{ TEXT("LowHealthDiscWeight"),			&FMABotTuningParams::LowHealthDiscWeight,			true,	0.0f,	60.0f },
+	{ TEXT("GroundedTargetHeight"),			&FMABotTuningParams::GroundedTargetHeight,			true,	100.0f,	2000.0f },
+	{ TEXT("GroundedDiscWeight"),			&FMABotTuningParams::GroundedDiscWeight,			true,	0.0f,	60.0f },
+	{ TEXT("AirborneChaingunWeight"),		&FMABotTuningParams::AirborneChaingunWeight,		true,	0.0f,	60.0f },
+	{ TEXT("FastTargetSpeed"),				&FMABotTuningParams::FastTargetSpeed,				true,	50.0f,	300.0f },
+	{ TEXT("FastTargetChaingunWeight"),		&FMABotTuningParams::FastTargetChaingunWeight,		true,	0.0f,	60.0f },
+	{ TEXT("FarTargetDistance"),			&FMABotTuningParams::FarTargetDistance,				true,	3000.0f,20000.0f },
+	{ TEXT("FarTargetChaingunWeight"),		&FMABotTuningParams::FarTargetChaingunWeight,		true,	0.0f,	60.0f },
+	{ TEXT("CloseTargetDistance"),			&FMABotTuningParams::CloseTargetDistance,			true,	500.0f,	8000.0f },
+	{ TEXT("CloseTargetDiscWeight"),		&FMABotTuningParams::CloseTargetDiscWeight,			true,	0.0f,	60.0f },
+	{ TEXT("StraightLineDiscWeight"),		&FMABotTuningParams::StraightLineDiscWeight,		true,	0.0f,	60.0f },
+	{ TEXT("ChaingunHoldPenalty"),			&FMABotTuningParams::ChaingunHoldPenalty,			true,	0.0f,	100.0f },
+	{ TEXT("ChaingunHoldPenaltyDelay"),		&FMABotTuningParams::ChaingunHoldPenaltyDelay,		true,	0.0f,	6.0f },
+	{ TEXT("DiscFireInterval"),				&FMABotTuningParams::DiscFireInterval,				true,	0.0f,	10.0f },
+	{ TEXT("ChaingunMaxHeat"),				&FMABotTuningParams::ChaingunMaxHeat,				true,	0.05f,	1.0f },
+	{ TEXT("ProjectileSkewChance"),			&FMABotTuningParams::ProjectileSkewChance,			true,	0.0f,	1.0f },
+	{ TEXT("ProjectileSkewMin"),			&FMABotTuningParams::ProjectileSkewMin,				true,	0.2f,	1.0f },
+	{ TEXT("ProjectileSkewMax"),			&FMABotTuningParams::ProjectileSkewMax,				true,	1.0f,	2.0f },
+	{ TEXT("LargeSkewChance"),				&FMABotTuningParams::LargeSkewChance,				true,	0.0f,	1.0f },
+	{ TEXT("LargeSkewPitchMin"),			&FMABotTuningParams::LargeSkewPitchMin,				true,	0.0f,	40.0f },
+	{ TEXT("LargeSkewPitchMax"),			&FMABotTuningParams::LargeSkewPitchMax,				true,	0.0f,	60.0f },
+	{ TEXT("LargeSkewYawMin"),				&FMABotTuningParams::LargeSkewYawMin,				true,	0.0f,	40.0f },
+	{ TEXT("LargeSkewYawMax"),				&FMABotTuningParams::LargeSkewYawMax,				true,	0.0f,	60.0f },
+	{ TEXT("SmallSkewChance"),				&FMABotTuningParams::SmallSkewChance,				true,	0.0f,	1.0f },
+	{ TEXT("SmallSkewPitch"),				&FMABotTuningParams::SmallSkewPitch,				true,	0.0f,	40.0f },
+	{ TEXT("SmallSkewYaw"),					&FMABotTuningParams::SmallSkewYaw,					true,	0.0f,	40.0f },
+};
+
+//Runtime lookup. Rows are named after the accuracy level (Horrible, Decent, Good, ...), anything missing falls back to the shipped defaults.
+FMABotTuningParams UMABotTuningLibrary::GetTuning(EBotAccuracyLevels AccuracyLevel)
+{
+	static TWeakObjectPtr<UDataTable> TuningTable;
+	//most installs don't have the table at all, so only go looking for it once rather than on every bot spawn
+	static bool bLookedForTuningTable = false;
+	if (!bLookedForTuningTable)
+	{
+		bLookedForTuningTable = true;
+		TuningTable = LoadObject<UDataTable>(nullptr, TEXT("/Game/AI/DT_BotTuning.DT_BotTuning"), nullptr, LOAD_NoWarn | LOAD_Quiet);
+		if (TuningTable.IsValid())
+		{
+			//keep it loaded, a table that got collected would send everyone back to the defaults
+			TuningTable->AddToRoot();
+		}
+	}
+	if (TuningTable.IsValid())
+	{
+		FName RowName(*StaticEnum<EBotAccuracyLevels>()->GetNameStringByValue((int64)AccuracyLevel));
+		if (FMABotTuningParams* Row = TuningTable->FindRow<FMABotTuningParams>(RowName, TEXT("Bot tuning"), false))
+		{
+			return *Row;
+		}
+	}
+	return FMABotTuningParams::GetDefaults(AccuracyLevel);
+}
+
+//determine how good a candidate the passed in target is to shoot at.
+float FMABotCombatModel::GetTargetFocusScore(const FMABotTuningParams& Params, const FMAEngagementView& View)
+{
+	float TargetFocusScore = 0.0f;
+	//we like to keep shooting what we are already shooting
+	if (View.bIsCurrentTarget)
+	{
+		TargetFocusScore += Params.FocusCurrentTargetBonus;
+	}
+	//low HP target -- how low their HP is, from 0 - 20
+	TargetFocusScore += (200.0f - View.TargetHealth) / Params.FocusHealthDivisor;
+	//slower targets -- kph 0 - 40 (can be negative too if they are faster than 200)
+	TargetFocusScore += (200.0f - View.TargetSpeedKph) / Params.FocusSpeedDivisor;
+	//close to ground
+	if (View.TargetHeightAboveGround < Params.FocusLowTargetHeight)
+	{
+		TargetFocusScore += Params.FocusLowTargetBonus;
+	}
+	//close targets
+	TargetFocusScore += FMath::Clamp((10000.0f - View.TargetDistance) / 100.0f, Params.FocusDistanceMin, Params.FocusDistanceMax);
+	//we really like shooting the carrier
+	if (View.bTargetCarryingFlag)
+	{
+		TargetFocusScore += Params.FocusCarrierBonus;
+	}
+	return TargetFocusScore;
+}
+
+//based on the health/location/velocity of our target, choose what to shoot them with. True for disc, false for chain.
+bool FMABotCombatModel::PrefersDisc(const FMABotTuningParams& Params, const FMAEngagementView& View, bool bHoldingChaingun, float TimeSinceLastWeaponChange, bool bNoDisc, bool bNoChaingun)
+{
+	float DiscWeight = 1.0f;
+	float ChaingunWeight = 0.0f;
+	if (View.TargetHealth < Params.LowHealthThreshold)
+	{
+		ChaingunWeight += Params.LowHealthChaingunWeight;
+		DiscWeight += Params.LowHealthDiscWeight;
+	}
+	//generally ground pound with disc, shoot flying targets with chain.
+	if (View.TargetHeightAboveGround < Params.GroundedTargetHeight)
+	{
+		DiscWeight += Params.GroundedDiscWeight;
+	}
+	else {
+		ChaingunWeight += Params.AirborneChaingunWeight;
+	}
+	//chain better against faster targets
+	if (View.TargetSpeedKph > Params.FastTargetSpeed)
+	{
+		ChaingunWeight += Params.FastTargetChaingunWeight;
+	}
+	//chain much than disc better against further targets
+	if (View.TargetDistance > Params.FarTargetDistance)
+	{
+		ChaingunWeight += Params.FarTargetChaingunWeight;
+	}
+	else if (View.TargetDistance < Params.CloseTargetDistance)
+	{
+		DiscWeight += Params.CloseTargetDiscWeight;
+	}
+	//coming directly towards or away from us is an easier disc shot
+	if (View.bTargetMovingRadially)
+	{
+		DiscWeight += Params.StraightLineDiscWeight;
+	}
+	//...but if the config says to not use the weapon, don't.
+	if (bNoChaingun)
+	{
+		ChaingunWeight = -100.0f;
+	}
+	if (bNoDisc)
+	{
+		DiscWeight = -100.0f;
+	}
+	//discourage bad bots from chaining a lot
+	if (bHoldingChaingun && TimeSinceLastWeaponChange > Params.ChaingunHoldPenaltyDelay)
+	{
+		ChaingunWeight -= Params.ChaingunHoldPenalty;
+	}
+	return DiscWeight > ChaingunWeight;
+}
+
+//Chooses how far off this bot's aim will be for the next second or so. Skew of 0,0 and projectile skew of 1 is a perfect shot.
+void FMABotCombatModel::RollAimSkew(const FMABotTuningParams& Params, FRandomStream& Random, float& OutPitchSkew, float& OutYawSkew, float& OutProjectileSkew)
+{
+	float AddPitch = Random.RandRange(0, 1) == 0 ? 1 : -1;
+	float AddYaw = Random.RandRange(0, 1) == 0 ? 1 : -1;
+	OutPitchSkew = 0.0f;
+	OutYawSkew = 0.0f;
+	OutProjectileSkew = 1.0f;
+	if (Random.FRand() < Params.ProjectileSkewChance)
+	{
+		OutProjectileSkew = Random.FRandRange(Params.ProjectileSkewMin, Params.ProjectileSkewMax);
+	}
+	if (Random.FRand() < Params.LargeSkewChance)
+	{
+		//take the correct aim and always add or subtract a chunk, meaning they can't possibly hit unless super close.
+		OutPitchSkew = Random.FRandRange(Params.LargeSkewPitchMin, Params.LargeSkewPitchMax) * AddPitch;
+		OutYawSkew = Random.FRandRange(Params.LargeSkewYawMin, Params.LargeSkewYawMax) * AddYaw;
+	}
+	else if (Random.FRand() < Params.SmallSkewChance)
+	{
+		//still skew randomly, but if they get small numbers for skew, they can actually hit.
+		OutPitchSkew = Random.FRandRange(-Params.SmallSkewPitch, Params.SmallSkewPitch);
+		OutYawSkew = Random.FRandRange(-Params.SmallSkewYaw, Params.SmallSkewYaw);
+	}
+}
+
+//Rough chance a single shot lands. Compares the angular error from aim skew, and the lead error from projectile skew, against how big the target
+//(or the disc splash) looks from where we are. Deliberately cheap, it's used for thousands of simulated fights a second and for unobserved bot fights.
+float FMABotCombatModel::EstimateHitChance(const FMABotTuningParams& Params, bool bDisc, const FMAEngagementView& View)
+{
+	float HitRadius = bDisc ? DiscSplashRadius : CharacterHitRadius;
+	float TargetAngle = FMath::RadiansToDegrees(FMath::Atan2(HitRadius, FMath::Max(View.TargetDistance, 1.0f)));
+
+	//large skew is at least the min on both axes, small skew is uniform in +-range
+	float LargeSkewHit = (TargetAngle > Params.LargeSkewPitchMin ? FMath::Min(1.0f, (TargetAngle - Params.LargeSkewPitchMin) / FMath::Max(Params.LargeSkewPitchMax - Params.LargeSkewPitchMin, 1.0f)) : 0.0f)
+		* (TargetAngle > Params.LargeSkewYawMin ? FMath::Min(1.0f, (TargetAngle - Params.LargeSkewYawMin) / FMath::Max(Params.LargeSkewYawMax - Params.LargeSkewYawMin, 1.0f)) : 0.0f);
+	float SmallSkewHit = FMath::Min(1.0f, TargetAngle / FMath::Max(Params.SmallSkewPitch, KINDA_SMALL_NUMBER))
+		* FMath::Min(1.0f, TargetAngle / FMath::Max(Params.SmallSkewYaw, KINDA_SMALL_NUMBER));
+	float AimHit = Params.LargeSkewChance * LargeSkewHit
+		+ (1.0f - Params.LargeSkewChance) * (Params.SmallSkewChance * SmallSkewHit + (1.0f - Params.SmallSkewChance));
+
+	//projectile skew makes us lead by the wrong amount, so we miss by |1 - skew| of the distance the target moves during the flight
+	float ProjectileSpeed = bDisc ? DiscProjectileSpeed : ChaingunProjectileSpeed;
+	float TargetTravel = View.TargetSpeedKph / 0.036f * View.TargetDistance / ProjectileSpeed;
+	float AllowedSkew = TargetTravel > KINDA_SMALL_NUMBER ? HitRadius / TargetTravel : 999.0f;
+	float SkewRange = FMath::Max(Params.ProjectileSkewMax - Params.ProjectileSkewMin, KINDA_SMALL_NUMBER);
+	float GoodSkewRange = FMath::Max(0.0f, FMath::Min(1.0f + AllowedSkew, Params.ProjectileSkewMax) - FMath::Max(1.0f - AllowedSkew, Params.ProjectileSkewMin));
+	float LeadHit = (1.0f - Params.ProjectileSkewChance) * FMath::Min(1.0f, AllowedSkew)
+		+ Params.ProjectileSkewChance * FMath::Min(1.0f, GoodSkewRange / SkewRange);
+	//a perfectly led shot at an airborne target with a disc still needs a direct hit
+	if (bDisc && View.TargetHeightAboveGround > DiscSplashRadius)
+	{
+		LeadHit *= CharacterHitRadius / DiscSplashRadius;
+	}
+	return FMath::Clamp(AimHit * LeadHit, 0.0f, 1.0f);
+}
+
+float FMABotCombatModel::EstimateDamagePerSecond(const FMABotTuningParams& Params, bool bDisc, const FMAEngagementView& View)
+{
+	float HitChance = EstimateHitChance(Params, bDisc, View);
+	if (bDisc)
+	{
+		return HitChance * DiscDamage / FMath::Max(Params.DiscFireInterval, DiscReloadTime);
+	}
+	//sustained chain fire is limited by how much heat the bot is willing to build up before letting go of the trigger
+	float ShotsPerSecond = FMath::Lerp(ChaingunSustainedShotsPerSecond, ChaingunShotsPerSecond, FMath::Clamp(Params.ChaingunMaxHeat, 0.0f, 1.0f));
+	return HitChance * ChaingunDamage * ShotsPerSecond;
+}
+
+//Rolls the individual shots one side gets off over Seconds from the expected rate, so lucky and unlucky streaks still happen.
+float FMABotCombatModel::RollDamage(const FMABotTuningParams& Params, bool bDisc, const FMAEngagementView& View, float Seconds, FRandomStream& Random)
+{
+	float HitChance = EstimateHitChance(Params, bDisc, View);
+	if (HitChance <= KINDA_SMALL_NUMBER)
+	{
+		return 0.0f;
+	}
+	float ShotDamage = bDisc ? DiscDamage : ChaingunDamage;
+	//the fractional part is a chance of one more shot, otherwise a disc every few seconds would never get fired in a half second step
+	float ExpectedShots = EstimateDamagePerSecond(Params, bDisc, View) * Seconds / (HitChance * ShotDamage);
+	int32 Shots = FMath::FloorToInt(ExpectedShots) + (Random.FRand() < FMath::Frac(ExpectedShots) ? 1 : 0);
+	float Damage = 0.0f;
+	for (int32 Shot = 0; Shot < Shots; Shot++)
+	{
+		if (Random.FRand() < HitChance)
+		{
+			Damage += ShotDamage;
+		}
+	}
+	return Damage;
+}
+
+//One simulated 1v1. Each half second (a DetermineCurrentTask tick) both sides pick a weapon the way the live bot would and trade damage.
+//Weapons are held between ticks and only switched off cooldown, like SelectBestWeapon, so the chaingun hold penalty plays its part.
+//Returns 1 if A wins, 0 if B wins, 0.5 for a timeout.
+float FMABotCombatModel::SimulateDuel(const FMABotTuningParams& ParamsA, const FMABotTuningParams& ParamsB, FRandomStream& Random)
+{
+	float Health[2] = { 100.0f, 100.0f };
+	//everyone spawns holding the disc
+	bool bHoldingChaingun[2] = { false, false };
+	float TimeOfLastWeaponChange[2] = { 0.0f, 0.0f };
+	float Distance = Random.FRandRange(1000.0f, 15000.0f);
+	const FMABotTuningParams* Params[2] = { &ParamsA, &ParamsB };
+	for (float Time = 0.0f; Time < 60.0f; Time += 0.5f)
+	{
+		//fights drift closer and further apart, people land and take off
+		Distance = FMath::Clamp(Distance + Random.FRandRange(-1500.0f, 1500.0f), 500.0f, 20000.0f);
+		float Damage[2] = { 0.0f, 0.0f };
+		for (int32 Side = 0; Side < 2; Side++)
+		{
+			FMAEngagementView View;
+			View.TargetHealth = Health[1 - Side];
+			View.TargetSpeedKph = Random.FRandRange(20.0f, 250.0f);
+			View.TargetHeightAboveGround = Random.FRand() < 0.5f ? Random.FRandRange(0.0f, 300.0f) : Random.FRandRange(300.0f, 3000.0f);
+			View.TargetDistance = Distance;
+			View.bIsCurrentTarget = true;
+			View.bTargetCarryingFlag = false;
+			View.bTargetMovingRadially = Random.FRand() < 0.3f;
+			float TimeSinceLastWeaponChange = Time - TimeOfLastWeaponChange[Side];
+			if (TimeSinceLastWeaponChange >= Params[Side]->WeaponSwitchCooldown)
+			{
+				bool bPrefersDisc = PrefersDisc(*Params[Side], View, bHoldingChaingun[Side], TimeSinceLastWeaponChange, false, false);
+				if (bPrefersDisc == bHoldingChaingun[Side])
+				{
+					bHoldingChaingun[Side] = !bPrefersDisc;
+					TimeOfLastWeaponChange[Side] = Time;
+				}
+			}
+			Damage[1 - Side] += RollDamage(*Params[Side], !bHoldingChaingun[Side], View, 0.5f, Random);
+		}
+		Health[0] -= Damage[0];
+		Health[1] -= Damage[1];
+		if (Health[0] <= 0.0f || Health[1] <= 0.0f)
+		{
+			if (Health[0] <= 0.0f && Health[1] <= 0.0f)
+			{
+				return 0.5f;
+			}
+			return Health[1] <= 0.0f ? 1.0f : 0.0f;
+		}
+	}
+	return 0.5f;
+}
+
+//-run=MABotTuning [-Generations=40] [-Population=32] [-Duels=2000] [-Seed=1] [-Out=path.csv]
+//Tunes each accuracy level towards its target win rate against the reference bot (the shipped Good tuning, standing in for an average pub player).
+int32 UMABotTuningCommandlet::Main(const FString& Params)
+{
+	int32 Generations = 40;
+	int32 PopulationSize = 32;
+	int32 DuelsPerCandidate = 2000;
+	int32 Seed = 1;
+	FString OutputPath = FPaths::ProjectSavedDir() / TEXT("BotTuning") / TEXT("BotTuning.csv");
+	FParse::Value(*Params, TEXT("Generations="), Generations);
+	FParse::Value(*Params, TEXT("Population="), PopulationSize);
+	FParse::Value(*Params, TEXT("Duels="), DuelsPerCandidate);
+	FParse::Value(*Params, TEXT("Seed="), Seed);
+	FParse::Value(*Params, TEXT("Out="), OutputPath);
+	//keep the best quarter each generation as parents
+	int32 NumParents = FMath::Max(2, PopulationSize / 4);
+
+	struct FLevelTarget
+	{
+		EBotAccuracyLevels Level;
+		float TargetWinRate;
+	};
+	const FLevelTarget LevelTargets[] =
+	{
+		{ EBotAccuracyLevels::Horrible, 0.15f },
+		{ EBotAccuracyLevels::Decent, 0.35f },
+		{ EBotAccuracyLevels::Good, 0.55f },
+	};
+	const FMABotTuningParams Reference = FMABotTuningParams::GetDefaults(EBotAccuracyLevels::Good);
+
+	FString CSV = TEXT("---");
+	for (const FMABotTuningParamDesc& Desc : TuningParamDescs)
+	{
+		CSV.Append(TEXT(",")).Append(Desc.Name);
+	}
+	CSV.Append(TEXT("\n"));
+
+	for (const FLevelTarget& LevelTarget : LevelTargets)
+	{
+		FMABotTuningParams Baseline = FMABotTuningParams::GetDefaults(LevelTarget.Level);
+		TArray<FMABotTuningParams> Population;
+		Population.Init(Baseline, PopulationSize);
+		TArray<float> Fitness;
+		Fitness.SetNumZeroed(PopulationSize);
+		TArray<float> WinRates;
+		WinRates.SetNumZeroed(PopulationSize);
+		float MutationScale = 0.15f;
+		FRandomStream MutationRandom(Seed);
+
+		for (int32 Generation = 0; Generation < Generations; Generation++)
+		{
+			//every candidate in a generation fights the same set of duels, so differences in score come from the parameters and not from luck
+			int32 GenerationSeed = Seed * 7919 + Generation;
+			ParallelFor(PopulationSize, [&](int32 CandidateIndex)
+			{
+				FRandomStream DuelRandom(GenerationSeed);
+				float Wins = 0.0f;
+				for (int32 Duel = 0; Duel < DuelsPerCandidate; Duel++)
+				{
+					Wins += FMABotCombatModel::SimulateDuel(Population[CandidateIndex], Reference, DuelRandom);
+				}
+				WinRates[CandidateIndex] = Wins / DuelsPerCandidate;
+				Fitness[CandidateIndex] = -FMath::Square(WinRates[CandidateIndex] - LevelTarget.TargetWinRate);
+			});
+
+			TArray<int32> Ranking;
+			for (int32 CandidateIndex = 0; CandidateIndex < PopulationSize; CandidateIndex++)
+			{
+				Ranking.Add(CandidateIndex);
+			}
+			Ranking.Sort([&Fitness](int32 A, int32 B) { return Fitness[A] > Fitness[B]; });
+			UE_LOG(LogTemp, Display, TEXT("%s gen %d: best win rate %.3f (target %.2f)"), *StaticEnum<EBotAccuracyLevels>()->GetNameStringByValue((int64)LevelTarget.Level),
+				Generation, WinRates[Ranking[0]], LevelTarget.TargetWinRate);
+
+			//next generation: keep the parents as they are, fill the rest with mutated copies of them
+			TArray<FMABotTuningParams> NextPopulation;
+			for (int32 ParentIndex = 0; ParentIndex < NumParents; ParentIndex++)
+			{
+				NextPopulation.Add(Population[Ranking[ParentIndex]]);
+			}
+			while (NextPopulation.Num() < PopulationSize)
+			{
+				FMABotTuningParams Child = NextPopulation[MutationRandom.RandRange(0, NumParents - 1)];
+				for (const FMABotTuningParamDesc& Desc : TuningParamDescs)
+				{
+					if (!Desc.bTunable)
+					{
+						continue;
+					}
+					float Range = Desc.MaxValue - Desc.MinValue;
+					float& Value = Child.*(Desc.Member);
+					Value = FMath::Clamp(Value + MutationRandom.GetFraction() * 2.0f * MutationScale * Range - MutationScale * Range, Desc.MinValue, Desc.MaxValue);
+				}
+				NextPopulation.Add(Child);
+			}
+			Population = MoveTemp(NextPopulation);
+			MutationScale *= 0.95f;
+		}
+
+		//parents are always carried over first, so index 0 is the best candidate from the last scored generation
+		const FMABotTuningParams& Best = Population[0];
+		CSV.Append(StaticEnum<EBotAccuracyLevels>()->GetNameStringByValue((int64)LevelTarget.Level));
+		for (const FMABotTuningParamDesc& Desc : TuningParamDescs)
+		{
+			CSV.Append(FString::Printf(TEXT(",%f"), Best.*(Desc.Member)));
+		}
+		CSV.Append(TEXT("\n"));
+	}
+
+	if (!FFileHelper::SaveStringToFile(CSV, *OutputPath))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Couldn't write bot tuning results to %s"), *OutputPath);
+		return 1;
+	}
+	UE_LOG(LogTemp, Display, TEXT("Wrote bot tuning to %s, reimport DT_BotTuning from it to use it in game."), *OutputPath);
+	return 0;
+}
@@ -0,0 +1,376 @@
+/**
+
+Chunked, compressed, resumable transfer of blobs between a client and the server, and its use for uploading freshly recorded routes.
+Route runners spawned via ServerSpawnBot run on the server, but routes are recorded on the client, and a long route does not fit in a single RPC.
+The sender compresses the payload once, splits it into small chunks and streams them over an unreliable RPC under a byte budget.
+The receiver answers with unreliable selective acks, so only lost chunks are resent, and an interrupted upload picks back up from the chunks already acked.
+Once every chunk is in, the receiver reassembles, decompresses and checks the CRC before anything trusts the data.
+
+*/
+
+#include "MidairCE.h"
+#include "MAPracticeComponent.h"
+#include "MAChunkedTransfer.h"
+#include "Misc/Compression.h"
+#include "Serialization/MemoryWriter.h"
+#include "Serialization/MemoryReader.h"
+
+//Unreliable bunches get split above roughly 1k, so stay under that with room for the RPC header.
+static const int32 TransferChunkSize = 960;
+//Number of chunks ahead of the first unacked chunk we allow in flight, matches the width of the ack bitfield.
+static const int32 TransferWindowSize = 32;
+//Resend a chunk if it hasn't been acked after this long. Generous relative to ping since acks are unreliable too.
+static const double TransferResendTime = 0.3;
+//Hard limits so a client can't make the server allocate whatever it likes.
+static const int32 MaxTransferUncompressedSize = 8 * 1024 * 1024;
+static const int32 MaxTransferChunks = 4096;
+//How many finished route uploads the server remembers so late chunks for them get re-acked instead of restarting them.
+static const int32 RememberedRouteUploads = 32;
+
+//Static. CRC of a route as uploaded, lets the server tell whether its copy is the one a client edited.
+uint32 UMAPracticeComponent::GetRouteTrailCrc(const FMARouteTrail& Route)
+{
+	TArray<uint8> RouteBytes;
+	FMemoryWriter Writer(RouteBytes);
+	FMARouteTrail::StaticStruct()->SerializeBin(Writer, const_cast<FMARouteTrail*>(&Route));
+	return FCrc::MemCrc32(RouteBytes.GetData(), RouteBytes.Num());
+}
+
+void FMAChunkedTransferSender::Begin(uint32 InTransferId, const TArray<uint8>& Payload)
+{
+	TransferId = InTransferId;
+	UncompressedSize = Payload.Num();
+	PayloadCrc = FCrc::MemCrc32(Payload.GetData(), Payload.Num());
+
+	int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Zlib, Payload.Num());
+	CompressedPayload.SetNumUninitialized(CompressedSize);
+	if (!FCompression::CompressMemory(NAME_Zlib, CompressedPayload.GetData(), CompressedSize, Payload.GetData(), Payload.Num()))
+	{
+		//incompressible data, just send it raw
+		CompressedPayload = Payload;
+		CompressedSize = Payload.Num();
+		bCompressed = false;
+	}
+	else {
+		bCompressed = true;
+	}
+	CompressedPayload.SetNum(CompressedSize);
+
+	NumChunks = FMath::Max(1, FMath::DivideAndRoundUp(CompressedSize, TransferChunkSize));
+	AckedChunks.Init(false, NumChunks);
+	LastSentTime.Init(-1.0, NumChunks);
+	NumAcked = 0;
+	FirstUnacked = 0;
+}
+
+void FMAChunkedTransferSender::GatherChunksToSend(double Now, int32 ByteBudget, TArray<FMATransferChunk>& OutChunks)
+{
+	int32 WindowEnd = FMath::Min(FirstUnacked + TransferWindowSize, NumChunks);
+	for (int32 ChunkIndex = FirstUnacked; ChunkIndex < WindowEnd && ByteBudget > 0; ChunkIndex++)
+	{
+		if (AckedChunks[ChunkIndex])
+		{
+			continue;
+		}
+		//never sent, or sent long enough ago that we assume it (or its ack) got lost
+		if (LastSentTime[ChunkIndex] >= 0.0 && Now - LastSentTime[ChunkIndex] < TransferResendTime)
+		{
+			continue;
+		}
+		int32 ChunkOffset = ChunkIndex * TransferChunkSize;
+		int32 ChunkBytes = FMath::Min(TransferChunkSize, CompressedPayload.Num() - ChunkOffset);
+
+		FMATransferChunk& Chunk = OutChunks.AddDefaulted_GetRef();
+		Chunk.TransferId = TransferId;
+		Chunk.ChunkIndex = ChunkIndex;
+		Chunk.NumChunks = NumChunks;
+		Chunk.UncompressedSize = UncompressedSize;
+		Chunk.PayloadCrc = PayloadCrc;
+		Chunk.bCompressed = bCompressed;
+		Chunk.Data.Append(CompressedPayload.GetData() + ChunkOffset, ChunkBytes);
+
+		LastSentTime[ChunkIndex] = Now;
+		ByteBudget -= ChunkBytes;
+	}
+}
+
+void FMAChunkedTransferSender::OnAck(int32 ContiguousAcked, uint32 AckBits)
+{
+	//everything below ContiguousAcked is in, and bit N of AckBits covers chunk ContiguousAcked + 1 + N.
+	ContiguousAcked = FMath::Min(ContiguousAcked, NumChunks);
+	for (int32 ChunkIndex = FirstUnacked; ChunkIndex < ContiguousAcked; ChunkIndex++)
+	{
+		if (!AckedChunks[ChunkIndex])
+		{
+			AckedChunks[ChunkIndex] = true;
+			NumAcked++;
+		}
+	}
+	for (int32 Bit = 0; Bit < 32; Bit++)
+	{
+		int32 ChunkIndex = ContiguousAcked + 1 + Bit;
+		if (ChunkIndex < NumChunks && (AckBits & (1u << Bit)) && !AckedChunks[ChunkIndex])
+		{
+			AckedChunks[ChunkIndex] = true;
+			NumAcked++;
+		}
+	}
+	while (FirstUnacked < NumChunks && AckedChunks[FirstUnacked])
+	{
+		FirstUnacked++;
+	}
+}
+
+bool FMAChunkedTransferReceiver::ReceiveChunk(const FMATransferChunk& Chunk)
+{
+	//first chunk sets up the transfer, every later chunk has to agree with it
+	if (NumChunks == 0)
+	{
+		if (Chunk.NumChunks <= 0 || Chunk.NumChunks > MaxTransferChunks
+			|| Chunk.UncompressedSize < 0 || Chunk.UncompressedSize > MaxTransferUncompressedSize)
+		{
+			bFailed = true;
+			return false;
+		}
+		TransferId = Chunk.TransferId;
+		NumChunks = Chunk.NumChunks;
+		UncompressedSize = Chunk.UncompressedSize;
+		PayloadCrc = Chunk.PayloadCrc;
+		bCompressed = Chunk.bCompressed;
+		ReceivedChunks.SetNum(NumChunks);
+		bHaveChunk.Init(false, NumChunks);
+	}
+	if (Chunk.TransferId != TransferId || Chunk.NumChunks != NumChunks || Chunk.PayloadCrc != PayloadCrc
+		|| Chunk.ChunkIndex < 0 || Chunk.ChunkIndex >= NumChunks || Chunk.Data.Num() > TransferChunkSize)
+	{
+		return false;
+	}
+	//duplicates are expected when an ack gets lost, just ack them again
+	if (!bHaveChunk[Chunk.ChunkIndex])
+	{
+		bHaveChunk[Chunk.ChunkIndex] = true;
+		ReceivedChunks[Chunk.ChunkIndex] = Chunk.Data;
+		NumReceived++;
+		while (ContiguousReceived < NumChunks && bHaveChunk[ContiguousReceived])
+		{
+			ContiguousReceived++;
+		}
+	}
+	return IsComplete();
+}
+
+void FMAChunkedTransferReceiver::GetAck(int32& OutContiguousAcked, uint32& OutAckBits) const
+{
+	OutContiguousAcked = ContiguousReceived;
+	OutAckBits = 0;
+	for (int32 Bit = 0; Bit < 32; Bit++)
+	{
+		int32 ChunkIndex = ContiguousReceived + 1 + Bit;
+		if (ChunkIndex < NumChunks && bHaveChunk[ChunkIndex])
+		{
+			OutAckBits |= (1u << Bit);
+		}
+	}
+}
+
+bool FMAChunkedTransferReceiver::Finish(TArray<uint8>& OutPayload)
+{
+	if (!IsComplete() || bFailed)
+	{
+		return false;
+	}
+	TArray<uint8> CompressedPayload;
+	for (const TArray<uint8>& ChunkData : ReceivedChunks)
+	{
+		CompressedPayload.Append(ChunkData);
+	}
+	ReceivedChunks.Empty();
+
+	if (bCompressed)
+	{
+		OutPayload.SetNumUninitialized(UncompressedSize);
+		if (!FCompression::UncompressMemory(NAME_Zlib, OutPayload.GetData(), UncompressedSize, CompressedPayload.GetData(), CompressedPayload.Num()))
+		{
+			bFailed = true;
+			return false;
+		}
+	}
+	else {
+		OutPayload = MoveTemp(CompressedPayload);
+	}
+	if (OutPayload.Num() != UncompressedSize || FCrc::MemCrc32(OutPayload.GetData(), OutPayload.Num()) != PayloadCrc)
+	{
+		bFailed = true;
+		return false;
+	}
+	return true;
+}
+
+//Client side. Kicks off streaming a route to the server, the server adds it to its route list once it arrives intact.
+//ReplacesRouteCrc is the CRC of the route this one is an edit of, 0 for a brand new route.
+void UMAPracticeComponent::UploadRouteToServer(const FMARouteTrail& Route, uint32 ReplacesRouteCrc)
+{
+	if (GetOwnerRole() == ROLE_Authority)
+	{
+		//listen server/standalone, the server already has it
+		return;
+	}
+	TArray<uint8> RouteBytes;
+	FMemoryWriter Writer(RouteBytes);
+	Writer << ReplacesRouteCrc;
+	FMARouteTrail::StaticStruct()->SerializeBin(Writer, const_cast<FMARouteTrail*>(&Route));
+
+	//transfer ids only need to be unique per player, the server keys uploads by them so a resumed upload reuses its id.
+	uint32 TransferId = ++LastRouteUploadId;
+	FMAChunkedTransferSender& Sender = PendingRouteUploads.Add(TransferId);
+	Sender.Begin(TransferId, RouteBytes);
+}
+
+//Client side, from TickComponent. Sends whatever the rate limit allows for this frame across all pending uploads.
+void UMAPracticeComponent::TickRouteUploads(float DeltaTime)
+{
+	if (PendingRouteUploads.Num() == 0)
+	{
+		return;
+	}
+	double Now = FPlatformTime::Seconds();
+	//carry unused budget over a little so low framerates don't starve the upload, but never let it build up into a burst.
+	RouteUploadByteBudget = FMath::Min(RouteUploadByteBudget + RouteUploadBytesPerSecond * DeltaTime, RouteUploadBytesPerSecond * 0.1f);
+
+	TArray<FMATransferChunk> ChunksToSend;
+	for (auto It = PendingRouteUploads.CreateIterator(); It; ++It)
+	{
+		if (It.Value().IsComplete())
+		{
+			It.RemoveCurrent();
+			continue;
+		}
+		ChunksToSend.Reset();
+		It.Value().GatherChunksToSend(Now, (int32)RouteUploadByteBudget, ChunksToSend);
+		for (const FMATransferChunk& Chunk : ChunksToSend)
+		{
+			RouteUploadByteBudget -= Chunk.Data.Num();
+			ServerRouteUploadChunk(Chunk);
+		}
+	}
+}
+
+bool UMAPracticeComponent::ServerRouteUploadChunk_Validate(const FMATransferChunk& Chunk)
+{
+	return Chunk.Data.Num() <= TransferChunkSize;
+}
+
+void UMAPracticeComponent::ServerRouteUploadChunk_Implementation(const FMATransferChunk& Chunk)
+{
+	if (!IsPracticeModeCommandEnabled())
+	{
+		return;
+	}
+	FMAChunkedTransferReceiver* Receiver = ReceivingRouteUploads.Find(Chunk.TransferId);
+	if (Receiver == nullptr)
+	{
+		//a late chunk for an upload we already finished, ack the whole thing again in case our earlier acks got lost
+		if (CompletedRouteUploadIds.Contains(Chunk.TransferId) || Chunk.TransferId <= LastForgottenRouteUploadId)
+		{
+			ClientRouteUploadAck(Chunk.TransferId, Chunk.NumChunks, 0);
+			return;
+		}
+		if (ReceivingRouteUploads.Num() >= 4)
+		{
+			return;
+		}
+		Receiver = &ReceivingRouteUploads.Add(Chunk.TransferId);
+	}
+	bool bComplete = Receiver->ReceiveChunk(Chunk);
+
+	int32 ContiguousAcked = 0;
+	uint32 AckBits = 0;
+	Receiver->GetAck(ContiguousAcked, AckBits);
+	ClientRouteUploadAck(Chunk.TransferId, ContiguousAcked, AckBits);
+
+	if (Receiver->HasFailed())
+	{
+		ReceivingRouteUploads.Remove(Chunk.TransferId);
+		ClientRouteUploadFinished(Chunk.TransferId, false);
+		return;
+	}
+	if (!bComplete)
+	{
+		return;
+	}
+
+	TArray<uint8> RouteBytes;
+	bool bValidRoute = Receiver->Finish(RouteBytes);
+	ReceivingRouteUploads.Remove(Chunk.TransferId);
+	//uploads can finish out of order, so remember each id rather than just the highest one
+	CompletedRouteUploadIds.Add(Chunk.TransferId);
+	if (CompletedRouteUploadIds.Num() > RememberedRouteUploads)
+	{
+		LastForgottenRouteUploadId = FMath::Max(LastForgottenRouteUploadId, CompletedRouteUploadIds[0]);
+		CompletedRouteUploadIds.RemoveAt(0);
+	}
+	if (bValidRoute)
+	{
+		uint32 ReplacesRouteCrc = 0;
+		FMARouteTrail UploadedRoute;
+		FMemoryReader Reader(RouteBytes);
+		Reader << ReplacesRouteCrc;
+		FMARouteTrail::StaticStruct()->SerializeBin(Reader, &UploadedRoute);
+		bValidRoute = !Reader.IsError() && UploadedRoute.MarkerLocations.Num() > 1;
+		if (bValidRoute)
+		{
+			TArray<FMARouteTrail>& RouteTrails = EditPracticeData().RouteTrails;
+			FString RouteName = UploadedRoute.Name;
+			int32 ExistingIndex = RouteTrails.IndexOfByPredicate([&UploadedRoute](const FMARouteTrail& Existing) { return Existing.Name.Equals(UploadedRoute.Name); });
+			uint32* UploadedById = RouteUploadIdsByName.Find(UploadedRoute.Name);
+			if (ExistingIndex == INDEX_NONE)
+			{
+				RouteTrails.Add(MoveTemp(UploadedRoute));
+			}
+			else if (UploadedById != nullptr)
+			{
+				//ours from an earlier upload, newer transfer wins so an older edit finishing late doesn't undo a newer one
+				if (Chunk.TransferId > *UploadedById)
+				{
+					RouteTrails[ExistingIndex] = MoveTemp(UploadedRoute);
+				}
+			}
+			else if (ReplacesRouteCrc != 0 && ReplacesRouteCrc == GetRouteTrailCrc(RouteTrails[ExistingIndex]))
+			{
+				//an edit of exactly the copy we have
+				RouteTrails[ExistingIndex] = MoveTemp(UploadedRoute);
+			}
+			else {
+				//a different route that happens to share the name, don't clobber it
+				UE_LOG(LogTemp, Warning, TEXT("Route upload rejected, a different route named %s already exists."), *RouteTrails[ExistingIndex].Name);
+				bValidRoute = false;
+			}
+			if (bValidRoute)
+			{
+				uint32& LastId = RouteUploadIdsByName.FindOrAdd(RouteName);
+				LastId = FMath::Max(LastId, Chunk.TransferId);
+			}
+		}
+	}
+	ClientRouteUploadFinished(Chunk.TransferId, bValidRoute);
+}
+
+void UMAPracticeComponent::ClientRouteUploadAck_Implementation(uint32 TransferId, int32 ContiguousAcked, uint32 AckBits)
+{
+	if (FMAChunkedTransferSender* Sender = PendingRouteUploads.Find(TransferId))
+	{
+		Sender->OnAck(ContiguousAcked, AckBits);
+	}
+}
+
+void UMAPracticeComponent::ClientRouteUploadFinished_Implementation(uint32 TransferId, bool bSuccess)
+{
+	PendingRouteUploads.Remove(TransferId);
+	if (!bSuccess)
+	{
+		if (AMAPlayerController* PC = Cast<AMAPlayerController>(ParentController))
+		{
+			PC->ClientSay_Implementation(nullptr, TEXT("Route upload to the server failed."), false);
+		}
+	}
+}
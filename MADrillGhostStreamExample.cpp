@@ -0,0 +1,463 @@
+/**
+
+Ghost feed for watcher mode drills.
+When a drill is demonstrated to a watcher (bIsDrillRunningAsWatcher) they only ever look at the bots, yet every bot was replicated to them
+as a full character: movement, weapons, vitals, the lot, at whatever rate net relevancy picked. With a few players watching on one
+server that adds up quickly.
+While the feed is on, the watcher's own drill bots aren't relevant to them at all (see AMACharacter::IsNetRelevantFor); match bots and
+other players' drill bots replicate as usual. Instead the server sends one small unreliable packet ten times a second, describing each drill bot:
+- route driven bots as route name crc + team + marker index, about 8 bytes. The watcher has the routes already (they started the drill
+  from their own practice data) so the client plays the route itself. If the watcher doesn't know a route it tells the server, and bots
+  on that route are sent like any other bot from then on
+- everything else as a quantized kinematic frame. Once a second it's a keyframe with full positions, in between positions are int16
+  deltas against that keyframe, so a lost packet never breaks the ones after it
+Only the bots of the drill being watched are sent, and not while they are parked between drills.
+The client spawns a local DrillGhostBlueprintClass actor per bot and interpolates it between the last two frames it got, following the
+route's own curve for route bots.
+
+*/
+
+#include "MidairCE.h"
+#include "MAPracticeComponent.h"
+#include "MABotAIComponent.h"
+#include "MAAITimingWheel.h"
+#include "MARouteFollowerComponent.h"
+#include "Player/AIPlayerController.h"
+#include "Player/MACharacter.h"
+#include "Player/MAPlayerState.h"
+#include "Serialization/MemoryWriter.h"
+#include "Serialization/MemoryReader.h"
+
+static const float GhostFrameInterval = 0.1f;
+static const int32 GhostFramesPerKeyframe = 10;
+//positions are sent in units of this many uu, deltas against the keyframe then cover +-65k uu
+static const float GhostPositionQuantum = 2.0f;
+static const float GhostVelocityQuantum = 4.0f;
+//how far past the last frame we keep moving a free bot on its velocity before we just hold it
+static const float GhostMaxExtrapolation = 0.2f;
+
+enum class EMAGhostKind : uint8
+{
+	Route,
+	//full position the following deltas are against
+	Keyframe,
+	Delta,
+	//full position outside a keyframe, nothing is sent against it
+	Position,
+};
+
+static FIntVector QuantizeGhostPosition(const FVector& Location)
+{
+	return FIntVector(FMath::RoundToInt(Location.X / GhostPositionQuantum), FMath::RoundToInt(Location.Y / GhostPositionQuantum), FMath::RoundToInt(Location.Z / GhostPositionQuantum));
+}
+
+static int16 QuantizeGhostVelocity(float Velocity)
+{
+	return (int16)FMath::Clamp(FMath::RoundToInt(Velocity / GhostVelocityQuantum), -32768, 32767);
+}
+
+//Watchers don't get their own drill bots replicated while their ghost feed is on.
+bool UMAPracticeComponent::IsDrillGhostFor(const AActor* Viewer, const AAIPlayerController* Bot)
+{
+	const APlayerController* ViewerPC = Cast<APlayerController>(Viewer);
+	const UMAPracticeComponent* ViewerPractice = ViewerPC != nullptr ? ViewerPC->FindComponentByClass<UMAPracticeComponent>() : nullptr;
+	return ViewerPractice != nullptr && ViewerPractice->IsDrillGhost(Bot);
+}
+
+//Only this player's own drill bots go out as ghosts, match bots and other players' drill bots replicate as usual.
+bool UMAPracticeComponent::IsDrillGhost(const AAIPlayerController* Bot) const
+{
+	return bDrillGhostFeedActive && Bot != nullptr
+		&& DrillBots.ContainsByPredicate([Bot](const TWeakObjectPtr<AAIPlayerController>& DrillBot) { return DrillBot.Get() == Bot; });
+}
+
+//What a route playing bot needs to send for a watcher to replay it themselves. False if the bot isn't following a route right now.
+bool UMABotAIComponent::GetGhostRoutePlayback(FString& OutRouteName, int32& OutMarkerIndex) const
+{
+	AAIPlayerController* AIPC = ParentCharacter != nullptr ? Cast<AAIPlayerController>(ParentCharacter->GetController()) : nullptr;
+	if (AIPC == nullptr || bInAbstractCombat || !AIPC->RouteFollower->IsFollowingRoute() || AIPC->RouteFollower->IsKnockedOffRoute())
+	{
+		return false;
+	}
+	OutRouteName = AIPC->RouteFollower->GetRoute()->Name;
+	OutMarkerIndex = AIPC->RouteFollower->GetCurrentMarkerIndex();
+	return true;
+}
+
+//Client side, when a drill starts or ends. Turning it off drops the ghosts, the real bots come back through normal replication.
+void UMAPracticeComponent::SetDrillGhostFeedEnabled(bool bEnabled)
+{
+	if (bEnabled == bDrillGhostFeedRequested)
+	{
+		return;
+	}
+	bDrillGhostFeedRequested = bEnabled;
+	if (!bEnabled)
+	{
+		ClearDrillGhosts();
+	}
+	ServerSetDrillGhostFeed(bEnabled);
+}
+
+void UMAPracticeComponent::ServerSetDrillGhostFeed_Implementation(bool bEnabled)
+{
+	bDrillGhostFeedActive = bEnabled;
+	FMAAITimingWheel& TimingWheel = FMAAITimingWheel::Get(GetWorld());
+	TimingWheel.Cancel(AITimer_DrillGhostFeed);
+	if (bEnabled)
+	{
+		GhostIds.Reset();
+		FreedGhostIds.Reset();
+		GhostUnknownRouteCrcs.Reset();
+		GhostFramesSinceKeyframe = GhostFramesPerKeyframe;
+		AITimer_DrillGhostFeed = TimingWheel.Schedule(this, GhostFrameInterval, [this]() { SendDrillGhostFrame(); }, GhostFrameInterval);
+	}
+}
+
+//The watcher has no route with this crc (renamed, or not in the practice data they started the drill with).
+void UMAPracticeComponent::ServerReportUnknownGhostRoute_Implementation(uint32 RouteCrc)
+{
+	GhostUnknownRouteCrcs.Add(RouteCrc);
+}
+
+//Lowest id that isn't in use and wasn't given up in the last keyframe's worth of frames. The watcher drops a ghost once it gets a frame
+//without it, so an id has to stay out of a few frames before it can mean a different bot. False if all of them are taken.
+bool UMAPracticeComponent::AllocateGhostId(uint8& OutGhostId)
+{
+	TSet<uint8> UsedIds;
+	for (const TPair<TWeakObjectPtr<AAIPlayerController>, uint8>& Entry : GhostIds)
+	{
+		UsedIds.Add(Entry.Value);
+	}
+	for (int32 Id = 0; Id < MAX_uint8; Id++)
+	{
+		const uint16* FreedAt = FreedGhostIds.Find((uint8)Id);
+		if (UsedIds.Contains((uint8)Id) || (FreedAt != nullptr && (uint16)(GhostFrameSequence - *FreedAt) < GhostFramesPerKeyframe))
+		{
+			continue;
+		}
+		FreedGhostIds.Remove((uint8)Id);
+		OutGhostId = (uint8)Id;
+		return true;
+	}
+	return false;
+}
+
+//Server, every GhostFrameInterval while a watcher's feed is on.
+void UMAPracticeComponent::SendDrillGhostFrame()
+{
+	bool bKeyframe = ++GhostFramesSinceKeyframe >= GhostFramesPerKeyframe;
+	if (bKeyframe)
+	{
+		GhostFramesSinceKeyframe = 0;
+		GhostKeyframeId++;
+		GhostKeyframePositions.Reset();
+	}
+	TArray<uint8> Frame;
+	FMemoryWriter Writer(Frame);
+	uint16 Sequence = ++GhostFrameSequence;
+	uint8 KeyframeId = GhostKeyframeId;
+	uint8 NumBots = 0;
+	Writer << Sequence;
+	Writer << KeyframeId;
+	int64 NumBotsOffset = Writer.Tell();
+	Writer << NumBots;
+
+	TSet<uint8> SentGhostIds;
+	for (const TWeakObjectPtr<AAIPlayerController>& DrillBot : DrillBots)
+	{
+		AAIPlayerController* AIPC = DrillBot.Get();
+		AMACharacter* BotCharacter = AIPC != nullptr ? Cast<AMACharacter>(AIPC->GetPawn()) : nullptr;
+		UMABotAIComponent* BotAI = BotCharacter != nullptr ? BotCharacter->FindComponentByClass<UMABotAIComponent>() : nullptr;
+		//parked bots are hidden and frozen until the next drill, there is nothing to watch
+		if (NumBots >= MAX_uint8 || BotAI == nullptr || AIPC->IsPendingKill() || BotCharacter->IsPendingKill() || FMath::IsNearlyZero(BotCharacter->GetHealth())
+			|| BotAI->bIsParked || BotCharacter->IsHidden())
+		{
+			continue;
+		}
+		//ids are stable for as long as the bot stays in the feed, so the client can keep the same ghost actor for a bot
+		uint8 GhostId;
+		if (uint8* ExistingId = GhostIds.Find(AIPC))
+		{
+			GhostId = *ExistingId;
+		}
+		else if (AllocateGhostId(GhostId))
+		{
+			GhostIds.Add(AIPC, GhostId);
+		}
+		else {
+			continue;
+		}
+		SentGhostIds.Add(GhostId);
+		Writer << GhostId;
+		NumBots++;
+
+		FString RouteName;
+		int32 MarkerIndex;
+		if (BotAI->GetGhostRoutePlayback(RouteName, MarkerIndex) && !GhostUnknownRouteCrcs.Contains(FCrc::StrCrc32(*RouteName)))
+		{
+			uint8 Kind = (uint8)EMAGhostKind::Route;
+			uint32 RouteCrc = FCrc::StrCrc32(*RouteName);
+			uint8 Team = BotCharacter->GetTeamId();
+			uint16 Marker = (uint16)FMath::Min(MarkerIndex, (int32)MAX_uint16);
+			Writer << Kind << RouteCrc << Team << Marker;
+			continue;
+		}
+
+		FIntVector Position = QuantizeGhostPosition(BotCharacter->GetActorLocation());
+		FVector Velocity = BotCharacter->GetVelocity();
+		int16 VelocityX = QuantizeGhostVelocity(Velocity.X);
+		int16 VelocityY = QuantizeGhostVelocity(Velocity.Y);
+		int16 VelocityZ = QuantizeGhostVelocity(Velocity.Z);
+		FRotator Rotation = AIPC->GetControlRotation();
+		FIntVector* KeyPosition = GhostKeyframePositions.Find(GhostId);
+		FIntVector Delta = KeyPosition != nullptr ? Position - *KeyPosition : FIntVector::ZeroValue;
+		bool bDeltaFits = KeyPosition != nullptr && FMath::Abs(Delta.X) <= MAX_int16 && FMath::Abs(Delta.Y) <= MAX_int16 && FMath::Abs(Delta.Z) <= MAX_int16;
+		if (bDeltaFits)
+		{
+			uint8 Kind = (uint8)EMAGhostKind::Delta;
+			int16 DeltaX = (int16)Delta.X;
+			int16 DeltaY = (int16)Delta.Y;
+			int16 DeltaZ = (int16)Delta.Z;
+			//a byte per axis is ~1.4 degrees, plenty for something you're watching from a distance
+			uint8 Yaw = FRotator::CompressAxisToByte(Rotation.Yaw);
+			uint8 Pitch = FRotator::CompressAxisToByte(Rotation.Pitch);
+			Writer << Kind << DeltaX << DeltaY << DeltaZ << Yaw << Pitch;
+		}
+		else {
+			//bots that join mid keyframe, or move further than a delta can cover, just send a full position
+			uint8 Kind = (uint8)(bKeyframe ? EMAGhostKind::Keyframe : EMAGhostKind::Position);
+			uint16 Yaw = FRotator::CompressAxisToShort(Rotation.Yaw);
+			uint16 Pitch = FRotator::CompressAxisToShort(Rotation.Pitch);
+			Writer << Kind << Position.X << Position.Y << Position.Z << Yaw << Pitch;
+			if (bKeyframe)
+			{
+				GhostKeyframePositions.Add(GhostId, Position);
+			}
+		}
+		Writer << VelocityX << VelocityY << VelocityZ;
+	}
+	//bots missing from this frame died, left or got parked, their ids go back in the pool
+	for (auto It = GhostIds.CreateIterator(); It; ++It)
+	{
+		if (!SentGhostIds.Contains(It.Value()))
+		{
+			FreedGhostIds.Add(It.Value(), Sequence);
+			GhostKeyframePositions.Remove(It.Value());
+			It.RemoveCurrent();
+		}
+	}
+	Writer.Seek(NumBotsOffset);
+	Writer << NumBots;
+	ClientReceiveDrillGhostFrame(Frame);
+}
+
+void UMAPracticeComponent::ClientReceiveDrillGhostFrame_Implementation(const TArray<uint8>& Frame)
+{
+	if (!bDrillGhostFeedRequested)
+	{
+		return;
+	}
+	FMemoryReader Reader(Frame);
+	uint16 Sequence;
+	uint8 KeyframeId;
+	uint8 NumBots;
+	Reader << Sequence << KeyframeId << NumBots;
+	//unreliable, so late packets can turn up after newer ones
+	if (Reader.IsError() || (bHasReceivedGhostFrame && (int16)(Sequence - LastGhostFrameSequence) <= 0))
+	{
+		return;
+	}
+	bHasReceivedGhostFrame = true;
+	LastGhostFrameSequence = Sequence;
+	if (KeyframeId != ReceivedGhostKeyframeId)
+	{
+		ReceivedGhostKeyframeId = KeyframeId;
+		ReceivedGhostKeyframePositions.Reset();
+	}
+
+	TSet<uint8> SeenGhosts;
+	for (int32 BotIndex = 0; BotIndex < NumBots && !Reader.IsError(); BotIndex++)
+	{
+		uint8 GhostId;
+		uint8 Kind;
+		Reader << GhostId << Kind;
+		FMADrillGhost& Ghost = DrillGhosts.FindOrAdd(GhostId);
+		SeenGhosts.Add(GhostId);
+		FMADrillGhostSample Sample;
+		bool bHasSample = true;
+		//set when this sample can't be interpolated to from the last one, the ghost jumps straight to it
+		bool bSnap = !Ghost.bHasNext;
+
+		if (Kind == (uint8)EMAGhostKind::Route)
+		{
+			uint32 RouteCrc;
+			uint8 Team;
+			uint16 Marker;
+			Reader << RouteCrc << Team << Marker;
+			if (RouteCrc != Ghost.RouteCrc || Team != Ghost.RouteTeam)
+			{
+				Ghost.RouteCrc = RouteCrc;
+				Ghost.RouteTeam = Team;
+				Ghost.Route = FMARouteTrail();
+				for (const FMARouteTrail& Route : GetPracticeData().RouteTrails)
+				{
+					if (FCrc::StrCrc32(*Route.Name) == RouteCrc)
+					{
+						Ghost.Route = GetRouteTrailByName(Route.Name, Team);
+						break;
+					}
+				}
+				//we don't have it, the server sends this route's bots as kinematic frames once it hears about it
+				if (Ghost.Route.MarkerLocations.Num() == 0 && !ReportedUnknownGhostRoutes.Contains(RouteCrc))
+				{
+					ReportedUnknownGhostRoutes.Add(RouteCrc);
+					ServerReportUnknownGhostRoute(RouteCrc);
+				}
+				//new route, don't interpolate from wherever we were before, and don't draw anything until we have a sample on it
+				Ghost.bHasNext = false;
+				bSnap = true;
+			}
+			Sample.RouteMarker = Marker;
+			bHasSample = Ghost.Route.MarkerLocations.Num() > 0;
+		}
+		else {
+			FIntVector Position;
+			if (Kind == (uint8)EMAGhostKind::Keyframe || Kind == (uint8)EMAGhostKind::Position)
+			{
+				uint16 Yaw;
+				uint16 Pitch;
+				Reader << Position.X << Position.Y << Position.Z << Yaw << Pitch;
+				Sample.Rotation = FRotator(FRotator::DecompressAxisFromShort(Pitch), FRotator::DecompressAxisFromShort(Yaw), 0.0f);
+				//only real keyframes are what the server sends deltas against
+				if (Kind == (uint8)EMAGhostKind::Keyframe)
+				{
+					ReceivedGhostKeyframePositions.Add(GhostId, Position);
+				}
+			}
+			else {
+				int16 DeltaX;
+				int16 DeltaY;
+				int16 DeltaZ;
+				uint8 Yaw;
+				uint8 Pitch;
+				Reader << DeltaX << DeltaY << DeltaZ << Yaw << Pitch;
+				Sample.Rotation = FRotator(FRotator::DecompressAxisFromByte(Pitch), FRotator::DecompressAxisFromByte(Yaw), 0.0f);
+				//missed the keyframe this is against, hold where we are until the next one
+				const FIntVector* KeyPosition = ReceivedGhostKeyframePositions.Find(GhostId);
+				bHasSample = KeyPosition != nullptr;
+				Position = bHasSample ? *KeyPosition + FIntVector(DeltaX, DeltaY, DeltaZ) : FIntVector::ZeroValue;
+			}
+			int16 VelocityX;
+			int16 VelocityY;
+			int16 VelocityZ;
+			Reader << VelocityX << VelocityY << VelocityZ;
+			Sample.Location = FVector(Position.X, Position.Y, Position.Z) * GhostPositionQuantum;
+			Sample.Velocity = FVector(VelocityX, VelocityY, VelocityZ) * GhostVelocityQuantum;
+			Sample.RouteMarker = -1.0f;
+			if (Ghost.RouteCrc != 0)
+			{
+				Ghost.RouteCrc = 0;
+				Ghost.Route = FMARouteTrail();
+				Ghost.bHasNext = false;
+				bSnap = true;
+			}
+		}
+		if (bHasSample)
+		{
+			Ghost.Previous = bSnap ? Sample : Ghost.Next;
+			Ghost.bHasPrevious = !bSnap;
+			Ghost.Next = Sample;
+			Ghost.bHasNext = true;
+			Ghost.InterpTime = 0.0f;
+		}
+	}
+
+	//bots that dropped out of the frame died or left
+	for (auto It = DrillGhosts.CreateIterator(); It; ++It)
+	{
+		if (!SeenGhosts.Contains(It.Key()))
+		{
+			if (AActor* GhostActor = It.Value().Actor.Get())
+			{
+				GhostActor->Destroy();
+			}
+			It.RemoveCurrent();
+		}
+	}
+}
+
+static void SampleGhostRoute(const FMARouteTrail& Route, float Marker, FVector& OutLocation, FRotator& OutRotation)
+{
+	int32 LastIndex = Route.MarkerLocations.Num() - 1;
+	float ClampedMarker = FMath::Clamp(Marker, 0.0f, (float)LastIndex);
+	int32 Index = FMath::FloorToInt(ClampedMarker);
+	int32 NextIndex = FMath::Min(Index + 1, LastIndex);
+	float Alpha = ClampedMarker - Index;
+	OutLocation = FMath::Lerp(Route.MarkerLocations[Index].Location, Route.MarkerLocations[NextIndex].Location, Alpha);
+	//shorter way round, a plain FRotator lerp spins the long way across +-180
+	const FRotator& From = Route.MarkerLocations[Index].Rotation;
+	OutRotation = (From + (Route.MarkerLocations[NextIndex].Rotation - From).GetNormalized() * Alpha).GetNormalized();
+}
+
+//Called from TickComponent on the watcher's client. Moves each ghost between the last two frames we got for it.
+void UMAPracticeComponent::TickDrillGhosts(float DeltaTime)
+{
+	if (DrillGhosts.Num() == 0 || DrillGhostBlueprintClass == nullptr)
+	{
+		return;
+	}
+	for (TPair<uint8, FMADrillGhost>& Entry : DrillGhosts)
+	{
+		FMADrillGhost& Ghost = Entry.Value;
+		if (!Ghost.bHasNext)
+		{
+			continue;
+		}
+		Ghost.InterpTime += DeltaTime;
+		float Alpha = Ghost.bHasPrevious ? FMath::Min(Ghost.InterpTime / GhostFrameInterval, 1.0f) : 1.0f;
+		FVector Location;
+		FRotator Rotation;
+		if (Ghost.Next.RouteMarker >= 0.0f)
+		{
+			//along the route itself rather than a straight line between the two markers we were told about
+			float Marker = FMath::Lerp(Ghost.Previous.RouteMarker, Ghost.Next.RouteMarker, Alpha);
+			SampleGhostRoute(Ghost.Route, Marker, Location, Rotation);
+		}
+		else {
+			Location = FMath::Lerp(Ghost.Previous.Location, Ghost.Next.Location, Alpha);
+			Rotation = (Ghost.Previous.Rotation + (Ghost.Next.Rotation - Ghost.Previous.Rotation).GetNormalized() * Alpha).GetNormalized();
+			//late frame, keep going the way the bot was going for a little while
+			float Overshoot = FMath::Clamp(Ghost.InterpTime - GhostFrameInterval, 0.0f, GhostMaxExtrapolation);
+			Location += Ghost.Next.Velocity * Overshoot;
+		}
+		Rotation.Roll = 0.0f;
+
+		AActor* GhostActor = Ghost.Actor.Get();
+		if (GhostActor == nullptr)
+		{
+			FActorSpawnParameters SpawnParams;
+			SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+			GhostActor = GetWorld()->SpawnActor<AActor>(DrillGhostBlueprintClass, Location, Rotation, SpawnParams);
+			Ghost.Actor = GhostActor;
+		}
+		else {
+			GhostActor->SetActorLocationAndRotation(Location, Rotation);
+		}
+	}
+}
+
+void UMAPracticeComponent::ClearDrillGhosts()
+{
+	for (TPair<uint8, FMADrillGhost>& Entry : DrillGhosts)
+	{
+		if (AActor* GhostActor = Entry.Value.Actor.Get())
+		{
+			GhostActor->Destroy();
+		}
+	}
+	DrillGhosts.Reset();
+	ReceivedGhostKeyframePositions.Reset();
+	ReportedUnknownGhostRoutes.Reset();
+	bHasReceivedGhostFrame = false;
+}
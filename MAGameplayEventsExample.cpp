@@ -0,0 +1,374 @@
+/**
+
+Gameplay event bus.
+Bots, practice mode and telemetry all want to know the same handful of gameplay facts, and each of them used to find out its own way:
+bots walked every flag actor on every think to see where the flags were, the game mode called PossibleTargetDied on every bot when
+someone died, and drill kill/midair counters were bumped directly from the damage code. Now whoever makes something happen posts a
+typed event, and whoever cares subscribes to that type:
+- FMAFlagEvent, a flag was picked up, dropped, returned or capped (AMACTFFlag)
+- FMADamagedEvent, FMAKilledEvent, FMAMidairHitEvent, a character took damage, died, or was hit in the air (AMACharacter::TakeDamage)
+- FMAProjectileFiredEvent, a weapon fired a projectile (AMAWeapon)
+- FMASpawnedEvent, a character spawned (game mode RestartPlayer)
+Posting never takes a lock. Each thread appends to its own single producer/single consumer queue per event type, and once a frame,
+as the first world starts ticking, the game thread drains every queue and hands each type's batch to its subscribers. Handlers are
+typed (TFunction<void(const FMAKilledEvent&)>), so a handler can't be given the wrong event, and events carry their world, so with
+several matches in the process subscribers only see their own. Types are delivered in the order of MA_GAMEPLAY_EVENT_TYPES, so a
+kill is always seen before the respawn that followed it. Anything posted from inside a handler goes out next frame.
+
+*/
+
+#include "MidairCE.h"
+#include "MAGameplayEvents.h"
+#include "MABotAIComponent.h"
+#include "MAPracticeComponent.h"
+#include "MAMetrics.h"
+#include "Player/AIPlayerController.h"
+#include "Player/MACharacter.h"
+#include "Game/CTF/MACTFFlag.h"
+#include "Containers/Queue.h"
+#include "Misc/DelayedAutoRegister.h"
+#include "EngineUtils.h"
+
+//Every event type the bus carries, in delivery order. Adding one here is all the bus needs, Post and Subscribe for it then exist.
+#define MA_GAMEPLAY_EVENT_TYPES(Op) \
+	Op(FMAFlagEvent, Flag) \
+	Op(FMADamagedEvent, Damaged) \
+	Op(FMAMidairHitEvent, MidairHit) \
+	Op(FMAKilledEvent, Killed) \
+	Op(FMAProjectileFiredEvent, ProjectileFired) \
+	Op(FMASpawnedEvent, Spawned)
+
+enum class EMAGameplayEventType : int32
+{
+#define MA_EVENT_TYPE_ENUM(Type, Name) Name,
+	MA_GAMEPLAY_EVENT_TYPES(MA_EVENT_TYPE_ENUM)
+#undef MA_EVENT_TYPE_ENUM
+};
+
+//One per thread that has ever posted. Only that thread pushes and only the game thread pops, so every queue is single producer/single consumer.
+struct FMAGameplayEventShard
+{
+#define MA_EVENT_QUEUE(Type, Name) TQueue<Type, EQueueMode::Spsc> Name##Queue;
+	MA_GAMEPLAY_EVENT_TYPES(MA_EVENT_QUEUE)
+#undef MA_EVENT_QUEUE
+};
+
+//only touched when a thread posts its first event and when dispatching
+static FCriticalSection ShardsLock;
+static TArray<FMAGameplayEventShard*> Shards;
+
+static FMAGameplayEventShard& GetLocalShard()
+{
+	static thread_local FMAGameplayEventShard* LocalShard = nullptr;
+	if (LocalShard == nullptr)
+	{
+		//never freed, whatever a finished thread posted still gets delivered
+		LocalShard = new FMAGameplayEventShard();
+		FScopeLock Lock(&ShardsLock);
+		Shards.Add(LocalShard);
+	}
+	return *LocalShard;
+}
+
+template<typename TEvent>
+struct TMAGameplayEventSubscriber
+{
+	uint32 Id = 0;
+	//cleared on unsubscribe, so a handler removed halfway through a batch doesn't see the rest of it
+	bool bActive = true;
+	bool bAnyWorld = false;
+	TWeakObjectPtr<UWorld> World;
+	//handlers go away with their owner, nobody has to remember to unsubscribe a destroyed bot
+	TWeakObjectPtr<const UObject> Owner;
+	TFunction<void(const TEvent&)> Handler;
+};
+
+//Everything for one event type: which queue in the shard it goes into, who wants it, and the batch being delivered. Game thread only, bar GetQueue.
+template<typename TEvent>
+struct TMAGameplayEventChannel
+{
+	static const EMAGameplayEventType Type;
+	static TQueue<TEvent, EQueueMode::Spsc>& GetQueue(FMAGameplayEventShard& Shard);
+	static TArray<TSharedRef<TMAGameplayEventSubscriber<TEvent>>> Subscribers;
+	static TArray<TEvent> Batch;
+};
+
+template<typename TEvent> TArray<TSharedRef<TMAGameplayEventSubscriber<TEvent>>> TMAGameplayEventChannel<TEvent>::Subscribers;
+template<typename TEvent> TArray<TEvent> TMAGameplayEventChannel<TEvent>::Batch;
+
+#define MA_EVENT_CHANNEL(EventType, Name) \
+	template<> const EMAGameplayEventType TMAGameplayEventChannel<EventType>::Type = EMAGameplayEventType::Name; \
+	template<> TQueue<EventType, EQueueMode::Spsc>& TMAGameplayEventChannel<EventType>::GetQueue(FMAGameplayEventShard& Shard) { return Shard.Name##Queue; }
+MA_GAMEPLAY_EVENT_TYPES(MA_EVENT_CHANNEL)
+#undef MA_EVENT_CHANNEL
+
+static uint32 NextSubscriberId = 0;
+
+//Any thread. The event is delivered next time the game thread dispatches.
+template<typename TEvent>
+void FMAGameplayEvents::Post(const TEvent& Event)
+{
+	TMAGameplayEventChannel<TEvent>::GetQueue(GetLocalShard()).Enqueue(Event);
+}
+
+//Game thread. World limits the handler to events from that world, nullptr for every world.
+template<typename TEvent>
+FMAGameplayEventHandle FMAGameplayEvents::Subscribe(UWorld* World, const UObject* Owner, TFunction<void(const TEvent&)> Handler)
+{
+	check(IsInGameThread());
+	TSharedRef<TMAGameplayEventSubscriber<TEvent>> Subscriber = MakeShared<TMAGameplayEventSubscriber<TEvent>>();
+	Subscriber->Id = ++NextSubscriberId;
+	Subscriber->bAnyWorld = World == nullptr;
+	Subscriber->World = World;
+	Subscriber->Owner = Owner;
+	Subscriber->Handler = MoveTemp(Handler);
+	TMAGameplayEventChannel<TEvent>::Subscribers.Add(Subscriber);
+
+	FMAGameplayEventHandle Handle;
+	Handle.EventType = (int32)TMAGameplayEventChannel<TEvent>::Type;
+	Handle.Id = Subscriber->Id;
+	return Handle;
+}
+
+template<typename TEvent>
+static void RemoveSubscriber(uint32 Id)
+{
+	TArray<TSharedRef<TMAGameplayEventSubscriber<TEvent>>>& Subscribers = TMAGameplayEventChannel<TEvent>::Subscribers;
+	int32 Index = Subscribers.IndexOfByPredicate([Id](const TSharedRef<TMAGameplayEventSubscriber<TEvent>>& Subscriber) { return Subscriber->Id == Id; });
+	if (Index != INDEX_NONE)
+	{
+		Subscribers[Index]->bActive = false;
+		Subscribers.RemoveAt(Index);
+	}
+}
+
+void FMAGameplayEvents::Unsubscribe(FMAGameplayEventHandle& Handle)
+{
+	check(IsInGameThread());
+	switch ((EMAGameplayEventType)Handle.EventType)
+	{
+#define MA_EVENT_UNSUBSCRIBE(Type, Name) case EMAGameplayEventType::Name: RemoveSubscriber<Type>(Handle.Id); break;
+		MA_GAMEPLAY_EVENT_TYPES(MA_EVENT_UNSUBSCRIBE)
+#undef MA_EVENT_UNSUBSCRIBE
+	}
+	Handle = FMAGameplayEventHandle();
+}
+
+template<typename TEvent>
+static int32 DispatchChannel(const TArray<FMAGameplayEventShard*>& ShardsToDrain)
+{
+	using FChannel = TMAGameplayEventChannel<TEvent>;
+	TArray<TEvent>& Batch = FChannel::Batch;
+	Batch.Reset();
+	TEvent Event;
+	for (FMAGameplayEventShard* Shard : ShardsToDrain)
+	{
+		while (FChannel::GetQueue(*Shard).Dequeue(Event))
+		{
+			Batch.Add(MoveTemp(Event));
+		}
+	}
+	if (Batch.Num() == 0)
+	{
+		return 0;
+	}
+	FChannel::Subscribers.RemoveAll([](const TSharedRef<TMAGameplayEventSubscriber<TEvent>>& Subscriber) { return !Subscriber->Owner.IsValid(); });
+	//handlers are free to subscribe and unsubscribe, so walk a copy
+	TArray<TSharedRef<TMAGameplayEventSubscriber<TEvent>>> Subscribers = FChannel::Subscribers;
+	for (const TEvent& BatchedEvent : Batch)
+	{
+		for (const TSharedRef<TMAGameplayEventSubscriber<TEvent>>& Subscriber : Subscribers)
+		{
+			if (Subscriber->bActive && Subscriber->Owner.IsValid() && (Subscriber->bAnyWorld || Subscriber->World == BatchedEvent.World))
+			{
+				Subscriber->Handler(BatchedEvent);
+			}
+		}
+	}
+	return Batch.Num();
+}
+
+//Once a frame, before the first world ticks, so everything posted last frame is handled before anyone acts on this one.
+void FMAGameplayEvents::Dispatch()
+{
+	static uint64 LastDispatchFrame = 0;
+	if (LastDispatchFrame == GFrameCounter)
+	{
+		return;
+	}
+	LastDispatchFrame = GFrameCounter;
+
+	TArray<FMAGameplayEventShard*> ShardsToDrain;
+	{
+		FScopeLock Lock(&ShardsLock);
+		ShardsToDrain = Shards;
+	}
+	int32 Dispatched = 0;
+#define MA_EVENT_DISPATCH(Type, Name) Dispatched += DispatchChannel<Type>(ShardsToDrain);
+	MA_GAMEPLAY_EVENT_TYPES(MA_EVENT_DISPATCH)
+#undef MA_EVENT_DISPATCH
+	FMAMetrics::Increment(EMACounter::GameplayEvents, Dispatched);
+}
+
+#define MA_EVENT_INSTANTIATE(Type, Name) \
+	template void FMAGameplayEvents::Post<Type>(const Type&); \
+	template FMAGameplayEventHandle FMAGameplayEvents::Subscribe<Type>(UWorld*, const UObject*, TFunction<void(const Type&)>);
+MA_GAMEPLAY_EVENT_TYPES(MA_EVENT_INSTANTIATE)
+#undef MA_EVENT_INSTANTIATE
+
+static FDelayedAutoRegisterHelper GRegisterGameplayEvents(EDelayedRegisterRunPhase::EndOfEngineInit, []()
+{
+	FWorldDelegates::OnWorldTickStart.AddLambda([](UWorld* World, ELevelTick TickType, float DeltaSeconds)
+	{
+		FMAGameplayEvents::Dispatch();
+	});
+
+	//telemetry, for every world in the process
+	FMAGameplayEvents::Subscribe<FMAKilledEvent>(nullptr, GetTransientPackage(), [](const FMAKilledEvent& Event)
+	{
+		FMAMetrics::Increment(EMACounter::Kills);
+	});
+	FMAGameplayEvents::Subscribe<FMAMidairHitEvent>(nullptr, GetTransientPackage(), [](const FMAMidairHitEvent& Event)
+	{
+		FMAMetrics::Increment(EMACounter::MidairHits);
+	});
+	FMAGameplayEvents::Subscribe<FMAProjectileFiredEvent>(nullptr, GetTransientPackage(), [](const FMAProjectileFiredEvent& Event)
+	{
+		FMAMetrics::Increment(EMACounter::ProjectilesFired);
+	});
+	FMAGameplayEvents::Subscribe<FMAFlagEvent>(nullptr, GetTransientPackage(), [](const FMAFlagEvent& Event)
+	{
+		if (Event.Type == EMAFlagEventType::Captured)
+		{
+			FMAMetrics::Increment(EMACounter::FlagCaptures);
+		}
+	});
+});
+
+//Where each world's flags are and who has them, kept up to date from flag events so nobody has to walk the actor list.
+FMAFlagTracker& FMAFlagTracker::Get(UWorld* World)
+{
+	static TMap<TWeakObjectPtr<UWorld>, TUniquePtr<FMAFlagTracker>> Trackers;
+	for (auto It = Trackers.CreateIterator(); It; ++It)
+	{
+		if (!It.Key().IsValid())
+		{
+			It.RemoveCurrent();
+		}
+	}
+	TUniquePtr<FMAFlagTracker>& Tracker = Trackers.FindOrAdd(World);
+	if (!Tracker.IsValid())
+	{
+		Tracker = MakeUnique<FMAFlagTracker>();
+		Tracker->Init(World);
+	}
+	return *Tracker;
+}
+
+void FMAFlagTracker::Init(UWorld* World)
+{
+	//flags are placed in the map, so there's no event for them existing. Look once, events keep it right from here on.
+	for (TActorIterator<AMACTFFlag> ActorItr(World); ActorItr; ++ActorItr)
+	{
+		AMACTFFlag* Flag = *ActorItr;
+		FMATrackedFlag& Tracked = Flags.AddDefaulted_GetRef();
+		Tracked.Flag = Flag;
+		Tracked.TeamId = Flag->GetTeamId();
+		Tracked.bHome = Flag->IsHome();
+		Tracked.Holder = Flag->StateName == CarriedObjectState::Held ? Cast<AMACharacter>(Flag->Holder) : nullptr;
+	}
+	FMAGameplayEvents::Subscribe<FMAFlagEvent>(World, World, [this](const FMAFlagEvent& Event) { OnFlagEvent(Event); });
+}
+
+void FMAFlagTracker::OnFlagEvent(const FMAFlagEvent& Event)
+{
+	FMATrackedFlag* Tracked = Flags.FindByPredicate([&Event](const FMATrackedFlag& Flag) { return Flag.TeamId == Event.FlagTeamId; });
+	if (Tracked == nullptr)
+	{
+		Tracked = &Flags.AddDefaulted_GetRef();
+		Tracked->TeamId = Event.FlagTeamId;
+	}
+	Tracked->Flag = Event.Flag;
+	//a capped flag goes straight back to its stand
+	Tracked->bHome = Event.Type == EMAFlagEventType::Returned || Event.Type == EMAFlagEventType::Captured;
+	Tracked->Holder = Event.Type == EMAFlagEventType::PickedUp ? Event.Character : nullptr;
+}
+
+const FMATrackedFlag* FMAFlagTracker::FindFlag(uint8 TeamId) const
+{
+	return Flags.FindByPredicate([TeamId](const FMATrackedFlag& Flag) { return Flag.TeamId == TeamId && Flag.Flag.IsValid(); });
+}
+
+//Bots hear about deaths from the bus instead of the game mode calling every one of them.
+void UMABotAIComponent::SubscribeToGameplayEvents()
+{
+	FMAGameplayEvents::Subscribe<FMAKilledEvent>(GetWorld(), this, [this](const FMAKilledEvent& Event)
+	{
+		if (Event.Victim != ParentCharacter)
+		{
+			PossibleTargetDied(Event.Victim.Get());
+		}
+	});
+}
+
+//Drill win conditions that depend on what the player does to bots. Subscribed for the length of a drill only.
+void UMAPracticeComponent::SubscribeToDrillEvents()
+{
+	UnsubscribeFromDrillEvents();
+	UWorld* World = GetWorld();
+	DrillEventHandles.Add(FMAGameplayEvents::Subscribe<FMADamagedEvent>(World, this, [this](const FMADamagedEvent& Event)
+	{
+		if (SelectedDrill.VictoryType == EDrillVictoryType::HitShot && IsDrillBotHitByPlayer(Event.Victim.Get(), Event.Instigator.Get()))
+		{
+			EndCurrentDrill(true);
+		}
+	}));
+	DrillEventHandles.Add(FMAGameplayEvents::Subscribe<FMAMidairHitEvent>(World, this, [this](const FMAMidairHitEvent& Event)
+	{
+		if (!IsDrillBotHitByPlayer(Event.Victim.Get(), Event.Instigator.Get()))
+		{
+			return;
+		}
+		DrillMidairCounter++;
+		if (SelectedDrill.VictoryType == EDrillVictoryType::TotalMidairs && DrillMidairCounter >= SelectedDrill.DrillVictoryAmount)
+		{
+			EndCurrentDrill(true);
+		}
+	}));
+	DrillEventHandles.Add(FMAGameplayEvents::Subscribe<FMAKilledEvent>(World, this, [this](const FMAKilledEvent& Event)
+	{
+		if (!IsDrillBotHitByPlayer(Event.Victim.Get(), Event.Killer.Get()))
+		{
+			return;
+		}
+		DrillKillCounter++;
+		if (SelectedDrill.VictoryType == EDrillVictoryType::TotalKills && DrillKillCounter >= SelectedDrill.DrillVictoryAmount)
+		{
+			EndCurrentDrill(true);
+		}
+	}));
+	DrillEventHandles.Add(FMAGameplayEvents::Subscribe<FMAFlagEvent>(World, this, [this](const FMAFlagEvent& Event)
+	{
+		if (SelectedDrill.VictoryType == EDrillVictoryType::FlagCaught && Event.Type == EMAFlagEventType::PickedUp && Event.bFlagInAir
+			&& Event.Character.IsValid() && Event.Character->GetController() == ParentController)
+		{
+			EndCurrentDrill(true);
+		}
+	}));
+}
+
+void UMAPracticeComponent::UnsubscribeFromDrillEvents()
+{
+	for (FMAGameplayEventHandle& Handle : DrillEventHandles)
+	{
+		FMAGameplayEvents::Unsubscribe(Handle);
+	}
+	DrillEventHandles.Reset();
+}
+
+//Only bots this drill spawned count, not match bots or other players' drill bots that happen to be in the way.
+bool UMAPracticeComponent::IsDrillBotHitByPlayer(AMACharacter* Victim, AMACharacter* Instigator) const
+{
+	AAIPlayerController* VictimAIPC = Victim != nullptr ? Cast<AAIPlayerController>(Victim->GetController()) : nullptr;
+	return VictimAIPC != nullptr && Instigator != nullptr && Instigator->GetController() == ParentController && DrillBots.Contains(VictimAIPC);
+}
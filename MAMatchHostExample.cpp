@@ -0,0 +1,370 @@
+/**
+
+Several matches in one dedicated server process.
+A server normally hosts one match, so a box running eight matches runs eight processes, each with its own copy of the engine, every
+map's baked AI data, the bot tuning table and whatever practice routes its bots run. UMAMatchHostEngine (set as GameEngine in
+DefaultEngine.ini) keeps the normal match and starts extra ones next to it, from -ExtraMatches=<URL>,<URL> on the command line or
+ma.StartMatch at runtime. Each extra match has its own game instance, world context and game net driver listening on the port from
+its URL, and UGameEngine::Tick already ticks every world context it has, so the matches don't know about each other.
+The map is loaded into a package of its own (<Map>_Match<N>), so the same map can run in as many matches as we like. Its streaming
+sublevels get the same suffix, the way level instances do, and soft references into any of the map's packages are pointed at the
+match's copies as each level loads. Extra matches don't server travel; a new map is ma.StopMatch and ma.StartMatch.
+
+What doesn't change during a match is loaded once for the process and shared read-only between matches:
+- baked AI map data, FMAAIMapData::FindForWorld keys it by GetSourceMapName, so all matches on a map use one copy
+- practice data and routes, through FMAPracticeDataCache and the route follower's shared routes (both keyed by content, not world)
+- bot tuning, the data table is loaded once and every bot copies its row
+Per-world state (timing wheel, crowd, bots) stays per world.
+
+With bots.SharedThinkPool on, bot decision making from every match goes through one FMABotThinkPool instead of running on the game
+thread inside each world's tick. Bots hand in the same snapshot they would give the sidecar, at the end of the frame the whole batch
+is run through MABotBrain::Think across the worker threads, and the commands are applied as the first world starts ticking next
+frame. On a dedicated server that lands the thinking in the time the game thread spends waiting for the next tick.
+
+*/
+
+#include "MidairCE.h"
+#include "MAMatchHostEngine.h"
+#include "MABotThinkPool.h"
+#include "MABotAIComponent.h"
+#include "MABotBrain.h"
+#include "MABotBrainSidecar.h"
+#include "MABotTuning.h"
+#include "Player/MACharacter.h"
+#include "Async/ParallelFor.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "Misc/CommandLine.h"
+#include "Misc/PackageName.h"
+#include "Engine/LevelStreaming.h"
+#include "UObject/UObjectHash.h"
+
+static TAutoConsoleVariable<int32> CVarBotSharedThinkPool(
+	TEXT("bots.SharedThinkPool"),
+	0,
+	TEXT("Run bot decision making for every match in this process on the worker threads once a frame, rather than on the game thread as each bot's timer fires."),
+	ECVF_Default);
+
+//Hosted worlds mapped back to the map they were loaded from, their own package is <Map>_Match<N>.
+static TMap<TWeakObjectPtr<const UWorld>, FName>& GetSourceMapNames()
+{
+	static TMap<TWeakObjectPtr<const UWorld>, FName> SourceMapNames;
+	return SourceMapNames;
+}
+
+//The map a world was loaded from, without PIE prefixes or match suffixes. Anything cached per map should be keyed by this.
+FName UMAMatchHostEngine::GetSourceMapName(const UWorld* World)
+{
+	if (const FName* SourceMapName = GetSourceMapNames().Find(World))
+	{
+		return *SourceMapName;
+	}
+	return FName(*UWorld::RemovePIEPrefix(World->GetOutermost()->GetName()));
+}
+
+//Soft references are only paths, loading a level into another package doesn't touch them, so ones into the source map or its sublevels
+//would resolve to the originals, which no match has loaded. Top level soft properties only, ones nested in structs or arrays are left alone.
+static void RemapSoftReferences(UPackage* Package, const TMap<FName, FName>& PackageRemaps)
+{
+	ForEachObjectWithOuter(Package, [&PackageRemaps](UObject* Object)
+	{
+		for (TFieldIterator<FSoftObjectProperty> It(Object->GetClass()); It; ++It)
+		{
+			FSoftObjectPtr* SoftPtr = It->ContainerPtrToValuePtr<FSoftObjectPtr>(Object);
+			FSoftObjectPath Path = SoftPtr->ToSoftObjectPath();
+			if (const FName* InstancePackage = PackageRemaps.Find(FName(*Path.GetLongPackageName())))
+			{
+				*SoftPtr = FSoftObjectPath(FName(*(InstancePackage->ToString() + TEXT(".") + Path.GetAssetName())), Path.GetSubPathString());
+			}
+		}
+	}, true);
+}
+
+void UMAMatchHostEngine::Start()
+{
+	//brings up the normal match
+	Super::Start();
+	//sublevels of hosted matches stream in later, they need the same soft reference fixup as the persistent level
+	FWorldDelegates::LevelAddedToWorld.AddWeakLambda(this, [this](ULevel* Level, UWorld* World)
+	{
+		for (const TPair<int32, FMAHostedMatch>& Entry : HostedMatches)
+		{
+			if (Entry.Value.World.Get() == World)
+			{
+				RemapSoftReferences(Level->GetOutermost(), Entry.Value.PackageRemaps);
+				return;
+			}
+		}
+	});
+
+	FString ExtraMatches;
+	if (IsRunningDedicatedServer() && FParse::Value(FCommandLine::Get(), TEXT("ExtraMatches="), ExtraMatches, false))
+	{
+		TArray<FString> MatchURLs;
+		ExtraMatches.ParseIntoArray(MatchURLs, TEXT(","));
+		for (const FString& MatchURL : MatchURLs)
+		{
+			StartMatch(MatchURL);
+		}
+	}
+}
+
+void UMAMatchHostEngine::PreExit()
+{
+	TArray<int32> MatchIndices;
+	HostedMatches.GetKeys(MatchIndices);
+	for (int32 MatchIndex : MatchIndices)
+	{
+		StopMatch(MatchIndex);
+	}
+	Super::PreExit();
+}
+
+//Starts loading a match next to the ones already running, e.g. "/Game/Maps/Arena?game=CTF?Port=7778". Returns its index, INDEX_NONE on a bad URL.
+int32 UMAMatchHostEngine::StartMatch(const FString& URLString)
+{
+	FURL URL(nullptr, *URLString, TRAVEL_Absolute);
+	if (!URL.Valid || URL.Map.IsEmpty())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Match host: bad match URL '%s'."), *URLString);
+		return INDEX_NONE;
+	}
+	if (FPackageName::IsShortPackageName(URL.Map) && !FPackageName::SearchForPackageOnDisk(URL.Map + FPackageName::GetMapPackageExtension(), &URL.Map))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Match host: couldn't find map '%s'."), *URL.Map);
+		return INDEX_NONE;
+	}
+
+	//every match gets its own game instance and with it its own world context
+	int32 MatchIndex = NextMatchIndex++;
+	FMAHostedMatch& Match = HostedMatches.Add(MatchIndex);
+	Match.URL = URL;
+	Match.SourceMapName = FName(*URL.Map);
+	Match.GameInstance = NewObject<UGameInstance>(this, GameInstance->GetClass());
+	Match.GameInstance->InitializeStandalone();
+
+	//the map goes into a package of its own, so it doesn't matter if another match is already running it. Loaded async so the running matches don't hitch.
+	FString InstancePackageName = FString::Printf(TEXT("%s_Match%d"), *URL.Map, MatchIndex);
+	Match.PackageRemaps.Add(Match.SourceMapName, FName(*InstancePackageName));
+	LoadPackageAsync(InstancePackageName, nullptr, *URL.Map,
+		FLoadPackageAsyncDelegate::CreateUObject(this, &UMAMatchHostEngine::OnMatchMapLoaded, MatchIndex), PKG_ContainsMap);
+	UE_LOG(LogTemp, Log, TEXT("Match host: starting match %d, %s"), MatchIndex, *URL.ToString());
+	return MatchIndex;
+}
+
+//Same steps LoadMap takes for the main match, minus tearing down the world that was there before.
+void UMAMatchHostEngine::OnMatchMapLoaded(const FName& PackageName, UPackage* Package, EAsyncLoadingResult::Type Result, int32 MatchIndex)
+{
+	FMAHostedMatch* Match = HostedMatches.Find(MatchIndex);
+	UWorld* World = Package != nullptr && Result == EAsyncLoadingResult::Succeeded ? UWorld::FindWorldInPackage(Package) : nullptr;
+	if (Match == nullptr)
+	{
+		//stopped while it was loading
+		return;
+	}
+	if (World == nullptr)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Match host: couldn't load %s for match %d."), *Match->URL.Map, MatchIndex);
+		StopMatch(MatchIndex);
+		return;
+	}
+
+	FWorldContext& Context = *Match->GameInstance->GetWorldContext();
+	//InitializeStandalone left a placeholder world in the context
+	if (UWorld* PlaceholderWorld = Context.World())
+	{
+		PlaceholderWorld->DestroyWorld(false);
+	}
+	//sublevels would otherwise stream into their original packages, shared by every match on the map. Same trick as level instances:
+	//load from the original, into a package named for this match.
+	for (ULevelStreaming* StreamingLevel : World->GetStreamingLevels())
+	{
+		FName SublevelPackage = StreamingLevel->PackageNameToLoad != NAME_None ? StreamingLevel->PackageNameToLoad : FName(*StreamingLevel->GetWorldAssetPackageName());
+		FName InstanceSublevelPackage(*FString::Printf(TEXT("%s_Match%d"), *SublevelPackage.ToString(), MatchIndex));
+		StreamingLevel->PackageNameToLoad = SublevelPackage;
+		StreamingLevel->SetWorldAssetByPackageName(InstanceSublevelPackage);
+		Match->PackageRemaps.Add(SublevelPackage, InstanceSublevelPackage);
+	}
+	RemapSoftReferences(Package, Match->PackageRemaps);
+
+	bool bListening = false;
+	{
+		//InitWorld, SetGameMode, BeginPlay and plenty of game code under them still read GWorld instead of their own world, so it has to
+		//be this match while we set it up. It's all synchronous on the game thread, no other world ticks in between, and the guard puts
+		//the main match back on the way out of this block, before StopMatch or anything else can run.
+		TGuardValue<UWorldProxy, UWorld*> GWorldGuard(GWorld, World);
+		//before anything in the world starts asking for per-map data
+		GetSourceMapNames().Add(World, Match->SourceMapName);
+		World->WorldType = EWorldType::Game;
+		World->AddToRoot();
+		World->SetGameInstance(Match->GameInstance);
+		Context.SetCurrentWorld(World);
+		Context.LastURL = Match->URL;
+		World->InitWorld();
+		World->SetGameMode(Match->URL);
+		//its own game net driver, on the port from its URL
+		bListening = World->Listen(Match->URL);
+		if (bListening)
+		{
+			World->InitializeActorsForPlay(Match->URL);
+			World->BeginPlay();
+			Match->World = World;
+		}
+	}
+	if (!bListening)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Match host: match %d couldn't listen on port %d."), MatchIndex, Match->URL.Port);
+		StopMatch(MatchIndex);
+		return;
+	}
+	UE_LOG(LogTemp, Log, TEXT("Match host: match %d is up on port %d."), MatchIndex, Match->URL.Port);
+}
+
+bool UMAMatchHostEngine::StopMatch(int32 MatchIndex)
+{
+	FMAHostedMatch Match;
+	if (!HostedMatches.RemoveAndCopyValue(MatchIndex, Match))
+	{
+		return false;
+	}
+	UWorld* World = Match.GameInstance->GetWorld();
+	Match.GameInstance->Shutdown();
+	if (World != nullptr)
+	{
+		if (Match.World.IsValid())
+		{
+			World->BeginTearingDown();
+			ShutdownWorldNetDriver(World);
+		}
+		GetSourceMapNames().Remove(World);
+		World->DestroyWorld(false);
+		World->RemoveFromRoot();
+		DestroyWorldContext(World);
+	}
+	UE_LOG(LogTemp, Log, TEXT("Match host: stopped match %d."), MatchIndex);
+	return true;
+}
+
+static FAutoConsoleCommand StartMatchCommand(
+	TEXT("ma.StartMatch"),
+	TEXT("Starts another match in this server process. Usage: ma.StartMatch <Map>?game=<Mode>?Port=<Port>"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		UMAMatchHostEngine* MatchHost = Cast<UMAMatchHostEngine>(GEngine);
+		if (MatchHost == nullptr || Args.Num() < 1)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("ma.StartMatch needs a match URL, and GameEngine set to MAMatchHostEngine."));
+			return;
+		}
+		MatchHost->StartMatch(Args[0]);
+	}));
+
+static FAutoConsoleCommand StopMatchCommand(
+	TEXT("ma.StopMatch"),
+	TEXT("Stops a match started with ma.StartMatch or -ExtraMatches. Usage: ma.StopMatch <Index>"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		UMAMatchHostEngine* MatchHost = Cast<UMAMatchHostEngine>(GEngine);
+		if (MatchHost == nullptr || Args.Num() < 1 || !MatchHost->StopMatch(FCString::Atoi(*Args[0])))
+		{
+			UE_LOG(LogTemp, Warning, TEXT("ma.StopMatch: no such match."));
+		}
+	}));
+
+static FAutoConsoleCommand ListMatchesCommand(
+	TEXT("ma.ListMatches"),
+	TEXT("Lists the extra matches running in this server process."),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		UMAMatchHostEngine* MatchHost = Cast<UMAMatchHostEngine>(GEngine);
+		if (MatchHost == nullptr)
+		{
+			return;
+		}
+		for (const TPair<int32, FMAHostedMatch>& Match : MatchHost->GetHostedMatches())
+		{
+			UWorld* World = Match.Value.World.Get();
+			UE_LOG(LogTemp, Log, TEXT("Match %d: %s port %d, %s, %d players"), Match.Key, *Match.Value.SourceMapName.ToString(), Match.Value.URL.Port,
+				World != nullptr ? TEXT("running") : TEXT("loading"), World != nullptr ? World->GetNumPlayerControllers() : 0);
+		}
+	}));
+
+void FMABotThinkBatch::Reset()
+{
+	Bots.Reset();
+	Snapshots.Reset();
+	Tunings.Reset();
+	Commands.Reset();
+}
+
+FMABotThinkPool& FMABotThinkPool::Get()
+{
+	static FMABotThinkPool ThinkPool;
+	return ThinkPool;
+}
+
+FMABotThinkPool::FMABotThinkPool()
+{
+	FCoreDelegates::OnEndFrame.AddRaw(this, &FMABotThinkPool::Dispatch);
+	FWorldDelegates::OnWorldTickStart.AddRaw(this, &FMABotThinkPool::OnWorldTickStart);
+	//workers must be done with the batch before anything it points into goes away
+	FCoreDelegates::OnPreExit.AddRaw(this, &FMABotThinkPool::WaitForBatch);
+}
+
+bool FMABotThinkPool::IsEnabled()
+{
+	return CVarBotSharedThinkPool.GetValueOnGameThread() != 0;
+}
+
+//The tuning comes along with the snapshot, the workers can't look it up themselves.
+void FMABotThinkPool::Submit(UMABotAIComponent* Bot, const FMABotBrainSnapshot& Snapshot, const FMABotTuningParams& Tuning)
+{
+	Pending.Bots.Add(Bot);
+	Pending.Snapshots.Add(Snapshot);
+	Pending.Tunings.Add(Tuning);
+}
+
+//End of frame, every world has ticked and handed in its snapshots. Only plain data goes to the workers, no UObjects.
+void FMABotThinkPool::Dispatch()
+{
+	if (InFlightTask.IsValid() || Pending.Snapshots.Num() == 0)
+	{
+		return;
+	}
+	Swap(Pending, InFlight);
+	InFlight.Commands.SetNum(InFlight.Snapshots.Num());
+	InFlightTask = FFunctionGraphTask::CreateAndDispatchWhenReady([this]()
+	{
+		ParallelFor(InFlight.Snapshots.Num(), [this](int32 Index)
+		{
+			MABotBrain::Think(InFlight.Snapshots[Index], InFlight.Tunings[Index], InFlight.Commands[Index]);
+		});
+	}, TStatId(), nullptr, ENamedThreads::AnyBackgroundThreadNormalTask);
+}
+
+void FMABotThinkPool::OnWorldTickStart(UWorld* World, ELevelTick TickType, float DeltaSeconds)
+{
+	//only the first world to tick this frame has anything to collect
+	if (!InFlightTask.IsValid())
+	{
+		return;
+	}
+	WaitForBatch();
+	for (int32 Index = 0; Index < InFlight.Bots.Num(); Index++)
+	{
+		//bots can be gone by now, their match may even have been stopped
+		if (UMABotAIComponent* Bot = InFlight.Bots[Index].Get())
+		{
+			Bot->ApplyBrainCommand(InFlight.Commands[Index]);
+		}
+	}
+	InFlight.Reset();
+}
+
+void FMABotThinkPool::WaitForBatch()
+{
+	if (InFlightTask.IsValid())
+	{
+		FTaskGraphInterface::Get().WaitUntilTaskCompletes(InFlightTask);
+		InFlightTask = nullptr;
+	}
+}
@@ -0,0 +1,218 @@
+/**
+
+Memory accounting for bots and practice data.
+We couldn't answer "how much memory do bots and practice libraries cost on this server". Two views:
+- LLM tags (when running with -llm) for allocations made in the bot, perception, route, practice data and AI bake code, so they show up
+  as their own lines in the engine's memory reports instead of inside Engine/UObject.
+- Our own accounting, which works in shipping too. Per bot and per route sizes are measured from the containers on demand (no
+  bookkeeping on the hot paths), practice datasets are counted once however many players share them, and bake data keeps a running counter.
+"ma.MemReport [bots|routes]" prints it, "ma.MemCSV <seconds>" appends a row every few seconds to a CSV under Saved/Profiling so it can
+be tracked over a whole session (0 stops it).
+
+*/
+
+#include "MidairCE.h"
+#include "MAMemoryAccounting.h"
+#include "MABotAIComponent.h"
+#include "MAPracticeComponent.h"
+#include "MAPracticeDataCache.h"
+#include "MARouteFollowerComponent.h"
+#include "Player/AIPlayerController.h"
+#include "Perception/PawnSensingComponent.h"
+#include "HAL/LowLevelMemTracker.h"
+#include "Misc/DelayedAutoRegister.h"
+
+#if ENABLE_LOW_LEVEL_MEM_TRACKER
+//project tags have to be registered before anything is allocated under them
+static FDelayedAutoRegisterHelper GRegisterMidairLLMTags(EDelayedRegisterRunPhase::EndOfEngineInit, []()
+{
+	FLowLevelMemTracker& Tracker = FLowLevelMemTracker::Get();
+	Tracker.RegisterProjectTag((int32)EMALLMTag::BotAI, TEXT("MidairBotAI"), NAME_None, NAME_None);
+	Tracker.RegisterProjectTag((int32)EMALLMTag::BotPerception, TEXT("MidairBotPerception"), NAME_None, NAME_None);
+	Tracker.RegisterProjectTag((int32)EMALLMTag::RouteData, TEXT("MidairRouteData"), NAME_None, NAME_None);
+	Tracker.RegisterProjectTag((int32)EMALLMTag::PracticeData, TEXT("MidairPracticeData"), NAME_None, NAME_None);
+	Tracker.RegisterProjectTag((int32)EMALLMTag::AIBakeData, TEXT("MidairAIBakeData"), NAME_None, NAME_None);
+});
+#endif
+
+TAtomic<int64> FMAMemoryAccounting::AIBakeDataBytes(0);
+FDelegateHandle FMAMemoryAccounting::CSVTickerHandle;
+FString FMAMemoryAccounting::CSVPath;
+double FMAMemoryAccounting::CSVStartTime = 0.0;
+
+SIZE_T FMAMemoryAccounting::GetRouteBytes(const FMARouteTrail& Route)
+{
+	return sizeof(FMARouteTrail) + Route.MarkerLocations.GetAllocatedSize() + Route.RecordedInputs.GetAllocatedSize() + Route.Name.GetAllocatedSize();
+}
+
+SIZE_T FMAMemoryAccounting::GetPracticeDataBytes(const FMAMapPracticeData& PracticeData)
+{
+	SIZE_T Bytes = sizeof(FMAMapPracticeData) + PracticeData.RouteTrails.GetAllocatedSize() - PracticeData.RouteTrails.Num() * sizeof(FMARouteTrail);
+	for (const FMARouteTrail& Route : PracticeData.RouteTrails)
+	{
+		Bytes += GetRouteBytes(Route);
+	}
+	//drills, bots and locations are small fixed size entries, the array storage is close enough
+	Bytes += PracticeData.Drills.GetAllocatedSize() + PracticeData.Bots.GetAllocatedSize() + PracticeData.Locations.GetAllocatedSize() + PracticeData.Tutorials.GetAllocatedSize();
+	return Bytes;
+}
+
+//The component, its route follower and share of the route it runs, its memory of targets, and the sensing component it creates for itself.
+SIZE_T UMABotAIComponent::GetBotMemoryBytes(SIZE_T& OutPerceptionBytes, SIZE_T& OutRouteBytes) const
+{
+	OutRouteBytes = 0;
+	AAIPlayerController* AIPC = ParentCharacter != nullptr ? Cast<AAIPlayerController>(ParentCharacter->GetController()) : nullptr;
+	if (AIPC != nullptr && AIPC->RouteFollower != nullptr)
+	{
+		OutRouteBytes = AIPC->RouteFollower->GetClass()->GetStructureSize() + AIPC->RouteFollower->GetRouteBytes();
+	}
+	OutPerceptionBytes = RecentlySeenTargets.GetAllocatedSize();
+	if (PawnSensingComp != nullptr)
+	{
+		OutPerceptionBytes += PawnSensingComp->GetClass()->GetStructureSize();
+	}
+	return GetClass()->GetStructureSize() + OutPerceptionBytes + OutRouteBytes;
+}
+
+//Game thread. Walks every bot and practice component, shared practice datasets are only counted once.
+FMAMemorySnapshot FMAMemoryAccounting::TakeSnapshot(TArray<FMAMemoryEntry>* OutBots, TArray<FMAMemoryEntry>* OutRoutes)
+{
+	check(IsInGameThread());
+	FMAMemorySnapshot Snapshot;
+	for (TObjectIterator<UMABotAIComponent> It; It; ++It)
+	{
+		if (It->IsTemplate())
+		{
+			continue;
+		}
+		SIZE_T PerceptionBytes = 0;
+		SIZE_T RouteBytes = 0;
+		SIZE_T BotBytes = It->GetBotMemoryBytes(PerceptionBytes, RouteBytes);
+		Snapshot.NumBots++;
+		Snapshot.BotComponentBytes += BotBytes - PerceptionBytes - RouteBytes;
+		Snapshot.BotPerceptionBytes += PerceptionBytes;
+		Snapshot.BotRouteBytes += RouteBytes;
+		if (OutBots != nullptr)
+		{
+			OutBots->Add(FMAMemoryEntry(It->BotConfig.Name, BotBytes));
+		}
+	}
+
+	TSet<const FMAMapPracticeData*> CountedDatasets;
+	for (TObjectIterator<UMAPracticeComponent> It; It; ++It)
+	{
+		if (It->IsTemplate())
+		{
+			continue;
+		}
+		const FMAMapPracticeData& PracticeData = It->GetPracticeData();
+		bool bAlreadyCounted = false;
+		CountedDatasets.Add(&PracticeData, &bAlreadyCounted);
+		if (bAlreadyCounted || PracticeData.RouteTrails.Num() + PracticeData.Drills.Num() == 0)
+		{
+			continue;
+		}
+		Snapshot.NumPracticeDatasets++;
+		Snapshot.PracticeDataBytes += GetPracticeDataBytes(PracticeData);
+		Snapshot.NumRoutes += PracticeData.RouteTrails.Num();
+		if (OutRoutes != nullptr)
+		{
+			for (const FMARouteTrail& Route : PracticeData.RouteTrails)
+			{
+				OutRoutes->Add(FMAMemoryEntry(Route.Name, GetRouteBytes(Route)));
+			}
+		}
+	}
+	Snapshot.AIBakeDataBytes = AIBakeDataBytes.Load();
+	return Snapshot;
+}
+
+static FString FormatMemoryBytes(int64 Bytes)
+{
+	return FString::Printf(TEXT("%.2f MB"), Bytes / (1024.0 * 1024.0));
+}
+
+static FAutoConsoleCommand CmdMemReport(
+	TEXT("ma.MemReport"),
+	TEXT("Memory used by bots and practice data. Add 'bots' or 'routes' to list the biggest of each."),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		bool bListBots = Args.Contains(TEXT("bots"));
+		bool bListRoutes = Args.Contains(TEXT("routes"));
+		TArray<FMAMemoryEntry> Bots;
+		TArray<FMAMemoryEntry> Routes;
+		FMAMemorySnapshot Snapshot = FMAMemoryAccounting::TakeSnapshot(bListBots ? &Bots : nullptr, bListRoutes ? &Routes : nullptr);
+
+		UE_LOG(LogTemp, Display, TEXT("Bots: %d, components %s, perception %s, routes %s (%s per bot)"), Snapshot.NumBots,
+			*FormatMemoryBytes(Snapshot.BotComponentBytes), *FormatMemoryBytes(Snapshot.BotPerceptionBytes), *FormatMemoryBytes(Snapshot.BotRouteBytes),
+			*FormatMemoryBytes(Snapshot.NumBots > 0 ? (Snapshot.BotComponentBytes + Snapshot.BotPerceptionBytes + Snapshot.BotRouteBytes) / Snapshot.NumBots : 0));
+		UE_LOG(LogTemp, Display, TEXT("Practice data: %d distinct datasets, %d routes, %s"), Snapshot.NumPracticeDatasets, Snapshot.NumRoutes, *FormatMemoryBytes(Snapshot.PracticeDataBytes));
+		UE_LOG(LogTemp, Display, TEXT("AI bake data: %s"), *FormatMemoryBytes(Snapshot.AIBakeDataBytes));
+
+		const int32 MaxListed = 20;
+		auto LogBiggest = [MaxListed](TArray<FMAMemoryEntry>& Entries, const TCHAR* Label)
+		{
+			Entries.Sort([](const FMAMemoryEntry& A, const FMAMemoryEntry& B) { return A.Bytes > B.Bytes; });
+			for (int32 EntryIndex = 0; EntryIndex < FMath::Min(Entries.Num(), MaxListed); EntryIndex++)
+			{
+				UE_LOG(LogTemp, Display, TEXT("  %s %s: %.1f KB"), Label, *Entries[EntryIndex].Name, Entries[EntryIndex].Bytes / 1024.0);
+			}
+		};
+		LogBiggest(Bots, TEXT("Bot"));
+		LogBiggest(Routes, TEXT("Route"));
+	}));
+
+//Appends one row per interval while enabled. Runs off the core ticker so it keeps going across map changes.
+void FMAMemoryAccounting::SetCSVInterval(float IntervalSeconds)
+{
+	if (CSVTickerHandle.IsValid())
+	{
+		FTicker::GetCoreTicker().RemoveTicker(CSVTickerHandle);
+		CSVTickerHandle.Reset();
+	}
+	if (IntervalSeconds <= 0.0f)
+	{
+		return;
+	}
+	CSVPath = FPaths::ProfilingDir() / FString::Printf(TEXT("MAMemory_%s.csv"), *FDateTime::Now().ToString());
+	CSVStartTime = FPlatformTime::Seconds();
+	FString Header = TEXT("Seconds,Bots,BotComponentBytes,BotPerceptionBytes,BotRouteBytes,BytesPerBot,PracticeDatasets,Routes,PracticeDataBytes,BytesPerRoute,AIBakeDataBytes");
+#if ENABLE_LOW_LEVEL_MEM_TRACKER
+	//same check the rows use, LLM is compiled in to most builds but only turned on with -llm
+	if (FLowLevelMemTracker::IsEnabled())
+	{
+		Header += TEXT(",LLMBotAI,LLMBotPerception,LLMRouteData,LLMPracticeData,LLMAIBakeData");
+	}
+#endif
+	FFileHelper::SaveStringToFile(Header + LINE_TERMINATOR, *CSVPath);
+
+	CSVTickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([](float DeltaTime)
+	{
+		FMAMemorySnapshot Snapshot = TakeSnapshot(nullptr, nullptr);
+		int64 BotBytes = Snapshot.BotComponentBytes + Snapshot.BotPerceptionBytes + Snapshot.BotRouteBytes;
+		FString Row = FString::Printf(TEXT("%.1f,%d,%lld,%lld,%lld,%lld,%d,%d,%lld,%lld,%lld"), FPlatformTime::Seconds() - CSVStartTime, Snapshot.NumBots,
+			Snapshot.BotComponentBytes, Snapshot.BotPerceptionBytes, Snapshot.BotRouteBytes, Snapshot.NumBots > 0 ? BotBytes / Snapshot.NumBots : 0,
+			Snapshot.NumPracticeDatasets, Snapshot.NumRoutes, Snapshot.PracticeDataBytes, Snapshot.NumRoutes > 0 ? Snapshot.PracticeDataBytes / Snapshot.NumRoutes : 0,
+			Snapshot.AIBakeDataBytes);
+#if ENABLE_LOW_LEVEL_MEM_TRACKER
+		if (FLowLevelMemTracker::IsEnabled())
+		{
+			FLowLevelMemTracker& Tracker = FLowLevelMemTracker::Get();
+			for (EMALLMTag Tag : { EMALLMTag::BotAI, EMALLMTag::BotPerception, EMALLMTag::RouteData, EMALLMTag::PracticeData, EMALLMTag::AIBakeData })
+			{
+				Row += FString::Printf(TEXT(",%lld"), Tracker.GetTagAmountForTracker(ELLMTracker::Default, (ELLMTag)Tag));
+			}
+		}
+#endif
+		FFileHelper::SaveStringToFile(Row + LINE_TERMINATOR, *CSVPath, FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), FILEWRITE_Append);
+		return true;
+	}), IntervalSeconds);
+}
+
+static FAutoConsoleCommand CmdMemCSV(
+	TEXT("ma.MemCSV"),
+	TEXT("ma.MemCSV <seconds> appends bot/practice memory to a CSV in Saved/Profiling every <seconds>, 0 stops."),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		FMAMemoryAccounting::SetCSVInterval(Args.Num() > 0 ? FCString::Atof(*Args[0]) : 5.0f);
+	}));
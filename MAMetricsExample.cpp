@@ -0,0 +1,409 @@
+/**
+
+Always-on metrics for bots, drills, practice data and weapons.
+Unreal Insights and stat files are great once we know something is wrong, but nobody runs them on a live server, so regressions (bots
+suddenly tracing twice as much, decisions taking longer after a tuning change, practice files getting slow to load) went unnoticed
+until someone complained. This is a small fixed registry of:
+- counters, e.g. bot decisions and traces
+- gauges, e.g. active bots
+- HDR style histograms, e.g. decision latency, traces per frame, drill length, practice load/save time, weapon heat
+Recording never takes a lock past a thread's first metric. Each thread writes into its own shard with relaxed stores (it's the only
+writer), and the exporter and the per frame trace count sum the shards without locking. Histograms are log-linear, 16 buckets per
+power of two, so any value up to ~2^41 is kept to within ~6%.
+Every ma.MetricsInterval seconds the exporter writes:
+- Saved/Metrics/midair_<pid>.prom, Prometheus text format, for node_exporter's textfile collector or any local scraper
+- a row per metric to Saved/Metrics/midair_<pid>_<time>.csv, rotated at ma.MetricsCSVMaxMB and keeping the newest ma.MetricsCSVFiles
+Histogram quantiles are over the last interval only, so a regression shows up straight away instead of being averaged into the whole
+session. Counts and sums are cumulative, as Prometheus expects.
+
+*/
+
+#include "MidairCE.h"
+#include "MAMetrics.h"
+#include "Misc/DelayedAutoRegister.h"
+#include "Misc/CoreDelegates.h"
+#include "HAL/PlatformAtomics.h"
+
+static TAutoConsoleVariable<float> CVarMetricsInterval(
+	TEXT("ma.MetricsInterval"),
+	10.0f,
+	TEXT("Seconds between metrics exports to Saved/Metrics. 0 stops exporting, recording carries on."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarMetricsCSVMaxMB(
+	TEXT("ma.MetricsCSVMaxMB"),
+	16,
+	TEXT("Metrics CSVs are rotated once they reach this size."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarMetricsCSVFiles(
+	TEXT("ma.MetricsCSVFiles"),
+	5,
+	TEXT("How many rotated metrics CSVs to keep."),
+	ECVF_Default);
+
+struct FMAMetricDefinition
+{
+	const TCHAR* Name;
+	const TCHAR* Help;
+	//histograms record integers, this turns them back into the unit in the name when exporting
+	double ExportScale;
+};
+
+//Must match the order of EMACounter, EMAGauge and EMAHistogram.
+static const FMAMetricDefinition CounterDefinitions[] =
+{
+	{ TEXT("midair_bot_decisions_total"), TEXT("Bot DetermineCurrentTask runs."), 1.0 },
+	{ TEXT("midair_bot_traces_total"), TEXT("Collision traces made by bot AI."), 1.0 },
+	{ TEXT("midair_drills_started_total"), TEXT("Practice drills and tutorials started."), 1.0 },
+	{ TEXT("midair_drills_won_total"), TEXT("Practice drills and tutorials completed."), 1.0 },
+	{ TEXT("midair_drills_lost_total"), TEXT("Practice drills and tutorials failed or timed out."), 1.0 },
+	{ TEXT("midair_ai_timers_fired_total"), TEXT("Bot and practice timers fired by the AI timing wheel."), 1.0 },
+	{ TEXT("midair_gameplay_events_total"), TEXT("Events delivered by the gameplay event bus."), 1.0 },
+	{ TEXT("midair_kills_total"), TEXT("Characters killed, bots included."), 1.0 },
+	{ TEXT("midair_midair_hits_total"), TEXT("Hits on characters in the air."), 1.0 },
+	{ TEXT("midair_projectiles_fired_total"), TEXT("Projectiles fired by players and bots."), 1.0 },
+	{ TEXT("midair_flag_captures_total"), TEXT("Flags capped."), 1.0 },
+};
+static const FMAMetricDefinition GaugeDefinitions[] =
+{
+	{ TEXT("midair_bots_active"), TEXT("Bots out moving around, not dead or parked."), 1.0 },
+};
+static const FMAMetricDefinition HistogramDefinitions[] =
+{
+	{ TEXT("midair_bot_decision_seconds"), TEXT("Time taken by one bot DetermineCurrentTask."), 1e-6 },
+	{ TEXT("midair_bot_traces_per_frame"), TEXT("Collision traces made by bot AI in one frame."), 1.0 },
+	{ TEXT("midair_ai_timers_fired_per_frame"), TEXT("AI timing wheel timers fired in one frame."), 1.0 },
+	{ TEXT("midair_drill_duration_seconds"), TEXT("Length of finished practice drills."), 1e-3 },
+	{ TEXT("midair_practice_load_seconds"), TEXT("Time to load practice data, cache hits included."), 1e-6 },
+	{ TEXT("midair_practice_save_seconds"), TEXT("Time to serialize and write practice data."), 1e-6 },
+	{ TEXT("midair_weapon_heat"), TEXT("Weapon heat sampled 4 times a second while above zero, 1 being overheated."), 1e-3 },
+};
+static_assert(UE_ARRAY_COUNT(CounterDefinitions) == (int32)EMACounter::Num, "Counter definitions out of sync with EMACounter");
+static_assert(UE_ARRAY_COUNT(GaugeDefinitions) == (int32)EMAGauge::Num, "Gauge definitions out of sync with EMAGauge");
+static_assert(UE_ARRAY_COUNT(HistogramDefinitions) == (int32)EMAHistogram::Num, "Histogram definitions out of sync with EMAHistogram");
+
+static const int32 HistogramSubBucketBits = 5;
+static const int32 HistogramSubBuckets = 1 << HistogramSubBucketBits;
+static const int32 HistogramHalfSubBuckets = HistogramSubBuckets / 2;
+//values from 2^41 up all land in the last bucket
+static const int32 HistogramMaxBits = 41;
+static const int32 HistogramBuckets = HistogramSubBuckets + (HistogramMaxBits - HistogramSubBucketBits) * HistogramHalfSubBuckets;
+static const int32 NumCounters = (int32)EMACounter::Num;
+static const int32 NumGauges = (int32)EMAGauge::Num;
+static const int32 NumHistograms = (int32)EMAHistogram::Num;
+
+//Below 32 every value has its own bucket, above that each power of two is split into 16 equal buckets.
+static int32 GetHistogramBucket(int64 Value)
+{
+	if (Value < HistogramSubBuckets)
+	{
+		return FMath::Max<int64>(Value, 0);
+	}
+	int32 Shift = FMath::Min((int32)FPlatformMath::FloorLog2_64(Value), HistogramMaxBits - 1) - (HistogramSubBucketBits - 1);
+	int32 SubBucket = FMath::Min<int64>(Value >> Shift, HistogramSubBuckets - 1) - HistogramHalfSubBuckets;
+	return HistogramSubBuckets + (Shift - 1) * HistogramHalfSubBuckets + SubBucket;
+}
+
+//Largest value that lands in this bucket, which is what quantiles report.
+static int64 GetHistogramBucketUpperBound(int32 Bucket)
+{
+	if (Bucket < HistogramSubBuckets)
+	{
+		return Bucket;
+	}
+	int32 Shift = (Bucket - HistogramSubBuckets) / HistogramHalfSubBuckets + 1;
+	int64 Top = (Bucket - HistogramSubBuckets) % HistogramHalfSubBuckets + HistogramHalfSubBuckets;
+	return ((Top + 1) << Shift) - 1;
+}
+
+//One per recording thread, only ever written by that thread.
+struct FMAMetricsShard
+{
+	int64 Counters[NumCounters] = {};
+	int64 HistogramCounts[NumHistograms][HistogramBuckets] = {};
+	int64 HistogramSums[NumHistograms] = {};
+};
+
+struct FMAMetricsSnapshot
+{
+	int64 Counters[NumCounters] = {};
+	int64 Gauges[NumGauges] = {};
+	int64 HistogramCounts[NumHistograms][HistogramBuckets] = {};
+	int64 HistogramSums[NumHistograms] = {};
+	int64 HistogramTotals[NumHistograms] = {};
+};
+
+//Fixed size so readers can walk it without a lock, a shard is written to its slot before NumShards is bumped past it.
+//Only threads adding their shard take the lock, to agree on the slot.
+static const int32 MaxMetricsShards = 256;
+static FCriticalSection ShardsLock;
+static FMAMetricsShard* Shards[MaxMetricsShards] = {};
+static int32 NumShards = 0;
+static int64 Gauges[NumGauges] = {};
+
+static FMAMetricsShard& GetLocalShard()
+{
+	static thread_local FMAMetricsShard* LocalShard = nullptr;
+	if (LocalShard == nullptr)
+	{
+		//never freed, so whatever a finished thread recorded still counts
+		LocalShard = new FMAMetricsShard();
+		FScopeLock Lock(&ShardsLock);
+		if (NumShards < MaxMetricsShards)
+		{
+			Shards[NumShards] = LocalShard;
+			FPlatformAtomics::InterlockedIncrement(&NumShards);
+		}
+		else {
+			//way more threads than we have cores, whatever they record goes nowhere
+			UE_LOG(LogTemp, Warning, TEXT("Metrics: out of shards, metrics recorded on this thread are dropped."));
+		}
+	}
+	return *LocalShard;
+}
+
+//single writer, so a relaxed read and store is all it takes, the exporter may just see the value one update late
+static void AddRelaxed(int64& Value, int64 Amount)
+{
+	FPlatformAtomics::AtomicStore_Relaxed(&Value, FPlatformAtomics::AtomicRead_Relaxed(&Value) + Amount);
+}
+
+void FMAMetrics::Increment(EMACounter Counter, int64 Amount)
+{
+	AddRelaxed(GetLocalShard().Counters[(int32)Counter], Amount);
+}
+
+void FMAMetrics::SetGauge(EMAGauge Gauge, int64 Value)
+{
+	FPlatformAtomics::AtomicStore_Relaxed(&Gauges[(int32)Gauge], Value);
+}
+
+void FMAMetrics::Record(EMAHistogram Histogram, int64 Value)
+{
+	FMAMetricsShard& Shard = GetLocalShard();
+	AddRelaxed(Shard.HistogramCounts[(int32)Histogram][GetHistogramBucket(Value)], 1);
+	AddRelaxed(Shard.HistogramSums[(int32)Histogram], Value);
+}
+
+FMAMetricScopeTimer::FMAMetricScopeTimer(EMAHistogram InHistogram)
+	: Histogram(InHistogram)
+	, StartCycles(FPlatformTime::Cycles64())
+{
+}
+
+FMAMetricScopeTimer::~FMAMetricScopeTimer()
+{
+	FMAMetrics::Record(Histogram, FMath::RoundToInt(FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - StartCycles) * 1000.0));
+}
+
+static void TakeMetricsSnapshot(FMAMetricsSnapshot& Snapshot)
+{
+	Snapshot = FMAMetricsSnapshot();
+	int32 ShardCount = FPlatformAtomics::AtomicRead(&NumShards);
+	for (int32 ShardIndex = 0; ShardIndex < ShardCount; ShardIndex++)
+	{
+		const FMAMetricsShard* Shard = Shards[ShardIndex];
+		for (int32 Counter = 0; Counter < NumCounters; Counter++)
+		{
+			Snapshot.Counters[Counter] += FPlatformAtomics::AtomicRead_Relaxed(&Shard->Counters[Counter]);
+		}
+		for (int32 Histogram = 0; Histogram < NumHistograms; Histogram++)
+		{
+			for (int32 Bucket = 0; Bucket < HistogramBuckets; Bucket++)
+			{
+				int64 Count = FPlatformAtomics::AtomicRead_Relaxed(&Shard->HistogramCounts[Histogram][Bucket]);
+				Snapshot.HistogramCounts[Histogram][Bucket] += Count;
+				Snapshot.HistogramTotals[Histogram] += Count;
+			}
+			Snapshot.HistogramSums[Histogram] += FPlatformAtomics::AtomicRead_Relaxed(&Shard->HistogramSums[Histogram]);
+		}
+	}
+	for (int32 Gauge = 0; Gauge < NumGauges; Gauge++)
+	{
+		Snapshot.Gauges[Gauge] = FPlatformAtomics::AtomicRead_Relaxed(&Gauges[Gauge]);
+	}
+}
+
+//Quantile of what was recorded between two snapshots, in the histogram's export unit. 0 if nothing was recorded.
+static double GetIntervalQuantile(const FMAMetricsSnapshot& Current, const FMAMetricsSnapshot& Previous, int32 Histogram, double Quantile)
+{
+	int64 IntervalTotal = Current.HistogramTotals[Histogram] - Previous.HistogramTotals[Histogram];
+	if (IntervalTotal <= 0)
+	{
+		return 0.0;
+	}
+	int64 Target = FMath::Max<int64>(1, FMath::CeilToInt(IntervalTotal * Quantile));
+	int64 Seen = 0;
+	for (int32 Bucket = 0; Bucket < HistogramBuckets; Bucket++)
+	{
+		Seen += Current.HistogramCounts[Histogram][Bucket] - Previous.HistogramCounts[Histogram][Bucket];
+		if (Seen >= Target)
+		{
+			return GetHistogramBucketUpperBound(Bucket) * HistogramDefinitions[Histogram].ExportScale;
+		}
+	}
+	return GetHistogramBucketUpperBound(HistogramBuckets - 1) * HistogramDefinitions[Histogram].ExportScale;
+}
+
+static const double ExportQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+static FString GetMetricsDir()
+{
+	return FPaths::ProjectSavedDir() / TEXT("Metrics");
+}
+
+static FString GetPrometheusPath()
+{
+	return GetMetricsDir() / FString::Printf(TEXT("midair_%u.prom"), FPlatformProcess::GetCurrentProcessId());
+}
+
+static void WritePrometheusFile(const FMAMetricsSnapshot& Current, const FMAMetricsSnapshot& Previous)
+{
+	FString Text;
+	for (int32 Counter = 0; Counter < NumCounters; Counter++)
+	{
+		const FMAMetricDefinition& Definition = CounterDefinitions[Counter];
+		Text += FString::Printf(TEXT("# HELP %s %s\n# TYPE %s counter\n%s %lld\n"), Definition.Name, Definition.Help, Definition.Name, Definition.Name, Current.Counters[Counter]);
+	}
+	for (int32 Gauge = 0; Gauge < NumGauges; Gauge++)
+	{
+		const FMAMetricDefinition& Definition = GaugeDefinitions[Gauge];
+		Text += FString::Printf(TEXT("# HELP %s %s\n# TYPE %s gauge\n%s %lld\n"), Definition.Name, Definition.Help, Definition.Name, Definition.Name, Current.Gauges[Gauge]);
+	}
+	for (int32 Histogram = 0; Histogram < NumHistograms; Histogram++)
+	{
+		const FMAMetricDefinition& Definition = HistogramDefinitions[Histogram];
+		Text += FString::Printf(TEXT("# HELP %s %s\n# TYPE %s summary\n"), Definition.Name, Definition.Help, Definition.Name);
+		for (double Quantile : ExportQuantiles)
+		{
+			Text += FString::Printf(TEXT("%s{quantile=\"%g\"} %g\n"), Definition.Name, Quantile, GetIntervalQuantile(Current, Previous, Histogram, Quantile));
+		}
+		Text += FString::Printf(TEXT("%s_sum %g\n%s_count %lld\n"), Definition.Name, Current.HistogramSums[Histogram] * Definition.ExportScale,
+			Definition.Name, Current.HistogramTotals[Histogram]);
+	}
+	//scrapers can read at any moment, so never let them see a half written file
+	FString FinalPath = GetPrometheusPath();
+	FString TempPath = FinalPath + TEXT(".tmp");
+	if (FFileHelper::SaveStringToFile(Text, *TempPath))
+	{
+		IFileManager::Get().Move(*FinalPath, *TempPath, true, true);
+	}
+}
+
+static FString MetricsCSVPath;
+
+//Starts a new CSV when the current one is too big, and deletes the oldest ones past the limit.
+static void RotateMetricsCSV()
+{
+	int64 MaxBytes = (int64)FMath::Max(CVarMetricsCSVMaxMB.GetValueOnGameThread(), 1) * 1024 * 1024;
+	if (!MetricsCSVPath.IsEmpty() && IFileManager::Get().FileSize(*MetricsCSVPath) < MaxBytes)
+	{
+		return;
+	}
+	MetricsCSVPath = GetMetricsDir() / FString::Printf(TEXT("midair_%u_%s.csv"), FPlatformProcess::GetCurrentProcessId(), *FDateTime::Now().ToString());
+	FFileHelper::SaveStringToFile(FString(TEXT("Time,Metric,Kind,Total,Interval,P50,P90,P99,P999")) + LINE_TERMINATOR, *MetricsCSVPath);
+
+	//only our own CSVs, several servers can share a Saved directory and each rotates its own
+	TArray<FString> CSVFiles;
+	IFileManager::Get().FindFiles(CSVFiles, *(GetMetricsDir() / FString::Printf(TEXT("midair_%u_*.csv"), FPlatformProcess::GetCurrentProcessId())), true, false);
+	int32 NumToDelete = CSVFiles.Num() - FMath::Max(CVarMetricsCSVFiles.GetValueOnGameThread(), 1);
+	if (NumToDelete > 0)
+	{
+		TArray<TPair<FDateTime, FString>> ByAge;
+		for (const FString& CSVFile : CSVFiles)
+		{
+			FString FullPath = GetMetricsDir() / CSVFile;
+			ByAge.Emplace(IFileManager::Get().GetTimeStamp(*FullPath), FullPath);
+		}
+		ByAge.Sort([](const TPair<FDateTime, FString>& A, const TPair<FDateTime, FString>& B) { return A.Key < B.Key; });
+		for (int32 Index = 0; Index < NumToDelete; Index++)
+		{
+			IFileManager::Get().Delete(*ByAge[Index].Value);
+		}
+	}
+}
+
+static void AppendMetricsCSV(const FMAMetricsSnapshot& Current, const FMAMetricsSnapshot& Previous)
+{
+	RotateMetricsCSV();
+	FString Time = FDateTime::UtcNow().ToIso8601();
+	FString Rows;
+	for (int32 Counter = 0; Counter < NumCounters; Counter++)
+	{
+		Rows += FString::Printf(TEXT("%s,%s,counter,%lld,%lld,,,,") LINE_TERMINATOR, *Time, CounterDefinitions[Counter].Name,
+			Current.Counters[Counter], Current.Counters[Counter] - Previous.Counters[Counter]);
+	}
+	for (int32 Gauge = 0; Gauge < NumGauges; Gauge++)
+	{
+		Rows += FString::Printf(TEXT("%s,%s,gauge,%lld,,,,,") LINE_TERMINATOR, *Time, GaugeDefinitions[Gauge].Name, Current.Gauges[Gauge]);
+	}
+	for (int32 Histogram = 0; Histogram < NumHistograms; Histogram++)
+	{
+		Rows += FString::Printf(TEXT("%s,%s,histogram,%lld,%lld"), *Time, HistogramDefinitions[Histogram].Name,
+			Current.HistogramTotals[Histogram], Current.HistogramTotals[Histogram] - Previous.HistogramTotals[Histogram]);
+		for (double Quantile : ExportQuantiles)
+		{
+			Rows += FString::Printf(TEXT(",%g"), GetIntervalQuantile(Current, Previous, Histogram, Quantile));
+		}
+		Rows += LINE_TERMINATOR;
+	}
+	FFileHelper::SaveStringToFile(Rows, *MetricsCSVPath, FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), FILEWRITE_Append);
+}
+
+//A few KB of text per export, cheap enough to just do on the game thread.
+void FMAMetrics::Export()
+{
+	static TUniquePtr<FMAMetricsSnapshot> Previous = MakeUnique<FMAMetricsSnapshot>();
+	TUniquePtr<FMAMetricsSnapshot> Current = MakeUnique<FMAMetricsSnapshot>();
+	TakeMetricsSnapshot(*Current);
+	IFileManager::Get().MakeDirectory(*GetMetricsDir(), true);
+	WritePrometheusFile(*Current, *Previous);
+	AppendMetricsCSV(*Current, *Previous);
+	Previous = MoveTemp(Current);
+}
+
+//Traces per frame comes from the trace counter, so the trace sites stay a single relaxed add. Runs every frame, so no lock.
+static void RecordFrameMetrics()
+{
+	static int64 LastFrameTraces = 0;
+	int64 Traces = 0;
+	int32 ShardCount = FPlatformAtomics::AtomicRead(&NumShards);
+	for (int32 ShardIndex = 0; ShardIndex < ShardCount; ShardIndex++)
+	{
+		Traces += FPlatformAtomics::AtomicRead_Relaxed(&Shards[ShardIndex]->Counters[(int32)EMACounter::BotTraces]);
+	}
+	FMAMetrics::Record(EMAHistogram::BotTracesPerFrame, Traces - LastFrameTraces);
+	LastFrameTraces = Traces;
+}
+
+static FDelayedAutoRegisterHelper GRegisterMidairMetrics(EDelayedRegisterRunPhase::EndOfEngineInit, []()
+{
+	FCoreDelegates::OnEndFrame.AddStatic(&RecordFrameMetrics);
+	FCoreDelegates::OnPreExit.AddLambda([]()
+	{
+		IFileManager::Get().Delete(*GetPrometheusPath(), false, false, true);
+	});
+	//checks once a second so interval changes take effect without re-registering anything
+	FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([](float DeltaTime)
+	{
+		static double LastExportTime = FPlatformTime::Seconds();
+		float Interval = CVarMetricsInterval.GetValueOnGameThread();
+		double Now = FPlatformTime::Seconds();
+		if (Interval > 0.0f && Now - LastExportTime >= Interval)
+		{
+			LastExportTime = Now;
+			FMAMetrics::Export();
+		}
+		return true;
+	}), 1.0f);
+});
+
+static FAutoConsoleCommand CmdMetricsExport(
+	TEXT("ma.MetricsExport"),
+	TEXT("Writes the metrics files in Saved/Metrics right now."),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		FMAMetrics::Export();
+		UE_LOG(LogTemp, Display, TEXT("Metrics written to %s"), *GetMetricsDir());
+	}));
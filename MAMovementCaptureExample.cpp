@@ -0,0 +1,378 @@
+/**
+
+Always-on movement capture on dedicated servers.
+Good cap routes only used to get into route libraries when someone sat in practice mode and recorded them by hand. Now the server keeps the
+last MovementCaptureSeconds of every player's movement in a small quantized ring buffer, sampled at the route recording rate. When something
+worth keeping happens (a cap, a fast grab, a long midair) the relevant window is copied out and turned into an FMARouteTrail on a worker thread.
+Captured routes collect in a per map, per team library saved in the practice data format, so it loads like any other practice file and
+bots/drills can run the routes straight away.
+Routes come out with the practice recorder's layout, a marker every ModulusForPathRecordMarkers samples with inputs and the grab timed
+from every sample, so the route follower plays them back at the right speed.
+Per player cost on the game thread is one ~20 byte write per recording tick, and the ring is allocated once.
+
+*/
+
+#include "MidairCE.h"
+#include "MAPracticeComponent.h"
+#include "MAMovementCapture.h"
+#include "MAMemoryAccounting.h"
+#include "MAGameplayEvents.h"
+#include "MAMatchHostEngine.h"
+#include "Player/AIPlayerController.h"
+#include "Player/MACharacter.h"
+#include "Game/CTF/MACTFFlagBase.h"
+#include "GameFramework/CharacterMovementComponent.h"
+#include "JsonObjectConverter.h"
+#include "Async/Async.h"
+#include "Misc/PackageName.h"
+
+static TAutoConsoleVariable<int32> CVarRouteAutoCapture(
+	TEXT("routes.AutoCapture"),
+	1,
+	TEXT("Capture player movement on dedicated servers and keep caps, fast grabs and midairs as routes."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarRouteCaptureFastGrabKph(
+	TEXT("routes.CaptureFastGrabKph"),
+	180.0f,
+	TEXT("Grabs at or above this speed are kept as routes even if they don't end in a cap."),
+	ECVF_Default);
+
+//how much movement each player keeps, long enough to cover the lead in plus a slow cap
+static const float MovementCaptureSeconds = 45.0f;
+//how much of the run before the grab counts as part of the route
+static const float CaptureLeadInSeconds = 12.0f;
+//how long we keep following a fast grab before promoting it, if they don't cap first
+static const float CaptureFollowThroughSeconds = 6.0f;
+//for midairs, the movement leading up to the shot
+static const float CaptureMidairSeconds = 8.0f;
+//midairs closer than this are just a scrappy fight, not worth a route
+static const float CaptureMidairMinDistance = 3000.0f;
+//letting go of the flag this close to our own stand while alive is a cap
+static const float CaptureCapRadius = 1000.0f;
+//routes kept per map and team, fastest caps and newest highlights
+static const int32 MaxCapturedRoutesPerSet = 50;
+
+//positions in 8 unit steps fit +-262k units in an int16, velocity in 1 unit/s steps, health/energy in hundredths
+static const float CaptureLocationScale = 8.0f;
+static const float CaptureVitalsScale = 100.0f;
+//top bit of Flags, the rest are EPlayerRecordableInputTypes bits
+static const uint16 CaptureHoldingFlagBit = 0x8000;
+
+//One quantized marker, 22 bytes.
+struct FMAMovementCaptureSample
+{
+	int16 Location[3];
+	int16 Velocity[3];
+	uint16 Pitch;
+	uint16 Yaw;
+	uint16 Health;
+	uint16 Energy;
+	uint16 Flags;
+};
+
+static int16 QuantizeCaptureValue(float Value, float Scale)
+{
+	return (int16)FMath::Clamp(FMath::RoundToInt(Value / Scale), -32768, 32767);
+}
+
+static FMAMovementCaptureSample QuantizeCaptureSample(AMACharacter* Character, const FRotator& ControlRotation, uint16 Flags)
+{
+	FMAMovementCaptureSample Sample;
+	FVector Location = Character->GetActorLocation();
+	FVector Velocity = Character->GetVelocity();
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		Sample.Location[Axis] = QuantizeCaptureValue(Location[Axis], CaptureLocationScale);
+		Sample.Velocity[Axis] = QuantizeCaptureValue(Velocity[Axis], 1.0f);
+	}
+	Sample.Pitch = FRotator::CompressAxisToShort(ControlRotation.Pitch);
+	Sample.Yaw = FRotator::CompressAxisToShort(ControlRotation.Yaw);
+	Sample.Health = (uint16)FMath::Clamp(FMath::RoundToInt(Character->GetHealth() * CaptureVitalsScale), 0, 65535);
+	Sample.Energy = (uint16)FMath::Clamp(FMath::RoundToInt(Character->GetEnergy() * CaptureVitalsScale), 0, 65535);
+	Sample.Flags = Flags;
+	return Sample;
+}
+
+//The server doesn't see key presses, so work the movement keys out from which way the character is accelerating relative to where they look.
+static uint16 GetCaptureInputFlags(AMACharacter* Character, const FRotator& ControlRotation)
+{
+	FVector Acceleration = FRotator(0.0f, ControlRotation.Yaw, 0.0f).UnrotateVector(Character->GetCharacterMovement()->GetCurrentAcceleration());
+	float Threshold = Acceleration.Size() * 0.3f;
+	uint16 Flags = 0;
+	if (Threshold > KINDA_SMALL_NUMBER)
+	{
+		Flags |= Acceleration.X > Threshold ? 1u << (uint8)EPlayerRecordableInputTypes::Forward : 0;
+		Flags |= Acceleration.X < -Threshold ? 1u << (uint8)EPlayerRecordableInputTypes::Backwards : 0;
+		Flags |= Acceleration.Y > Threshold ? 1u << (uint8)EPlayerRecordableInputTypes::Right : 0;
+		Flags |= Acceleration.Y < -Threshold ? 1u << (uint8)EPlayerRecordableInputTypes::Left : 0;
+	}
+	return Flags;
+}
+
+//Worker thread. Same layout the practice route recorder writes: a marker every MarkerModulus samples, inputs and the grab stamped
+//with the time of the sample they happened on. Built from the quantized window instead of live samples.
+static FMARouteTrail BuildRouteFromCapture(const TArray<FMAMovementCaptureSample>& Window, float SampleInterval, int32 MarkerModulus)
+{
+	MA_LLM_SCOPE(RouteData);
+	FMARouteTrail Route;
+	Route.MarkerLocations.Reserve(FMath::DivideAndRoundUp(Window.Num(), MarkerModulus));
+	uint16 LastInputFlags = 0;
+	bool bHasGrabbed = false;
+	for (int32 SampleIndex = 0; SampleIndex < Window.Num(); SampleIndex++)
+	{
+		const FMAMovementCaptureSample& Sample = Window[SampleIndex];
+		if (SampleIndex % MarkerModulus == 0)
+		{
+			FPlayerLocationAndState& Marker = Route.MarkerLocations.AddDefaulted_GetRef();
+			Marker.Location = FVector(Sample.Location[0], Sample.Location[1], Sample.Location[2]) * CaptureLocationScale;
+			Marker.Velocity = FVector(Sample.Velocity[0], Sample.Velocity[1], Sample.Velocity[2]);
+			Marker.Rotation = FRotator(FRotator::DecompressAxisFromShort(Sample.Pitch), FRotator::DecompressAxisFromShort(Sample.Yaw), 0.0f);
+			Marker.Health = Sample.Health / CaptureVitalsScale;
+			Marker.Energy = Sample.Energy / CaptureVitalsScale;
+		}
+
+		uint16 InputFlags = Sample.Flags & ~CaptureHoldingFlagBit;
+		uint16 ChangedInputs = InputFlags ^ LastInputFlags;
+		for (uint8 InputIndex = 0; ChangedInputs != 0 && InputIndex < (uint8)EPlayerRecordableInputTypes::MAX; InputIndex++)
+		{
+			uint16 InputBit = 1u << InputIndex;
+			if (ChangedInputs & InputBit)
+			{
+				FMARecordedInput& RecordedInput = Route.RecordedInputs.AddDefaulted_GetRef();
+				RecordedInput.InputType = (EPlayerRecordableInputTypes)InputIndex;
+				RecordedInput.bPressed = (InputFlags & InputBit) != 0;
+				RecordedInput.TimeStamp = SampleIndex * SampleInterval;
+			}
+		}
+		LastInputFlags = InputFlags;
+
+		if ((Sample.Flags & CaptureHoldingFlagBit) && !bHasGrabbed)
+		{
+			bHasGrabbed = true;
+			Route.GrabTime = SampleIndex * SampleInterval;
+		}
+	}
+	return Route;
+}
+
+//Called from TickComponent. Server only, and only for human players, bots are already running routes.
+void UMAPracticeComponent::TickMovementCapture(float DeltaTime)
+{
+	AMACharacter* Character = GetControlledCharacter();
+	if (Character == nullptr || GetNetMode() != NM_DedicatedServer || ParentController->IsA<AAIPlayerController>()
+		|| CVarRouteAutoCapture.GetValueOnGameThread() == 0)
+	{
+		return;
+	}
+	if (MovementCaptureRing.Num() == 0)
+	{
+		//one allocation for the life of the player, from here on we only overwrite the oldest sample
+		MovementCaptureRing.SetNumUninitialized(FMath::CeilToInt(MovementCaptureSeconds / PathRecordMarkerInterval));
+		MovementCaptureSampleCount = 0;
+		MovementCaptureGrabSample = INDEX_NONE;
+		//midairs come from the damage code, the sample stream can't see them
+		FMAGameplayEvents::Subscribe<FMAMidairHitEvent>(GetWorld(), this, [this](const FMAMidairHitEvent& Event)
+		{
+			AMACharacter* Shooter = Event.Instigator.Get();
+			AMACharacter* Victim = Event.Victim.Get();
+			if (Shooter != nullptr && Victim != nullptr && Shooter->GetController() == ParentController
+				&& FVector::Dist(Shooter->GetActorLocation(), Victim->GetActorLocation()) >= CaptureMidairMinDistance)
+			{
+				NotifyMovementCaptureEvent(EMAMovementCaptureEvent::Midair);
+			}
+		});
+	}
+	MovementCaptureAccumulator += DeltaTime;
+	if (MovementCaptureAccumulator < PathRecordMarkerInterval)
+	{
+		return;
+	}
+	MovementCaptureAccumulator = FMath::Min(MovementCaptureAccumulator - PathRecordMarkerInterval, PathRecordMarkerInterval);
+
+	bool bHoldingFlag = Character->CarriedObject != nullptr;
+	bool bWasHoldingFlag = MovementCaptureSampleCount > 0
+		&& (MovementCaptureRing[(MovementCaptureSampleCount - 1) % MovementCaptureRing.Num()].Flags & CaptureHoldingFlagBit) != 0;
+	FRotator ControlRotation = ParentController->GetControlRotation();
+	uint16 Flags = GetCaptureInputFlags(Character, ControlRotation) | (bHoldingFlag ? CaptureHoldingFlagBit : 0);
+	MovementCaptureRing[MovementCaptureSampleCount % MovementCaptureRing.Num()] = QuantizeCaptureSample(Character, ControlRotation, Flags);
+	MovementCaptureSampleCount++;
+
+	int64 LeadInSamples = FMath::CeilToInt(CaptureLeadInSeconds / PathRecordMarkerInterval);
+	if (bHoldingFlag && !bWasHoldingFlag)
+	{
+		MovementCaptureGrabSample = MovementCaptureSampleCount - 1;
+		bMovementCaptureFastGrab = Character->GetVelocity().Size() * 0.036f >= CVarRouteCaptureFastGrabKph.GetValueOnGameThread();
+	}
+	else if (!bHoldingFlag && bWasHoldingFlag && MovementCaptureGrabSample != INDEX_NONE)
+	{
+		//let go of the flag. Caps let go at our own stand while still alive, anything else is a drop or a death.
+		bool bCapped = false;
+		if (Character->GetHealth() > 0.0f)
+		{
+			for (TActorIterator<AMACTFFlagBase> ActorItr(GetWorld()); ActorItr; ++ActorItr)
+			{
+				if ((*ActorItr)->GetTeamId() == Character->GetTeamId())
+				{
+					bCapped = FVector::Dist((*ActorItr)->GetActorLocation(), Character->GetActorLocation()) < CaptureCapRadius;
+					break;
+				}
+			}
+		}
+		if (bCapped)
+		{
+			PromoteCapturedMovement(EMAMovementCaptureEvent::Cap, MovementCaptureGrabSample - LeadInSamples, MovementCaptureSampleCount);
+		}
+		else if (bMovementCaptureFastGrab)
+		{
+			PromoteCapturedMovement(EMAMovementCaptureEvent::FastGrab, MovementCaptureGrabSample - LeadInSamples, MovementCaptureSampleCount);
+		}
+		MovementCaptureGrabSample = INDEX_NONE;
+		bMovementCaptureFastGrab = false;
+	}
+	else if (bMovementCaptureFastGrab && MovementCaptureSampleCount - MovementCaptureGrabSample >= FMath::CeilToInt(CaptureFollowThroughSeconds / PathRecordMarkerInterval))
+	{
+		//still carrying a while after a fast grab, keep the grab now. We keep watching for the cap.
+		PromoteCapturedMovement(EMAMovementCaptureEvent::FastGrab, MovementCaptureGrabSample - LeadInSamples, MovementCaptureSampleCount);
+		bMovementCaptureFastGrab = false;
+	}
+}
+
+//For events the sample stream can't see on its own, e.g. Midair for the shooter when a long midair lands.
+void UMAPracticeComponent::NotifyMovementCaptureEvent(EMAMovementCaptureEvent Event)
+{
+	int64 WindowSamples = FMath::CeilToInt(CaptureMidairSeconds / PathRecordMarkerInterval);
+	PromoteCapturedMovement(Event, MovementCaptureSampleCount - WindowSamples, MovementCaptureSampleCount);
+}
+
+//Copies samples [FirstSample, EndSample) out of the ring and builds the route from them in the background.
+void UMAPracticeComponent::PromoteCapturedMovement(EMAMovementCaptureEvent Event, int64 FirstSample, int64 EndSample)
+{
+	AMACharacter* Character = GetControlledCharacter();
+	if (Character == nullptr || MovementCaptureRing.Num() == 0)
+	{
+		return;
+	}
+	//anything older than the ring has already been overwritten
+	FirstSample = FMath::Max3(FirstSample, MovementCaptureSampleCount - MovementCaptureRing.Num(), (int64)0);
+	if (EndSample - FirstSample < 2)
+	{
+		return;
+	}
+	//the raw window is a few KB, everything else happens off the game thread
+	TArray<FMAMovementCaptureSample> Window;
+	Window.Reserve(EndSample - FirstSample);
+	for (int64 SampleIndex = FirstSample; SampleIndex < EndSample; SampleIndex++)
+	{
+		Window.Add(MovementCaptureRing[SampleIndex % MovementCaptureRing.Num()]);
+	}
+
+	//the ring is sampled every recording tick, routes only keep a marker every ModulusForPathRecordMarkers of them
+	float SampleInterval = PathRecordMarkerInterval;
+	int32 MarkerModulus = FMath::Max(ModulusForPathRecordMarkers, 1);
+	FString PlayerName = ParentController->PlayerState != nullptr ? ParentController->PlayerState->GetPlayerName() : TEXT("Player");
+	//the map on disk, not this match's instanced copy of it, so every match on a map adds to the same set
+	FString MapName = FPackageName::GetShortName(UMAMatchHostEngine::GetSourceMapName(GetWorld()));
+	uint8 TeamId = Character->GetTeamId();
+	Async(EAsyncExecution::ThreadPool, [Window = MoveTemp(Window), SampleInterval, MarkerModulus, PlayerName, MapName, TeamId, Event]()
+	{
+		FMARouteTrail Route = BuildRouteFromCapture(Window, SampleInterval, MarkerModulus);
+		const TCHAR* EventName = Event == EMAMovementCaptureEvent::Cap ? TEXT("Cap") : Event == EMAMovementCaptureEvent::FastGrab ? TEXT("Grab") : TEXT("Midair");
+		Route.Name = FString::Printf(TEXT("%s %s %.1fs"), *PlayerName, EventName, Window.Num() * SampleInterval);
+		AsyncTask(ENamedThreads::GameThread, [MapName, TeamId, Event, Route = MoveTemp(Route)]() mutable
+		{
+			FMACapturedRouteLibrary::Get().AddRoute(MapName, TeamId, Event, MoveTemp(Route));
+		});
+	});
+}
+
+FMACapturedRouteLibrary& FMACapturedRouteLibrary::Get()
+{
+	static FMACapturedRouteLibrary Library;
+	return Library;
+}
+
+//Game thread. Caps and highlights are kept in separate files per map and team, caps sorted fastest first.
+//Only queues the route, loading, sorting and saving the set all happen on a worker.
+void FMACapturedRouteLibrary::AddRoute(const FString& MapName, uint8 TeamId, EMAMovementCaptureEvent Event, FMARouteTrail&& Route)
+{
+	check(IsInGameThread());
+	bool bIsCap = Event == EMAMovementCaptureEvent::Cap;
+	FString SetName = FString::Printf(TEXT("%s_Team%d_%s"), *MapName, TeamId, bIsCap ? TEXT("Caps") : TEXT("Highlights"));
+	FMACapturedRouteSet& Set = RouteSets.FindOrAdd(SetName);
+	Set.MapName = MapName;
+	Set.bCaps = bIsCap;
+	Set.PendingRoutes.Add(MoveTemp(Route));
+	SaveRouteSet(SetName);
+}
+
+FString FMACapturedRouteLibrary::GetRouteSetPath(const FString& SetName)
+{
+	return FPaths::ProjectSavedDir() / TEXT("CapturedRoutes") / SetName + TEXT(".json");
+}
+
+//One worker job per set at a time, anything added while one is in flight goes out in one more job after it.
+//The set's routes are moved to the worker and back rather than copied, so the game thread never touches more than the new route.
+void FMACapturedRouteLibrary::SaveRouteSet(const FString& SetName)
+{
+	FMACapturedRouteSet& Set = RouteSets.FindChecked(SetName);
+	if (Set.bSaveInFlight || Set.PendingRoutes.Num() == 0)
+	{
+		return;
+	}
+	Set.bSaveInFlight = true;
+
+	FMAMapPracticeData Data;
+	Data.MapName = Set.MapName;
+	Data.Author = TEXT("Server capture");
+	Data.RouteTrails = MoveTemp(Set.Routes);
+	TArray<FMARouteTrail> NewRoutes = MoveTemp(Set.PendingRoutes);
+	bool bLoaded = Set.bLoaded;
+	bool bCaps = Set.bCaps;
+	FString Path = GetRouteSetPath(SetName);
+	Async(EAsyncExecution::ThreadPool, [Data = MoveTemp(Data), NewRoutes = MoveTemp(NewRoutes), bLoaded, bCaps, Path, SetName]() mutable
+	{
+		MA_LLM_SCOPE(RouteData);
+		if (!bLoaded)
+		{
+			//pick up what previous server runs captured, once, so we add to the library rather than replace it
+			FString JSONPracticeData;
+			FMAMapPracticeData SavedData;
+			if (FFileHelper::LoadFileToString(JSONPracticeData, *Path)
+				&& FJsonObjectConverter::JsonObjectStringToUStruct(JSONPracticeData, &SavedData, 0, 0))
+			{
+				Data.RouteTrails = MoveTemp(SavedData.RouteTrails);
+			}
+		}
+
+		TArray<FMARouteTrail>& Routes = Data.RouteTrails;
+		Routes.Append(MoveTemp(NewRoutes));
+		if (bCaps)
+		{
+			//markers are a fixed interval apart, so fewer markers is a faster cap
+			Routes.Sort([](const FMARouteTrail& A, const FMARouteTrail& B) { return A.MarkerLocations.Num() < B.MarkerLocations.Num(); });
+			if (Routes.Num() > MaxCapturedRoutesPerSet)
+			{
+				Routes.SetNum(MaxCapturedRoutesPerSet);
+			}
+		}
+		else if (Routes.Num() > MaxCapturedRoutesPerSet)
+		{
+			Routes.RemoveAt(0, Routes.Num() - MaxCapturedRoutesPerSet);
+		}
+
+		FString JSONPracticeData;
+		if (!FJsonObjectConverter::UStructToJsonObjectString(Data, JSONPracticeData) || !FFileHelper::SaveStringToFile(JSONPracticeData, *Path))
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Couldn't save captured routes to %s"), *Path);
+		}
+		AsyncTask(ENamedThreads::GameThread, [SetName, Routes = MoveTemp(Data.RouteTrails)]() mutable
+		{
+			FMACapturedRouteSet& FinishedSet = FMACapturedRouteLibrary::Get().RouteSets.FindChecked(SetName);
+			FinishedSet.Routes = MoveTemp(Routes);
+			FinishedSet.bLoaded = true;
+			FinishedSet.bSaveInFlight = false;
+			FMACapturedRouteLibrary::Get().SaveRouteSet(SetName);
+		});
+	});
+}
@@ -12,18 +12,16 @@ void UMAPracticeComponent::SaveAllPracticeDataToFile()
 	{
 		return;
 	}
-	FMAMapPracticeData MapPracticeDataToSave;
+	FMAMapPracticeData MapPracticeDataToSave = GetPracticeData();
 	//Currently we just allow a single map per file, could improve this later to allow multiple maps.
 	MapPracticeDataToSave.MapName = GetWorld()->GetMapName();
-	MapPracticeDataToSave.RouteTrails = RouteTrails;
-	MapPracticeDataToSave.Drills = Drills;
-	MapPracticeDataToSave.Bots = MapPracticeData.Bots;
-	MapPracticeDataToSave.Locations = MapPracticeData.Locations;
 	MapPracticeDataToSave.Author = ParentController->PlayerState->GetPlayerName();
-	MapPracticeDataToSave.Tutorials = MapPracticeData.Tutorials;
 	FString JSONPracticeData = "";
 
+	//the file dialog is left out, we only want what we spend serializing and writing
+	double SaveStartTime = FPlatformTime::Seconds();
 	FJsonObjectConverter::UStructToJsonObjectString(MapPracticeDataToSave, JSONPracticeData);
+	double SerializeSeconds = FPlatformTime::Seconds() - SaveStartTime;
 
 	/**
 	* Upload practice data to the API
@@ -57,7 +55,9 @@ void UMAPracticeComponent::SaveAllPracticeDataToFile()
 			{
 				// Get absolute file path
 				FString AbsoluteFilePath = SaveDirectory + "/" + FileName;
+				double WriteStartTime = FPlatformTime::Seconds();
 				FFileHelper::SaveStringToFile(TextToSave, *AbsoluteFilePath);
+				FMAMetrics::Record(EMAHistogram::PracticeSaveTime, FMath::RoundToInt((SerializeSeconds + FPlatformTime::Seconds() - WriteStartTime) * 1000000.0));
 			}
 		}
 	}
@@ -73,20 +73,12 @@ void UMAPracticeComponent::StartSelectedDrillOrTutorial(bool bIsTutorial)
 	}
 	DrillResultMessage = "";
 	DrillKillCounter = 0;
+	FMAMetrics::Increment(EMACounter::DrillsStarted);
+	DrillStartRealTime = FPlatformTime::Seconds();
 	DrillMidairCounter = 0;
 	bIsActiveSpeedDrill = SelectedDrill.VictoryType == EDrillVictoryType::MovementSpeed;
-
-	if (!SelectedDrill.LeaveOldBots)
-	{
-		KillAllBots();
-	}
-
-
-	//delete any previously spawned victory locations.
-	if (IsValid(SpawnedDrillVictoryLocation) && SpawnedDrillVictoryLocation->IsPendingKillPending() == false && SpawnedDrillVictoryLocation->IsPendingKill() == false) {
-		SpawnedDrillVictoryLocation->Destroy();
-		SpawnedDrillVictoryLocation = nullptr;
-	}
+	//kills, midairs, hits and flag catches all come in as gameplay events while the drill runs
+	SubscribeToDrillEvents();
 
 	//teleport player to drill/tutorial start location, if one is configured
 	FPlayerLocationAndState PlayerSpawnLocation = SelectedDrill.InitialPlayerNamedLocation.LocationAndState;
@@ -107,12 +99,12 @@ void UMAPracticeComponent::StartSelectedDrillOrTutorial(bool bIsTutorial)
 
 		}
 	}
+	//drills without a length just run until they are won or lost, no timer at all
+	FMAAITimingWheel& TimingWheel = FMAAITimingWheel::Get(GetWorld());
+	TimingWheel.Cancel(AITimer_DrillLength);
 	if (SelectedDrill.DrillLength > 0.0f)
 	{
-		ParentController->GetWorldTimerManager().SetTimer(TimerHandle_DrillLength, this, &UMAPracticeComponent::EndCurrentDrillByTimeout, SelectedDrill.DrillLength, true, SelectedDrill.DrillLength);
-	}
-	else {
-		ParentController->GetWorldTimerManager().SetTimer(TimerHandle_DrillLength, this, &UMAPracticeComponent::EndCurrentDrillByTimeout, 9999.0f, true, 9999.0f);
+		AITimer_DrillLength = TimingWheel.Schedule(this, SelectedDrill.DrillLength, [this]() { EndCurrentDrillByTimeout(); });
 	}
 	if (SelectedDrill.ResetFlagsOnStart)
 	{
@@ -125,7 +117,7 @@ void UMAPracticeComponent::StartSelectedDrillOrTutorial(bool bIsTutorial)
 	//drill struct contains just bot names, so pull down the full bot object and fetch the routes they know
 	TArray<FMABotConfig> BotsForDrill;
 	TSet<FString> RoutesBotsKnow;
-	for (FMABotConfig BotConfig : MapPracticeData.Bots)
+	for (const FMABotConfig& BotConfig : GetPracticeData().Bots)
 	{
 		if (SelectedDrill.BotNames.Contains(BotConfig.Name))
 		{
@@ -156,8 +148,16 @@ void UMAPracticeComponent::StartSelectedDrillOrTutorial(bool bIsTutorial)
 		}
 	}
 
-	//if there is an end location marked, spawn it
-	if (!SelectedDrill.VictoryLocation.Name.IsEmpty())
+	//if there is an end location marked, spawn it, or move the one from the last drill if we still have it.
+	bool bHasVictoryLocation = IsValid(SpawnedDrillVictoryLocation) && SpawnedDrillVictoryLocation->IsPendingKillPending() == false && SpawnedDrillVictoryLocation->IsPendingKill() == false;
+	if (SelectedDrill.VictoryLocation.Name.IsEmpty())
+	{
+		if (bHasVictoryLocation)
+		{
+			SetDrillVictoryLocationActive(false);
+		}
+	}
+	else
 	{
 		FMANamedLocation VictoryLoc = SelectedDrill.VictoryLocation;
 		if (AMAPlayerState* PS = Cast<AMAPlayerState>(ParentController->PlayerState))
@@ -168,20 +168,199 @@ void UMAPracticeComponent::StartSelectedDrillOrTutorial(bool bIsTutorial)
 			}
 		}
 
-		ADrillVictoryLocation* VictoryLocation = GetControlledCharacter()->GetWorld()->SpawnActor<ADrillVictoryLocation>(DrillVictoryLocationBluePrintClass,
-			VictoryLoc.LocationAndState.Location, VictoryLoc.LocationAndState.Rotation);
-		VictoryLocation->LocationAndState = VictoryLoc.LocationAndState;
-		VictoryLocation->SetSize(SelectedDrill.VictoryLocationRadius, SelectedDrill.VictoryLocationHalfHeight);
-		SpawnedDrillVictoryLocation = VictoryLocation;
+		if (bHasVictoryLocation)
+		{
+			SpawnedDrillVictoryLocation->SetActorLocationAndRotation(VictoryLoc.LocationAndState.Location, VictoryLoc.LocationAndState.Rotation);
+		}
+		else {
+			SpawnedDrillVictoryLocation = GetControlledCharacter()->GetWorld()->SpawnActor<ADrillVictoryLocation>(DrillVictoryLocationBluePrintClass,
+				VictoryLoc.LocationAndState.Location, VictoryLoc.LocationAndState.Rotation);
+		}
+		SpawnedDrillVictoryLocation->LocationAndState = VictoryLoc.LocationAndState;
+		SpawnedDrillVictoryLocation->SetSize(SelectedDrill.VictoryLocationRadius, SelectedDrill.VictoryLocationHalfHeight);
+		SetDrillVictoryLocationActive(true);
+	}
+
+
+	//Then, start any routes we can start immediately. Bots still alive from the last drill get reused where they match, so retrying is quick.
+	//watchers only look at the bots, so they get them as a ghost feed rather than replicated characters
+	SetDrillGhostFeedEnabled(bIsDrillRunningAsWatcher);
+	ServerSyncDrillBots(BotsToSpawnForDrill, SelectedDrill.LeaveOldBots);
+
+}
+
+//how long bots parked at the end of a drill wait for the next drill before we get rid of them
+static const float ParkedDrillBotTimeout = 120.0f;
+
+//Server side. Diffs the bots this drill wants against the bots our last drill left behind, resetting the ones we can reuse
+//and only spawning/removing the difference. Retrying the same drill then doesn't pay for any bot spawns at all.
+//Only ever touches this player's own drill bots, other players' drills and the match's bots are left alone.
+void UMAPracticeComponent::ServerSyncDrillBots_Implementation(const TArray<FMABotConfig>& BotsForDrill, bool bLeaveOldBots)
+{
+	FMAAITimingWheel::Get(GetWorld()).Cancel(AITimer_DestroyParkedDrillBots);
+	DrillBots.RemoveAll([](const TWeakObjectPtr<AAIPlayerController>& DrillBot) { return !DrillBot.IsValid() || DrillBot->IsPendingKill(); });
+	TArray<FMABotConfig> BotsToSpawn = BotsForDrill;
+	if (!bLeaveOldBots)
+	{
+		TArray<AAIPlayerController*> UnneededBots;
+		for (const TWeakObjectPtr<AAIPlayerController>& DrillBot : DrillBots)
+		{
+			AAIPlayerController* AIPC = DrillBot.Get();
+			//each live bot can stand in for one bot of the same config in the new drill
+			int32 NeededBotIndex = BotsToSpawn.IndexOfByPredicate([AIPC](const FMABotConfig& Bot) { return Bot.Name.Equals(AIPC->BC.Name); });
+			if (NeededBotIndex != INDEX_NONE && ResetDrillBot(AIPC, BotsToSpawn[NeededBotIndex]))
+			{
+				BotsToSpawn.RemoveAtSwap(NeededBotIndex);
+			}
+			else {
+				UnneededBots.Add(AIPC);
+			}
+		}
+		for (AAIPlayerController* AIPC : UnneededBots)
+		{
+			DestroyDrillBot(AIPC);
+			DrillBots.Remove(AIPC);
+		}
+	}
+	for (const FMABotConfig& Bot : BotsToSpawn)
+	{
+		if (AAIPlayerController* AIPC = SpawnBotInternal(Bot))
+		{
+			DrillBots.Add(AIPC);
+		}
+	}
+	//our drill bots run routes from this player's practice data
+	for (const TWeakObjectPtr<AAIPlayerController>& DrillBot : DrillBots)
+	{
+		DrillBot->RouteFollower->SetRouteSource(this);
+	}
+}
+
+void UMAPracticeComponent::ServerSpawnBot_Implementation(const FMABotConfig& Bot)
+{
+	SpawnBotInternal(Bot);
+}
+
+//Server side. Spawns a bot with this config and gives it a body, returning its controller so drills know which bot is theirs.
+AAIPlayerController* UMAPracticeComponent::SpawnBotInternal(const FMABotConfig& Bot)
+{
+	AGameModeBase* GameMode = GetWorld()->GetAuthGameMode();
+	if (GameMode == nullptr)
+	{
+		return nullptr;
+	}
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	AAIPlayerController* AIPC = GetWorld()->SpawnActor<AAIPlayerController>(AAIPlayerController::StaticClass(), SpawnParams);
+	if (AIPC == nullptr)
+	{
+		return nullptr;
+	}
+	AIPC->SetBotConfig(Bot);
+	GameMode->RestartPlayer(AIPC);
+	return AIPC;
+}
+
+void UMAPracticeComponent::DestroyDrillBot(AAIPlayerController* AIPC)
+{
+	if (APawn* BotPawn = AIPC->GetPawn())
+	{
+		BotPawn->Destroy();
+	}
+	AIPC->Destroy();
+}
+
+//Server side. Gets rid of every bot our drills left in the world, parked or not.
+void UMAPracticeComponent::DestroyDrillBots()
+{
+	FMAAITimingWheel::Get(GetWorld()).Cancel(AITimer_DestroyParkedDrillBots);
+	for (const TWeakObjectPtr<AAIPlayerController>& DrillBot : DrillBots)
+	{
+		if (DrillBot.IsValid() && !DrillBot->IsPendingKill())
+		{
+			DestroyDrillBot(DrillBot.Get());
+		}
+	}
+	DrillBots.Reset();
+}
+
+//Our bots go with us, this is also how they get cleaned up when the player logs out and their controller is destroyed.
+void UMAPracticeComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	UWorld* World = GetWorld();
+	if (World != nullptr && !World->bIsTearingDown && GetOwner()->HasAuthority())
+	{
+		DestroyDrillBots();
+	}
+	Super::EndPlay(EndPlayReason);
+}
+
+//Puts a live bot back into the state a freshly spawned one would be in. Returns false if it can't be reused (ie, it's dead), so we respawn it instead.
+bool UMAPracticeComponent::ResetDrillBot(AAIPlayerController* AIPC, const FMABotConfig& Bot)
+{
+	AMACharacter* BotCharacter = Cast<AMACharacter>(AIPC->GetPawn());
+	if (BotCharacter == nullptr || BotCharacter->IsPendingKill() || FMath::IsNearlyZero(BotCharacter->GetHealth()))
+	{
+		return false;
 	}
+	UMABotAIComponent* BotComponent = BotCharacter->FindComponentByClass<UMABotAIComponent>();
+	if (BotComponent == nullptr)
+	{
+		return false;
+	}
+	//stop whatever route it was on, the bot picks a fresh one (and teleports onto it) the next time it ticks
+	AIPC->RouteFollower->StopRoute();
+	AIPC->SetBotConfig(Bot);
 
+	//non route bots go back to a spawn point like they had just respawned
+	if (Bot.BotType != EBotTypes::RouteRunner)
+	{
+		if (AActor* StartSpot = GetWorld()->GetAuthGameMode()->ChoosePlayerStart(AIPC))
+		{
+			BotCharacter->TeleportTo(StartSpot->GetActorLocation(), StartSpot->GetActorRotation());
+		}
+	}
+	BotCharacter->GetCharacterMovement()->StopMovementImmediately();
+	BotCharacter->GetVitals()->SetHealth(BotCharacter->GetMaxHealth());
+	BotCharacter->GetVitals()->SetEnergy(100.0f);
+	BotComponent->ResetForDrill();
+	return true;
+}
 
-	//Then, start any routes we can start immediately:
-	for (FMABotConfig Bot : BotsToSpawnForDrill)
+//Victory locations are hidden between drills rather than destroyed, so starting the next drill can just move it.
+void UMAPracticeComponent::SetDrillVictoryLocationActive(bool bActive)
+{
+	if (!IsValid(SpawnedDrillVictoryLocation))
 	{
-		ServerSpawnBot(Bot);
+		return;
 	}
+	SpawnedDrillVictoryLocation->SetActorHiddenInGame(!bActive);
+	SpawnedDrillVictoryLocation->SetActorEnableCollision(bActive);
+}
 
+//Server side. Leaves the drill's bots in the world but stops them doing anything until the next drill start picks them back up.
+//If no drill does within ParkedDrillBotTimeout, they are destroyed.
+void UMAPracticeComponent::ServerParkDrillBots_Implementation()
+{
+	for (const TWeakObjectPtr<AAIPlayerController>& DrillBot : DrillBots)
+	{
+		AAIPlayerController* AIPC = DrillBot.Get();
+		if (AIPC == nullptr)
+		{
+			continue;
+		}
+		if (AMACharacter* BotCharacter = Cast<AMACharacter>(AIPC->GetPawn()))
+		{
+			if (UMABotAIComponent* BotComponent = BotCharacter->FindComponentByClass<UMABotAIComponent>())
+			{
+				AIPC->RouteFollower->StopRoute();
+				BotComponent->SetParked(true);
+			}
+		}
+	}
+	FMAAITimingWheel& TimingWheel = FMAAITimingWheel::Get(GetWorld());
+	TimingWheel.Cancel(AITimer_DestroyParkedDrillBots);
+	AITimer_DestroyParkedDrillBots = TimingWheel.Schedule(this, ParkedDrillBotTimeout, [this]() { DestroyDrillBots(); });
 }
 
 void UMAPracticeComponent::EndCurrentDrillByTimeout()
@@ -192,14 +371,12 @@ void UMAPracticeComponent::EndCurrentDrillByTimeout()
 	if (SelectedDrill.VictoryType == EDrillVictoryType::NoFlagCarrier)
 	{
 		bDrillWon = true;
-		//For NoFlagCarrier, we just loop through the flag actors and see if they are being held by a bot. If they are, we lose. Otherwise, win.
-		for (TActorIterator<AMACTFFlag> ActorItr(GetWorld()); ActorItr; ++ActorItr)
+		//For NoFlagCarrier, we just check whether either flag is being held by a bot. If it is, we lose. Otherwise, win.
+		for (const FMATrackedFlag& Flag : FMAFlagTracker::Get(GetWorld()).GetFlags())
 		{
-			// Same as with the Object Iterator, access the subclass instance with the * or -> operators.
-			AMACTFFlag *Flag = *ActorItr;
-			if (Flag->Holder != nullptr)
+			if (Flag.Holder.IsValid())
 			{
-				if (AMAPlayerState* AIPS = Cast<AMAPlayerState>(Flag->Holder->PlayerState))
+				if (AMAPlayerState* AIPS = Cast<AMAPlayerState>(Flag.Holder->PlayerState))
 				{
 					AMAPlayerState* PS = Cast<AMAPlayerState>(ParentController->PlayerState);
 					if (AIPS->GetTeamId() != PS->GetTeamId())
@@ -216,18 +393,20 @@ void UMAPracticeComponent::EndCurrentDrillByTimeout()
 
 void UMAPracticeComponent::EndCurrentDrill(bool bDrillWon)
 {
-	ParentController->GetWorldTimerManager().ClearTimer(TimerHandle_DrillLength);
+	FMAAITimingWheel::Get(GetWorld()).Cancel(AITimer_DrillLength);
+	UnsubscribeFromDrillEvents();
+	FMAMetrics::Increment(bDrillWon ? EMACounter::DrillsWon : EMACounter::DrillsLost);
+	FMAMetrics::Record(EMAHistogram::DrillDuration, FMath::RoundToInt((FPlatformTime::Seconds() - DrillStartRealTime) * 1000.0));
+	//bots stay around (parked) for a quick retry, the next drill start decides which of them are still needed
 	if (!SelectedDrill.LeaveOldBots)
 	{
-		KillAllBots();
+		ServerParkDrillBots();
 	}
 
 	bIsActiveSpeedDrill = false;
+	SetDrillGhostFeedEnabled(false);
 
-	if (IsValid(SpawnedDrillVictoryLocation) && SpawnedDrillVictoryLocation->IsPendingKillPending() == false && SpawnedDrillVictoryLocation->IsPendingKill() == false) {
-		SpawnedDrillVictoryLocation->Destroy();
-		SpawnedDrillVictoryLocation = nullptr;
-	}
+	SetDrillVictoryLocationActive(false);
 
 
 	if (bDrillWon)
@@ -318,5 +497,7 @@ void UMAPracticeComponent::EndCurrentDrill(bool bDrillWon)
 	}
 
 
-	ParentController->GetWorldTimerManager().SetTimer(TimerHandle_DrillMessageClear, this, &UMAPracticeComponent::ClearDrillResultMessage, 5.0f, true, 5.0f);
+	FMAAITimingWheel& TimingWheel = FMAAITimingWheel::Get(GetWorld());
+	TimingWheel.Cancel(AITimer_DrillMessageClear);
+	AITimer_DrillMessageClear = TimingWheel.Schedule(this, 5.0f, [this]() { ClearDrillResultMessage(); });
 }
\ No newline at end of file
@@ -0,0 +1,130 @@
+/**
+
+Server-wide cache of loaded practice data, keyed by a hash of the file contents.
+On a practice server it's common for most players to load the same community practice file. Rather than every UMAPracticeComponent
+parsing and holding its own copy of the routes, drills, bots and tutorials, components point at a shared immutable dataset and only take
+a private copy the first time the player edits something (records a route, saves a location, edits a drill, etc).
+Memory and load time then scale with the number of distinct practice files in use, not with the number of players.
+
+*/
+
+#include "MidairCE.h"
+#include "MAPracticeComponent.h"
+#include "MAPracticeDataCache.h"
+#include "MAMemoryAccounting.h"
+#include "MAMetrics.h"
+#include "JsonObjectConverter.h"
+#include "Misc/SecureHash.h"
+
+FMAPracticeDataCache& FMAPracticeDataCache::Get()
+{
+	static FMAPracticeDataCache Cache;
+	return Cache;
+}
+
+FSHAHash FMAPracticeDataCache::HashPracticeDataString(const FString& JSONPracticeData)
+{
+	FTCHARToUTF8 UTF8Data(*JSONPracticeData);
+	FSHAHash Hash;
+	FSHA1::HashBuffer(UTF8Data.Get(), UTF8Data.Length(), Hash.Hash);
+	return Hash;
+}
+
+//Game thread only. Returns the already loaded dataset for this exact file contents if anyone is still using it, otherwise parses it and remembers it.
+TSharedPtr<const FMAMapPracticeData> FMAPracticeDataCache::FindOrLoad(const FString& JSONPracticeData, FSHAHash& OutHash)
+{
+	check(IsInGameThread());
+	MA_LLM_SCOPE(PracticeData);
+	OutHash = HashPracticeDataString(JSONPracticeData);
+	if (TWeakPtr<const FMAMapPracticeData>* CachedData = Datasets.Find(OutHash))
+	{
+		if (TSharedPtr<const FMAMapPracticeData> SharedData = CachedData->Pin())
+		{
+			return SharedData;
+		}
+	}
+
+	TSharedPtr<FMAMapPracticeData> LoadedData = MakeShared<FMAMapPracticeData>();
+	if (!FJsonObjectConverter::JsonObjectStringToUStruct(JSONPracticeData, LoadedData.Get(), 0, 0))
+	{
+		return nullptr;
+	}
+	//we only hold weak refs, so a dataset is freed as soon as the last player using it loads something else or leaves.
+	Datasets.Add(OutHash, LoadedData);
+	PruneExpired();
+	return LoadedData;
+}
+
+void FMAPracticeDataCache::PruneExpired()
+{
+	for (auto It = Datasets.CreateIterator(); It; ++It)
+	{
+		if (!It.Value().IsValid())
+		{
+			It.RemoveCurrent();
+		}
+	}
+}
+
+//Read-only view of this player's practice data. Everything that doesn't modify practice data should go through here.
+const FMAMapPracticeData& UMAPracticeComponent::GetPracticeData() const
+{
+	static const FMAMapPracticeData EmptyPracticeData;
+	return PracticeData.IsValid() ? *PracticeData : EmptyPracticeData;
+}
+
+//Copy-on-write access for edits. The first edit after loading a shared dataset copies it so other players don't see our changes.
+FMAMapPracticeData& UMAPracticeComponent::EditPracticeData()
+{
+	MA_LLM_SCOPE(PracticeData);
+	if (!PracticeData.IsValid())
+	{
+		PracticeData = MakeShared<FMAMapPracticeData>();
+		bOwnsPracticeData = true;
+	}
+	else if (!bOwnsPracticeData)
+	{
+		PracticeData = MakeShared<FMAMapPracticeData>(*PracticeData);
+		bOwnsPracticeData = true;
+	}
+	//no longer matches the file we loaded, so it can't be found by hash anymore.
+	PracticeDataHash = FSHAHash();
+	//only the game thread ever writes through here, so it's fine to cast away the const we hand out to readers.
+	return const_cast<FMAMapPracticeData&>(*PracticeData);
+}
+
+bool UMAPracticeComponent::LoadPracticeDataFromString(const FString& JSONPracticeData)
+{
+	FMAMetricScopeTimer LoadTimer(EMAHistogram::PracticeLoadTime);
+	FSHAHash LoadedHash;
+	TSharedPtr<const FMAMapPracticeData> LoadedData = FMAPracticeDataCache::Get().FindOrLoad(JSONPracticeData, LoadedHash);
+	if (!LoadedData.IsValid())
+	{
+		return false;
+	}
+	PracticeData = LoadedData;
+	PracticeDataHash = LoadedHash;
+	bOwnsPracticeData = false;
+	//remote players get the same data by hash, from their own cache if they've had it before
+	if (GetOwnerRole() == ROLE_Authority && ParentController != nullptr && !ParentController->IsLocalController())
+	{
+		AdvertisePracticeDataset();
+	}
+	return true;
+}
+
+void UMAPracticeComponent::LoadPracticeDataFromFile(const FString& FileName)
+{
+	if (!IsPracticeModeCommandEnabled())
+	{
+		return;
+	}
+	FString JSONPracticeData;
+	if (!FFileHelper::LoadFileToString(JSONPracticeData, *FileName) || !LoadPracticeDataFromString(JSONPracticeData))
+	{
+		if (AMAPlayerController* PC = Cast<AMAPlayerController>(ParentController))
+		{
+			PC->ClientSay_Implementation(nullptr, TEXT("Failed to load practice data file."), false);
+		}
+	}
+}
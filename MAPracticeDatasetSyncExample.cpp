@@ -0,0 +1,431 @@
+/**
+
+Hash addressed practice data for clients joining a practice server.
+When the server runs drills or tutorials from its own practice file, clients didn't have the routes to draw trails or preview routes,
+so everything had to be replicated live. Now the server advertises the practice data it loaded for a player as a manifest: the
+SHA1 of the whole dataset plus the SHA1 of each 64KB chunk of it. The client keeps a disk cache keyed by those hashes under
+Saved/PracticeCache:
+- the whole dataset already cached, nothing is transferred at all (the usual repeat join)
+- otherwise only the chunks it doesn't have are requested, so a tutorial the server tweaked only costs the chunks that changed
+Requested chunks come down in the background over the same compressed, selectively acked chunked transfer route uploads use, under a
+per client byte rate. Every chunk and the reassembled dataset are checked against the manifest before anything is cached or loaded.
+
+*/
+
+#include "MidairCE.h"
+#include "MAPracticeComponent.h"
+#include "MAPracticeDataCache.h"
+#include "MAChunkedTransfer.h"
+#include "MAMemoryAccounting.h"
+#include "JsonObjectConverter.h"
+#include "Misc/SecureHash.h"
+#include "Async/Async.h"
+
+static TAutoConsoleVariable<int32> CVarPracticeDatasetRate(
+	TEXT("ma.PracticeDatasetRate"),
+	128 * 1024,
+	TEXT("Bytes per second the server sends to each client while they download its practice data."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarPracticeCacheMB(
+	TEXT("ma.PracticeCacheMB"),
+	256,
+	TEXT("Size of the client's practice data cache in Saved/PracticeCache, least recently used files are deleted past it."),
+	ECVF_Default);
+
+static const int32 DatasetChunkSize = 64 * 1024;
+//each chunk is its own chunked transfer, this many at once per client keeps the link busy without holding every chunk in flight
+static const int32 MaxConcurrentDatasetChunks = 4;
+static const int32 MaxDatasetSize = 64 * 1024 * 1024;
+
+//What the server keeps of a dataset it advertises, shared by every player it loaded the same practice file for.
+struct FMAPublishedPracticeDataset
+{
+	FSHAHash Hash;
+	TArray<uint8> Payload;
+	TArray<FSHAHash> ChunkHashes;
+};
+
+static FString GetPracticeCacheDir()
+{
+	return FPaths::ProjectSavedDir() / TEXT("PracticeCache");
+}
+
+static FString GetCachedDatasetPath(const FSHAHash& Hash)
+{
+	return GetPracticeCacheDir() / Hash.ToString() + TEXT(".json");
+}
+
+static FString GetCachedChunkPath(const FSHAHash& Hash)
+{
+	return GetPracticeCacheDir() / TEXT("Chunks") / Hash.ToString();
+}
+
+static FSHAHash HashBytes(const uint8* Data, int32 Size)
+{
+	FSHAHash Hash;
+	FSHA1::HashBuffer(Data, Size, Hash.Hash);
+	return Hash;
+}
+
+//Loads a cached file if it's there and still matches its hash, and marks it as recently used.
+static bool LoadCachedFile(const FString& Path, const FSHAHash& Hash, TArray<uint8>& OutBytes)
+{
+	if (!FFileHelper::LoadFileToArray(OutBytes, *Path, FILEREAD_Silent) || HashBytes(OutBytes.GetData(), OutBytes.Num()) != Hash)
+	{
+		OutBytes.Reset();
+		return false;
+	}
+	IFileManager::Get().SetTimeStamp(*Path, FDateTime::UtcNow());
+	return true;
+}
+
+//Worker thread. Deletes the least recently used cache files until the cache fits its budget again.
+static void TrimPracticeCache()
+{
+	TArray<FString> CachedFiles;
+	IFileManager::Get().FindFilesRecursive(CachedFiles, *GetPracticeCacheDir(), TEXT("*"), true, false);
+	TArray<TPair<FDateTime, FString>> ByAge;
+	int64 TotalBytes = 0;
+	for (const FString& CachedFile : CachedFiles)
+	{
+		TotalBytes += IFileManager::Get().FileSize(*CachedFile);
+		ByAge.Emplace(IFileManager::Get().GetTimeStamp(*CachedFile), CachedFile);
+	}
+	int64 MaxBytes = (int64)CVarPracticeCacheMB.GetValueOnAnyThread() * 1024 * 1024;
+	ByAge.Sort([](const TPair<FDateTime, FString>& A, const TPair<FDateTime, FString>& B) { return A.Key < B.Key; });
+	for (int32 Index = 0; Index < ByAge.Num() && TotalBytes > MaxBytes; Index++)
+	{
+		TotalBytes -= IFileManager::Get().FileSize(*ByAge[Index].Value);
+		IFileManager::Get().Delete(*ByAge[Index].Value);
+	}
+}
+
+//Server. The practice data exactly as clients will receive it. Files loaded by several players are only serialized and hashed once.
+static TSharedPtr<const FMAPublishedPracticeDataset> PublishPracticeDataset(const FMAMapPracticeData& PracticeData, const FSHAHash& SourceHash)
+{
+	static TMap<FSHAHash, TWeakPtr<const FMAPublishedPracticeDataset>> Published;
+	bool bShareable = SourceHash != FSHAHash();
+	if (bShareable)
+	{
+		if (TSharedPtr<const FMAPublishedPracticeDataset> Existing = Published.FindRef(SourceHash).Pin())
+		{
+			return Existing;
+		}
+	}
+	MA_LLM_SCOPE(PracticeData);
+	FString JSONPracticeData;
+	FJsonObjectConverter::UStructToJsonObjectString(PracticeData, JSONPracticeData);
+	FTCHARToUTF8 UTF8Data(*JSONPracticeData);
+	TSharedPtr<FMAPublishedPracticeDataset> Dataset = MakeShared<FMAPublishedPracticeDataset>();
+	Dataset->Payload.Append((const uint8*)UTF8Data.Get(), UTF8Data.Length());
+	//same hash FMAPracticeDataCache gives the string, so the client's load lands on the same cache entry
+	Dataset->Hash = HashBytes(Dataset->Payload.GetData(), Dataset->Payload.Num());
+	for (int32 Offset = 0; Offset < Dataset->Payload.Num(); Offset += DatasetChunkSize)
+	{
+		Dataset->ChunkHashes.Add(HashBytes(Dataset->Payload.GetData() + Offset, FMath::Min(DatasetChunkSize, Dataset->Payload.Num() - Offset)));
+	}
+	if (bShareable)
+	{
+		for (auto It = Published.CreateIterator(); It; ++It)
+		{
+			if (!It.Value().IsValid())
+			{
+				It.RemoveCurrent();
+			}
+		}
+		Published.Add(SourceHash, Dataset);
+	}
+	return Dataset;
+}
+
+//Server, whenever practice data is loaded for a remote player. Tells their client what to fetch, the client asks for what it's missing.
+void UMAPracticeComponent::AdvertisePracticeDataset()
+{
+	const FMAMapPracticeData& Data = GetPracticeData();
+	if (Data.RouteTrails.Num() + Data.Drills.Num() + Data.Tutorials.Num() == 0)
+	{
+		return;
+	}
+	PublishedPracticeDataset = PublishPracticeDataset(Data, PracticeDataHash);
+	if (PublishedPracticeDataset->Payload.Num() > MaxDatasetSize)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Practice data is %d bytes, too big to send to clients"), PublishedPracticeDataset->Payload.Num());
+		PublishedPracticeDataset.Reset();
+		return;
+	}
+	//a new advertisement makes any chunks still going out for the old one pointless
+	PracticeDatasetSerial++;
+	PendingDatasetSends.Reset();
+	RequestedDatasetChunks.Reset();
+
+	FMAPracticeDatasetManifest Manifest;
+	Manifest.Serial = PracticeDatasetSerial;
+	Manifest.Size = PublishedPracticeDataset->Payload.Num();
+	Manifest.DatasetHash.Append(PublishedPracticeDataset->Hash.Hash, sizeof(FSHAHash::Hash));
+	for (const FSHAHash& ChunkHash : PublishedPracticeDataset->ChunkHashes)
+	{
+		Manifest.ChunkHashes.Append(ChunkHash.Hash, sizeof(FSHAHash::Hash));
+	}
+	ClientAdvertisePracticeDataset(Manifest);
+}
+
+void UMAPracticeComponent::ClientAdvertisePracticeDataset_Implementation(const FMAPracticeDatasetManifest& Manifest)
+{
+	int32 NumChunks = FMath::DivideAndRoundUp(Manifest.Size, DatasetChunkSize);
+	if (Manifest.Size <= 0 || Manifest.Size > MaxDatasetSize || Manifest.DatasetHash.Num() != sizeof(FSHAHash::Hash)
+		|| Manifest.ChunkHashes.Num() != NumChunks * sizeof(FSHAHash::Hash))
+	{
+		return;
+	}
+	IncomingDatasetSerial = Manifest.Serial;
+	IncomingDatasetSize = Manifest.Size;
+	FMemory::Memcpy(IncomingDatasetHash.Hash, Manifest.DatasetHash.GetData(), sizeof(FSHAHash::Hash));
+	IncomingDatasetChunkHashes.SetNum(NumChunks);
+	for (int32 ChunkIndex = 0; ChunkIndex < NumChunks; ChunkIndex++)
+	{
+		FMemory::Memcpy(IncomingDatasetChunkHashes[ChunkIndex].Hash, Manifest.ChunkHashes.GetData() + ChunkIndex * sizeof(FSHAHash::Hash), sizeof(FSHAHash::Hash));
+	}
+	IncomingDatasetChunks.Reset();
+	IncomingDatasetChunks.SetNum(NumChunks);
+	NumIncomingDatasetChunks = 0;
+	ReceivingDatasetChunks.Reset();
+	if (IncomingDatasetHash == ServerPracticeDataHash)
+	{
+		return;
+	}
+
+	//disk reads (and hashing them) happen off the game thread, we only come back with what was found
+	TWeakObjectPtr<UMAPracticeComponent> WeakThis(this);
+	uint16 Serial = Manifest.Serial;
+	FSHAHash DatasetHash = IncomingDatasetHash;
+	TArray<FSHAHash> ChunkHashes = IncomingDatasetChunkHashes;
+	Async(EAsyncExecution::ThreadPool, [WeakThis, Serial, DatasetHash, ChunkHashes]()
+	{
+		TArray<uint8> Dataset;
+		TArray<TArray<uint8>> CachedChunks;
+		CachedChunks.SetNum(ChunkHashes.Num());
+		if (!LoadCachedFile(GetCachedDatasetPath(DatasetHash), DatasetHash, Dataset))
+		{
+			for (int32 ChunkIndex = 0; ChunkIndex < ChunkHashes.Num(); ChunkIndex++)
+			{
+				LoadCachedFile(GetCachedChunkPath(ChunkHashes[ChunkIndex]), ChunkHashes[ChunkIndex], CachedChunks[ChunkIndex]);
+			}
+		}
+		AsyncTask(ENamedThreads::GameThread, [WeakThis, Serial, Dataset = MoveTemp(Dataset), CachedChunks = MoveTemp(CachedChunks)]() mutable
+		{
+			UMAPracticeComponent* This = WeakThis.Get();
+			if (This == nullptr || This->IncomingDatasetSerial != Serial)
+			{
+				return;
+			}
+			if (Dataset.Num() > 0)
+			{
+				This->OnPracticeDatasetReady(Dataset, false);
+				return;
+			}
+			TArray<int32> MissingChunks;
+			for (int32 ChunkIndex = 0; ChunkIndex < CachedChunks.Num(); ChunkIndex++)
+			{
+				if (CachedChunks[ChunkIndex].Num() > 0)
+				{
+					This->IncomingDatasetChunks[ChunkIndex] = MoveTemp(CachedChunks[ChunkIndex]);
+					This->NumIncomingDatasetChunks++;
+				}
+				else {
+					MissingChunks.Add(ChunkIndex);
+				}
+			}
+			if (MissingChunks.Num() > 0)
+			{
+				This->ServerRequestPracticeDatasetChunks(Serial, MissingChunks);
+			}
+			else {
+				This->AssembleIncomingDataset();
+			}
+		});
+	});
+}
+
+bool UMAPracticeComponent::ServerRequestPracticeDatasetChunks_Validate(uint16 Serial, const TArray<int32>& ChunkIndexes)
+{
+	return ChunkIndexes.Num() <= FMath::DivideAndRoundUp(MaxDatasetSize, DatasetChunkSize);
+}
+
+void UMAPracticeComponent::ServerRequestPracticeDatasetChunks_Implementation(uint16 Serial, const TArray<int32>& ChunkIndexes)
+{
+	if (Serial != PracticeDatasetSerial || !PublishedPracticeDataset.IsValid())
+	{
+		return;
+	}
+	for (int32 ChunkIndex : ChunkIndexes)
+	{
+		if (PublishedPracticeDataset->ChunkHashes.IsValidIndex(ChunkIndex))
+		{
+			RequestedDatasetChunks.AddUnique(ChunkIndex);
+		}
+	}
+}
+
+//Server, from TickComponent. Streams requested chunks to this player's client, a few at a time, within the byte rate.
+void UMAPracticeComponent::TickPracticeDatasetSends(float DeltaTime)
+{
+	if (!PublishedPracticeDataset.IsValid() || (PendingDatasetSends.Num() == 0 && RequestedDatasetChunks.Num() == 0))
+	{
+		return;
+	}
+	float BytesPerSecond = CVarPracticeDatasetRate.GetValueOnGameThread();
+	//same budget rules as route uploads, a little carry over but no bursts
+	PracticeDatasetByteBudget = FMath::Min(PracticeDatasetByteBudget + BytesPerSecond * DeltaTime, BytesPerSecond * 0.1f);
+
+	for (auto It = PendingDatasetSends.CreateIterator(); It; ++It)
+	{
+		if (It.Value().IsComplete())
+		{
+			It.RemoveCurrent();
+		}
+	}
+	while (PendingDatasetSends.Num() < MaxConcurrentDatasetChunks && RequestedDatasetChunks.Num() > 0)
+	{
+		int32 ChunkIndex = RequestedDatasetChunks[0];
+		RequestedDatasetChunks.RemoveAt(0);
+		const TArray<uint8>& Payload = PublishedPracticeDataset->Payload;
+		int32 Offset = ChunkIndex * DatasetChunkSize;
+		TArray<uint8> ChunkBytes(Payload.GetData() + Offset, FMath::Min(DatasetChunkSize, Payload.Num() - Offset));
+		//the transfer id carries the chunk and which advertisement it belongs to
+		uint32 TransferId = ((uint32)PracticeDatasetSerial << 16) | (uint32)ChunkIndex;
+		PendingDatasetSends.Add(TransferId).Begin(TransferId, ChunkBytes);
+	}
+
+	double Now = FPlatformTime::Seconds();
+	TArray<FMATransferChunk> ChunksToSend;
+	for (TPair<uint32, FMAChunkedTransferSender>& Send : PendingDatasetSends)
+	{
+		if (PracticeDatasetByteBudget <= 0.0f)
+		{
+			break;
+		}
+		ChunksToSend.Reset();
+		Send.Value.GatherChunksToSend(Now, (int32)PracticeDatasetByteBudget, ChunksToSend);
+		for (const FMATransferChunk& Chunk : ChunksToSend)
+		{
+			PracticeDatasetByteBudget -= Chunk.Data.Num();
+			ClientPracticeDatasetChunk(Chunk);
+		}
+	}
+}
+
+bool UMAPracticeComponent::ServerPracticeDatasetChunkAck_Validate(uint32 TransferId, int32 ContiguousAcked, uint32 AckBits)
+{
+	return true;
+}
+
+void UMAPracticeComponent::ServerPracticeDatasetChunkAck_Implementation(uint32 TransferId, int32 ContiguousAcked, uint32 AckBits)
+{
+	if (FMAChunkedTransferSender* Sender = PendingDatasetSends.Find(TransferId))
+	{
+		Sender->OnAck(ContiguousAcked, AckBits);
+	}
+}
+
+void UMAPracticeComponent::ClientPracticeDatasetChunk_Implementation(const FMATransferChunk& Chunk)
+{
+	uint16 Serial = Chunk.TransferId >> 16;
+	int32 ChunkIndex = Chunk.TransferId & 0xFFFF;
+	if (Serial != IncomingDatasetSerial || !IncomingDatasetChunks.IsValidIndex(ChunkIndex))
+	{
+		return;
+	}
+	//already have it, the server just hasn't seen our ack yet
+	if (IncomingDatasetChunks[ChunkIndex].Num() > 0)
+	{
+		ServerPracticeDatasetChunkAck(Chunk.TransferId, Chunk.NumChunks, 0);
+		return;
+	}
+	FMAChunkedTransferReceiver& Receiver = ReceivingDatasetChunks.FindOrAdd(Chunk.TransferId);
+	bool bComplete = Receiver.ReceiveChunk(Chunk);
+	int32 ContiguousAcked = 0;
+	uint32 AckBits = 0;
+	Receiver.GetAck(ContiguousAcked, AckBits);
+	ServerPracticeDatasetChunkAck(Chunk.TransferId, ContiguousAcked, AckBits);
+	if (Receiver.HasFailed())
+	{
+		//bad or oversized chunk header, start this chunk over rather than leave the dataset waiting on it forever
+		ReceivingDatasetChunks.Remove(Chunk.TransferId);
+		ServerRequestPracticeDatasetChunks(Serial, { ChunkIndex });
+		return;
+	}
+	if (!bComplete)
+	{
+		return;
+	}
+
+	TArray<uint8> ChunkBytes;
+	bool bValid = Receiver.Finish(ChunkBytes) && HashBytes(ChunkBytes.GetData(), ChunkBytes.Num()) == IncomingDatasetChunkHashes[ChunkIndex];
+	ReceivingDatasetChunks.Remove(Chunk.TransferId);
+	if (!bValid)
+	{
+		//ask again rather than trust it, the transfer's crc already passed so this should never happen short of a bad server
+		ServerRequestPracticeDatasetChunks(Serial, { ChunkIndex });
+		return;
+	}
+	//chunks are cached on their own too, so a changed dataset only has to fetch the chunks that changed
+	FString ChunkPath = GetCachedChunkPath(IncomingDatasetChunkHashes[ChunkIndex]);
+	Async(EAsyncExecution::ThreadPool, [ChunkPath, ChunkBytes]()
+	{
+		FFileHelper::SaveArrayToFile(ChunkBytes, *ChunkPath);
+	});
+	IncomingDatasetChunks[ChunkIndex] = MoveTemp(ChunkBytes);
+	NumIncomingDatasetChunks++;
+	if (NumIncomingDatasetChunks == IncomingDatasetChunks.Num())
+	{
+		AssembleIncomingDataset();
+	}
+}
+
+void UMAPracticeComponent::AssembleIncomingDataset()
+{
+	TArray<uint8> Dataset;
+	Dataset.Reserve(IncomingDatasetSize);
+	for (const TArray<uint8>& ChunkBytes : IncomingDatasetChunks)
+	{
+		Dataset.Append(ChunkBytes);
+	}
+	IncomingDatasetChunks.Reset();
+	if (Dataset.Num() != IncomingDatasetSize || HashBytes(Dataset.GetData(), Dataset.Num()) != IncomingDatasetHash)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Practice data from the server didn't match its hash, ignoring it"));
+		return;
+	}
+	OnPracticeDatasetReady(Dataset, true);
+}
+
+//Client, once the advertised dataset is in memory, from the cache or the server.
+void UMAPracticeComponent::OnPracticeDatasetReady(const TArray<uint8>& Dataset, bool bFromServer)
+{
+	if (bFromServer)
+	{
+		FString DatasetPath = GetCachedDatasetPath(IncomingDatasetHash);
+		Async(EAsyncExecution::ThreadPool, [DatasetPath, Dataset]()
+		{
+			FFileHelper::SaveArrayToFile(Dataset, *DatasetPath);
+			TrimPracticeCache();
+		});
+	}
+	FString JSONPracticeData;
+	FFileHelper::BufferToString(JSONPracticeData, Dataset.GetData(), Dataset.Num());
+	FSHAHash LoadedHash;
+	TSharedPtr<const FMAMapPracticeData> LoadedData = FMAPracticeDataCache::Get().FindOrLoad(JSONPracticeData, LoadedHash);
+	if (!LoadedData.IsValid())
+	{
+		return;
+	}
+	ServerPracticeData = LoadedData;
+	ServerPracticeDataHash = IncomingDatasetHash;
+	//players working on their own practice data keep it, everyone else now has the server's routes, drills and tutorials
+	if (!bOwnsPracticeData && GetPracticeData().RouteTrails.Num() + GetPracticeData().Drills.Num() == 0)
+	{
+		PracticeData = LoadedData;
+		PracticeDataHash = LoadedHash;
+	}
+}
@@ -0,0 +1,174 @@
+/**
+
+Practice mode rewind. Keeps the last few seconds of the player's full practice state in a fixed size ring buffer
+so they can scrub back through a run and retry from any point, rather than only from a single saved position.
+Frames are taken at a fixed rate (at most one per tick) so finding the frame for "N seconds ago" is just index math,
+and the buffer is allocated once when rewind is turned on, so sampling never allocates.
+
+*/
+
+#include "MidairCE.h"
+#include "MAPracticeComponent.h"
+#include "Player/MACharacter.h"
+#include "MAGameplayEvents.h"
+#include "Game/CTF/MACTFFlag.h"
+
+//Everything we put back on restore. Location/rotation/velocity/energy/health go through the same LoadPosition path as saved positions.
+struct FMAPracticeRewindFrame
+{
+	FVector Location;
+	FRotator Rotation;
+	FVector Velocity;
+	float Energy;
+	float Health;
+	float WeaponHeat;
+	//team id of the flag we were carrying, or INDEX_NONE
+	int32 HeldFlagTeam;
+};
+
+void UMAPracticeComponent::EnableRewind(bool bEnable)
+{
+	bRewindEnabled = bEnable && IsPracticeModeCommandEnabled();
+	if (bRewindEnabled)
+	{
+		//one allocation up front for the whole window, we just overwrite the oldest frame from here on.
+		int32 Capacity = FMath::CeilToInt(RewindWindowSeconds * RewindSampleRate) + 1;
+		RewindFrames.SetNumUninitialized(Capacity);
+	}
+	else {
+		RewindFrames.Empty();
+	}
+	RewindHead = 0;
+	RewindCount = 0;
+	RewindSampleAccumulator = 0.0f;
+	bIsScrubbingRewind = false;
+}
+
+//Called from TickComponent.
+void UMAPracticeComponent::TickRewindBuffer(float DeltaTime)
+{
+	AMACharacter* Character = GetControlledCharacter();
+	if (!bRewindEnabled || bIsScrubbingRewind || Character == nullptr || RewindFrames.Num() == 0)
+	{
+		return;
+	}
+	//fixed sample rate so frame index maps straight to time. If we are running slower than the sample rate we just take one per tick.
+	RewindSampleAccumulator += DeltaTime;
+	float SampleInterval = 1.0f / RewindSampleRate;
+	if (RewindSampleAccumulator < SampleInterval)
+	{
+		return;
+	}
+	RewindSampleAccumulator = FMath::Min(RewindSampleAccumulator - SampleInterval, SampleInterval);
+
+	RewindHead = (RewindHead + 1) % RewindFrames.Num();
+	RewindCount = FMath::Min(RewindCount + 1, RewindFrames.Num());
+
+	FMAPracticeRewindFrame& Frame = RewindFrames[RewindHead];
+	Frame.Location = Character->GetActorLocation();
+	Frame.Rotation = ParentController->GetControlRotation();
+	Frame.Velocity = Character->GetVelocity();
+	Frame.Energy = Character->GetEnergy();
+	Frame.Health = Character->GetHealth();
+	Frame.WeaponHeat = Character->Weapon != nullptr ? Character->Weapon->Heat : 0.0f;
+	Frame.HeldFlagTeam = Character->CarriedObject != nullptr ? Character->CarriedObject->GetTeamId() : INDEX_NONE;
+}
+
+float UMAPracticeComponent::GetRewindAvailableSeconds() const
+{
+	return RewindCount > 1 ? (RewindCount - 1) / RewindSampleRate : 0.0f;
+}
+
+//Frames are stored newest at RewindHead, so N samples back is just a wrap around the ring.
+const FMAPracticeRewindFrame& UMAPracticeComponent::GetRewindFrame(int32 SamplesAgo) const
+{
+	SamplesAgo = FMath::Clamp(SamplesAgo, 0, RewindCount - 1);
+	int32 Index = (RewindHead - SamplesAgo + RewindFrames.Num()) % RewindFrames.Num();
+	return RewindFrames[Index];
+}
+
+//Freeze sampling while the player drags through the window, otherwise we'd be recording the scrub itself.
+void UMAPracticeComponent::BeginRewindScrub()
+{
+	if (!bRewindEnabled || RewindCount == 0)
+	{
+		return;
+	}
+	bIsScrubbingRewind = true;
+	RewindScrubSecondsAgo = 0.0f;
+}
+
+//Puts the player at the state SecondsAgo back. Blends between the two nearest frames so dragging the scrub bar is smooth.
+void UMAPracticeComponent::ScrubRewind(float SecondsAgo)
+{
+	AMACharacter* Character = GetControlledCharacter();
+	if (!bIsScrubbingRewind || Character == nullptr || RewindCount == 0)
+	{
+		return;
+	}
+	RewindScrubSecondsAgo = FMath::Clamp(SecondsAgo, 0.0f, GetRewindAvailableSeconds());
+	float SamplesAgo = RewindScrubSecondsAgo * RewindSampleRate;
+	int32 NewerSample = FMath::FloorToInt(SamplesAgo);
+	float Alpha = SamplesAgo - NewerSample;
+	const FMAPracticeRewindFrame& Newer = GetRewindFrame(NewerSample);
+	const FMAPracticeRewindFrame& Older = GetRewindFrame(NewerSample + 1);
+
+	FPlayerLocationAndState State;
+	State.Location = FMath::Lerp(Newer.Location, Older.Location, Alpha);
+	State.Rotation = FMath::Lerp(Newer.Rotation, Older.Rotation, Alpha);
+	State.Velocity = FMath::Lerp(Newer.Velocity, Older.Velocity, Alpha);
+	State.Energy = FMath::Lerp(Newer.Energy, Older.Energy, Alpha);
+	State.Health = FMath::Lerp(Newer.Health, Older.Health, Alpha);
+	LoadPosition(State, true);
+
+	if (Character->Weapon != nullptr)
+	{
+		Character->Weapon->Heat = FMath::Lerp(Newer.WeaponHeat, Older.WeaponHeat, Alpha);
+	}
+	//flag state doesn't blend, use whichever frame we are closer to
+	RestoreRewindFlagState(Alpha < 0.5f ? Newer.HeldFlagTeam : Older.HeldFlagTeam);
+}
+
+//Resume play from the scrubbed point. Anything newer than it is no longer part of this run, so drop it from the window.
+void UMAPracticeComponent::EndRewindScrub()
+{
+	if (!bIsScrubbingRewind)
+	{
+		return;
+	}
+	int32 SamplesAgo = FMath::Clamp(FMath::RoundToInt(RewindScrubSecondsAgo * RewindSampleRate), 0, RewindCount - 1);
+	RewindHead = (RewindHead - SamplesAgo + RewindFrames.Num()) % RewindFrames.Num();
+	RewindCount -= SamplesAgo;
+	RewindSampleAccumulator = 0.0f;
+	bIsScrubbingRewind = false;
+}
+
+//Single step rewind for a keybind, e.g. "retry from 3 seconds ago".
+void UMAPracticeComponent::RewindBySeconds(float SecondsAgo)
+{
+	BeginRewindScrub();
+	ScrubRewind(SecondsAgo);
+	EndRewindScrub();
+}
+
+void UMAPracticeComponent::RestoreRewindFlagState(int32 HeldFlagTeam)
+{
+	AMACharacter* Character = GetControlledCharacter();
+	int32 CurrentFlagTeam = Character->CarriedObject != nullptr ? Character->CarriedObject->GetTeamId() : INDEX_NONE;
+	if (CurrentFlagTeam == HeldFlagTeam)
+	{
+		return;
+	}
+	//we picked up a flag after the point we are rewinding to, so put the flags back first
+	if (CurrentFlagTeam != INDEX_NONE)
+	{
+		ResetFlags();
+	}
+	if (HeldFlagTeam != INDEX_NONE)
+	{
+		if (const FMATrackedFlag* Flag = FMAFlagTracker::Get(GetWorld()).FindFlag(HeldFlagTeam))
+		{
+			Flag->Flag->SetHolder(Character);
+		}
+	}
+}
@@ -0,0 +1,345 @@
+/**
+
+Route playback for bots.
+Bots used to run routes through a full UMAPracticeComponent on every AI controller, the same component a human uses for practice mode,
+so each bot carried drill state, recording buffers, its own copy of the practice data and the full copy of whatever route it was on.
+UMARouteFollowerComponent is all a bot actually needs: where it is on the route, the few playback options, and a pointer to the route.
+Routes are resolved once through the practice component of the player whose drill the bots belong to, and shared between every bot
+running the same route from the same practice file, so ten bots on one route hold one copy of it. The component only ticks while a
+route is playing. Position, velocity and aim come from the markers, jetting and firing from the route's recorded inputs.
+
+*/
+
+#include "MidairCE.h"
+#include "MARouteFollowerComponent.h"
+#include "MAPracticeComponent.h"
+#include "MABotAIComponent.h"
+#include "MAMemoryAccounting.h"
+#include "Player/AIPlayerController.h"
+#include "Player/MACharacter.h"
+#include "Player/MAPlayerState.h"
+
+//how long a bot that got hit is left to fly before it snaps back onto its route
+static const float RouteResumeDelay = 1.0f;
+//how far ahead of where it was knocked off we look for the closest marker to resume from
+static const float RouteResumeSearchSeconds = 3.0f;
+
+AAIPlayerController::AAIPlayerController(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	//bots only ever play routes back, the rest of practice mode stays on human controllers
+	RouteFollower = CreateDefaultSubobject<UMARouteFollowerComponent>(TEXT("RouteFollower"));
+}
+
+UMARouteFollowerComponent::UMARouteFollowerComponent()
+{
+	PrimaryComponentTick.bCanEverTick = true;
+	PrimaryComponentTick.bStartWithTickEnabled = false;
+	//after the bot has decided what to do, so we have the final say on where the pawn is
+	PrimaryComponentTick.TickGroup = TG_PostPhysics;
+}
+
+//Routes for the same practice file, name and team are shared by every bot running them. Weak, so a route goes away with its last bot.
+static TMap<FString, TWeakPtr<const FMARouteTrail>>& GetSharedRoutes()
+{
+	static TMap<FString, TWeakPtr<const FMARouteTrail>> SharedRoutes;
+	return SharedRoutes;
+}
+
+//The practice component whose routes this bot runs, normally the player that started the drill.
+void UMARouteFollowerComponent::SetRouteSource(UMAPracticeComponent* Source)
+{
+	RouteSource = Source;
+}
+
+UMAPracticeComponent* UMARouteFollowerComponent::FindRouteSource() const
+{
+	if (RouteSource.IsValid())
+	{
+		return RouteSource.Get();
+	}
+	//otherwise the player that owns the bot, if there is one. A bot nobody claimed has no routes to run, rather than someone else's.
+	AActor* BotOwner = GetOwner() != nullptr ? GetOwner()->GetOwner() : nullptr;
+	APlayerController* OwningPC = Cast<APlayerController>(BotOwner);
+	if (OwningPC != nullptr && !OwningPC->IsA<AAIPlayerController>())
+	{
+		return OwningPC->FindComponentByClass<UMAPracticeComponent>();
+	}
+	return nullptr;
+}
+
+//Picks the route the next StartRoute plays. False if it doesn't exist (or has no markers) for this team.
+bool UMARouteFollowerComponent::SelectRoute(const FString& RouteName, int32 TeamID)
+{
+	StopRoute();
+	Route.Reset();
+	UMAPracticeComponent* Source = FindRouteSource();
+	if (Source == nullptr)
+	{
+		return false;
+	}
+	//routes keep a marker every ModulusForPathRecordMarkers recording ticks, and the grab time is only kept to low precision
+	MarkerInterval = Source->PathRecordMarkerInterval * FMath::Max(Source->ModulusForPathRecordMarkers, 1);
+	GrabMarkerInterval = Source->PathRecordMarkerInterval * FMath::Max(Source->ModulusForLowPrecisionRecordMarkers, 1);
+	RouteTeam = TeamID;
+
+	//edited practice data has no hash, and can change under us, so those bots get their own copy
+	bool bShareable = Source->PracticeDataHash != FSHAHash();
+	FString Key = FString::Printf(TEXT("%s/%s/%d"), *Source->PracticeDataHash.ToString(), *RouteName, TeamID);
+	TMap<FString, TWeakPtr<const FMARouteTrail>>& SharedRoutes = GetSharedRoutes();
+	if (bShareable)
+	{
+		Route = SharedRoutes.FindRef(Key).Pin();
+	}
+	if (!Route.IsValid())
+	{
+		MA_LLM_SCOPE(RouteData);
+		Route = MakeShared<const FMARouteTrail>(Source->GetRouteTrailByName(RouteName, TeamID));
+		if (bShareable)
+		{
+			for (auto It = SharedRoutes.CreateIterator(); It; ++It)
+			{
+				if (!It.Value().IsValid())
+				{
+					It.RemoveCurrent();
+				}
+			}
+			SharedRoutes.Add(Key, Route);
+		}
+	}
+	if (Route->MarkerLocations.Num() < 2)
+	{
+		Route.Reset();
+		return false;
+	}
+	return true;
+}
+
+int32 UMARouteFollowerComponent::GetMarkerIndexAtTime(float RouteTime) const
+{
+	if (!Route.IsValid() || MarkerInterval <= 0.0f)
+	{
+		return 0;
+	}
+	return FMath::Clamp(FMath::FloorToInt(RouteTime / MarkerInterval), 0, Route->MarkerLocations.Num() - 1);
+}
+
+//Marker the flag is picked up on, INDEX_NONE if the route never grabs.
+int32 UMARouteFollowerComponent::GetGrabMarkerIndex() const
+{
+	if (!Route.IsValid() || Route->GrabTime <= 0.0f || GrabMarkerInterval <= 0.0f)
+	{
+		return INDEX_NONE;
+	}
+	return FMath::Clamp(FMath::FloorToInt(Route->GrabTime / GrabMarkerInterval), 0, Route->MarkerLocations.Num() - 1);
+}
+
+//Teleports the pawn onto the selected route at StartMarkerIndex and plays it from there.
+void UMARouteFollowerComponent::StartRoute(int32 StartMarkerIndex, bool bInResumePathAfterDamage, bool bInStayAliveAfterRouteEnd, bool bInRestoreHealthOnTeleport)
+{
+	AMACharacter* Character = GetControlledCharacter();
+	if (!Route.IsValid() || Character == nullptr)
+	{
+		return;
+	}
+	bResumePathAfterDamage = bInResumePathAfterDamage;
+	bStayAliveAfterRouteEnd = bInStayAliveAfterRouteEnd;
+	bRestoreHealthOnTeleport = bInRestoreHealthOnTeleport;
+	bKnockedOffRoute = false;
+	TeleportToMarker(FMath::Clamp(StartMarkerIndex, 0, Route->MarkerLocations.Num() - 2));
+	SetComponentTickEnabled(true);
+}
+
+void UMARouteFollowerComponent::StopRoute()
+{
+	ReleaseRecordedInputs();
+	SetComponentTickEnabled(false);
+	bKnockedOffRoute = false;
+	CurrentMarkerIndex = 0;
+	PlaybackTime = 0.0f;
+}
+
+bool UMARouteFollowerComponent::IsFollowingRoute() const
+{
+	return IsComponentTickEnabled();
+}
+
+AMACharacter* UMARouteFollowerComponent::GetControlledCharacter() const
+{
+	AController* Controller = Cast<AController>(GetOwner());
+	return Controller != nullptr ? Cast<AMACharacter>(Controller->GetPawn()) : nullptr;
+}
+
+void UMARouteFollowerComponent::TeleportToMarker(int32 MarkerIndex)
+{
+	AMACharacter* Character = GetControlledCharacter();
+	const FPlayerLocationAndState& Marker = Route->MarkerLocations[MarkerIndex];
+	Character->TeleportTo(Marker.Location, Marker.Rotation);
+	Character->GetCharacterMovement()->Velocity = Marker.Velocity;
+	if (bRestoreHealthOnTeleport)
+	{
+		Character->GetVitals()->SetHealth(Marker.Health);
+		Character->GetVitals()->SetEnergy(Marker.Energy);
+	}
+	PlaybackTime = MarkerIndex * MarkerInterval;
+	CurrentMarkerIndex = MarkerIndex + 1;
+	LastHealth = Character->GetHealth();
+	SeekRecordedInputs();
+}
+
+//Inputs are only stored when they change, so after a jump in playback time work out what was held down at that point.
+void UMARouteFollowerComponent::SeekRecordedInputs()
+{
+	bPlaybackJetting = false;
+	bPlaybackFiring = false;
+	NextRecordedInput = 0;
+	while (NextRecordedInput < Route->RecordedInputs.Num() && Route->RecordedInputs[NextRecordedInput].TimeStamp <= PlaybackTime)
+	{
+		ApplyRecordedInput(Route->RecordedInputs[NextRecordedInput++]);
+	}
+	if (AMACharacter* Character = GetControlledCharacter())
+	{
+		Character->SetTrigger(0, bPlaybackFiring);
+	}
+}
+
+void UMARouteFollowerComponent::ApplyRecordedInput(const FMARecordedInput& Input)
+{
+	switch (Input.InputType)
+	{
+	case(EPlayerRecordableInputTypes::Jet):
+		bPlaybackJetting = Input.bPressed;
+		break;
+	case(EPlayerRecordableInputTypes::Fire):
+		bPlaybackFiring = Input.bPressed;
+		break;
+	}
+}
+
+//Lets go of anything playback was holding down, when the route stops or we get knocked off it.
+void UMARouteFollowerComponent::ReleaseRecordedInputs()
+{
+	AMACharacter* Character = GetControlledCharacter();
+	if (Character != nullptr && bPlaybackJetting)
+	{
+		Character->StopJetting();
+	}
+	if (Character != nullptr && bPlaybackFiring)
+	{
+		Character->SetTrigger(0, false);
+	}
+	bPlaybackJetting = false;
+	bPlaybackFiring = false;
+}
+
+void UMARouteFollowerComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+	AMACharacter* Character = GetControlledCharacter();
+	if (!Route.IsValid() || Character == nullptr || FMath::IsNearlyZero(Character->GetHealth()))
+	{
+		StopRoute();
+		return;
+	}
+	float Now = GetWorld()->GetTimeSeconds();
+
+	//taking a hit knocks us off the route for a moment, then we pick it back up from wherever the hit sent us
+	if (bResumePathAfterDamage && Character->GetHealth() < LastHealth - KINDA_SMALL_NUMBER)
+	{
+		bKnockedOffRoute = true;
+		ResumeRouteTime = Now + RouteResumeDelay;
+		ReleaseRecordedInputs();
+	}
+	LastHealth = Character->GetHealth();
+	if (bKnockedOffRoute)
+	{
+		if (Now < ResumeRouteTime)
+		{
+			return;
+		}
+		bKnockedOffRoute = false;
+		int32 LastSearchMarker = FMath::Min(CurrentMarkerIndex + FMath::CeilToInt(RouteResumeSearchSeconds / MarkerInterval), Route->MarkerLocations.Num() - 2);
+		int32 ClosestMarker = FMath::Min(CurrentMarkerIndex, LastSearchMarker);
+		float ClosestDistSquared = MAX_FLT;
+		for (int32 MarkerIndex = ClosestMarker; MarkerIndex <= LastSearchMarker; MarkerIndex++)
+		{
+			float DistSquared = FVector::DistSquared(Character->GetActorLocation(), Route->MarkerLocations[MarkerIndex].Location);
+			if (DistSquared < ClosestDistSquared)
+			{
+				ClosestDistSquared = DistSquared;
+				ClosestMarker = MarkerIndex;
+			}
+		}
+		TeleportToMarker(ClosestMarker);
+		return;
+	}
+
+	PlaybackTime += DeltaTime;
+	float Marker = PlaybackTime / MarkerInterval;
+	int32 LastMarker = Route->MarkerLocations.Num() - 1;
+	if (Marker >= LastMarker)
+	{
+		FinishRoute();
+		return;
+	}
+	int32 MarkerIndex = FMath::FloorToInt(Marker);
+	float Alpha = Marker - MarkerIndex;
+	const FPlayerLocationAndState& From = Route->MarkerLocations[MarkerIndex];
+	const FPlayerLocationAndState& To = Route->MarkerLocations[MarkerIndex + 1];
+	CurrentMarkerIndex = MarkerIndex + 1;
+	Character->SetActorLocation(FMath::Lerp(From.Location, To.Location, Alpha), false, nullptr, ETeleportType::TeleportPhysics);
+	//velocity keeps animation, sound and projectile inheritance right even though we place the pawn ourselves
+	Character->GetCharacterMovement()->Velocity = FMath::Lerp(From.Velocity, To.Velocity, Alpha);
+	Cast<AController>(GetOwner())->SetControlRotation(FMath::Lerp(From.Rotation, To.Rotation, Alpha));
+
+	//jetting and firing as recorded. Jet effects and energy use don't come from the markers, and the shots are part of the route.
+	bool bWasJetting = bPlaybackJetting;
+	bool bWasFiring = bPlaybackFiring;
+	while (NextRecordedInput < Route->RecordedInputs.Num() && Route->RecordedInputs[NextRecordedInput].TimeStamp <= PlaybackTime)
+	{
+		ApplyRecordedInput(Route->RecordedInputs[NextRecordedInput++]);
+	}
+	if (bPlaybackJetting)
+	{
+		Character->Jet();
+	}
+	else if (bWasJetting)
+	{
+		Character->StopJetting();
+	}
+	if (bPlaybackFiring != bWasFiring)
+	{
+		Character->SetTrigger(0, bPlaybackFiring);
+	}
+}
+
+void UMARouteFollowerComponent::FinishRoute()
+{
+	StopRoute();
+	if (bStayAliveAfterRouteEnd)
+	{
+		return;
+	}
+	//route runners die at the end of their route and run it again on respawn
+	AAIPlayerController* AIPC = Cast<AAIPlayerController>(GetOwner());
+	AMACharacter* Character = GetControlledCharacter();
+	UMABotAIComponent* BotAI = Character != nullptr ? Character->FindComponentByClass<UMABotAIComponent>() : nullptr;
+	if (AIPC != nullptr)
+	{
+		AIPC->Suicide();
+		if (BotAI != nullptr)
+		{
+			BotAI->OnDied();
+		}
+	}
+}
+
+//This bot's share of the routes it's running, so adding it up over every bot counts each shared route once.
+SIZE_T UMARouteFollowerComponent::GetRouteBytes() const
+{
+	if (!Route.IsValid())
+	{
+		return 0;
+	}
+	return FMAMemoryAccounting::GetRouteBytes(*Route) / FMath::Max(Route.GetSharedReferenceCount(), 1);
+}
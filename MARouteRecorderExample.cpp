@@ -0,0 +1,264 @@
+/**
+
+Background route recording for practice mode.
+While recording, the game thread only copies a small fixed size sample of the pawn into a preallocated
+single producer/single consumer ring buffer every PathRecordMarkerInterval. A worker thread drains the ring
+and builds the route up incrementally, so recording a long route no longer reallocates growing arrays on the
+game thread. It keeps a marker every ModulusForPathRecordMarkers samples, the spacing the route follower plays
+back at, and stores held inputs only when they change. Samples dropped because the ring was full are filled
+in between the markers either side, so later markers stay at the right time.
+
+*/
+
+#include "MidairCE.h"
+#include "MAPracticeComponent.h"
+#include "MAMemoryAccounting.h"
+#include "Player/MACharacter.h"
+#include "Containers/CircularQueue.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "Async/Async.h"
+
+//Everything we need from the pawn for a single route marker. Plain old data and fixed size, so it can go through the ring without touching the heap.
+struct FMARouteRecordSample
+{
+	FVector Location;
+	FRotator Rotation;
+	FVector Velocity;
+	float Health;
+	float Energy;
+	float TimeStamp;
+	//counts every recording tick, dropped ones included, so the worker knows which marker this is
+	int32 SampleIndex;
+	//bitmask of EPlayerRecordableInputTypes held down when the sample was taken
+	uint32 InputFlags;
+	bool bHoldingFlag;
+};
+
+//Owns the recording thread. PushSample is game thread only, everything else in Run is worker only until the route is handed back.
+class FMARouteRecorderWorker : public FRunnable
+{
+public:
+	FMARouteRecorderWorker(int32 InMarkerModulus, TWeakObjectPtr<UMAPracticeComponent> InOwner);
+	virtual ~FMARouteRecorderWorker();
+
+	//returns false if the worker has fallen far enough behind that the ring is full, the sample is dropped rather than allocating.
+	bool PushSample(const FMARouteRecordSample& Sample) { return Samples.Enqueue(Sample); }
+	//no more samples are coming, drain what is left and hand the route back to the game thread
+	void FinishRecording() { bFinishRequested = true; WakeEvent->Trigger(); }
+
+	virtual uint32 Run() override;
+	virtual void Stop() override { bStopRequested = true; WakeEvent->Trigger(); }
+
+	//10 minutes at 20 markers/s is 12000 samples, but the worker drains every few frames so the ring only needs to cover a hitch.
+	static const uint32 RingCapacity = 2048;
+	//how far the route arrays grow at a time on the worker, so appending stays cheap for long routes
+	static const int32 MarkerReserveChunk = 1024;
+
+private:
+	void ProcessSample(const FMARouteRecordSample& Sample);
+	FPlayerLocationAndState& AddMarker();
+
+	TCircularQueue<FMARouteRecordSample> Samples;
+	FMARouteTrail Route;
+	int32 MarkerModulus;
+	uint32 LastInputFlags = 0;
+	bool bHasGrabbed = false;
+	TWeakObjectPtr<UMAPracticeComponent> Owner;
+	FThreadSafeBool bFinishRequested;
+	FThreadSafeBool bStopRequested;
+	FEvent* WakeEvent;
+	FRunnableThread* Thread;
+};
+
+FMARouteRecorderWorker::FMARouteRecorderWorker(int32 InMarkerModulus, TWeakObjectPtr<UMAPracticeComponent> InOwner)
+	: Samples(RingCapacity)
+	, MarkerModulus(FMath::Max(InMarkerModulus, 1))
+	, Owner(InOwner)
+{
+	Route.MarkerLocations.Reserve(MarkerReserveChunk);
+	WakeEvent = FPlatformProcess::GetSynchEventFromPool();
+	Thread = FRunnableThread::Create(this, TEXT("MARouteRecorder"), 0, TPri_BelowNormal);
+}
+
+FMARouteRecorderWorker::~FMARouteRecorderWorker()
+{
+	if (Thread != nullptr)
+	{
+		Thread->Kill(true);
+		delete Thread;
+		Thread = nullptr;
+	}
+	FPlatformProcess::ReturnSynchEventToPool(WakeEvent);
+	WakeEvent = nullptr;
+}
+
+uint32 FMARouteRecorderWorker::Run()
+{
+	MA_LLM_SCOPE(RouteData);
+	FMARouteRecordSample Sample;
+	while (!bStopRequested)
+	{
+		//we don't trigger the event per sample to keep the game thread side to just the enqueue, so wake up a few times a second and drain in batches.
+		WakeEvent->Wait(FTimespan::FromMilliseconds(100));
+		while (Samples.Dequeue(Sample))
+		{
+			ProcessSample(Sample);
+		}
+		//the game thread stops pushing before it asks us to finish, so once the ring is empty here the route is complete.
+		if (bFinishRequested && Samples.IsEmpty())
+		{
+			Route.MarkerLocations.Shrink();
+			Route.RecordedInputs.Shrink();
+			TWeakObjectPtr<UMAPracticeComponent> WeakOwner = Owner;
+			AsyncTask(ENamedThreads::GameThread, [WeakOwner, FinishedRoute = MoveTemp(Route)]() mutable
+			{
+				if (WeakOwner.IsValid())
+				{
+					WeakOwner->OnRouteRecordingFinished(MoveTemp(FinishedRoute));
+				}
+			});
+			break;
+		}
+	}
+	return 0;
+}
+
+FPlayerLocationAndState& FMARouteRecorderWorker::AddMarker()
+{
+	if (Route.MarkerLocations.Num() == Route.MarkerLocations.Max())
+	{
+		Route.MarkerLocations.Reserve(Route.MarkerLocations.Num() + MarkerReserveChunk);
+	}
+	return Route.MarkerLocations.AddDefaulted_GetRef();
+}
+
+void FMARouteRecorderWorker::ProcessSample(const FMARouteRecordSample& Sample)
+{
+	//every sample counts for inputs and the grab, only every MarkerModulus'th one becomes a marker
+	int32 MarkerIndex = Sample.SampleIndex / MarkerModulus;
+	if (Sample.SampleIndex % MarkerModulus == 0 && MarkerIndex >= Route.MarkerLocations.Num())
+	{
+		FPlayerLocationAndState SampleMarker;
+		SampleMarker.Location = Sample.Location;
+		SampleMarker.Rotation = Sample.Rotation;
+		SampleMarker.Velocity = Sample.Velocity;
+		SampleMarker.Health = Sample.Health;
+		SampleMarker.Energy = Sample.Energy;
+
+		//markers whose samples were dropped, blend from the last one we have so everything after stays at its own time
+		FPlayerLocationAndState GapStart = Route.MarkerLocations.Num() > 0 ? Route.MarkerLocations.Last() : SampleMarker;
+		int32 GapStartIndex = Route.MarkerLocations.Num() - 1;
+		while (Route.MarkerLocations.Num() < MarkerIndex)
+		{
+			float Alpha = (float)(Route.MarkerLocations.Num() - GapStartIndex) / (MarkerIndex - GapStartIndex);
+			FPlayerLocationAndState& Gap = AddMarker();
+			Gap.Location = FMath::Lerp(GapStart.Location, SampleMarker.Location, Alpha);
+			Gap.Rotation = (GapStart.Rotation + (SampleMarker.Rotation - GapStart.Rotation).GetNormalized() * Alpha).GetNormalized();
+			Gap.Velocity = FMath::Lerp(GapStart.Velocity, SampleMarker.Velocity, Alpha);
+			Gap.Health = FMath::Lerp(GapStart.Health, SampleMarker.Health, Alpha);
+			Gap.Energy = FMath::Lerp(GapStart.Energy, SampleMarker.Energy, Alpha);
+		}
+		AddMarker() = SampleMarker;
+	}
+
+	//inputs are held for many markers in a row, so only store the changes. Playback keeps holding the last input until the next change.
+	uint32 ChangedInputs = Sample.InputFlags ^ LastInputFlags;
+	if (ChangedInputs != 0)
+	{
+		for (uint8 InputIndex = 0; InputIndex < (uint8)EPlayerRecordableInputTypes::MAX; InputIndex++)
+		{
+			uint32 InputBit = 1u << InputIndex;
+			if (ChangedInputs & InputBit)
+			{
+				FMARecordedInput& RecordedInput = Route.RecordedInputs.AddDefaulted_GetRef();
+				RecordedInput.InputType = (EPlayerRecordableInputTypes)InputIndex;
+				RecordedInput.bPressed = (Sample.InputFlags & InputBit) != 0;
+				RecordedInput.TimeStamp = Sample.TimeStamp;
+			}
+		}
+		LastInputFlags = Sample.InputFlags;
+	}
+
+	//first sample we are holding the flag on is the grab, bots use this to decide whether they missed it.
+	if (Sample.bHoldingFlag && !bHasGrabbed)
+	{
+		bHasGrabbed = true;
+		Route.GrabTime = Sample.TimeStamp;
+	}
+}
+
+void UMAPracticeComponent::StartRouteRecording()
+{
+	if (!IsPracticeModeCommandEnabled() || RouteRecorder.IsValid() || GetControlledCharacter() == nullptr)
+	{
+		return;
+	}
+	RouteRecordStartTime = GetWorld()->GetTimeSeconds();
+	RecordableInputFlags = 0;
+	DroppedRouteSamples = 0;
+	RouteRecordSampleCount = 0;
+	RouteRecorder = MakeUnique<FMARouteRecorderWorker>(ModulusForPathRecordMarkers, this);
+	ParentController->GetWorldTimerManager().SetTimer(TimerHandle_RecordRouteMarker, this, &UMAPracticeComponent::RecordRouteMarker, PathRecordMarkerInterval, true);
+}
+
+//Runs every PathRecordMarkerInterval on the game thread while recording. Keep this to reading the pawn and a single enqueue.
+void UMAPracticeComponent::RecordRouteMarker()
+{
+	AMACharacter* Character = GetControlledCharacter();
+	if (!RouteRecorder.IsValid() || Character == nullptr)
+	{
+		return;
+	}
+	FMARouteRecordSample Sample;
+	Sample.Location = Character->GetActorLocation();
+	Sample.Rotation = ParentController->GetControlRotation();
+	Sample.Velocity = Character->GetVelocity();
+	Sample.Health = Character->GetHealth();
+	Sample.Energy = Character->GetEnergy();
+	Sample.TimeStamp = GetWorld()->GetTimeSeconds() - RouteRecordStartTime;
+	Sample.SampleIndex = RouteRecordSampleCount++;
+	Sample.InputFlags = RecordableInputFlags;
+	Sample.bHoldingFlag = Character->CarriedObject != nullptr;
+	if (!RouteRecorder->PushSample(Sample))
+	{
+		DroppedRouteSamples++;
+	}
+}
+
+//Called from the input bindings for anything a route can play back, so the recorder just snapshots the current bitmask.
+void UMAPracticeComponent::RecordInput(EPlayerRecordableInputTypes InputType, bool bPressed)
+{
+	uint32 InputBit = 1u << (uint8)InputType;
+	RecordableInputFlags = bPressed ? (RecordableInputFlags | InputBit) : (RecordableInputFlags & ~InputBit);
+}
+
+void UMAPracticeComponent::StopRouteRecording()
+{
+	if (!RouteRecorder.IsValid())
+	{
+		return;
+	}
+	ParentController->GetWorldTimerManager().ClearTimer(TimerHandle_RecordRouteMarker);
+	//route comes back through OnRouteRecordingFinished once the worker has drained the ring
+	RouteRecorder->FinishRecording();
+}
+
+void UMAPracticeComponent::OnRouteRecordingFinished(FMARouteTrail&& RecordedRoute)
+{
+	//worker thread has already returned from Run by now, so this only joins it.
+	RouteRecorder.Reset();
+	if (DroppedRouteSamples > 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Route recorder dropped %d samples, recording thread fell behind."), DroppedRouteSamples);
+	}
+	if (RecordedRoute.MarkerLocations.Num() < 2)
+	{
+		return;
+	}
+	TArray<FMARouteTrail>& RouteTrails = EditPracticeData().RouteTrails;
+	RecordedRoute.Name = FString::Printf(TEXT("Recorded Route %d"), RouteTrails.Num() + 1);
+	RouteTrails.Add(MoveTemp(RecordedRoute));
+	//route runners are spawned on the server, so it needs its own copy
+	UploadRouteToServer(RouteTrails.Last());
+}
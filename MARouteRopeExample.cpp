@@ -0,0 +1,740 @@
+/**
+
+Route editing for the tutorial builder.
+Trimming the start off a recorded route, splicing two routes together or slowing down a section used to mean copying and shifting the
+whole MarkerLocations/RecordedInputs arrays and fixing up every timestamp, for every edit.
+While a route is being edited it is held as a rope instead: a balanced tree of blocks of up to RouteRopeBlockSize markers, where every
+node caches the marker count, duration, bounds and input state of everything under it. Trim, split, splice and retime only touch the
+O(log n) nodes along the cut, the rest of the blocks are shared with the previous version, which is also what makes undo free.
+Timestamps are local to their block and a retimed section is just a scale on one node, so nothing downstream of an edit is rewritten.
+The rope is flattened back to a normal FMARouteTrail (resampled to the marker interval if anything was retimed) when edits are applied.
+
+*/
+
+#include "MidairCE.h"
+#include "MAPracticeComponent.h"
+#include "MARouteRope.h"
+#include "MAMemoryAccounting.h"
+
+static const int32 RouteRopeBlockSize = 64;
+//how many edits back undo goes per route
+static const int32 MaxRouteEditUndo = 32;
+
+typedef TSharedPtr<const FMARouteRopeNode> FMARouteRopeNodePtr;
+
+//Nodes are immutable once built, edits make new nodes along the path they change and share everything else.
+struct FMARouteRopeNode
+{
+	//interior nodes
+	FMARouteRopeNodePtr Left;
+	FMARouteRopeNodePtr Right;
+	//blocks. Input timestamps and GrabTime are local to the block and before TimeScale.
+	TArray<FPlayerLocationAndState> Markers;
+	TArray<FMARecordedInput> Inputs;
+	float MarkerInterval = 0.0f;
+	float GrabTime = -1.0f;
+
+	//everything under this node plays back TimeScale times slower
+	float TimeScale = 1.0f;
+	//summaries of everything under this node, Duration includes TimeScale
+	float Duration = 0.0f;
+	int32 NumMarkers = 0;
+	FBox Bounds = FBox(ForceInit);
+	//inputs changed under this node and what they are left at, so what's held at any cut is known without replaying the route
+	uint32 InputsTouched = 0;
+	uint32 InputsHeld = 0;
+	bool bHasGrab = false;
+	int32 Height = 1;
+
+	bool IsLeaf() const { return !Left.IsValid(); }
+};
+
+static uint32 ApplyInputs(uint32 HeldBefore, const FMARouteRopeNode* Node)
+{
+	return Node != nullptr ? (HeldBefore & ~Node->InputsTouched) | Node->InputsHeld : HeldBefore;
+}
+
+static FMARouteRopeNodePtr MakeLeaf(TArray<FPlayerLocationAndState>&& Markers, TArray<FMARecordedInput>&& Inputs, float MarkerInterval, float GrabTime, float TimeScale)
+{
+	TSharedPtr<FMARouteRopeNode> Leaf = MakeShared<FMARouteRopeNode>();
+	Leaf->Markers = MoveTemp(Markers);
+	Leaf->Inputs = MoveTemp(Inputs);
+	Leaf->MarkerInterval = MarkerInterval;
+	Leaf->GrabTime = GrabTime;
+	Leaf->TimeScale = TimeScale;
+	Leaf->NumMarkers = Leaf->Markers.Num();
+	Leaf->Duration = Leaf->NumMarkers * MarkerInterval * TimeScale;
+	Leaf->bHasGrab = GrabTime >= 0.0f;
+	for (const FPlayerLocationAndState& Marker : Leaf->Markers)
+	{
+		Leaf->Bounds += Marker.Location;
+	}
+	for (const FMARecordedInput& Input : Leaf->Inputs)
+	{
+		uint32 InputBit = 1u << (uint8)Input.InputType;
+		Leaf->InputsTouched |= InputBit;
+		Leaf->InputsHeld = Input.bPressed ? (Leaf->InputsHeld | InputBit) : (Leaf->InputsHeld & ~InputBit);
+	}
+	return Leaf;
+}
+
+static FMARouteRopeNodePtr MakeInterior(const FMARouteRopeNodePtr& Left, const FMARouteRopeNodePtr& Right)
+{
+	TSharedPtr<FMARouteRopeNode> Node = MakeShared<FMARouteRopeNode>();
+	Node->Left = Left;
+	Node->Right = Right;
+	Node->Duration = Left->Duration + Right->Duration;
+	Node->NumMarkers = Left->NumMarkers + Right->NumMarkers;
+	Node->Bounds = Left->Bounds + Right->Bounds;
+	Node->InputsTouched = Left->InputsTouched | Right->InputsTouched;
+	Node->InputsHeld = ApplyInputs(Left->InputsHeld, Right.Get());
+	Node->bHasGrab = Left->bHasGrab || Right->bHasGrab;
+	Node->Height = FMath::Max(Left->Height, Right->Height) + 1;
+	return Node;
+}
+
+static FMARouteRopeNodePtr WithTimeScale(const FMARouteRopeNodePtr& Node, float Scale)
+{
+	if (Scale == 1.0f)
+	{
+		return Node;
+	}
+	TSharedPtr<FMARouteRopeNode> Scaled = MakeShared<FMARouteRopeNode>(*Node);
+	Scaled->TimeScale *= Scale;
+	Scaled->Duration *= Scale;
+	return Scaled;
+}
+
+//Anything that restructures an interior node has to move its scale onto its children first.
+static FMARouteRopeNodePtr PushDownTimeScale(const FMARouteRopeNodePtr& Node)
+{
+	if (Node->IsLeaf() || Node->TimeScale == 1.0f)
+	{
+		return Node;
+	}
+	return MakeInterior(WithTimeScale(Node->Left, Node->TimeScale), WithTimeScale(Node->Right, Node->TimeScale));
+}
+
+//AVL style, heights of the two sides never differ by more than one.
+static FMARouteRopeNodePtr MakeBalanced(const FMARouteRopeNodePtr& Left, const FMARouteRopeNodePtr& Right)
+{
+	if (Left->Height > Right->Height + 1)
+	{
+		FMARouteRopeNodePtr L = PushDownTimeScale(Left);
+		if (L->Left->Height >= L->Right->Height)
+		{
+			return MakeInterior(L->Left, MakeInterior(L->Right, Right));
+		}
+		FMARouteRopeNodePtr LR = PushDownTimeScale(L->Right);
+		return MakeInterior(MakeInterior(L->Left, LR->Left), MakeInterior(LR->Right, Right));
+	}
+	if (Right->Height > Left->Height + 1)
+	{
+		FMARouteRopeNodePtr R = PushDownTimeScale(Right);
+		if (R->Right->Height >= R->Left->Height)
+		{
+			return MakeInterior(MakeInterior(Left, R->Left), R->Right);
+		}
+		FMARouteRopeNodePtr RL = PushDownTimeScale(R->Left);
+		return MakeInterior(MakeInterior(Left, RL->Left), MakeInterior(RL->Right, R->Right));
+	}
+	return MakeInterior(Left, Right);
+}
+
+static FMARouteRopeNodePtr MergeLeaves(const FMARouteRopeNode& Left, const FMARouteRopeNode& Right)
+{
+	float LeftLocalDuration = Left.NumMarkers * Left.MarkerInterval;
+	TArray<FPlayerLocationAndState> Markers = Left.Markers;
+	Markers.Append(Right.Markers);
+	TArray<FMARecordedInput> Inputs = Left.Inputs;
+	for (const FMARecordedInput& Input : Right.Inputs)
+	{
+		Inputs.Add_GetRef(Input).TimeStamp += LeftLocalDuration;
+	}
+	float GrabTime = Left.bHasGrab ? Left.GrabTime : (Right.bHasGrab ? Right.GrabTime + LeftLocalDuration : -1.0f);
+	return MakeLeaf(MoveTemp(Markers), MoveTemp(Inputs), Left.MarkerInterval, GrabTime, Left.TimeScale);
+}
+
+static FMARouteRopeNodePtr Join(const FMARouteRopeNodePtr& Left, const FMARouteRopeNodePtr& Right)
+{
+	if (!Left.IsValid())
+	{
+		return Right;
+	}
+	if (!Right.IsValid())
+	{
+		return Left;
+	}
+	if (Left->Height > Right->Height + 1)
+	{
+		FMARouteRopeNodePtr L = PushDownTimeScale(Left);
+		return MakeBalanced(L->Left, Join(L->Right, Right));
+	}
+	if (Right->Height > Left->Height + 1)
+	{
+		FMARouteRopeNodePtr R = PushDownTimeScale(Right);
+		return MakeBalanced(Join(Left, R->Left), R->Right);
+	}
+	//small neighbouring blocks get merged so repeated edits don't leave a trail of tiny blocks behind
+	if (Left->IsLeaf() && Right->IsLeaf() && Left->NumMarkers + Right->NumMarkers <= RouteRopeBlockSize
+		&& Left->TimeScale == Right->TimeScale && Left->MarkerInterval == Right->MarkerInterval)
+	{
+		return MergeLeaves(*Left, *Right);
+	}
+	return MakeInterior(Left, Right);
+}
+
+//OutLeft gets the first Index markers, OutRight the rest. Either can come back null.
+static void SplitAt(const FMARouteRopeNodePtr& Node, int32 Index, FMARouteRopeNodePtr& OutLeft, FMARouteRopeNodePtr& OutRight)
+{
+	if (!Node.IsValid() || Index <= 0)
+	{
+		OutLeft = nullptr;
+		OutRight = Node;
+		return;
+	}
+	if (Index >= Node->NumMarkers)
+	{
+		OutLeft = Node;
+		OutRight = nullptr;
+		return;
+	}
+	if (Node->IsLeaf())
+	{
+		float CutTime = Index * Node->MarkerInterval;
+		TArray<FPlayerLocationAndState> LeftMarkers(Node->Markers.GetData(), Index);
+		TArray<FPlayerLocationAndState> RightMarkers(Node->Markers.GetData() + Index, Node->NumMarkers - Index);
+		TArray<FMARecordedInput> LeftInputs;
+		TArray<FMARecordedInput> RightInputs;
+		for (const FMARecordedInput& Input : Node->Inputs)
+		{
+			if (Input.TimeStamp < CutTime)
+			{
+				LeftInputs.Add(Input);
+			}
+			else {
+				RightInputs.Add_GetRef(Input).TimeStamp -= CutTime;
+			}
+		}
+		bool bGrabOnLeft = Node->bHasGrab && Node->GrabTime < CutTime;
+		bool bGrabOnRight = Node->bHasGrab && !bGrabOnLeft;
+		OutLeft = MakeLeaf(MoveTemp(LeftMarkers), MoveTemp(LeftInputs), Node->MarkerInterval, bGrabOnLeft ? Node->GrabTime : -1.0f, Node->TimeScale);
+		OutRight = MakeLeaf(MoveTemp(RightMarkers), MoveTemp(RightInputs), Node->MarkerInterval, bGrabOnRight ? Node->GrabTime - CutTime : -1.0f, Node->TimeScale);
+		return;
+	}
+	FMARouteRopeNodePtr N = PushDownTimeScale(Node);
+	int32 LeftCount = N->Left->NumMarkers;
+	FMARouteRopeNodePtr A;
+	FMARouteRopeNodePtr B;
+	if (Index < LeftCount)
+	{
+		SplitAt(N->Left, Index, A, B);
+		OutLeft = A;
+		OutRight = Join(B, N->Right);
+	}
+	else if (Index == LeftCount)
+	{
+		OutLeft = N->Left;
+		OutRight = N->Right;
+	}
+	else {
+		SplitAt(N->Right, Index - LeftCount, A, B);
+		OutLeft = Join(N->Left, A);
+		OutRight = B;
+	}
+}
+
+//Adds input changes at the very start so a piece that expects HeldBefore plays back with WantedHeld instead.
+static FMARouteRopeNodePtr SetInputsAtStart(const FMARouteRopeNodePtr& Node, uint32 HeldBefore, uint32 WantedHeld)
+{
+	uint32 ChangedInputs = HeldBefore ^ WantedHeld;
+	if (!Node.IsValid() || ChangedInputs == 0)
+	{
+		return Node;
+	}
+	if (Node->IsLeaf())
+	{
+		TArray<FMARecordedInput> Inputs;
+		for (uint8 InputIndex = 0; InputIndex < (uint8)EPlayerRecordableInputTypes::MAX; InputIndex++)
+		{
+			uint32 InputBit = 1u << InputIndex;
+			if (ChangedInputs & InputBit)
+			{
+				FMARecordedInput& Input = Inputs.AddDefaulted_GetRef();
+				Input.InputType = (EPlayerRecordableInputTypes)InputIndex;
+				Input.bPressed = (WantedHeld & InputBit) != 0;
+				Input.TimeStamp = 0.0f;
+			}
+		}
+		Inputs.Append(Node->Inputs);
+		TArray<FPlayerLocationAndState> Markers = Node->Markers;
+		return MakeLeaf(MoveTemp(Markers), MoveTemp(Inputs), Node->MarkerInterval, Node->GrabTime, Node->TimeScale);
+	}
+	FMARouteRopeNodePtr N = PushDownTimeScale(Node);
+	return MakeInterior(SetInputsAtStart(N->Left, HeldBefore, WantedHeld), N->Right);
+}
+
+static void CollectBlocks(const FMARouteRopeNode* Node, float ParentScale, TArray<TPair<const FMARouteRopeNode*, float>>& OutBlocks)
+{
+	float Scale = ParentScale * Node->TimeScale;
+	if (Node->IsLeaf())
+	{
+		OutBlocks.Emplace(Node, Scale);
+		return;
+	}
+	CollectBlocks(Node->Left.Get(), Scale, OutBlocks);
+	CollectBlocks(Node->Right.Get(), Scale, OutBlocks);
+}
+
+FMARouteRope FMARouteRope::FromRouteTrail(const FMARouteTrail& Route, float MarkerInterval)
+{
+	MA_LLM_SCOPE(RouteData);
+	FMARouteRope Rope;
+	int32 NumMarkers = Route.MarkerLocations.Num();
+	if (NumMarkers == 0 || MarkerInterval <= 0.0f)
+	{
+		return Rope;
+	}
+	float BlockDuration = RouteRopeBlockSize * MarkerInterval;
+	int32 NumBlocks = FMath::DivideAndRoundUp(NumMarkers, RouteRopeBlockSize);
+	TArray<TArray<FMARecordedInput>> BlockInputs;
+	BlockInputs.SetNum(NumBlocks);
+	for (const FMARecordedInput& Input : Route.RecordedInputs)
+	{
+		int32 BlockIndex = FMath::Clamp(FMath::FloorToInt(Input.TimeStamp / BlockDuration), 0, NumBlocks - 1);
+		BlockInputs[BlockIndex].Add_GetRef(Input).TimeStamp -= BlockIndex * BlockDuration;
+	}
+	//GrabTime of 0 is what a route that never grabbed has
+	int32 GrabBlock = Route.GrabTime > 0.0f ? FMath::Clamp(FMath::FloorToInt(Route.GrabTime / BlockDuration), 0, NumBlocks - 1) : INDEX_NONE;
+
+	TArray<FMARouteRopeNodePtr> Level;
+	Level.Reserve(NumBlocks);
+	for (int32 BlockIndex = 0; BlockIndex < NumBlocks; BlockIndex++)
+	{
+		int32 First = BlockIndex * RouteRopeBlockSize;
+		TArray<FPlayerLocationAndState> Markers(Route.MarkerLocations.GetData() + First, FMath::Min(RouteRopeBlockSize, NumMarkers - First));
+		float GrabTime = BlockIndex == GrabBlock ? Route.GrabTime - BlockIndex * BlockDuration : -1.0f;
+		Level.Add(MakeLeaf(MoveTemp(Markers), MoveTemp(BlockInputs[BlockIndex]), MarkerInterval, GrabTime, 1.0f));
+	}
+	//pair up level by level, heights can only ever differ by one this way
+	while (Level.Num() > 1)
+	{
+		TArray<FMARouteRopeNodePtr> NextLevel;
+		NextLevel.Reserve(Level.Num() / 2 + 1);
+		for (int32 Index = 0; Index + 1 < Level.Num(); Index += 2)
+		{
+			NextLevel.Add(MakeInterior(Level[Index], Level[Index + 1]));
+		}
+		if (Level.Num() % 2 == 1)
+		{
+			NextLevel.Add(Level.Last());
+		}
+		Level = MoveTemp(NextLevel);
+	}
+	Rope.Root = Level[0];
+	return Rope;
+}
+
+//Retimed sections don't line up with the marker interval anymore, so they are resampled. Untouched routes come out exactly as they went in.
+void FMARouteRope::ToRouteTrail(FMARouteTrail& OutRoute, float MarkerInterval) const
+{
+	OutRoute.MarkerLocations.Reset();
+	OutRoute.RecordedInputs.Reset();
+	OutRoute.GrabTime = 0.0f;
+	if (!Root.IsValid() || MarkerInterval <= 0.0f)
+	{
+		return;
+	}
+	TArray<TPair<const FMARouteRopeNode*, float>> Blocks;
+	CollectBlocks(Root.Get(), 1.0f, Blocks);
+
+	TArray<const FPlayerLocationAndState*> SourceMarkers;
+	TArray<float> SourceTimes;
+	TArray<float> SourceScales;
+	SourceMarkers.Reserve(Root->NumMarkers);
+	SourceTimes.Reserve(Root->NumMarkers);
+	SourceScales.Reserve(Root->NumMarkers);
+	bool bFoundGrab = false;
+	float BlockStartTime = 0.0f;
+	for (const TPair<const FMARouteRopeNode*, float>& Block : Blocks)
+	{
+		const FMARouteRopeNode& Leaf = *Block.Key;
+		float Scale = Block.Value;
+		for (int32 MarkerIndex = 0; MarkerIndex < Leaf.NumMarkers; MarkerIndex++)
+		{
+			SourceMarkers.Add(&Leaf.Markers[MarkerIndex]);
+			SourceTimes.Add(BlockStartTime + MarkerIndex * Leaf.MarkerInterval * Scale);
+			SourceScales.Add(Scale);
+		}
+		for (const FMARecordedInput& Input : Leaf.Inputs)
+		{
+			OutRoute.RecordedInputs.Add_GetRef(Input).TimeStamp = BlockStartTime + Input.TimeStamp * Scale;
+		}
+		if (Leaf.bHasGrab && !bFoundGrab)
+		{
+			bFoundGrab = true;
+			OutRoute.GrabTime = BlockStartTime + Leaf.GrabTime * Scale;
+		}
+		BlockStartTime += Leaf.NumMarkers * Leaf.MarkerInterval * Scale;
+	}
+
+	int32 NumOut = FMath::Max(1, FMath::RoundToInt(BlockStartTime / MarkerInterval));
+	OutRoute.MarkerLocations.Reserve(NumOut);
+	int32 SourceIndex = 0;
+	for (int32 OutIndex = 0; OutIndex < NumOut; OutIndex++)
+	{
+		float Time = OutIndex * MarkerInterval;
+		while (SourceIndex + 1 < SourceMarkers.Num() && SourceTimes[SourceIndex + 1] <= Time)
+		{
+			SourceIndex++;
+		}
+		int32 NextIndex = FMath::Min(SourceIndex + 1, SourceMarkers.Num() - 1);
+		const FPlayerLocationAndState& A = *SourceMarkers[SourceIndex];
+		const FPlayerLocationAndState& B = *SourceMarkers[NextIndex];
+		float Span = SourceTimes[NextIndex] - SourceTimes[SourceIndex];
+		float Alpha = Span > 0.0f ? FMath::Clamp((Time - SourceTimes[SourceIndex]) / Span, 0.0f, 1.0f) : 0.0f;
+
+		FPlayerLocationAndState& Marker = OutRoute.MarkerLocations.AddDefaulted_GetRef();
+		Marker.Location = FMath::Lerp(A.Location, B.Location, Alpha);
+		//through the shorter way round, a straight lerp from 179 to -179 yaw spins all the way back
+		Marker.Rotation = (A.Rotation + (B.Rotation - A.Rotation).GetNormalized() * Alpha).GetNormalized();
+		//slowed down sections move slower too
+		Marker.Velocity = FMath::Lerp(A.Velocity / SourceScales[SourceIndex], B.Velocity / SourceScales[NextIndex], Alpha);
+		Marker.Health = FMath::Lerp(A.Health, B.Health, Alpha);
+		Marker.Energy = FMath::Lerp(A.Energy, B.Energy, Alpha);
+	}
+}
+
+int32 FMARouteRope::Num() const
+{
+	return Root.IsValid() ? Root->NumMarkers : 0;
+}
+
+float FMARouteRope::GetDuration() const
+{
+	return Root.IsValid() ? Root->Duration : 0.0f;
+}
+
+FBox FMARouteRope::GetBounds() const
+{
+	return Root.IsValid() ? Root->Bounds : FBox(ForceInit);
+}
+
+const FPlayerLocationAndState* FMARouteRope::GetMarker(int32 Index) const
+{
+	const FMARouteRopeNode* Node = Root.Get();
+	if (Node == nullptr || Index < 0 || Index >= Node->NumMarkers)
+	{
+		return nullptr;
+	}
+	while (!Node->IsLeaf())
+	{
+		if (Index < Node->Left->NumMarkers)
+		{
+			Node = Node->Left.Get();
+		}
+		else {
+			Index -= Node->Left->NumMarkers;
+			Node = Node->Right.Get();
+		}
+	}
+	return &Node->Markers[Index];
+}
+
+int32 FMARouteRope::FindMarkerAtTime(float Time) const
+{
+	const FMARouteRopeNode* Node = Root.Get();
+	if (Node == nullptr)
+	{
+		return INDEX_NONE;
+	}
+	int32 Index = 0;
+	Time = FMath::Clamp(Time, 0.0f, Node->Duration);
+	while (true)
+	{
+		//child durations are in this node's time, before its own scale
+		Time /= Node->TimeScale;
+		if (Node->IsLeaf())
+		{
+			return Index + FMath::Clamp(FMath::FloorToInt(Time / Node->MarkerInterval), 0, Node->NumMarkers - 1);
+		}
+		if (Time < Node->Left->Duration)
+		{
+			Node = Node->Left.Get();
+		}
+		else {
+			Time -= Node->Left->Duration;
+			Index += Node->Left->NumMarkers;
+			Node = Node->Right.Get();
+		}
+	}
+}
+
+float FMARouteRope::GetTimeOfMarker(int32 Index) const
+{
+	const FMARouteRopeNode* Node = Root.Get();
+	float Time = 0.0f;
+	float Scale = 1.0f;
+	while (Node != nullptr)
+	{
+		Scale *= Node->TimeScale;
+		if (Node->IsLeaf())
+		{
+			return Time + FMath::Clamp(Index, 0, Node->NumMarkers) * Node->MarkerInterval * Scale;
+		}
+		if (Index < Node->Left->NumMarkers)
+		{
+			Node = Node->Left.Get();
+		}
+		else {
+			Time += Node->Left->Duration * Scale;
+			Index -= Node->Left->NumMarkers;
+			Node = Node->Right.Get();
+		}
+	}
+	return Time;
+}
+
+//For picking a cut point by standing on it. Whole subtrees are skipped when their bounds are further away than the best so far.
+int32 FMARouteRope::FindNearestMarker(const FVector& Location) const
+{
+	int32 BestIndex = INDEX_NONE;
+	float BestDistSquared = MAX_flt;
+	TArray<TPair<const FMARouteRopeNode*, int32>, TInlineAllocator<32>> Stack;
+	if (Root.IsValid())
+	{
+		Stack.Emplace(Root.Get(), 0);
+	}
+	while (Stack.Num() > 0)
+	{
+		TPair<const FMARouteRopeNode*, int32> Entry = Stack.Pop(false);
+		const FMARouteRopeNode* Node = Entry.Key;
+		if (Node->Bounds.ComputeSquaredDistanceToPoint(Location) >= BestDistSquared)
+		{
+			continue;
+		}
+		if (Node->IsLeaf())
+		{
+			for (int32 MarkerIndex = 0; MarkerIndex < Node->NumMarkers; MarkerIndex++)
+			{
+				float DistSquared = FVector::DistSquared(Node->Markers[MarkerIndex].Location, Location);
+				if (DistSquared < BestDistSquared)
+				{
+					BestDistSquared = DistSquared;
+					BestIndex = Entry.Value + MarkerIndex;
+				}
+			}
+			continue;
+		}
+		//nearer side last so it's searched first and prunes more of the other
+		bool bLeftNearer = Node->Left->Bounds.ComputeSquaredDistanceToPoint(Location) <= Node->Right->Bounds.ComputeSquaredDistanceToPoint(Location);
+		TPair<const FMARouteRopeNode*, int32> LeftEntry(Node->Left.Get(), Entry.Value);
+		TPair<const FMARouteRopeNode*, int32> RightEntry(Node->Right.Get(), Entry.Value + Node->Left->NumMarkers);
+		Stack.Add(bLeftNearer ? RightEntry : LeftEntry);
+		Stack.Add(bLeftNearer ? LeftEntry : RightEntry);
+	}
+	return BestIndex;
+}
+
+//Index of the first marker at or after Time, so cutting there keeps everything before Time on the left.
+int32 FMARouteRope::GetCutIndex(float Time) const
+{
+	if (!Root.IsValid() || Time >= Root->Duration)
+	{
+		return Num();
+	}
+	return Time <= 0.0f ? 0 : FindMarkerAtTime(Time);
+}
+
+FMARouteRope FMARouteRope::Trim(float StartTime, float EndTime) const
+{
+	int32 StartIndex = GetCutIndex(StartTime);
+	int32 EndIndex = FMath::Max(GetCutIndex(EndTime), StartIndex);
+	FMARouteRopeNodePtr Before;
+	FMARouteRopeNodePtr Rest;
+	FMARouteRopeNodePtr Kept;
+	FMARouteRopeNodePtr After;
+	SplitAt(Root, StartIndex, Before, Rest);
+	SplitAt(Rest, EndIndex - StartIndex, Kept, After);
+	//whatever was held down at the cut has to be pressed at the new start
+	FMARouteRope Trimmed;
+	Trimmed.Root = SetInputsAtStart(Kept, 0, ApplyInputs(0, Before.Get()));
+	return Trimmed;
+}
+
+void FMARouteRope::Split(float Time, FMARouteRope& OutBefore, FMARouteRope& OutAfter) const
+{
+	FMARouteRopeNodePtr Before;
+	FMARouteRopeNodePtr After;
+	SplitAt(Root, GetCutIndex(Time), Before, After);
+	OutBefore.Root = Before;
+	OutAfter.Root = SetInputsAtStart(After, 0, ApplyInputs(0, Before.Get()));
+}
+
+//Other is played from its own start with nothing held, then this route carries on with whatever it had held at the cut.
+FMARouteRope FMARouteRope::Splice(float Time, const FMARouteRope& Other) const
+{
+	FMARouteRopeNodePtr Before;
+	FMARouteRopeNodePtr After;
+	SplitAt(Root, GetCutIndex(Time), Before, After);
+	uint32 HeldAtCut = ApplyInputs(0, Before.Get());
+	FMARouteRopeNodePtr Inserted = SetInputsAtStart(Other.Root, HeldAtCut, 0);
+	After = SetInputsAtStart(After, ApplyInputs(HeldAtCut, Inserted.Get()), HeldAtCut);
+	FMARouteRope Spliced;
+	Spliced.Root = Join(Join(Before, Inserted), After);
+	return Spliced;
+}
+
+//Scale above 1 slows the section down. Only the node holding the section changes, everything after it just starts later.
+FMARouteRope FMARouteRope::Retime(float StartTime, float EndTime, float Scale) const
+{
+	Scale = FMath::Clamp(Scale, 0.1f, 10.0f);
+	int32 StartIndex = GetCutIndex(StartTime);
+	int32 EndIndex = FMath::Max(GetCutIndex(EndTime), StartIndex);
+	FMARouteRopeNodePtr Before;
+	FMARouteRopeNodePtr Rest;
+	FMARouteRopeNodePtr Section;
+	FMARouteRopeNodePtr After;
+	SplitAt(Root, StartIndex, Before, Rest);
+	SplitAt(Rest, EndIndex - StartIndex, Section, After);
+	FMARouteRope Retimed;
+	Retimed.Root = Join(Join(Before, Section.IsValid() ? WithTimeScale(Section, Scale) : Section), After);
+	return Retimed;
+}
+
+//Current version of a route being edited, starting an edit from the practice data the first time.
+bool UMAPracticeComponent::GetRouteEdit(const FString& RouteName, FMARouteRope& OutRope)
+{
+	if (TArray<FMARouteRope>* History = RouteEditHistory.Find(RouteName))
+	{
+		OutRope = History->Last();
+		return true;
+	}
+	const FMARouteTrail* Route = GetPracticeData().RouteTrails.FindByPredicate([&RouteName](const FMARouteTrail& Existing) { return Existing.Name.Equals(RouteName); });
+	if (Route == nullptr)
+	{
+		return false;
+	}
+	//recorded routes keep a marker every ModulusForPathRecordMarkers recording ticks
+	OutRope = FMARouteRope::FromRouteTrail(*Route, PathRecordMarkerInterval * FMath::Max(ModulusForPathRecordMarkers, 1));
+	RouteEditHistory.Add(RouteName).Add(OutRope);
+	return true;
+}
+
+void UMAPracticeComponent::PushRouteEdit(const FString& RouteName, const FMARouteRope& EditedRope)
+{
+	TArray<FMARouteRope>& History = RouteEditHistory.FindOrAdd(RouteName);
+	History.Add(EditedRope);
+	if (History.Num() > MaxRouteEditUndo)
+	{
+		History.RemoveAt(0);
+	}
+}
+
+void UMAPracticeComponent::EditRouteTrim(const FString& RouteName, float StartTime, float EndTime)
+{
+	FMARouteRope Rope;
+	if (IsPracticeModeCommandEnabled() && GetRouteEdit(RouteName, Rope))
+	{
+		PushRouteEdit(RouteName, Rope.Trim(StartTime, EndTime));
+	}
+}
+
+void UMAPracticeComponent::EditRouteSplit(const FString& RouteName, float Time, const FString& NewRouteName)
+{
+	FMARouteRope Rope;
+	//the new half can't take the name of a route that already exists, edited or not
+	bool bNameTaken = RouteEditHistory.Contains(NewRouteName)
+		|| GetPracticeData().RouteTrails.ContainsByPredicate([&NewRouteName](const FMARouteTrail& Existing) { return Existing.Name.Equals(NewRouteName); });
+	if (IsPracticeModeCommandEnabled() && !bNameTaken && GetRouteEdit(RouteName, Rope))
+	{
+		FMARouteRope Before;
+		FMARouteRope After;
+		Rope.Split(Time, Before, After);
+		PushRouteEdit(RouteName, Before);
+		PushRouteEdit(NewRouteName, After);
+	}
+}
+
+void UMAPracticeComponent::EditRouteSplice(const FString& RouteName, float Time, const FString& OtherRouteName)
+{
+	FMARouteRope Rope;
+	FMARouteRope Other;
+	if (IsPracticeModeCommandEnabled() && GetRouteEdit(RouteName, Rope) && GetRouteEdit(OtherRouteName, Other))
+	{
+		PushRouteEdit(RouteName, Rope.Splice(Time, Other));
+	}
+}
+
+void UMAPracticeComponent::EditRouteRetime(const FString& RouteName, float StartTime, float EndTime, float Scale)
+{
+	FMARouteRope Rope;
+	if (IsPracticeModeCommandEnabled() && GetRouteEdit(RouteName, Rope))
+	{
+		PushRouteEdit(RouteName, Rope.Retime(StartTime, EndTime, Scale));
+	}
+}
+
+void UMAPracticeComponent::UndoRouteEdit(const FString& RouteName)
+{
+	TArray<FMARouteRope>* History = RouteEditHistory.Find(RouteName);
+	if (History != nullptr && History->Num() > 1)
+	{
+		History->Pop();
+	}
+}
+
+//Flattens every route being edited back into the practice data, and hands them to the server like a freshly recorded route.
+void UMAPracticeComponent::ApplyRouteEdits()
+{
+	if (!IsPracticeModeCommandEnabled() || RouteEditHistory.Num() == 0)
+	{
+		return;
+	}
+	TArray<FMARouteTrail>& RouteTrails = EditPracticeData().RouteTrails;
+	for (TPair<FString, TArray<FMARouteRope>>& Edit : RouteEditHistory)
+	{
+		int32 RouteIndex = RouteTrails.IndexOfByPredicate([&Edit](const FMARouteTrail& Existing) { return Existing.Name.Equals(Edit.Key); });
+		if (RouteIndex == INDEX_NONE)
+		{
+			RouteIndex = RouteTrails.AddDefaulted();
+			RouteTrails[RouteIndex].Name = Edit.Key;
+		}
+		//lets the server check its copy is the one we edited before replacing it
+		uint32 ReplacesRouteCrc = RouteTrails[RouteIndex].MarkerLocations.Num() > 0 ? GetRouteTrailCrc(RouteTrails[RouteIndex]) : 0;
+		//resampled at the same spacing a recording would have, so the follower plays it back at the right speed
+		Edit.Value.Last().ToRouteTrail(RouteTrails[RouteIndex], PathRecordMarkerInterval * FMath::Max(ModulusForPathRecordMarkers, 1));
+		//trimmed down to nothing, same as recording one that short. The server drops its copy too.
+		if (RouteTrails[RouteIndex].MarkerLocations.Num() < 2)
+		{
+			RouteTrails.RemoveAt(RouteIndex);
+			if (ReplacesRouteCrc != 0 && GetOwnerRole() != ROLE_Authority)
+			{
+				ServerRemoveEditedRoute(Edit.Key, ReplacesRouteCrc);
+			}
+			continue;
+		}
+		UploadRouteToServer(RouteTrails[RouteIndex], ReplacesRouteCrc);
+	}
+	RouteEditHistory.Reset();
+}
+
+bool UMAPracticeComponent::ServerRemoveEditedRoute_Validate(const FString& RouteName, uint32 RouteCrc)
+{
+	return RouteName.Len() <= 256;
+}
+
+//Same rules as replacing a route by upload: only one this player uploaded, or exactly the copy they edited.
+void UMAPracticeComponent::ServerRemoveEditedRoute_Implementation(const FString& RouteName, uint32 RouteCrc)
+{
+	if (!IsPracticeModeCommandEnabled())
+	{
+		return;
+	}
+	TArray<FMARouteTrail>& RouteTrails = EditPracticeData().RouteTrails;
+	int32 RouteIndex = RouteTrails.IndexOfByPredicate([&RouteName](const FMARouteTrail& Existing) { return Existing.Name.Equals(RouteName); });
+	if (RouteIndex != INDEX_NONE && (RouteUploadIdsByName.Contains(RouteName) || GetRouteTrailCrc(RouteTrails[RouteIndex]) == RouteCrc))
+	{
+		RouteTrails.RemoveAt(RouteIndex);
+	}
+}
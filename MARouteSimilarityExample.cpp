@@ -0,0 +1,360 @@
+/**
+
+Route similarity and clustering for large route libraries.
+Shared practice files end up with lots of near identical routes, and which ones a bot runs (BotConfig.RouteTrailNames) has been picked by hand.
+This compares routes with dynamic time warping over their position and velocity, so two runs of the same line at slightly different speeds
+still match, then groups near duplicates, picks a representative for each group, and reports how well the library covers the different
+start locations.
+To get through thousands of routes in seconds:
+- routes are downsampled and stored structure-of-arrays, so the DTW cost for four cells at a time is one set of vector ops
+- DTW is banded around the diagonal and gives up as soon as a pair can't get under the cluster threshold
+- only routes that start and end near each other are compared at all (a route from the other side of the map can't be a duplicate),
+  and the remaining pairs run in parallel across all cores
+
+*/
+
+#include "MidairCE.h"
+#include "MAPracticeComponent.h"
+#include "MARouteSimilarity.h"
+#include "Async/ParallelFor.h"
+#include "Async/Async.h"
+
+//routes are resampled down to at most this many points, a 30s route at 20 markers/s is 600 markers
+static const int32 MaxSeriesPoints = 200;
+//velocity is compared as where it would take you in this many seconds, so it's in the same units as position
+static const float SeriesVelocitySeconds = 0.25f;
+//Sakoe-Chiba band, as a fraction of the longer route
+static const float DTWBandFraction = 0.1f;
+//start areas for the coverage report
+static const float CoverageCellSize = 4000.0f;
+
+FMARouteDTWSeries FMARouteSimilarity::BuildSeries(const FMARouteTrail& Route)
+{
+	FMARouteDTWSeries Series;
+	const TArray<FPlayerLocationAndState>& Markers = Route.MarkerLocations;
+	if (Markers.Num() == 0)
+	{
+		Series.Num = 0;
+		Series.Start = FVector::ZeroVector;
+		Series.End = FVector::ZeroVector;
+		return Series;
+	}
+	int32 Stride = FMath::Max(1, FMath::DivideAndRoundUp(Markers.Num(), MaxSeriesPoints));
+	Series.Num = FMath::DivideAndRoundUp(Markers.Num(), Stride);
+	//padded with copies of the last point so the vector loop can always load 4 at a time past the end of the band
+	int32 PaddedNum = Series.Num + 4;
+	Series.X.SetNumUninitialized(PaddedNum);
+	Series.Y.SetNumUninitialized(PaddedNum);
+	Series.Z.SetNumUninitialized(PaddedNum);
+	Series.VX.SetNumUninitialized(PaddedNum);
+	Series.VY.SetNumUninitialized(PaddedNum);
+	Series.VZ.SetNumUninitialized(PaddedNum);
+	for (int32 PointIndex = 0; PointIndex < PaddedNum; PointIndex++)
+	{
+		const FPlayerLocationAndState& Marker = Markers[FMath::Min(PointIndex * Stride, Markers.Num() - 1)];
+		Series.X[PointIndex] = Marker.Location.X;
+		Series.Y[PointIndex] = Marker.Location.Y;
+		Series.Z[PointIndex] = Marker.Location.Z;
+		Series.VX[PointIndex] = Marker.Velocity.X * SeriesVelocitySeconds;
+		Series.VY[PointIndex] = Marker.Velocity.Y * SeriesVelocitySeconds;
+		Series.VZ[PointIndex] = Marker.Velocity.Z * SeriesVelocitySeconds;
+	}
+	Series.Start = Markers[0].Location;
+	Series.End = Markers.Last().Location;
+	return Series;
+}
+
+//Banded DTW with squared euclidean cost. Returns the RMS distance along the best alignment, or MAX_flt as soon as it can't come in under Cutoff.
+float FMARouteSimilarity::DTWDistance(const FMARouteDTWSeries& A, const FMARouteDTWSeries& B, float Cutoff)
+{
+	const int32 N = A.Num;
+	const int32 M = B.Num;
+	if (N == 0 || M == 0)
+	{
+		return MAX_flt;
+	}
+	//band follows the diagonal from (0,0) to (N-1,M-1), so routes of different lengths still line up
+	const int32 Band = FMath::CeilToInt(FMath::Max(N, M) * DTWBandFraction) + 1;
+	const float Slope = N > 1 ? (float)(M - 1) / (N - 1) : 0.0f;
+	//the best path is at most N + M steps, so once every cell in a row is over this the pair can't make it
+	const float AbandonCost = FMath::Square(Cutoff) * (N + M);
+
+	//two rows of the cost matrix, INF everywhere except the band last written into them
+	TArray<float> Rows[2];
+	int32 RowLo[2] = { 0, 0 };
+	int32 RowHi[2] = { -1, -1 };
+	Rows[0].Init(MAX_flt, M);
+	Rows[1].Init(MAX_flt, M);
+	TArray<float> LocalCost;
+	LocalCost.SetNumUninitialized(2 * Band + 8);
+
+	const float* BX = B.X.GetData();
+	const float* BY = B.Y.GetData();
+	const float* BZ = B.Z.GetData();
+	const float* BVX = B.VX.GetData();
+	const float* BVY = B.VY.GetData();
+	const float* BVZ = B.VZ.GetData();
+
+	for (int32 i = 0; i < N; i++)
+	{
+		float* Prev = Rows[(i + 1) & 1].GetData();
+		int32 CurIndex = i & 1;
+		float* Cur = Rows[CurIndex].GetData();
+		//clear what this buffer held two rows ago
+		for (int32 j = RowLo[CurIndex]; j <= RowHi[CurIndex]; j++)
+		{
+			Cur[j] = MAX_flt;
+		}
+		int32 Center = FMath::RoundToInt(i * Slope);
+		int32 Lo = FMath::Max(0, Center - Band);
+		int32 Hi = FMath::Min(M - 1, Center + Band);
+		RowLo[CurIndex] = Lo;
+		RowHi[CurIndex] = Hi;
+
+		//local costs for the whole band row, four cells per iteration
+		VectorRegister AX = VectorSetFloat1(A.X[i]);
+		VectorRegister AY = VectorSetFloat1(A.Y[i]);
+		VectorRegister AZ = VectorSetFloat1(A.Z[i]);
+		VectorRegister AVX = VectorSetFloat1(A.VX[i]);
+		VectorRegister AVY = VectorSetFloat1(A.VY[i]);
+		VectorRegister AVZ = VectorSetFloat1(A.VZ[i]);
+		for (int32 j = Lo; j <= Hi; j += 4)
+		{
+			VectorRegister Delta = VectorSubtract(VectorLoad(BX + j), AX);
+			VectorRegister Cost = VectorMultiply(Delta, Delta);
+			Delta = VectorSubtract(VectorLoad(BY + j), AY);
+			Cost = VectorMultiplyAdd(Delta, Delta, Cost);
+			Delta = VectorSubtract(VectorLoad(BZ + j), AZ);
+			Cost = VectorMultiplyAdd(Delta, Delta, Cost);
+			Delta = VectorSubtract(VectorLoad(BVX + j), AVX);
+			Cost = VectorMultiplyAdd(Delta, Delta, Cost);
+			Delta = VectorSubtract(VectorLoad(BVY + j), AVY);
+			Cost = VectorMultiplyAdd(Delta, Delta, Cost);
+			Delta = VectorSubtract(VectorLoad(BVZ + j), AVZ);
+			Cost = VectorMultiplyAdd(Delta, Delta, Cost);
+			VectorStore(Cost, LocalCost.GetData() + (j - Lo));
+		}
+
+		//the recurrence itself depends on the cell to the left, so this part stays scalar
+		float RowMin = MAX_flt;
+		for (int32 j = Lo; j <= Hi; j++)
+		{
+			float Best = (i == 0 && j == 0) ? 0.0f : Prev[j];
+			if (j > 0)
+			{
+				Best = FMath::Min3(Best, Prev[j - 1], Cur[j - 1]);
+			}
+			Cur[j] = Best == MAX_flt ? MAX_flt : Best + LocalCost[j - Lo];
+			RowMin = FMath::Min(RowMin, Cur[j]);
+		}
+		if (RowMin > AbandonCost)
+		{
+			return MAX_flt;
+		}
+	}
+	float Total = Rows[(N - 1) & 1][M - 1];
+	return Total == MAX_flt ? MAX_flt : FMath::Sqrt(Total / (N + M));
+}
+
+FMARouteClusterReport FMARouteSimilarity::ClusterRoutes(const TArray<FMARouteTrail>& Routes, const FMARouteClusterSettings& Settings)
+{
+	FMARouteClusterReport Report;
+	const int32 NumRoutes = Routes.Num();
+	TArray<FMARouteDTWSeries> Series;
+	Series.SetNum(NumRoutes);
+	ParallelFor(NumRoutes, [&](int32 RouteIndex)
+	{
+		Series[RouteIndex] = BuildSeries(Routes[RouteIndex]);
+	});
+
+	//candidate pairs: bucket starts into cells the size of the start radius, then only look at the neighbouring cells
+	TMap<FIntVector, TArray<int32>> StartCells;
+	auto GetCell = [](const FVector& Location, float CellSize)
+	{
+		return FIntVector(FMath::FloorToInt(Location.X / CellSize), FMath::FloorToInt(Location.Y / CellSize), FMath::FloorToInt(Location.Z / CellSize));
+	};
+	for (int32 RouteIndex = 0; RouteIndex < NumRoutes; RouteIndex++)
+	{
+		StartCells.FindOrAdd(GetCell(Series[RouteIndex].Start, Settings.StartMatchRadius)).Add(RouteIndex);
+	}
+	TArray<TPair<int32, int32>> CandidatePairs;
+	for (int32 RouteIndex = 0; RouteIndex < NumRoutes; RouteIndex++)
+	{
+		const FMARouteDTWSeries& RouteSeries = Series[RouteIndex];
+		FIntVector Cell = GetCell(RouteSeries.Start, Settings.StartMatchRadius);
+		for (int32 X = -1; X <= 1; X++)
+		{
+			for (int32 Y = -1; Y <= 1; Y++)
+			{
+				for (int32 Z = -1; Z <= 1; Z++)
+				{
+					const TArray<int32>* Neighbours = StartCells.Find(Cell + FIntVector(X, Y, Z));
+					if (Neighbours == nullptr)
+					{
+						continue;
+					}
+					for (int32 OtherIndex : *Neighbours)
+					{
+						if (OtherIndex > RouteIndex
+							&& FVector::Dist(RouteSeries.Start, Series[OtherIndex].Start) < Settings.StartMatchRadius
+							&& FVector::Dist(RouteSeries.End, Series[OtherIndex].End) < Settings.EndMatchRadius)
+						{
+							CandidatePairs.Emplace(RouteIndex, OtherIndex);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	TArray<float> PairDistances;
+	PairDistances.SetNumUninitialized(CandidatePairs.Num());
+	ParallelFor(CandidatePairs.Num(), [&](int32 PairIndex)
+	{
+		PairDistances[PairIndex] = DTWDistance(Series[CandidatePairs[PairIndex].Key], Series[CandidatePairs[PairIndex].Value], Settings.DuplicateDistance);
+	});
+	Report.NumPairsCompared = CandidatePairs.Num();
+
+	TArray<TArray<int32>> Neighbours;
+	Neighbours.SetNum(NumRoutes);
+	for (int32 PairIndex = 0; PairIndex < CandidatePairs.Num(); PairIndex++)
+	{
+		if (PairDistances[PairIndex] < Settings.DuplicateDistance)
+		{
+			Neighbours[CandidatePairs[PairIndex].Key].Add(CandidatePairs[PairIndex].Value);
+			Neighbours[CandidatePairs[PairIndex].Value].Add(CandidatePairs[PairIndex].Key);
+		}
+	}
+
+	//greedy: fastest route that isn't in a cluster yet becomes the representative, and takes every unclustered near duplicate with it
+	TArray<int32> Order;
+	for (int32 RouteIndex = 0; RouteIndex < NumRoutes; RouteIndex++)
+	{
+		if (Series[RouteIndex].Num > 1)
+		{
+			Order.Add(RouteIndex);
+		}
+	}
+	Order.Sort([&Routes](int32 A, int32 B) { return Routes[A].MarkerLocations.Num() < Routes[B].MarkerLocations.Num(); });
+	Report.RouteCluster.Init(INDEX_NONE, NumRoutes);
+	for (int32 RouteIndex : Order)
+	{
+		if (Report.RouteCluster[RouteIndex] != INDEX_NONE)
+		{
+			continue;
+		}
+		int32 ClusterIndex = Report.Clusters.Num();
+		FMARouteCluster& Cluster = Report.Clusters.AddDefaulted_GetRef();
+		Cluster.Representative = RouteIndex;
+		Cluster.Members.Add(RouteIndex);
+		Report.RouteCluster[RouteIndex] = ClusterIndex;
+		for (int32 OtherIndex : Neighbours[RouteIndex])
+		{
+			if (Report.RouteCluster[OtherIndex] == INDEX_NONE)
+			{
+				Cluster.Members.Add(OtherIndex);
+				Report.RouteCluster[OtherIndex] = ClusterIndex;
+			}
+		}
+	}
+
+	//coverage: how many routes and how many distinct kinds of route leave from each start area
+	TMap<FIntVector, int32> CoverageIndices;
+	for (int32 ClusterIndex = 0; ClusterIndex < Report.Clusters.Num(); ClusterIndex++)
+	{
+		const FMARouteCluster& Cluster = Report.Clusters[ClusterIndex];
+		FIntVector Cell = GetCell(Series[Cluster.Representative].Start, CoverageCellSize);
+		int32& CoverageIndex = CoverageIndices.FindOrAdd(Cell, INDEX_NONE);
+		if (CoverageIndex == INDEX_NONE)
+		{
+			CoverageIndex = Report.StartCoverage.Num();
+			FMARouteStartCoverage& Coverage = Report.StartCoverage.AddDefaulted_GetRef();
+			Coverage.Location = (FVector(Cell) + FVector(0.5f)) * CoverageCellSize;
+		}
+		FMARouteStartCoverage& Coverage = Report.StartCoverage[CoverageIndex];
+		Coverage.Clusters.Add(ClusterIndex);
+		Coverage.NumRoutes += Cluster.Members.Num();
+	}
+	//busiest start areas first, and within an area the most popular line first
+	for (FMARouteStartCoverage& Coverage : Report.StartCoverage)
+	{
+		Coverage.Clusters.Sort([&Report](int32 A, int32 B) { return Report.Clusters[A].Members.Num() > Report.Clusters[B].Members.Num(); });
+	}
+	Report.StartCoverage.Sort([](const FMARouteStartCoverage& A, const FMARouteStartCoverage& B) { return A.NumRoutes > B.NumRoutes; });
+	return Report;
+}
+
+//Suggested RouteTrailNames for a bot: representatives taken round robin across start areas, so bots spread over every start rather than
+//all running variations of the most popular line.
+TArray<FString> FMARouteSimilarity::SelectRepresentativeRouteNames(const TArray<FMARouteTrail>& Routes, const FMARouteClusterReport& Report, int32 MaxNames)
+{
+	TArray<FString> Names;
+	for (int32 Rank = 0; Names.Num() < MaxNames; Rank++)
+	{
+		bool bAddedAny = false;
+		for (const FMARouteStartCoverage& Coverage : Report.StartCoverage)
+		{
+			if (Rank < Coverage.Clusters.Num() && Names.Num() < MaxNames)
+			{
+				Names.Add(Routes[Report.Clusters[Coverage.Clusters[Rank]].Representative].Name);
+				bAddedAny = true;
+			}
+		}
+		if (!bAddedAny)
+		{
+			break;
+		}
+	}
+	return Names;
+}
+
+//Practice command. Analyzes the loaded routes in the background and reports back to the player, with the full breakdown in a CSV.
+void UMAPracticeComponent::AnalyzeRouteLibrary(float DuplicateDistance)
+{
+	if (!IsPracticeModeCommandEnabled() || !PracticeData.IsValid())
+	{
+		return;
+	}
+	//shared datasets are immutable so the worker can read them as is, our own copy can still be edited so it gets snapshotted
+	TSharedPtr<const FMAMapPracticeData> Snapshot = bOwnsPracticeData ? MakeShared<FMAMapPracticeData>(*PracticeData) : PracticeData;
+	FMARouteClusterSettings Settings;
+	Settings.DuplicateDistance = DuplicateDistance;
+	FString OutputPath = FPaths::ProjectSavedDir() / TEXT("RouteAnalysis") / Snapshot->MapName + TEXT(".csv");
+	TWeakObjectPtr<UMAPracticeComponent> WeakThis = this;
+
+	Async(EAsyncExecution::ThreadPool, [Snapshot, Settings, OutputPath, WeakThis]()
+	{
+		double StartTime = FPlatformTime::Seconds();
+		const TArray<FMARouteTrail>& Routes = Snapshot->RouteTrails;
+		FMARouteClusterReport Report = FMARouteSimilarity::ClusterRoutes(Routes, Settings);
+		double Elapsed = FPlatformTime::Seconds() - StartTime;
+
+		FString CSV = TEXT("Route,Cluster,Representative,StartX,StartY,StartZ\n");
+		for (int32 RouteIndex = 0; RouteIndex < Routes.Num(); RouteIndex++)
+		{
+			int32 ClusterIndex = Report.RouteCluster[RouteIndex];
+			bool bRepresentative = ClusterIndex != INDEX_NONE && Report.Clusters[ClusterIndex].Representative == RouteIndex;
+			FVector Start = Routes[RouteIndex].MarkerLocations.Num() > 0 ? Routes[RouteIndex].MarkerLocations[0].Location : FVector::ZeroVector;
+			CSV.Append(FString::Printf(TEXT("\"%s\",%d,%d,%.0f,%.0f,%.0f\n"), *Routes[RouteIndex].Name, ClusterIndex, bRepresentative ? 1 : 0, Start.X, Start.Y, Start.Z));
+		}
+		FFileHelper::SaveStringToFile(CSV, *OutputPath);
+
+		int32 ThinStartAreas = 0;
+		for (const FMARouteStartCoverage& Coverage : Report.StartCoverage)
+		{
+			ThinStartAreas += Coverage.Clusters.Num() == 1 ? 1 : 0;
+		}
+		FString Summary = FString::Printf(TEXT("%d routes, %d distinct (%d pairs compared in %.1fs). %d start areas, %d with only one line. Details in %s"),
+			Routes.Num(), Report.Clusters.Num(), Report.NumPairsCompared, Elapsed, Report.StartCoverage.Num(), ThinStartAreas, *OutputPath);
+		AsyncTask(ENamedThreads::GameThread, [WeakThis, Summary]()
+		{
+			if (WeakThis.IsValid())
+			{
+				if (AMAPlayerController* PC = Cast<AMAPlayerController>(WeakThis->ParentController))
+				{
+					PC->ClientSay_Implementation(nullptr, Summary, false);
+				}
+			}
+		});
+	});
+}
@@ -28,6 +28,14 @@ void AMAWeapon::UpdateCurrentHeat(float DeltaTime)
 	//how much heat is slowing your fire rate. Reduce heat implications while spinning up.
 	//Add 0.05f buffer so you are generally at 100% when moving and low heat.
 	HeatFactor = FMath::Clamp((1.0f - Heat) + 0.05f, 0.0f, 1.0f);
+	//per mille, idle weapons sitting at zero heat would drown out everything else.
+	//a few samples a second is plenty for the distribution, every tick for every weapon was most of what got recorded
+	HeatMetricTime += DeltaTime;
+	if (Heat > 0.0f && HeatMetricTime >= 0.25f)
+	{
+		HeatMetricTime = 0.0f;
+		FMAMetrics::Record(EMAHistogram::WeaponHeat, FMath::RoundToInt(Heat * 1000.0f));
+	}
 	//GEngine->AddOnScreenDebugMessage(GetFName().GetNumber() + 27, 12.f, FColor::Yellow, FString::Printf(TEXT("Character Speed ---  %i, --- %i"), FMath::RoundToInt(CharacterSpeed), FMath::RoundToInt(100.0f * CharacterSpeed / HeatDissapationThresholdSpeed)));
 	//GEngine->AddOnScreenDebugMessage(GetFName().GetNumber() + 28, 12.f, FColor::Orange, FString::Printf(TEXT("Heat ---  %i"), FMath::RoundToInt(100.0f*Heat)));
 	//GEngine->AddOnScreenDebugMessage(GetFName().GetNumber() + 26, 12.f, FColor::Red, FString::Printf(TEXT("HeatFactor ---  %i"), FMath::RoundToInt(100.0f*HeatFactor)));